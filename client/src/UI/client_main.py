@@ -164,17 +164,77 @@ class CrushClient:
             mode = response[0]
             current_angle = struct.unpack('h', response[1:3])[0] / 10.0
             error_flags = response[3]
+            latency_us = struct.unpack('<H', response[6:8])[0]
 
             return {
                 "mode": CrushMode(mode),
                 "current_angle": current_angle,
                 "wifi_disconnected": bool(error_flags & 0x01),
                 "angle_out_of_range": bool(error_flags & 0x02),
+                # サーボの通信品質(起動時と probe_link() で測る)
+                "link_baud": self.LINK_BAUDS[response[4]] if response[4] < len(self.LINK_BAUDS) else 0,
+                "link_error_permille": response[5],
+                "link_latency_us": latency_us,
             }
         except Exception as e:
             print(f"Status parsing error: {e}")
             return None
 
+    LINK_BAUDS = (0, 115200, 625000, 1250000)  # ステータス応答の通信速度の番号(0は返信なし)
+
+    def probe_link(self) -> bool:
+        """サーボの通信速度を測り直す。安定した速度があればTrue(結果は get_status() で見る)"""
+        response = self._send_message(bytes([0x70]))
+        return bool(response) and response[0] == 0x00
+
+    TELEMETRY_RESULTS = ("ok", "timeout", "short_read", "echo_mismatch", "out_of_range", "bad_reply")
+
+    def get_telemetry(self, reset: bool = False) -> Optional[dict]:
+        """サーボ通信のテレメトリ(ID毎の回数、失敗の種類、通信時間のヒストグラム)を取得"""
+        if not self.connected or not self.socket:
+            print("Not connected to ESP32")
+            return None
+
+        try:
+            self.socket.settimeout(self.operation_timeout)
+            self.socket.sendall(bytes([0x61 if reset else 0x60]))
+            head = self._recv_exact(3)
+            if head[0] != 0x00:
+                return None
+            length = struct.unpack('<H', head[1:3])[0]
+            data = self._recv_exact(length)
+
+            magic, version, id_count, result_count, buckets, first_shift, bad_ids = struct.unpack('<2sBBBBBB', data[:8])
+            if magic != b'IT' or version != 1:
+                return None
+            record_fmt = '<B%dIII%dH' % (result_count, buckets)
+            record_size = struct.calcsize(record_fmt)
+            servos = {}
+            for i in range(id_count):
+                fields = struct.unpack_from(record_fmt, data, 8 + i * record_size)
+                counts = fields[1:1 + result_count]
+                servos[fields[0]] = {
+                    "counts": dict(zip(self.TELEMETRY_RESULTS, counts)),
+                    "total_us": fields[1 + result_count],
+                    "max_us": fields[2 + result_count],
+                    # ビンiの上限(us): 2^(first_shift + i)、最後のビンは上限なし
+                    "histogram": list(fields[3 + result_count:]),
+                }
+            return {"first_bucket_shift": first_shift, "bad_ids": bad_ids, "servos": servos}
+        except Exception as e:
+            print(f"Telemetry error: {e}")
+            self.cleanup()
+            return None
+
+    def _recv_exact(self, size: int) -> bytes:
+        data = b''
+        while len(data) < size:
+            chunk = self.socket.recv(size - len(data))
+            if not chunk:
+                raise ConnectionResetError("connection closed")
+            data += chunk
+        return data
+
 
 class RobotControlUI:
     def __init__(self, root):
@@ -450,6 +510,8 @@ class RobotControlUI:
                 f"角度: {status['current_angle']}\xb0\n"
                 f"WiFi切断: {status['wifi_disconnected']}\n"
                 f"角度範囲外: {status['angle_out_of_range']}\n"
+                f"サーボ通信: {status['link_baud']}bps, 誤り {status['link_error_permille']}‰, "
+                f"{status['link_latency_us']}us\n"
                 f"\n"  # 空行を追加して区切り
                 f"現在のパラメータ:\n"
                 f"周期: {current_params['period']:.1f}秒\n"
@@ -26,12 +26,32 @@ struct SwimParameters {
     SwimParameters() : periodSec(0), wingDeg(0), maxAngleDeg(0), yRate(0) {}
 };
 
+// テレメトリのスナップショットをbufに書き、書いたバイト数を返す関数
+// resetがtrueなら書いた後に記録を消す
+typedef size_t (*TelemetryProvider)(uint8_t* buf, size_t size, bool reset);
+// サーボの通信品質を測り直す関数(setLinkStatusで結果を渡す)。安定した速度があればtrue
+typedef bool (*LinkProbeHandler)();
+
 class MessageProcessor {
 public:
+    static const size_t TELEMETRY_BUF_SIZE = 2048;  // スナップショットの最大バイト数
+
+    // サーボの通信品質(ステータス応答の4～7バイト目)
+    struct LinkStatus {
+        uint8_t baudCode;       // 0:返信なし 1:115200 2:625000 3:1250000bps
+        uint8_t errorPermille;  // 誤り率(千分率、255で頭打ち)
+        uint16_t latencyUs;     // 読出し1回の平均時間(us)
+        LinkStatus() : baudCode(0), errorPermille(0), latencyUs(0) {}
+    };
+
     MessageProcessor();
     bool processMessage(WiFiClient& client);
     void statusResponse(WiFiClient& client);
+    void telemetryResponse(WiFiClient& client, bool reset);
     void sendResponse(WiFiClient& client, uint8_t response);
+    void setTelemetryProvider(TelemetryProvider provider) { telemetryProvider = provider; }
+    void setLinkProbeHandler(LinkProbeHandler handler) { linkProbeHandler = handler; }
+    void setLinkStatus(const LinkStatus& status) { linkStatus = status; }
     
     CrushMode getCurrentMode() const { return currentMode; }
     WingUpMode getCurrentWingMode() const { return currentWingMode; }
@@ -46,4 +66,7 @@ private:
     CrushMode currentMode;
     WingUpMode currentWingMode;
     bool isMouthOpen;
+    TelemetryProvider telemetryProvider;
+    LinkProbeHandler linkProbeHandler;
+    LinkStatus linkStatus;
 };
\ No newline at end of file
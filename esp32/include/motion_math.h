@@ -0,0 +1,111 @@
+// motion_math.h
+// モーションの計算(位相、sin/cos、振幅、ICSのポジション)を単精度と固定小数点だけで行う
+// ESP32のFPUは単精度だけなので、doubleのfmod/sin/cosはソフトウェアで計算される
+// 1周 = 2^32の位相、Q15(1.0 = 32768)のsin/cos、ICSポジションx65536の振幅(ゲイン)を使い、ティック毎の計算は整数だけ
+// doubleの計算(degPosF(振幅 * sin(2π * fmod(t, 周期) / 周期)))とのポジションの差は1以内
+//   位相: 周期はfloatの値そのまま(整数 x 2^n us)で持つので、時刻が進んでも誤差は増えない(1e-8周以下)
+//   sin: 5次の近似で1.4e-4以下。振幅45度(1333ポジション)でも0.19ポジションなので、切り捨ての境目で1ずれるだけ
+#pragma once
+#include <stdint.h>
+#include <math.h>
+#include <IcsBaseClass.h>
+
+namespace MotionMath {
+    typedef uint32_t Phase;  // 周期の中の位置 1周 = 2^32
+    typedef int32_t Gain;    // sinが1の時のポジションの中心からの差 x65536
+
+    const Phase QUARTER_TURN = 0x40000000u;
+    const Phase HALF_TURN = 0x80000000u;
+    const int32_t Q15_ONE = 32768;
+    const int POS_CENTER = IcsBaseClass::degPosCenti(0);  // 0度のポジション
+    const float POS_PER_DEG = 29.633f;                    // 1度あたりのポジション(degPosFと同じ)
+
+    // sin(π/2 * z)の5次の近似(Q15で計算した最大誤差 約1.4e-4) Q15の係数
+    const uint32_t SIN_C1 = 51456;  // 1.5703201
+    const uint32_t SIN_C3 = 21041;  // 0.6421133
+    const uint32_t SIN_C5 = 2355;   // 0.0718609
+
+    // 周期 floatの周期(仮数M x 2^E 秒)を、M x 15625 x 2^(E+6) usとして2^(E+6)usの単位で丸めずに持つ
+    struct Period {
+        uint64_t units;  // 周期(2^-shift us) 0は周期なし
+        uint8_t shift;   // 時刻(us)を単位に直す左シフト
+        uint64_t step;   // 1単位あたりの位相 x2^32
+    };
+
+    // 周期(秒)から作る。パラメータが変わった時だけ呼べばよい
+    inline Period makePeriod(float periodSec) {
+        Period p = {0, 0, 0};
+        if (!(periodSec > 0.0f) || periodSec > 1.0e9f) {
+            return p;
+        }
+        int e;
+        float m = frexpf(periodSec, &e);  // periodSec = m x 2^e (0.5 <= m < 1)
+        uint64_t mant = (uint64_t)ldexpf(m, 24);
+        int sh = e - 24 + 6;
+        p.units = mant * 15625u;
+        if (sh >= 0) {
+            p.units <<= sh;
+        } else {
+            p.shift = (uint8_t)-sh;
+        }
+        p.step = UINT64_MAX / p.units;
+        return p;
+    }
+
+    // 時刻(ms) + offsetUs(us)の位相
+    // millis()の値をそのまま渡すので、doubleでfmod(ms, 周期)をとるのと同じ位相になる
+    inline Phase phaseAt(unsigned long timeMs, unsigned long offsetUs, const Period& p) {
+        if (p.units == 0) {
+            return 0;
+        }
+        uint64_t rem = ((uint64_t)timeMs * 1000u + offsetUs) % p.units;
+        // 2^shift倍しても周期で割った余りは同じように求まる(あふれないように分けて掛ける)
+        for (uint8_t s = p.shift; s > 0;) {
+            uint8_t k = (s > 24) ? 24 : s;
+            rem = (rem << k) % p.units;
+            s -= k;
+        }
+        return (Phase)((rem * p.step) >> 32);
+    }
+
+    // sin Q15(-32768～32768 近似の分だけ数LSBはみ出す)
+    inline int32_t sinQ15(Phase ph) {
+        uint32_t z = (ph >> 15) & 0x7FFF;  // 4分の1周の中の位置 Q15
+        if (ph & QUARTER_TURN) {
+            z = Q15_ONE - z;
+        }
+        uint32_t z2 = (z * z) >> 15;
+        uint32_t t = SIN_C3 - ((z2 * SIN_C5) >> 15);
+        t = SIN_C1 - ((z2 * t) >> 15);
+        int32_t y = (int32_t)((z * t) >> 15);
+        return (ph & HALF_TURN) ? -y : y;
+    }
+
+    // cos Q15
+    inline int32_t cosQ15(Phase ph) {
+        return sinQ15(ph + QUARTER_TURN);
+    }
+
+    // cosが負になる半周(1/4周より後、3/4周まで)
+    inline bool cosNegative(Phase ph) {
+        return (Phase)(ph - QUARTER_TURN - 1) < HALF_TURN;
+    }
+
+    // 振幅(度)をゲインにする。パラメータが変わった時だけ呼べばよい
+    inline Gain gainFromDeg(float deg) {
+        float g = deg * POS_PER_DEG * 65536.0f;
+        return (Gain)(g >= 0.0f ? g + 0.5f : g - 0.5f);
+    }
+
+    // ゲイン x sin(Q15)をICSのポジションにする
+    // degPosFと同じく0に向かって切り捨てるので、左右で符号を変えたゲインは中心から同じだけ離れる
+    inline int posOf(Gain gain, int32_t sQ15) {
+        int64_t prod = (int64_t)gain * sQ15;  // x2^31
+        return (int)(prod / (1LL << 31)) + POS_CENTER;
+    }
+
+    // ゲイン x sin(Q15)の角度(度) デバッグ表示用
+    inline float degOf(Gain gain, int32_t sQ15) {
+        return (float)gain * sQ15 / (65536.0f * Q15_ONE) / POS_PER_DEG;
+    }
+}
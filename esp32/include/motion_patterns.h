@@ -1,5 +1,6 @@
 // motion_patterns.h
 #pragma once
+#include <stdint.h>
 #include <vector>
 #include <array>
 
@@ -12,103 +13,285 @@ struct WingMotionPoint {
 };
 
 
-struct SplineCoefficients {
-    std::vector<double> a;  // 3次項の係数
-    std::vector<double> b;  // 2次項の係数
-    std::vector<double> c;  // 1次項の係数
-    std::vector<double> d;  // 定数項
+// 区間1つの3次スプラインの係数 k[0]dt^3 + k[1]dt^2 + k[2]dt + k[3](dtは区間の始めからの時刻)
+struct SplineSegment {
+    float k[4];
+};
+
+// 自然スプラインの係数をコンパイル時に解く(C++11のconstexprなので再帰で書く)
+// pは点の列、nは区間の数(点の数 - 1)。点の数が少ないので同じ値を何度も計算しても構わない
+namespace SplineSolver {
+    constexpr double h(const WingMotionPoint* p, int i) {
+        return p[i + 1].timeRatio - p[i].timeRatio;
+    }
+    constexpr double slope(const WingMotionPoint* p, int i) {
+        return (p[i + 1].angleRatio - p[i].angleRatio) / h(p, i);
+    }
+    constexpr double mu(const WingMotionPoint* p, int i);
+    // 前進消去の対角
+    constexpr double l(const WingMotionPoint* p, int i) {
+        return 2.0 * (p[i + 1].timeRatio - p[i - 1].timeRatio) - h(p, i - 1) * mu(p, i - 1);
+    }
+    constexpr double mu(const WingMotionPoint* p, int i) {
+        return (i == 0) ? 0.0 : h(p, i) / l(p, i);
+    }
+    constexpr double z(const WingMotionPoint* p, int i) {
+        return (i == 0) ? 0.0 : (3.0 * (slope(p, i) - slope(p, i - 1)) - h(p, i - 1) * z(p, i - 1)) / l(p, i);
+    }
+    // 2次項(両端は0)
+    constexpr double c(const WingMotionPoint* p, int n, int i) {
+        return (i == n) ? 0.0 : z(p, i) - mu(p, i) * c(p, n, i + 1);
+    }
+    constexpr SplineSegment segment(const WingMotionPoint* p, int n, int i) {
+        return SplineSegment{{
+            (float)((c(p, n, i + 1) - c(p, n, i)) / (3.0 * h(p, i))),
+            (float)c(p, n, i),
+            (float)(slope(p, i) - h(p, i) * (c(p, n, i + 1) + 2.0 * c(p, n, i)) / 3.0),
+            (float)p[i].angleRatio,
+        }};
+    }
+}
+
+// 組み込みのパターン 点と係数はconstexprなのでフラッシュに置かれ、RAMも起動時の計算も使わない
+struct SplinePattern {
+    uint8_t pointCount;
+    const WingMotionPoint* points;
+    const SplineSegment* segments;  // pointCount - 1個
+
+    // 時刻tの値 範囲外は端の区間の式をそのまま延ばす
+    // segmentは前回の区間(呼ぶ側で持つ)。時刻が進むだけならそのままか次の区間で、飛んだ時だけ二分探索する
+    float interpolate(float t, uint8_t& segment) const {
+        uint8_t last = pointCount - 2;
+        uint8_t i = (segment > last) ? last : segment;
+        if (!((i == 0 || t >= knot(i)) && (i == last || t <= knot(i + 1)))) {
+            if (i < last && t > knot(i + 1) && (i + 1 == last || t <= knot(i + 2))) {
+                i++;
+            } else {
+                uint8_t lo = 0;
+                uint8_t hi = last;
+                while (lo < hi) {
+                    uint8_t mid = (uint8_t)((lo + hi) / 2);
+                    if (t > knot(mid + 1)) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                i = lo;
+            }
+        }
+        segment = i;
+        const float* k = segments[i].k;
+        float dt = t - knot(i);
+        return ((k[0] * dt + k[1]) * dt + k[2]) * dt + k[3];
+    }
+
+    float interpolate(float t) const {
+        uint8_t segment = 0;
+        return interpolate(t, segment);
+    }
+
+private:
+    float knot(uint8_t i) const { return (float)points[i].timeRatio; }
 };
 
 namespace MotionPatterns {
     // 基本的な泳ぎパターン
-    const std::vector<WingMotionPoint> SWIM_PATTERN = {
+    constexpr WingMotionPoint SWIM_PATTERN[] = {
         {0.0,  0.0},   // 開始位置（中心）
         {0.25, 1.0},   // 最大位置
         {0.5,  0.0},   // 中間位置
         {0.75, -1.0},  // 最小位置
         {1.0,  0.0}    // 終了位置（中心に戻る）
     };
+    constexpr uint8_t SWIM_POINT_NUM = sizeof(SWIM_PATTERN) / sizeof(SWIM_PATTERN[0]);
+    constexpr SplineSegment SWIM_SEGMENTS[] = {
+        SplineSolver::segment(SWIM_PATTERN, SWIM_POINT_NUM - 1, 0),
+        SplineSolver::segment(SWIM_PATTERN, SWIM_POINT_NUM - 1, 1),
+        SplineSolver::segment(SWIM_PATTERN, SWIM_POINT_NUM - 1, 2),
+        SplineSolver::segment(SWIM_PATTERN, SWIM_POINT_NUM - 1, 3),
+    };
+    static_assert(sizeof(SWIM_SEGMENTS) / sizeof(SWIM_SEGMENTS[0]) == SWIM_POINT_NUM - 1, "SWIM_SEGMENTS must have one entry per segment");
+    constexpr SplinePattern SWIM = {SWIM_POINT_NUM, SWIM_PATTERN, SWIM_SEGMENTS};
 
     // その場で浮遊するパターン
-    const std::vector<WingMotionPoint> STAY_PATTERN = {
+    constexpr WingMotionPoint STAY_PATTERN[] = {
         {0.0,  0.0},   // 開始位置
         {0.25, 0.5},   // 小さめの振幅
         {0.5,  0.0},
         {0.75, -0.5},
         {1.0,  0.0}
     };
+    constexpr uint8_t STAY_POINT_NUM = sizeof(STAY_PATTERN) / sizeof(STAY_PATTERN[0]);
+    constexpr SplineSegment STAY_SEGMENTS[] = {
+        SplineSolver::segment(STAY_PATTERN, STAY_POINT_NUM - 1, 0),
+        SplineSolver::segment(STAY_PATTERN, STAY_POINT_NUM - 1, 1),
+        SplineSolver::segment(STAY_PATTERN, STAY_POINT_NUM - 1, 2),
+        SplineSolver::segment(STAY_PATTERN, STAY_POINT_NUM - 1, 3),
+    };
+    static_assert(sizeof(STAY_SEGMENTS) / sizeof(STAY_SEGMENTS[0]) == STAY_POINT_NUM - 1, "STAY_SEGMENTS must have one entry per segment");
+    constexpr SplinePattern STAY = {STAY_POINT_NUM, STAY_PATTERN, STAY_SEGMENTS};
 }
 
+// 3次スプライン補間(自然スプライン)
+// 係数は固定の大きさの配列にfloatで持ち、calculateCoefficientsでもinterpolateでもメモリを確保しない
+// 1ポーズの全サーボ(チャンネル)を同じ時刻の点で一度に補間できる
+// 時刻は前回の区間から探すので、時刻が進むだけなら区間はそのままか次の区間。飛んだ時だけ二分探索する
 class SplineInterpolator {
 public:
-    SplineInterpolator() {}
-
-    void calculateCoefficients(const std::vector<WingMotionPoint>& points) {
-        size_t n = points.size() - 1;
-        
-        // 係数配列の初期化
-        coeffs.a.resize(n);
-        coeffs.b.resize(n);
-        coeffs.c.resize(n);
-        coeffs.d.resize(n);
-
-        // h[i] = x[i+1] - x[i]
-        std::vector<double> h(n);
-        for (size_t i = 0; i < n; i++) {
-            h[i] = points[i + 1].timeRatio - points[i].timeRatio;
+    static const uint8_t MAX_POINTS = 16;    // 点の数の上限
+    static const uint8_t MAX_CHANNELS = 6;   // 1ポーズのサーボの数の上限(ID1～6)
+
+    SplineInterpolator() : pointCount(0), channelCount(0), lastSegment(0) {}
+
+    // WingMotionPointの列(1チャンネル)から係数を計算する
+    bool calculateCoefficients(const WingMotionPoint* points, uint8_t count) {
+        if (count < 2 || count > MAX_POINTS) {
+            return false;
+        }
+        float times[MAX_POINTS];
+        float values[MAX_POINTS];
+        for (uint8_t i = 0; i < count; i++) {
+            times[i] = (float)points[i].timeRatio;
+            values[i] = (float)points[i].angleRatio;
+        }
+        return calculatePose(times, values, count, 1);
+    }
+
+    bool calculateCoefficients(const std::vector<WingMotionPoint>& points) {
+        if (points.size() > MAX_POINTS) {
+            return false;
+        }
+        return calculateCoefficients(points.data(), (uint8_t)points.size());
+    }
+
+    // ポーズの列から係数を計算する
+    // times[count]は増えていく時刻、values[count * channels]は点毎に全チャンネルの値を並べたもの
+    // 点の数かチャンネルの数が範囲外、または時刻が増えていなければfalse(係数は前のまま)
+    bool calculatePose(const float* times, const float* values, uint8_t count, uint8_t channels) {
+        if (count < 2 || count > MAX_POINTS || channels < 1 || channels > MAX_CHANNELS) {
+            return false;
+        }
+        uint8_t n = count - 1;  // 区間の数
+        float h[MAX_POINTS];
+        for (uint8_t i = 0; i < n; i++) {
+            h[i] = times[i + 1] - times[i];
+            if (!(h[i] > 0.0f)) {
+                return false;
+            }
         }
 
-        // 3次スプライン補間の係数計算
-        std::vector<double> alpha(n);
-        std::vector<double> l(n + 1);
-        std::vector<double> mu(n);
-        std::vector<double> z(n + 1);
-
-        // Step 1: 前進消去
-        l[0] = 1.0;
-        for (size_t i = 1; i < n; i++) {
-            alpha[i] = 3.0 * (points[i + 1].angleRatio - points[i].angleRatio) / h[i]
-                    - 3.0 * (points[i].angleRatio - points[i - 1].angleRatio) / h[i - 1];
-            l[i] = 2.0 * (points[i + 1].timeRatio - points[i - 1].timeRatio) - h[i - 1] * mu[i - 1];
+        // 前進消去の係数は時刻だけで決まるので全チャンネルで共通
+        float l[MAX_POINTS];
+        float mu[MAX_POINTS];
+        l[0] = 1.0f;
+        mu[0] = 0.0f;
+        for (uint8_t i = 1; i < n; i++) {
+            l[i] = 2.0f * (times[i + 1] - times[i - 1]) - h[i - 1] * mu[i - 1];
             mu[i] = h[i] / l[i];
-            z[i] = (alpha[i] - h[i - 1] * z[i - 1]) / l[i];
         }
 
-        // Step 2: 後退代入
-        l[n] = 1.0;
-        z[n] = 0.0;
-        coeffs.c[n - 1] = z[n - 1];
-        
-        for (int i = n - 2; i >= 0; i--) {
-            coeffs.c[i] = z[i] - mu[i] * coeffs.c[i + 1];
-            coeffs.b[i] = (points[i + 1].angleRatio - points[i].angleRatio) / h[i]
-                       - h[i] * (coeffs.c[i + 1] + 2.0 * coeffs.c[i]) / 3.0;
-            coeffs.a[i] = (coeffs.c[i + 1] - coeffs.c[i]) / (3.0 * h[i]);
+        for (uint8_t ch = 0; ch < channels; ch++) {
+            // Step 1: 前進消去
+            float z[MAX_POINTS];
+            z[0] = 0.0f;
+            for (uint8_t i = 1; i < n; i++) {
+                float y0 = values[(i - 1) * channels + ch];
+                float y1 = values[i * channels + ch];
+                float y2 = values[(i + 1) * channels + ch];
+                float alpha = 3.0f * (y2 - y1) / h[i] - 3.0f * (y1 - y0) / h[i - 1];
+                z[i] = (alpha - h[i - 1] * z[i - 1]) / l[i];
+            }
+
+            // Step 2: 後退代入(両端の2次の係数は0)
+            float cNext = 0.0f;
+            for (int i = n - 1; i >= 0; i--) {
+                float y0 = values[i * channels + ch];
+                float y1 = values[(i + 1) * channels + ch];
+                float c = z[i] - mu[i] * cNext;
+                float* k = coeffs[i][ch];
+                k[0] = (cNext - c) / (3.0f * h[i]);                       // 3次項
+                k[1] = c;                                                 // 2次項
+                k[2] = (y1 - y0) / h[i] - h[i] * (cNext + 2.0f * c) / 3.0f;  // 1次項
+                k[3] = y0;                                                // 定数項
+                cNext = c;
+            }
         }
 
-        // d係数の設定
-        for (size_t i = 0; i < n; i++) {
-            coeffs.d[i] = points[i].angleRatio;
+        for (uint8_t i = 0; i < count; i++) {
+            knots[i] = times[i];
         }
+        pointCount = count;
+        channelCount = channels;
+        lastSegment = 0;
+        return true;
     }
 
-    double interpolate(double t, const std::vector<WingMotionPoint>& points) {
-        // 適切な区間を見つける
-        size_t i = 0;
-        while (i < points.size() - 1 && t > points[i + 1].timeRatio) {
-            i++;
+    // 時刻tの値(チャンネル0) 範囲外は端の区間の式をそのまま延ばす
+    float interpolate(float t) {
+        if (pointCount == 0) {
+            return 0.0f;
         }
+        uint8_t i = findSegment(t);
+        return evaluate(coeffs[i][0], t - knots[i]);
+    }
 
-        // 相対時間の計算
-        double dt = t - points[i].timeRatio;
-        
-        // スプライン補間値の計算
-        return coeffs.a[i] * dt * dt * dt +
-               coeffs.b[i] * dt * dt +
-               coeffs.c[i] * dt +
-               coeffs.d[i];
+    // 以前の呼び方(pointsはcalculateCoefficientsに渡したもの。係数に時刻も持つので使わない)
+    double interpolate(double t, const std::vector<WingMotionPoint>& points) {
+        (void)points;
+        return interpolate((float)t);
     }
 
+    // 時刻tの全チャンネルの値をout[チャンネルの数]に入れる
+    void interpolatePose(float t, float* out) {
+        if (pointCount == 0) {
+            return;
+        }
+        uint8_t i = findSegment(t);
+        float dt = t - knots[i];
+        for (uint8_t ch = 0; ch < channelCount; ch++) {
+            out[ch] = evaluate(coeffs[i][ch], dt);
+        }
+    }
+
+    uint8_t getPointCount() const { return pointCount; }
+    uint8_t getChannelCount() const { return channelCount; }
+
 private:
-    SplineCoefficients coeffs;
+    // Horner法
+    static float evaluate(const float* k, float dt) {
+        return ((k[0] * dt + k[1]) * dt + k[2]) * dt + k[3];
+    }
+
+    // tを含む区間 前回の区間とその次を先に見る
+    uint8_t findSegment(float t) {
+        uint8_t last = pointCount - 2;  // 最後の区間
+        uint8_t i = lastSegment;
+        if ((i == 0 || t >= knots[i]) && (i == last || t <= knots[i + 1])) {
+            return i;
+        }
+        if (i < last && t > knots[i + 1] && (i + 1 == last || t <= knots[i + 2])) {
+            lastSegment = i + 1;
+            return lastSegment;
+        }
+        // 二分探索 knots[lo] < t <= knots[lo + 1](端は端の区間)
+        uint8_t lo = 0;
+        uint8_t hi = last;
+        while (lo < hi) {
+            uint8_t mid = (uint8_t)((lo + hi) / 2);
+            if (t > knots[mid + 1]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        lastSegment = lo;
+        return lo;
+    }
+
+    float knots[MAX_POINTS];                          // 点の時刻
+    float coeffs[MAX_POINTS - 1][MAX_CHANNELS][4];    // 区間毎・チャンネル毎の3次,2次,1次,定数項
+    uint8_t pointCount;
+    uint8_t channelCount;
+    uint8_t lastSegment;                              // 前回の区間
 };
@@ -0,0 +1,167 @@
+// trajectory_table.h
+// 遊泳・浮遊のパラメータから1周期分のサーボ毎のポジション表を作り(コンパイル)、ティックでは表を引くだけにする
+// パラメータはたまにしか変わらないので、sinや振幅の計算は変わった時に1回だけ行う
+// 表は2枚あり、使っていない方に作ってから入れ替えるので、表を引く側は作っている途中の表を見ない
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include "motion_math.h"
+
+// 表を作るパラメータ(SwimParametersと同じ項目)
+struct TrajectoryShape {
+    float periodSec;
+    float wingDeg;
+    float maxAngleDeg;
+    float yRate;
+    bool isBackward;
+
+    // SwimParameters(message_processor.h)などから取り出す
+    template <class P>
+    static TrajectoryShape of(const P& p) {
+        TrajectoryShape s = {p.periodSec, p.wingDeg, p.maxAngleDeg, p.yRate, p.isBackward};
+        return s;
+    }
+    bool operator==(const TrajectoryShape& o) const {
+        return periodSec == o.periodSec && wingDeg == o.wingDeg && maxAngleDeg == o.maxAngleDeg &&
+               yRate == o.yRate && isBackward == o.isBackward;
+    }
+};
+
+// 1周期分のサーボ(ID1～6)毎のポジション表
+class TrajectoryTable {
+public:
+    enum Kind : uint8_t {
+        KIND_NONE = 0,
+        KIND_SWIM,   // handleSwimModeの軌道
+        KIND_STAY,   // handleStayModeの軌道(上下だけ)
+    };
+
+    static const uint8_t ROW_NUM = 6;           // ID1～6
+    static const uint16_t MAX_SAMPLES = 256;    // 1周期のサンプル数の上限
+    static const uint16_t MIN_SAMPLES = 64;     // 短い周期でも直線で補う誤差を振幅45度で2ポジション以内にする
+    static const uint8_t OVERSAMPLE = 4;        // 制御周期の何倍の細かさで持つか(送信時刻のずれは間を直線で補う)
+    static const uint8_t STEP_ROWS = (1 << 2) | (1 << 5);  // 補間しない行(ID3,6の翼の回転は切り替えるだけ)
+    static constexpr int POS_ROTATED = IcsBaseClass::degPosCenti(3000);  // 翼の回転角度(30度)
+
+    TrajectoryTable() : kind(KIND_NONE), tickUs(0), samples(0), compileUs(0) {
+        memset(&shape, 0, sizeof(shape));
+        memset(&period, 0, sizeof(period));
+    }
+
+    // パラメータから表を作る
+    void compile(Kind kind, const TrajectoryShape& shape, unsigned long tickUs) {
+        unsigned long startUs = micros();
+        this->kind = kind;
+        this->shape = shape;
+        this->tickUs = tickUs;
+        period = MotionMath::makePeriod(shape.periodSec);
+
+        // 1周期を制御周期で割った数 x OVERSAMPLE
+        unsigned long n = MIN_SAMPLES;
+        if (period.units != 0 && tickUs != 0 && shape.periodSec * 1000000.0f < (float)tickUs * MAX_SAMPLES) {
+            n = (unsigned long)(shape.periodSec * 1000000.0f / tickUs + 0.999f) * OVERSAMPLE;
+        } else if (period.units != 0) {
+            n = MAX_SAMPLES;
+        }
+        samples = (uint16_t)((n < MIN_SAMPLES) ? MIN_SAMPLES : (n > MAX_SAMPLES) ? MAX_SAMPLES : n);
+
+        // 振幅は単精度で1回だけ。左は向きが逆
+        MotionMath::Gain gain[ROW_NUM] = {0};
+        if (kind == KIND_SWIM) {
+            float wingRad = shape.wingDeg * (float)PI / 180.0f;
+            float rightAmplitude = shape.maxAngleDeg * (1.0f + shape.yRate) / 2.0f;  // yRateが正なら右に曲がる
+            float leftAmplitude = shape.maxAngleDeg * (1.0f - shape.yRate) / 2.0f;
+            gain[0] = MotionMath::gainFromDeg(rightAmplitude * cosf(wingRad));  // 右の上下
+            gain[1] = MotionMath::gainFromDeg(rightAmplitude * sinf(wingRad));  // 右の前後
+            gain[3] = MotionMath::gainFromDeg(-leftAmplitude * cosf(wingRad));  // 左の上下
+            gain[4] = MotionMath::gainFromDeg(-leftAmplitude * sinf(wingRad));  // 左の前後
+        } else if (kind == KIND_STAY) {
+            gain[0] = MotionMath::gainFromDeg(shape.maxAngleDeg);   // 翼の角度は0度なので上下だけ
+            gain[3] = MotionMath::gainFromDeg(-shape.maxAngleDeg);
+        }
+
+        for (uint16_t s = 0; s < samples; s++) {
+            MotionMath::Phase ph = (MotionMath::Phase)(((uint64_t)s << 32) / samples);
+            int32_t sinQ15 = MotionMath::sinQ15(ph);
+            for (uint8_t r = 0; r < ROW_NUM; r++) {
+                pos[r][s] = (int16_t)MotionMath::posOf(gain[r], sinQ15);
+            }
+            // 翼の回転 前進はcosが負(前から後ろ)、後退はcosが正(後ろから前)の間だけ回す
+            bool rotate = kind == KIND_SWIM && (MotionMath::cosNegative(ph) != shape.isBackward);
+            pos[2][s] = pos[5][s] = (int16_t)(rotate ? POS_ROTATED : MotionMath::POS_CENTER);
+        }
+        compileUs = micros() - startUs;
+    }
+
+    // 同じパラメータで作った表か
+    bool matches(Kind kind, const TrajectoryShape& shape, unsigned long tickUs) const {
+        return this->kind == kind && this->tickUs == tickUs && this->shape == shape;
+    }
+
+    // 時刻(ms) + offsetUs(us)の位相
+    MotionMath::Phase phaseAt(unsigned long timeMs, unsigned long offsetUs) const {
+        return MotionMath::phaseAt(timeMs, offsetUs, period);
+    }
+
+    // 位相のポジション 両隣のサンプルを直線で補う
+    int positionAt(uint8_t id, MotionMath::Phase ph) const {
+        if (id < 1 || id > ROW_NUM || samples == 0) {
+            return MotionMath::POS_CENTER;
+        }
+        const int16_t* row = pos[id - 1];
+        uint64_t x = (uint64_t)ph * samples;
+        uint16_t i = (uint16_t)(x >> 32);
+        if (STEP_ROWS & (1 << (id - 1))) {
+            return row[i];
+        }
+        int32_t frac = (int32_t)((x >> 16) & 0xFFFF);
+        int32_t a = row[i];
+        int32_t b = row[(i + 1 == samples) ? 0 : i + 1];
+        return a + (((b - a) * frac) >> 16);
+    }
+
+    Kind getKind() const { return kind; }
+    uint16_t sampleCount() const { return samples; }
+    unsigned long compileTimeUs() const { return compileUs; }
+    // 表に使っているバイト数
+    size_t usedBytes() const { return (size_t)samples * ROW_NUM * sizeof(int16_t); }
+
+private:
+    Kind kind;
+    TrajectoryShape shape;
+    unsigned long tickUs;             // 作った時の制御周期(us)
+    MotionMath::Period period;
+    uint16_t samples;                 // 1周期のサンプル数
+    unsigned long compileUs;          // 作るのにかかった時間(micros())
+    int16_t pos[ROW_NUM][MAX_SAMPLES];  // ID1～6のポジション
+};
+
+// 2枚の表 使っていない方に作ってから入れ替える
+// 作るのはloop()(メッセージを受け取った時)かティックのどちらか一方の中だけにする(main.cppではモーションタスクのlock()の中)
+class TrajectoryBank {
+public:
+    TrajectoryBank() : active(nullptr), swaps(0) {}
+
+    // パラメータの表を用意する 今の表と同じなら作らない
+    const TrajectoryTable* prepare(TrajectoryTable::Kind kind, const TrajectoryShape& shape, unsigned long tickUs) {
+        const TrajectoryTable* cur = active.load(std::memory_order_acquire);
+        if (cur != nullptr && cur->matches(kind, shape, tickUs)) {
+            return cur;
+        }
+        TrajectoryTable* back = (cur == &tables[0]) ? &tables[1] : &tables[0];
+        back->compile(kind, shape, tickUs);
+        active.store(back, std::memory_order_release);
+        swaps++;
+        return back;
+    }
+
+    // 今の表(まだ無ければnullptr)
+    const TrajectoryTable* current() const { return active.load(std::memory_order_acquire); }
+    unsigned long swapCount() const { return swaps; }
+
+private:
+    TrajectoryTable tables[2];
+    std::atomic<const TrajectoryTable*> active;
+    unsigned long swaps;
+};
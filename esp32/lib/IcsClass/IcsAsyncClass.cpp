@@ -0,0 +1,772 @@
+/**
+*	@file IcsAsyncClass.cpp
+*	@brief ICS3.5/3.6 non-blocking transaction engine
+*	@date	2026/10/16
+*	@version 1.0.0
+**/
+
+#include "IcsAsyncClass.h"
+
+/**
+*	@brief コンストラクタ
+*	@param[in] *ics 送受信に使うICSクラス(begin()済みであること)
+**/
+IcsAsyncClass::IcsAsyncClass(IcsHardSerialClass *ics)
+{
+  this->ics = ics;
+  head = 0;
+  count = 0;
+  nextHandle = 0;
+  sentUs = 0;
+  startUs = 0;
+  rxEvent = false;
+  eventAttached = false;
+  for (byte i = 0; i < QUEUE_SIZE; i++)
+  {
+    slots[i].handle = HANDLE_NONE;
+    slots[i].status = STATUS_FREE;
+  }
+  streamAckEvery = 0;
+  streamLatencyMinUs = 0;
+  windowCount = 0;
+  memset(streamSeq, 0, sizeof(streamSeq));
+  resetStreamStats();
+  resyncState = RESYNC_IDLE;
+  resyncStartUs = 0;
+  resyncQuietUs = 0;
+  resyncDrained = 0;
+}
+
+
+
+//UART受信イベント ////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief UARTの受信イベント(onReceive)を登録する
+* @note 登録すると、返信待ちの間はイベントかタイムアウトが来るまでpoll()がUARTを見に行かない
+* @attention ESP32ではコールバックはUARTのイベントタスクから呼ばれるので、フラグを立てるだけにしている
+**/
+void IcsAsyncClass::attachUartEvent()
+{
+  HardwareSerial *serial = ics->getSerial();
+  if (serial == nullptr)
+  {
+    return;
+  }
+  serial->onReceive([this]() { rxEvent = true; });
+  eventAttached = true;
+}
+
+
+
+//トランザクションの登録 //////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 送受信をキューに登録する
+* @param[in] *txBuf 送信データ
+* @param[in] txLen 送信データ数(#MAX_TX まで)
+* @param[in] rxLen 受信データ数(#MAX_RX まで)
+* @param[in] cb 完了時に呼ぶ関数(nullptrなら呼ばない)
+* @param[in] *ctx cbに渡すポインタ
+* @return ハンドル
+* @retval #HANDLE_NONE キューがいっぱい、またはデータ数が範囲外
+**/
+int IcsAsyncClass::submit(const byte *txBuf, byte txLen, byte rxLen, Callback cb, void *ctx)
+{
+  if (count >= QUEUE_SIZE || txLen > MAX_TX || rxLen > MAX_RX || txLen == 0)
+  {
+    return HANDLE_NONE;
+  }
+
+  Slot &slot = slots[(head + count) % QUEUE_SIZE];
+  slot.handle = nextHandle;
+  nextHandle = (nextHandle + 1) & 0x7FFFFFFF;
+  slot.status = STATUS_QUEUED;
+  memcpy(slot.tx, txBuf, txLen);
+  slot.txLen = txLen;
+  slot.rxLen = rxLen;
+  slot.rxCount = 0;
+  slot.echoCount = 0;
+  slot.stream = false;
+  slot.cb = cb;
+  slot.ctx = ctx;
+  count++;
+
+  return slot.handle;
+}
+
+/**
+* @brief ポジション設定を登録する(IcsBaseClass::setPosと同じコマンド)
+* @param[in] id サーボモータのID番号
+* @param[in] pos ポジションデータ
+* @return ハンドル
+* @retval #HANDLE_NONE 範囲外、キューがいっぱい
+* @note ストリーミング中はackEvery回に1回だけ返信を待ち、それ以外は送信したら完了(#STATUS_SENT)にする
+**/
+int IcsAsyncClass::submitSetPos(byte id, unsigned int pos, Callback cb, void *ctx)
+{
+  byte txCmd[3];
+
+  if (!IcsCommand::validId(id) || !IcsCommand::validPos(pos))
+  {
+    return HANDLE_NONE;
+  }
+
+  IcsCommand::encodePos(txCmd, id, pos);
+
+  int handle = submit(txCmd, sizeof txCmd, IcsCommand::POS_RX_LEN, cb, ctx);
+  if (handle >= 0 && streamAckEvery > 0)
+  {
+    bool ack = (streamSeq[id] == 0);   //サンプルACK
+    streamSeq[id] = (streamSeq[id] + 1) % streamAckEvery;
+    slots[(head + count - 1) % QUEUE_SIZE].stream = !ack;
+  }
+  return handle;
+}
+
+/**
+* @brief パラメータ書込みを登録する(setStrc/setSpd/setCur/setTmpと同じコマンド)
+* @param[in] id サーボモータのID番号
+* @param[in] sc サブコマンド(1:ストレッチ 2:スピード 3:電流リミット 4:温度リミット)
+* @param[in] val 書き込む値
+* @return ハンドル
+* @retval #HANDLE_NONE 範囲外、キューがいっぱい
+* @retval #HANDLE_SKIPPED シャドウレジスタと同じ値なので送らない(cbは呼ばれない)
+**/
+int IcsAsyncClass::submitSetParam(byte id, byte sc, byte val, Callback cb, void *ctx)
+{
+  byte txCmd[3];
+
+  if (!IcsCommand::validId(id) || !IcsCommand::validParam(sc, val))
+  {
+    return HANDLE_NONE;
+  }
+
+  if (ics->shadowHit(id, sc, val)) //前回書き込んだ値と同じなので送らない
+  {
+    return HANDLE_SKIPPED;
+  }
+
+  IcsCommand::encodeWrite(txCmd, id, sc, val);
+
+  return submit(txCmd, sizeof txCmd, IcsCommand::WRITE_RX_LEN, cb, ctx);
+}
+
+/**
+* @brief パラメータ読出しを登録する(getStrc/getSpd/getCur/getTmp/getPosと同じコマンド)
+* @param[in] id サーボモータのID番号
+* @param[in] sc サブコマンド(1:ストレッチ 2:スピード 3:電流値 4:温度 5:現在位置)
+* @return ハンドル
+* @retval #HANDLE_NONE 範囲外、キューがいっぱい
+**/
+int IcsAsyncClass::submitGetParam(byte id, byte sc, Callback cb, void *ctx)
+{
+  byte txCmd[2];
+
+  if (!IcsCommand::validId(id) || sc < IcsCommand::SC_STRC || sc > IcsCommand::SC_POS)
+  {
+    return HANDLE_NONE;
+  }
+
+  IcsCommand::encodeRead(txCmd, id, sc);
+
+  return submit(txCmd, sizeof txCmd, IcsCommand::readRxLen(sc), cb, ctx);
+}
+
+
+
+//状態機械 ////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief トランザクションを進める
+* @note 送信は数十usで終わるのでその場で行い、返信は届いた分だけ読んで戻る
+* @note 返信が揃うかタイムアウトすると完了にして、次のトランザクションを送信する
+* @note 再同期中は再同期が終わるまで次を送らない
+**/
+void IcsAsyncClass::poll()
+{
+  collectStream();
+  while (count > 0 || resyncState != RESYNC_IDLE)
+  {
+    if (resyncState != RESYNC_IDLE)
+    {
+      if (!serviceResync())
+      {
+        return;   //線が静かになるのを待つ、または再確認の返信待ち
+      }
+      continue;
+    }
+
+    Slot &slot = slots[head];
+
+    if (slot.status == STATUS_QUEUED)
+    {
+      if (slot.stream)
+      {
+        if (!startStream(slot))
+        {
+          return;   //返信窓が空くまで待つ
+        }
+        continue;   //送っただけで完了
+      }
+      if (windowCount > 0)
+      {
+        return;   //ストリーミングの返信を読み終えてから送る(返信を取り違えないように)
+      }
+      if (!startNext())
+      {
+        return;
+      }
+    }
+
+    if (!serviceReply())
+    {
+      return;   //まだ返信待ち
+    }
+  }
+}
+
+/**
+* @brief 先頭のトランザクションを送信する
+* @retval true 送信した
+* @retval false シリアルが設定されていない(失敗で完了させた)
+**/
+bool IcsAsyncClass::startNext()
+{
+  Slot &slot = slots[head];
+  HardwareSerial *serial = ics->getSerial();
+
+  startUs = micros();
+  if (serial == nullptr)
+  {
+    complete(slot, IcsTelemetry::RESULT_TIMEOUT);
+    return false;
+  }
+
+  serial->flush();
+  rxEvent = false;
+  ics->sendFrame(slot.tx, slot.txLen);
+  sentUs = micros();
+  slot.status = STATUS_WAIT_REPLY;
+  return true;
+}
+
+/**
+* @brief 返信待ちのトランザクションを見る
+* @retval true 完了した(成功または失敗)
+* @retval false まだ返信待ち
+**/
+bool IcsAsyncClass::serviceReply()
+{
+  Slot &slot = slots[head];
+  bool timedOut = (micros() - sentUs) >= replyTimeoutUs(slot.rxLen);
+
+  if (eventAttached && !rxEvent && !timedOut)
+  {
+    return false;   //受信イベントがまだ来ていない
+  }
+  rxEvent = false;
+
+  if (!readInto(slot))
+  {
+    complete(slot, IcsTelemetry::RESULT_ECHO_MISMATCH);
+    return true;
+  }
+
+  if (slot.rxCount == slot.rxLen)
+  {
+    bool valid = IcsCommand::validReply(slot.tx, slot.txLen, slot.rx, slot.rxLen);
+    complete(slot, valid ? IcsTelemetry::RESULT_OK : IcsTelemetry::RESULT_BAD_REPLY);
+    return true;
+  }
+  if (timedOut)
+  {
+    complete(slot, IcsTelemetry::classify(slot.rxCount, slot.rxLen));
+    return true;
+  }
+  return false;
+}
+
+/**
+* @brief 届いている返信をスロットに読む
+* @retval true 読めた分を読んだ
+* @retval false エコーが送信データと違った(送信が衝突した)
+* @note エコーはちょうどtxLenバイト読み捨てる
+**/
+bool IcsAsyncClass::readInto(Slot &slot)
+{
+  HardwareSerial *serial = ics->getSerial();
+  byte echoLen = ics->getEcho() ? slot.txLen : 0;
+  while (slot.rxCount < slot.rxLen && serial->available() > 0)
+  {
+    byte c = serial->read();
+    if (slot.echoCount < echoLen)   //エコー
+    {
+      if (c != slot.tx[slot.echoCount++])
+      {
+        return false;
+      }
+      continue;
+    }
+    slot.rx[slot.rxCount++] = c;
+  }
+  return true;
+}
+
+/**
+* @brief 先頭のトランザクションを完了にしてコールバックを呼ぶ
+* @param[in,out] slot 完了したスロット
+* @param[in] result 結果(RESULT_OK以外は失敗)
+* @note コールバックの中から次のトランザクションを登録してもよい
+* @note シャドウレジスタとテレメトリも同期版と同じように更新する
+* @note 返信がずれていて自動の再同期が有効なら、再同期を始める(コールバックの後、次の送信の前に行う)
+* @note テレメトリの時間はpoll()の間隔を含むので、同期版より長めに出る
+**/
+void IcsAsyncClass::complete(Slot &slot, IcsTelemetry::Result result)
+{
+  byte id = IcsCommand::idOf(slot.tx[0]);
+  bool ok = (result == IcsTelemetry::RESULT_OK);
+
+  ics->recordTelemetry(id, result, micros() - startUs);
+  if (ics->getAutoResync() && IcsHardSerialClass::isMisaligned(result))
+  {
+    beginResync(id);   //次を送る前にずれを直す
+  }
+
+  if (streamAckEvery > 0 && (slot.tx[0] & IcsCommand::CMD_MASK) == IcsCommand::CMD_POS)   //サンプルACK
+  {
+    StreamStats &s = streamStats[id];
+    countStreamFrame(id, startUs);
+    s.acks++;
+    if (ok)
+    {
+      s.ackMisses = 0;
+      s.lastPos = IcsCommand::decodePos(slot.rx[1], slot.rx[2]);
+    }
+    else
+    {
+      s.ackFailures++;
+      if (s.ackMisses < 0xFF)
+      {
+        s.ackMisses++;
+      }
+    }
+  }
+
+  slot.status = ok ? STATUS_DONE : STATUS_FAILED;
+  if (!ok)
+  {
+    ics->invalidateShadow(id);
+  }
+  else if ((slot.tx[0] & IcsCommand::CMD_MASK) == IcsCommand::CMD_WRITE)   //パラメータ書込み
+  {
+    ics->shadowStore(id, slot.tx[1], slot.tx[2]);
+  }
+  head = (head + 1) % QUEUE_SIZE;
+  count--;
+
+  if (slot.cb != nullptr)
+  {
+    slot.cb(slot.handle, ok, slot.rx, slot.rxCount, slot.ctx);
+  }
+}
+
+/**
+* @brief 返信のタイムアウト(us)
+* @param[in] rxLen 受信データ数
+* @note IcsHardSerialClassの設定(TIMEOUT_FIXED / TIMEOUT_COMPUTED)に従う
+**/
+unsigned long IcsAsyncClass::replyTimeoutUs(byte rxLen) const
+{
+  return ics->replyTimeoutUs(rxLen);
+}
+
+
+
+//再同期 /////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 再同期を始める
+* @param[in] id 最後に通信したサーボのID(再確認に使う)
+* @note 手順はIcsHardSerialClass::resync()と同じだが、待つ間はpoll()から戻る
+**/
+void IcsAsyncClass::beginResync(byte id)
+{
+  resyncState = RESYNC_DRAIN;
+  resyncStartUs = micros();
+  resyncQuietUs = resyncStartUs;
+  resyncDrained = 0;
+  IcsCommand::encodeRead(resyncSlot.tx, id, IcsHardSerialClass::RESYNC_PROBE_SC);
+  resyncSlot.txLen = IcsCommand::READ_TX_LEN;
+  resyncSlot.rxLen = IcsCommand::readRxLen(IcsHardSerialClass::RESYNC_PROBE_SC);
+}
+
+/**
+* @brief 再同期を進める
+* @retval true 終わった(同期が戻った、またはあきらめた)
+* @retval false まだ途中
+**/
+bool IcsAsyncClass::serviceResync()
+{
+  HardwareSerial *serial = ics->getSerial();
+  if (serial == nullptr)
+  {
+    finishResync(false);
+    return true;
+  }
+
+  if (resyncState == RESYNC_DRAIN)
+  {
+    while (serial->available() > 0)
+    {
+      serial->read();   //空読み
+      resyncDrained++;
+      resyncQuietUs = micros();
+    }
+
+    unsigned long gapUs = ics->resyncGapUs();
+    if (micros() - resyncQuietUs < gapUs)
+    {
+      if (micros() - resyncStartUs >= gapUs * IcsHardSerialClass::RESYNC_MAX_GAPS)
+      {
+        finishResync(false);   //ずっと何か届いている
+        return true;
+      }
+      return false;
+    }
+
+    //最後のIDに読出しを送って、返信の区切りが合っているか確かめる
+    resyncSlot.rxCount = 0;
+    resyncSlot.echoCount = 0;
+    ics->sendFrame(resyncSlot.tx, resyncSlot.txLen);
+    sentUs = micros();
+    resyncState = RESYNC_PROBE;
+    return false;
+  }
+
+  if (!readInto(resyncSlot))
+  {
+    finishResync(false);
+    return true;
+  }
+  if (resyncSlot.rxCount == resyncSlot.rxLen)
+  {
+    finishResync(IcsCommand::validReply(resyncSlot.tx, resyncSlot.txLen, resyncSlot.rx, resyncSlot.rxLen));
+    return true;
+  }
+  if ((micros() - sentUs) >= replyTimeoutUs(resyncSlot.rxLen))
+  {
+    finishResync(false);
+    return true;
+  }
+  return false;
+}
+
+/**
+* @brief 再同期を終えて数える
+* @param[in] recovered 同期が戻ったか
+**/
+void IcsAsyncClass::finishResync(bool recovered)
+{
+  ics->countResync(IcsCommand::idOf(resyncSlot.tx[0]), recovered, resyncDrained);
+  resyncState = RESYNC_IDLE;
+}
+
+
+
+//ストリーミング //////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief ポジション設定のストリーミングを設定する
+* @param[in] ackEvery 返信を待つ間隔(フレーム数)。0でストリーミングしない、1ですべて返信を待つ
+* @param[in] latencyMinUs サーボの応答時間の最小値(us)。0なら前の返信窓が終わるまで次を送らない
+* @note 応答時間の最大値はIcsHardSerialClass::responseLatencyMaxUs()を使う
+* @note 最小値を実際より大きくすると返信と送信が衝突する。衝突はサンプルACKと後からの照合で数える
+* @note エコーが返る配線では返信の順番がわからなくなるので、最小値は0として扱う
+**/
+void IcsAsyncClass::setStreaming(byte ackEvery, unsigned long latencyMinUs)
+{
+  streamAckEvery = ackEvery;
+  streamLatencyMinUs = latencyMinUs;
+  memset(streamSeq, 0, sizeof(streamSeq));
+}
+
+/**
+* @brief ストリーミングで使う応答時間の最小値(us)
+**/
+unsigned long IcsAsyncClass::streamLatencyMin() const
+{
+  if (ics->getEcho())
+  {
+    return 0;
+  }
+  unsigned long maxUs = ics->responseLatencyMaxUs();
+  return (streamLatencyMinUs < maxUs) ? streamLatencyMinUs : maxUs;
+}
+
+/**
+* @brief ストリーミングのフレームを送ってよい最も早い時刻(us)
+* @note 自分の返信窓は最後の返信窓の後ろに置き、送信はどの返信窓とも重ならないようにする
+**/
+unsigned long IcsAsyncClass::streamStartUs(const Slot &slot) const
+{
+  unsigned long now = micros();
+  if (windowCount == 0)
+  {
+    return now;
+  }
+
+  unsigned long txUs = ics->frameTimeUs(slot.txLen);
+  unsigned long at = windows[windowCount - 1].endUs - txUs - streamLatencyMin();
+  if ((long)(at - now) < 0)
+  {
+    at = now;
+  }
+  for (byte i = 0; i < windowCount; i++)   //返信窓は時刻順なので、後ろへずらすだけでよい
+  {
+    const StreamWindow &w = windows[i];
+    if ((long)(at + txUs - w.startUs) > 0 && (long)(w.endUs - at) > 0)
+    {
+      at = w.endUs;
+    }
+  }
+  return at;
+}
+
+/**
+* @brief 先頭のストリーミングのフレームを送信して完了にする
+* @retval true 送信した
+* @retval false 返信窓が空いていない、読んでいない返信窓が多すぎる、またはシリアルが設定されていない
+* @note cbはok=true、rxLen=0で呼ぶ。返信は後からcollectStream()で照合する
+**/
+bool IcsAsyncClass::startStream(Slot &slot)
+{
+  HardwareSerial *serial = ics->getSerial();
+  if (serial == nullptr)
+  {
+    startUs = micros();
+    complete(slot, IcsTelemetry::RESULT_TIMEOUT);
+    return false;
+  }
+  if (windowCount >= MAX_STREAM_WINDOWS || (long)(streamStartUs(slot) - micros()) > 0)   //送ってよい時刻を過ぎていれば送る
+  {
+    return false;
+  }
+
+  ics->sendFrame(slot.tx, slot.txLen, false);   //まだ読んでいない返信は捨てない
+  unsigned long endUs = micros();
+  byte id = IcsCommand::idOf(slot.tx[0]);
+
+  StreamWindow &w = windows[windowCount++];
+  w.id = id;
+  w.header = slot.tx[0] & 0x7F;
+  w.echoLen = ics->getEcho() ? slot.txLen : 0;
+  w.rxLen = slot.rxLen;
+  w.startUs = endUs + streamLatencyMin();
+  w.endUs = endUs + ics->responseLatencyMaxUs() + ics->frameTimeUs(slot.rxLen + 1);   //1バイト分の余裕
+  countStreamFrame(id, endUs - ics->frameTimeUs(slot.txLen));
+
+  slot.status = STATUS_SENT;
+  head = (head + 1) % QUEUE_SIZE;
+  count--;
+  if (slot.cb != nullptr)
+  {
+    slot.cb(slot.handle, true, slot.rx, 0, slot.ctx);
+  }
+  return true;
+}
+
+/**
+* @brief 返信窓が過ぎたストリーミングの返信を読んで照合する
+* @note 先頭バイトが次の返信窓のものなら、この窓には返信が来なかったとみなす
+* @note テレメトリにはサンプルACKだけを記録する
+**/
+void IcsAsyncClass::collectStream()
+{
+  HardwareSerial *serial = ics->getSerial();
+  while (windowCount > 0)
+  {
+    StreamWindow &w = windows[0];
+    if ((long)(micros() - (w.endUs + ics->fifoTimeoutUs())) < 0)
+    {
+      return;   //まだ読めない
+    }
+
+    StreamStats &s = streamStats[w.id];
+    for (byte i = 0; i < w.echoLen && serial->available() > 0; i++)
+    {
+      serial->read();   //エコー
+    }
+
+    if (serial->available() == 0 || (serial->peek() != w.header && windowCount > 1 && serial->peek() == windows[1].header))
+    {
+      s.repliesMissing++;
+    }
+    else
+    {
+      byte rx[MAX_RX] = {};
+      byte n = 0;
+      while (n < w.rxLen && serial->available() > 0)
+      {
+        rx[n++] = serial->read();
+      }
+      if (n == w.rxLen && rx[0] == w.header && IcsCommand::validData(rx, n))
+      {
+        s.repliesOk++;
+        s.lastPos = IcsCommand::decodePos(rx[1], rx[2]);
+      }
+      else
+      {
+        s.repliesBad++;
+      }
+    }
+
+    windowCount--;
+    memmove(&windows[0], &windows[1], windowCount * sizeof(StreamWindow));
+  }
+}
+
+/**
+* @brief 送ったポジション設定を数える
+* @param[in] us 送信を始めた時刻(us)
+**/
+void IcsAsyncClass::countStreamFrame(byte id, unsigned long us)
+{
+  StreamStats &s = streamStats[id];
+  if (s.frames == 0)
+  {
+    s.firstUs = us;
+  }
+  s.frames++;
+  s.lastUs = us;
+}
+
+/**
+* @brief ストリーミングのカウンタを返す
+* @param[in] id サーボID(範囲外はID0)
+**/
+const IcsAsyncClass::StreamStats &IcsAsyncClass::getStreamStats(byte id) const
+{
+  return streamStats[IcsCommand::validId(id) ? id : 0];
+}
+
+/**
+* @brief サーボに送れたポジション設定の頻度(Hz)
+* @return 最初と最後に送った時刻から求めた平均。2回以上送っていなければ0
+**/
+float IcsAsyncClass::streamRateHz(byte id) const
+{
+  const StreamStats &s = getStreamStats(id);
+  if (s.frames < 2 || s.lastUs == s.firstUs)
+  {
+    return 0.0f;
+  }
+  return (float)(s.frames - 1) * 1000000.0f / (float)(s.lastUs - s.firstUs);
+}
+
+/**
+* @brief サンプルACKにサーボが返信しているか
+* @retval false サンプルACKが #DEAD_ACK_LIMIT 回続けて失敗した
+**/
+bool IcsAsyncClass::servoResponding(byte id) const
+{
+  return getStreamStats(id).ackMisses < DEAD_ACK_LIMIT;
+}
+
+/**
+* @brief ストリーミングのカウンタを消す
+**/
+void IcsAsyncClass::resetStreamStats()
+{
+  memset(streamStats, 0, sizeof(streamStats));
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    streamStats[id].lastPos = -1;
+  }
+}
+
+
+
+//結果の確認 //////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief ハンドルに対応するスロットを探す
+* @retval nullptr 見つからない(上書きされた)
+**/
+IcsAsyncClass::Slot *IcsAsyncClass::findSlot(int handle)
+{
+  if (handle < 0)
+  {
+    return nullptr;
+  }
+  for (byte i = 0; i < QUEUE_SIZE; i++)
+  {
+    if (slots[i].handle == handle)
+    {
+      return &slots[i];
+    }
+  }
+  return nullptr;
+}
+
+const IcsAsyncClass::Slot *IcsAsyncClass::findSlot(int handle) const
+{
+  return const_cast<IcsAsyncClass *>(this)->findSlot(handle);
+}
+
+/**
+* @brief トランザクションの状態を返す
+* @param[in] handle submitで返ったハンドル
+* @return 状態(見つからない場合は #STATUS_FREE)
+**/
+IcsAsyncClass::Status IcsAsyncClass::status(int handle) const
+{
+  const Slot *slot = findSlot(handle);
+  if (slot == nullptr)
+  {
+    return STATUS_FREE;
+  }
+  return slot->status;
+}
+
+/**
+* @brief 完了したトランザクションの値を返す
+* @param[in] handle submitで返ったハンドル
+* @return ポジション設定/現在位置読出しはポジションデータ、パラメータはその値
+* @retval -1 未完了、失敗、または上書きされた
+**/
+int IcsAsyncClass::result(int handle) const
+{
+  const Slot *slot = findSlot(handle);
+  if (slot == nullptr || slot->status != STATUS_DONE)
+  {
+    return IcsBaseClass::ICS_FALSE;
+  }
+
+  if (slot->rxLen == 4)   //現在位置読出し
+  {
+    return IcsCommand::decodePos(slot->rx[2], slot->rx[3]);
+  }
+  if ((slot->tx[0] & IcsCommand::CMD_MASK) == IcsCommand::CMD_POS)   //ポジション設定
+  {
+    return IcsCommand::decodePos(slot->rx[1], slot->rx[2]);
+  }
+  return slot->rx[slot->rxLen - 1];
+}
+
+/**
+* @brief すべてのトランザクションが完了するまで待つ
+* @param[in] timeoutUs 待つ時間の上限(us)
+* @retval true すべて完了した
+* @retval false 時間内に終わらなかった
+* @note ブロッキングで送受信する前(setFree等)に呼んで、バスを空けておく
+**/
+bool IcsAsyncClass::waitAll(unsigned long timeoutUs)
+{
+  unsigned long start = micros();
+  poll();
+  while (busy())
+  {
+    if (micros() - start >= timeoutUs)
+    {
+      return false;
+    }
+    delayMicroseconds(1);
+    poll();
+  }
+  return true;
+}
@@ -0,0 +1,229 @@
+/**
+* @file IcsAsyncClass.h
+* @brief ICS3.5/3.6 non-blocking transaction engine header file
+* @date 2026/10/16
+* @version 1.0.0
+
+* @par 概要
+* IcsHardSerialClassの送受信をキューに積み、loop()から呼ぶpoll()で少しずつ進める。<br>
+* 返信を待つ間にloop()を止めないので、WiFiの処理とサーボ通信を重ねて行える。<br>
+
+* @par ストリーミング
+* setStreaming()を呼ぶと、ポジション設定は返信を待たずに次のフレームを送る。<br>
+* ICSのサーボは必ず返信するので、返信が線に出る時間(返信窓)だけは空けておき、<br>
+* 応答時間の最小値がわかっていれば、前のサーボの応答待ちの間に次のフレームを送る。<br>
+* 返信は後からまとめて読んで照合し、ackEvery回に1回は通常どおり返信を待って(サンプルACK)<br>
+* 返信しないサーボを見つける。<br>
+
+* @par 再同期
+* IcsHardSerialClass::setAutoResync(true)なら、返信がずれていた時にpoll()の中で止まらずに再同期する。<br>
+* 受信バッファを読み捨て、線が静かになるのを待ち、最後のIDに読出しを送って確かめてから次を送る。<br>
+**/
+
+#ifndef _ics_Async_h_
+#define _ics_Async_h_
+
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+
+//IcsAsyncClassクラス///////////////////////////////////////////////////
+/**
+* @class IcsAsyncClass
+* @brief ICSの送受信をブロックせずに行うためのクラス
+* @brief 1つのバスに対して1つ作り、トランザクションを順番に処理する
+**/
+class IcsAsyncClass
+{
+  //固定値
+  public:
+  static constexpr byte QUEUE_SIZE = 16;   ///< 同時に持てるトランザクションの数
+  static constexpr byte MAX_TX = 4;        ///< 1フレームの送信データ数の最大値
+  static constexpr byte MAX_RX = 18;       ///< 1フレームの受信データ数の最大値(KRR全データ)
+
+  static constexpr int HANDLE_NONE = -1;   ///< 登録できなかった時のハンドル
+  static constexpr int HANDLE_SKIPPED = -2; ///< シャドウレジスタと同じ値なので送らなかった時のハンドル
+
+  static constexpr byte MAX_STREAM_WINDOWS = 4;  ///< 読んでいない返信窓の最大数
+  static constexpr byte DEFAULT_ACK_EVERY = 8;   ///< ストリーミングで返信を待つ間隔(フレーム数)
+  static constexpr byte DEAD_ACK_LIMIT = 2;      ///< サンプルACKがこの回数続けて失敗したら応答なしとみなす
+
+  //クラス内の型定義
+  public:
+  /**
+  * @enum Status
+  * @brief トランザクションの状態
+  **/
+  enum Status : byte
+  {
+    STATUS_FREE = 0,     ///< 未使用(または結果が上書きされた)
+    STATUS_QUEUED,       ///< 送信待ち
+    STATUS_WAIT_REPLY,   ///< 送信済み、返信待ち
+    STATUS_DONE,         ///< 正常に完了
+    STATUS_FAILED,       ///< タイムアウトまたは返信不正
+    STATUS_SENT,         ///< ストリーミングで送信済み(返信は後から照合する)
+  };
+
+  /**
+  * @struct StreamStats
+  * @brief ストリーミングのID毎のカウンタ
+  **/
+  struct StreamStats
+  {
+    unsigned long frames;          ///< 送ったポジション設定の数(サンプルACKを含む)
+    unsigned long acks;            ///< サンプルACKの数
+    unsigned long ackFailures;     ///< 失敗したサンプルACKの数
+    unsigned long repliesOk;       ///< 後から照合して正しかった返信の数
+    unsigned long repliesBad;      ///< 後から照合して化けていた(または途中で切れた)返信の数
+    unsigned long repliesMissing;  ///< 返信窓に何も来なかった数
+    unsigned long firstUs;         ///< 最初に送った時刻(us)
+    unsigned long lastUs;          ///< 最後に送った時刻(us)
+    int lastPos;                   ///< 返信にあった現在位置(-1は未取得)
+    byte ackMisses;                ///< 続けて失敗したサンプルACKの数
+  };
+
+  /**
+  * @brief 完了時に呼ばれる関数
+  * @param[in] handle 完了したトランザクションのハンドル
+  * @param[in] ok 成功したかどうか
+  * @param[in] *rxBuf 受信データ(失敗時は受信できた分だけ)
+  * @param[in] rxLen 受信データ数
+  * @param[in] *ctx 登録時に渡したポインタ
+  **/
+  typedef void (*Callback)(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx);
+
+  //コンストラクタ、デストラクタ
+  public:
+    explicit IcsAsyncClass(IcsHardSerialClass *ics);
+
+  //変数
+  protected:
+  /**
+  * @struct Slot
+  * @brief 1トランザクション分の情報
+  **/
+  struct Slot
+  {
+    int handle;            ///< ハンドル(スロットの再利用を見分ける)
+    Status status;         ///< 状態
+    byte tx[MAX_TX];       ///< 送信データ
+    byte txLen;            ///< 送信データ数
+    byte rx[MAX_RX];       ///< 受信データ
+    byte rxLen;            ///< 受信データ数
+    byte rxCount;          ///< 受信済みデータ数
+    byte echoCount;        ///< 読み捨てたエコーの数
+    bool stream;           ///< ストリーミングで送る(返信を待たない)
+    Callback cb;           ///< 完了時の関数
+    void *ctx;             ///< 完了時の関数に渡すポインタ
+  };
+
+  IcsHardSerialClass *ics;   ///<送受信に使うICSクラス
+  Slot slots[QUEUE_SIZE];    ///<リングバッファ
+  byte head;                 ///<次に処理するスロット
+  byte count;                ///<未完了のトランザクション数
+  int nextHandle;            ///<次に払い出すハンドル
+  unsigned long sentUs;      ///<処理中のトランザクションを送信した時刻(us)
+  unsigned long startUs;     ///<処理中のトランザクションの送信を始めた時刻(us テレメトリ用)
+  volatile bool rxEvent;     ///<UARTの受信イベントがあった
+  bool eventAttached;        ///<attachUartEvent()を呼んだか
+
+  /**
+  * @struct StreamWindow
+  * @brief ストリーミングで送ったフレームの返信窓(まだ読んでいない返信)
+  **/
+  struct StreamWindow
+  {
+    byte id;                 ///< サーボID
+    byte header;             ///< 返信の先頭バイト(送信コマンドの最上位ビットを0にしたもの)
+    byte echoLen;            ///< 返信の前に読み捨てるエコーの数
+    byte rxLen;              ///< 受信データ数
+    unsigned long startUs;   ///< 返信が始まる最も早い時刻(us)
+    unsigned long endUs;     ///< 返信が終わる最も遅い時刻(us)
+  };
+
+  byte streamAckEvery;                          ///<返信を待つ間隔(0はストリーミングしない)
+  unsigned long streamLatencyMinUs;             ///<サーボの応答時間の最小値(us)
+  StreamWindow windows[MAX_STREAM_WINDOWS];     ///<返信窓(時刻順)
+  byte windowCount;                             ///<返信窓の数
+  byte streamSeq[IcsCommand::MAX_ID + 1];       ///<ID毎のフレームの通し番号(サンプルACKを選ぶ)
+  StreamStats streamStats[IcsCommand::MAX_ID + 1];  ///<ID毎のカウンタ
+
+  /**
+  * @enum ResyncState
+  * @brief 再同期の状態
+  **/
+  enum ResyncState : byte
+  {
+    RESYNC_IDLE = 0,   ///< 再同期していない
+    RESYNC_DRAIN,      ///< 読み捨てながら線が静かになるのを待つ
+    RESYNC_PROBE,      ///< 再確認の読出しの返信待ち
+  };
+
+  ResyncState resyncState;       ///<再同期の状態
+  Slot resyncSlot;               ///<再確認の読出し
+  unsigned long resyncStartUs;   ///<再同期を始めた時刻(us)
+  unsigned long resyncQuietUs;   ///<最後にバイトが届いた時刻(us)
+  unsigned long resyncDrained;   ///<読み捨てたバイト数
+
+  //関数
+  public:
+    //UARTの受信イベントでpoll()を進めるように登録する
+    void attachUartEvent();
+
+    //トランザクションの登録
+    int submit(const byte *txBuf, byte txLen, byte rxLen, Callback cb = nullptr, void *ctx = nullptr);
+    int submitSetPos(byte id, unsigned int pos, Callback cb = nullptr, void *ctx = nullptr);
+    int submitSetParam(byte id, byte sc, byte val, Callback cb = nullptr, void *ctx = nullptr);
+    int submitGetParam(byte id, byte sc, Callback cb = nullptr, void *ctx = nullptr);
+
+    //状態機械を進める loop()から毎回呼ぶ
+    void poll();
+
+    //結果の確認
+    Status status(int handle) const;
+    int result(int handle) const;
+    //すべて完了するまでpoll()を回す
+    bool waitAll(unsigned long timeoutUs);
+
+    /**
+    *	@brief 未完了のトランザクション数
+    **/
+    byte pending() const {return count;}
+    /**
+    *	@brief 処理中、キューに残っている、まだ読んでいない返信がある、または再同期中か
+    **/
+    bool busy() const {return count > 0 || windowCount > 0 || resyncState != RESYNC_IDLE;}
+    /**
+    *	@brief 送受信に使うICSクラスを返す
+    **/
+    IcsHardSerialClass *getIcs() const {return ics;}
+
+    //ストリーミング
+    void setStreaming(byte ackEvery, unsigned long latencyMinUs = 0);
+    /**
+    *	@brief ストリーミングしているか
+    **/
+    bool streaming() const {return streamAckEvery > 0;}
+    const StreamStats &getStreamStats(byte id) const;
+    float streamRateHz(byte id) const;
+    bool servoResponding(byte id) const;
+    void resetStreamStats();
+
+  protected:
+    Slot *findSlot(int handle);
+    const Slot *findSlot(int handle) const;
+    bool startNext();
+    bool startStream(Slot &slot);
+    unsigned long streamStartUs(const Slot &slot) const;
+    unsigned long streamLatencyMin() const;
+    void countStreamFrame(byte id, unsigned long us);
+    void collectStream();
+    bool serviceReply();
+    bool readInto(Slot &slot);
+    void beginResync(byte id);
+    bool serviceResync();
+    void finishResync(bool recovered);
+    void complete(Slot &slot, IcsTelemetry::Result result);
+    unsigned long replyTimeoutUs(byte rxLen) const;
+};
+
+#endif
@@ -8,6 +8,19 @@
 **/
 
 #include "IcsBaseClass.h"
+#include "IcsBus.h"
+
+/**
+*	@brief コンストラクタ
+*	@note シャドウレジスタは無効、キャッシュは空、テレメトリは無しで始まる
+**/
+IcsBaseClass::IcsBaseClass()
+{
+  shadowEnabled = false;
+  telemetry = nullptr;
+  invalidateShadowAll();
+  resetShadowStats();
+}
 
 //サーボID範囲 /////////////////////////////////////////////////////////////////////////////////////////////
 /**
@@ -50,6 +63,55 @@ bool IcsBaseClass::maxMin(int maxPos, int minPos, int val)
 
 
 
+//返信コマンドの確認 ////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 返信の先頭バイトが送信したコマンドに対する返信か確認する
+* @param[in] *txCmd 送信したコマンド
+* @param[in] *rxCmd 受信した返信
+* @retval true 対応する返信
+* @retval false 別のコマンドの返信(ずれている)
+* @note ICSの返信コマンドは送信コマンドの最上位ビットを0にしたもの
+**/
+bool IcsBaseClass::isReplyOf(const byte *txCmd, const byte *rxCmd)
+{
+  return IcsCommand::isReplyOf(txCmd, rxCmd);
+}
+
+
+
+//複数フレームの一括送受信 ///////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 同じ長さのコマンドを複数まとめて送受信する
+* @param[in,out] *txBuf 送信データ(txLen x count バイトを連続して格納)
+* @param[in] txLen 1フレームの送信データ数
+* @param[out] *rxBuf 受信格納バッファ(rxLen x count バイト)
+* @param[in] rxLen 1フレームの受信データ数
+* @param[in] count フレーム数
+* @param[out] *okFlags フレームごとの成否(count個)
+* @return 通信に成功したフレーム数
+* @note 基底クラスではsynchronizeを順に呼ぶだけなので、通信部分で最適化したものをオーバーライドする
+* @note 返信はIcsCommand::validReply()で確認し、送ったコマンドへの返信でなければそのフレームは失敗にする
+**/
+byte IcsBaseClass::synchronizeMulti(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen, byte count, bool *okFlags)
+{
+  byte okCount = 0;
+
+  for (byte i = 0; i < count; i++)
+  {
+    byte *tx = txBuf + i * txLen;
+    byte *rx = rxBuf + i * rxLen;
+
+    okFlags[i] = synchronize(tx, txLen, rx, rxLen) && IcsCommand::validReply(tx, txLen, rx, rxLen);
+    if (okFlags[i])
+    {
+      okCount++;
+    }
+  }
+  return okCount;
+}
+
+
+
 //角度変換　角度からPOSへ////////////////////////////////////////////////////////////////////////////////////
 /**
 * @brief 角度データ(float型)をポジションデータに変換
@@ -150,37 +212,18 @@ int IcsBaseClass::posDeg100(int pos)
 **/
 int IcsBaseClass::setPos(byte id, unsigned int pos)
 {
-  byte txCmd[3];
-  byte rxCmd[3];
-  unsigned int rePos;
-  bool flg;
-
-  
   if ((id != idMax(id)) || ( ! maxMin(MAX_POS, MIN_POS, pos)) ) //範囲外の時
   {
+    recordTelemetry(id, IcsTelemetry::RESULT_OUT_OF_RANGE, 0);
     return ICS_FALSE;
   }
 
-  txCmd[0] = 0x80 + id;               // CMD
-  txCmd[1] = ((pos >> 7) & 0x007F);   // POS_H
-  txCmd[2] = (pos & 0x007F);          // POS_L
-
-  //送受信
-  	
-  
-  
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+  int rePos = IcsBus<IcsBaseClass>(*this).setPos(id, pos);
+  if (rePos == ICS_FALSE)  //通信失敗
   {
-    return ICS_FALSE;
+    invalidateShadow(id);
   }
-
-		
-  
-  rePos = ((rxCmd[1] << 7) & 0x3F80) + (rxCmd[2] & 0x007F);
-
   return rePos;
-
 }
 
 
@@ -194,31 +237,78 @@ int IcsBaseClass::setPos(byte id, unsigned int pos)
 **/
 int IcsBaseClass::setFree(byte id)
 {
-  byte txCmd[3];
-  byte rxCmd[3];
-  unsigned int rePos;
-  bool flg;
+  //脱力したらパラメータの状態は分からなくなったものとして扱う
+  invalidateShadow(id);
 
-  if (id != idMax(id)) //範囲外の時
+  return IcsBus<IcsBaseClass>(*this).setFree(id);
+}
+
+
+
+//複数サーボ角度セット //////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 複数のサーボモータの角度をまとめて変更します
+* @param[in] *ids サーボモータのID番号の配列
+* @param[in] *positions ポジションデータの配列(idsと同じ並び)
+* @param[in] count サーボの数(#MAX_MULTI まで)
+* @param[out] *rePos 返ってきたポジションデータ(失敗したIDは-1)
+* @return 成功したサーボの数
+* @retval -1 countが範囲外
+* @note フレームをまとめて組み立て、synchronizeMultiで1回の呼び出しで送受信する
+* @note 返信は先頭バイトで送信IDと照合し、ずれた返信は失敗として扱う
+**/
+int IcsBaseClass::setPosMulti(const byte *ids, const unsigned int *positions, byte count, int *rePos)
+{
+  byte txCmd[MAX_MULTI * 3];
+  byte rxCmd[MAX_MULTI * 3];
+  bool okFlags[MAX_MULTI];
+  byte slot[MAX_MULTI];   //送信フレーム番号 -> 引数の並び
+  byte frameNum = 0;
+  int okCount = 0;
+
+  if (count > MAX_MULTI)
   {
     return ICS_FALSE;
   }
 
-  txCmd[0] = 0x80 + id;    // CMD
-  txCmd[1] = 0;
-  txCmd[2] = 0;
+  for (byte i = 0; i < count; i++)
+  {
+    byte id = ids[i];
+    unsigned int pos = positions[i];
 
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+    rePos[i] = ICS_FALSE;
+    if ((id != idMax(id)) || ( ! maxMin(MAX_POS, MIN_POS, pos)) ) //範囲外のIDは送らない
+    {
+      recordTelemetry(id, IcsTelemetry::RESULT_OUT_OF_RANGE, 0);
+      continue;
+    }
+
+    IcsCommand::encodePos(txCmd + frameNum * 3, id, pos);
+    slot[frameNum] = i;
+    frameNum++;
+  }
+
+  if (frameNum == 0)
   {
-    return ICS_FALSE;
+    return 0;
   }
 
-  rePos = ((rxCmd[1] << 7) & 0x3F80) + (rxCmd[2] & 0x007F);
+  //送受信
+  synchronizeMulti(txCmd, 3, rxCmd, 3, frameNum, okFlags);
 
-  return rePos;
+  for (byte f = 0; f < frameNum; f++)
+  {
+    if (okFlags[f] == false)
+    {
+      invalidateShadow(ids[slot[f]]);
+      continue;
+    }
+    byte *rx = rxCmd + f * 3;
+    rePos[slot[f]] = IcsCommand::decodePos(rx[1], rx[2]);
+    okCount++;
+  }
 
+  return okCount;
 }
 
 
@@ -235,31 +325,7 @@ int IcsBaseClass::setFree(byte id)
 **/
 int IcsBaseClass::setStrc(byte id, unsigned int strc)
 {
-  byte txCmd[3];
-  byte rxCmd[3];
-  unsigned int reData;
-  bool flg;
-
-  if ((id != idMax(id)) || ( ! maxMin(MAX_127, MIN_1, strc)) ) //範囲外の時
-  {
-    return ICS_FALSE;
-  }
-
-  txCmd[0] = 0xC0 + id;    // CMD
-  txCmd[1] = 0x01;         // SC ストレッチ
-  txCmd[2] = strc;         // ストレッチ
-
-
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
-  {
-    return ICS_FALSE;
-  }
-  reData = rxCmd[2];
-
-  return reData;
-
+  return writeParam(id, SC_STRC, strc);
 }
 
 
@@ -275,32 +341,7 @@ int IcsBaseClass::setStrc(byte id, unsigned int strc)
 **/
 int IcsBaseClass::setSpd(byte id, unsigned int spd)
 {
-  byte txCmd[3];
-  byte rxCmd[3];
-  unsigned int reData;
-  bool flg;
-
-  if ((id != idMax(id)) || ( ! maxMin(MAX_127, MIN_1, spd)) ) //範囲外の時
-  {
-    return ICS_FALSE;
-  }
-
-
-  txCmd[0] = 0xC0 + id;      // CMD
-  txCmd[1] = 0x02;           // SC スピード
-  txCmd[2] = spd;            // スピード
-
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
-  {
-    return ICS_FALSE;
-  }
-
-  reData = rxCmd[2];
-
-  return reData;
-
+  return writeParam(id, SC_SPD, spd);
 }
 
 
@@ -317,32 +358,7 @@ int IcsBaseClass::setSpd(byte id, unsigned int spd)
 **/
 int IcsBaseClass::setCur(byte id, unsigned int curlim)
 {
-  byte txCmd[3];
-  byte rxCmd[3];
-  unsigned int reData;
-  bool flg;
-
-  if ((id != idMax(id)) || ( ! maxMin(MAX_63, MIN_1, curlim)) ) //範囲外の時
-  {
-    return ICS_FALSE;
-  }
-
-  txCmd[0] = 0xC0 + id;                     // CMD
-  txCmd[1] = 0x03;                          // SC 電流値
-  txCmd[2] = curlim;                        // 電流リミット値
-
-
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
-  {
-    return ICS_FALSE;
-  }
-
-  reData = rxCmd[2];
-
-  return reData;
-
+  return writeParam(id, SC_CUR, curlim);
 }
 
 
@@ -359,74 +375,152 @@ int IcsBaseClass::setCur(byte id, unsigned int curlim)
 **/
 int IcsBaseClass::setTmp(byte id, unsigned int tmplim)
 {
-  byte txCmd[3];
-  byte rxCmd[3];
-  unsigned int reData;
-  bool flg;
-//  if (id != idMax(id)) //範囲外の時
-//  {
-//    return ICS_FALSE;
-//  }
-//  tmplim = maxMin(MAX_127, MIN_1, tmplim);   //入力値範囲
+  return writeParam(id, SC_TMP, tmplim);
+}
+
 
-  if ((id != idMax(id)) || ( ! maxMin(MAX_127, MIN_1, tmplim)) ) //範囲外の時
+//パラメータ書込み(共通) ////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief パラメータを書き込む(setStrc/setSpd/setCur/setTmpの中身)
+* @param[in] id サーボモータのID番号
+* @param[in] sc サブコマンド( #SC_STRC ～ #SC_TMP )
+* @param[in] val 書き込む値
+* @return 書き込んだ値
+* @retval -1 範囲外、通信失敗
+* @note シャドウレジスタと同じ値なら送らずに値を返す。失敗したらそのIDのキャッシュを捨てる
+**/
+int IcsBaseClass::writeParam(byte id, byte sc, unsigned int val)
+{
+  if ((id != idMax(id)) || !IcsCommand::validParam(sc, val)) //範囲外の時
   {
+    recordTelemetry(id, IcsTelemetry::RESULT_OUT_OF_RANGE, 0);
     return ICS_FALSE;
   }
 
+  if (shadowHit(id, sc, val)) //前回書き込んだ値と同じなので送らない
+  {
+    return val;
+  }
 
-  txCmd[0] = 0xC0 + id;                      // CMD
-  txCmd[1] = 0x04;                           // SC 温度値
-  txCmd[2] = tmplim;                         // 温度リミット値
-
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+  int reData = IcsBus<IcsBaseClass>(*this).setParam(id, sc, val);
+  if (reData == ICS_FALSE)
   {
+    invalidateShadow(id);
     return ICS_FALSE;
   }
-
-  reData = rxCmd[2];
+  shadowStore(id, sc, val);
 
   return reData;
-
 }
 
 
-//ストレッチ値読出し　1～127 ////////////////////////////////////////////////////////////////////////////////
+
+//シャドウレジスタ ///////////////////////////////////////////////////////////////////////////////////////////
 /**
-* @brief サーボモータのストレッチ(保持力)の値を読み込みます
+* @brief シャドウレジスタを使うか設定する
+* @param[in] enable trueで使う
+* @note 有効にすると、setStrc/setSpd/setCur/setTmpで前回と同じ値を書く時は通信しない
+* @attention サーボの電源を入れ直した時はROMの値に戻るので、invalidateShadowAll()を呼ぶ事
+**/
+void IcsBaseClass::enableShadow(bool enable)
+{
+  shadowEnabled = enable;
+  invalidateShadowAll();
+}
+
+/**
+* @brief 指定したIDのキャッシュを捨てる
 * @param[in] id サーボモータのID番号
-* @return 読み込んだストレッチのデータ
-* @retval -1 通信失敗
-* @note ストレッチ読込    1～127  1(弱）      127(強）
 **/
-int IcsBaseClass::getStrc(byte id)
+void IcsBaseClass::invalidateShadow(byte id)
 {
-  byte txCmd[2];
-  byte rxCmd[3];
-  unsigned int reData;
-  bool flg;
-  //id = idMax(id);          //ID範囲
-  if (id != idMax(id)) //範囲外の時
+  if (id != idMax(id))
   {
-    return ICS_FALSE;
+    return;
   }
-  txCmd[0] = 0xA0 + id;    // CMD
-  txCmd[1] = 0x01;         // SC ストレッチ
+  if (shadowEnabled)
+  {
+    for (byte i = 0; i < 4; i++)
+    {
+      if (shadowReg[id][i] != 0)
+      {
+        shadowStats.invalidated++;
+        break;
+      }
+    }
+  }
+  memset(shadowReg[id], 0, sizeof shadowReg[id]);
+}
 
+/**
+* @brief すべてのIDのキャッシュを捨てる
+**/
+void IcsBaseClass::invalidateShadowAll()
+{
+  memset(shadowReg, 0, sizeof shadowReg);
+}
 
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+/**
+* @brief 書き込もうとしている値がキャッシュと同じか確認する
+* @param[in] id サーボモータのID番号
+* @param[in] sc サブコマンド( #SC_STRC ～ #SC_TMP )
+* @param[in] val 書き込む値
+* @retval true 同じ値なので書込みを省ける(省いた数を数える)
+* @retval false 書き込む必要がある
+**/
+bool IcsBaseClass::shadowHit(byte id, byte sc, unsigned int val)
+{
+  if (!shadowEnabled || id != idMax(id) || sc < SC_STRC || sc > SC_TMP)
   {
-    return ICS_FALSE;
+    return false;
   }
+  if (shadowReg[id][sc - 1] == 0 || shadowReg[id][sc - 1] != val)
+  {
+    return false;
+  }
+  shadowStats.skipped++;
+  return true;
+}
+
+/**
+* @brief 書き込みに成功した値をキャッシュに入れる
+* @param[in] id サーボモータのID番号
+* @param[in] sc サブコマンド( #SC_STRC ～ #SC_TMP )
+* @param[in] val 書き込んだ値
+**/
+void IcsBaseClass::shadowStore(byte id, byte sc, unsigned int val)
+{
+  if (!shadowEnabled || id != idMax(id) || sc < SC_STRC || sc > SC_TMP)
+  {
+    return;
+  }
+  shadowReg[id][sc - 1] = val;
+  shadowStats.written++;
+}
+
+/**
+* @brief シャドウレジスタのカウンタを0にする
+**/
+void IcsBaseClass::resetShadowStats()
+{
+  shadowStats.skipped = 0;
+  shadowStats.written = 0;
+  shadowStats.invalidated = 0;
+}
 
-  reData = rxCmd[2];
 
-  return reData;
 
+//ストレッチ値読出し　1～127 ////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief サーボモータのストレッチ(保持力)の値を読み込みます
+* @param[in] id サーボモータのID番号
+* @return 読み込んだストレッチのデータ
+* @retval -1 通信失敗
+* @note ストレッチ読込    1～127  1(弱）      127(強）
+**/
+int IcsBaseClass::getStrc(byte id)
+{
+  return IcsBus<IcsBaseClass>(*this).getParam(id, SC_STRC);
 }
 
 
@@ -442,29 +536,7 @@ int IcsBaseClass::getStrc(byte id)
 **/
 int IcsBaseClass::getSpd(byte id)
 {
-  byte txCmd[2];
-  byte rxCmd[3];
-  unsigned int reData;
-  bool flg;
-  if (id != idMax(id)) //範囲外の時
-  {
-    return ICS_FALSE;
-  }
-  txCmd[0] = 0xA0 + id;    // CMD
-  txCmd[1] = 0x02;         // SC スピード
-
-
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
-  {
-    return ICS_FALSE;
-  }
-
-  reData = rxCmd[2];
-
-  return reData;
-
+  return IcsBus<IcsBaseClass>(*this).getParam(id, SC_SPD);
 }
 
 
@@ -479,29 +551,7 @@ int IcsBaseClass::getSpd(byte id)
 **/
 int IcsBaseClass::getCur(byte id)
 {
-  byte txCmd[2];
-  byte rxCmd[3];
-  unsigned int reData;
-  bool flg;
-  if (id != idMax(id)) //範囲外の時
-  {
-    return ICS_FALSE;
-  }
-  txCmd[0] = 0xA0 + id;    // CMD
-  txCmd[1] = 0x03;         // SC 電流値
-
-
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
-  {
-    return ICS_FALSE;
-  }
-
-  reData = rxCmd[2];
-
-  return reData;
-
+  return IcsBus<IcsBaseClass>(*this).getParam(id, SC_CUR);
 }
 
 
@@ -517,29 +567,7 @@ int IcsBaseClass::getCur(byte id)
 **/
 int IcsBaseClass::getTmp(byte id)
 {
-  byte txCmd[2];
-  byte rxCmd[3];
-  unsigned int reData;
-  bool flg;
-  if (id != idMax(id)) //範囲外の時
-  {
-    return ICS_FALSE;
-  }
-  txCmd[0] = 0xA0 + id;    // CMD
-  txCmd[1] = 0x04;         // SC 温度値
-
-
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
-  {
-    return ICS_FALSE;
-  }
-
-  reData = rxCmd[2];
-
-  return reData;
-
+  return IcsBus<IcsBaseClass>(*this).getParam(id, SC_TMP);
 }
 
 
@@ -553,29 +581,7 @@ int IcsBaseClass::getTmp(byte id)
 **/
 int IcsBaseClass::getPos(byte id)
 {
-  byte txCmd[2];
-  byte rxCmd[4];
-  unsigned int reData;
-  bool flg;
-  if (id != idMax(id)) //範囲外の時
-  {
-    return ICS_FALSE;
-  }
-  txCmd[0] = 0xA0 + id;    // CMD
-  txCmd[1] = 0x05;         // 角度読出し
-
-
-  //送受信
-  flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
-  {
-    return ICS_FALSE;
-  }
-
-  reData = ((rxCmd[2] << 7) & 0x3F80) + (rxCmd[3] & 0x007F);
-
-  return reData;
-
+  return IcsBus<IcsBaseClass>(*this).getParam(id, SC_POS);
 }
 
 //IDの読み込み //////////////////////////////////////////////////////////////////////////////////////////
@@ -602,7 +608,7 @@ int IcsBaseClass::getID()
   //送受信
   
   flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+  if (flg == false || !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd)) //IDコマンドの返信でなければ失敗
   {
     return ICS_FALSE;
   }
@@ -641,7 +647,7 @@ int IcsBaseClass::setID(byte id)
   //送受信
   
   flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+  if (flg == false || !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd)) //書き込んだIDが返ってこなければ失敗
   {
     return ICS_FALSE;
   }
@@ -677,7 +683,7 @@ unsigned short IcsBaseClass::getKrrButton()
 
   //送受信
   flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+  if (flg == false || !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd))
   {
     return KRR_BUTTON_FALSE;
   }
@@ -719,7 +725,7 @@ int IcsBaseClass::getKrrAnalog(int paCh)
 
   //送受信
   flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+  if (flg == false || !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd))
   {
     return ICS_FALSE;
   }
@@ -754,7 +760,7 @@ bool IcsBaseClass::getKrrAllData(unsigned short *button,int adData[4])
   ;
   //送受信
   flg = synchronize(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
-  if (flg == false)
+  if (flg == false || !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd))
   {
     return false;
   }
@@ -34,6 +34,8 @@
 #ifndef __ics_Base_Servo_h__
 #define __ics_Base_Servo_h__
 #include "Arduino.h"
+#include "IcsCommand.h"
+#include "IcsTelemetry.h"
 
 
   //KRR KRC-5FH ボタン定義////////
@@ -90,6 +92,15 @@ class IcsBaseClass
   
   static constexpr int ICS_FALSE = -1;  ///< ICS通信等々で失敗したときの値
 
+  static constexpr int MAX_MULTI = MAX_ID + 1;  ///< 一括送受信で扱えるフレームの最大数
+
+  //パラメータのサブコマンド
+  static constexpr byte SC_STRC = IcsCommand::SC_STRC;  ///< ストレッチ
+  static constexpr byte SC_SPD  = IcsCommand::SC_SPD;   ///< スピード
+  static constexpr byte SC_CUR  = IcsCommand::SC_CUR;   ///< 電流(書込みは電流リミット)
+  static constexpr byte SC_TMP  = IcsCommand::SC_TMP;   ///< 温度(書込みは温度リミット)
+  static constexpr byte SC_POS  = IcsCommand::SC_POS;   ///< 現在位置(読出しのみ ICS3.6以降)
+
   //固定値(非公開分)
   protected :
 
@@ -114,19 +125,40 @@ class IcsBaseClass
   
   //static const int MIN_100DEG = -13500;
   static constexpr int MIN_100DEG = -18000; ///< 角度(x100)の最小値
+
+  //固定小数点の角度変換 (1deg = 29.633 POS)
+  static constexpr long DEG_POS_NUM = 29633;     ///< 1degあたりのPOS x1000
+  static constexpr long CENTI_DEG_DEN = 100000;  ///< 角度x100 と 29.633x1000 の分母
+  static constexpr int  POS_CENTER = 7500;       ///< 0degのポジションデータ
+  static constexpr int  POS_LIMIT = 5334;        ///< posDegが範囲外(180degより大きい)になる中心からの差
   
   //クラス内の型定義
   public:
+  /**
+  * @struct ShadowStats
+  * @brief シャドウレジスタの効果を数えるカウンタ
+  **/
+  struct ShadowStats
+  {
+    unsigned long skipped;        ///< 値が同じなので送らなかった書込みの数(省いたトランザクション数)
+    unsigned long written;        ///< 実際に送った書込みの数
+    unsigned long invalidated;    ///< エラーやsetFreeでキャッシュを捨てた回数
+  };
 
   //コンストラクタ、デストラクタ
   public:
 	//コンストラクタ(construncor)
+	IcsBaseClass();
 
   //変数
   public:
 
 
   protected : 
+  bool shadowEnabled;                     ///< シャドウレジスタを使うかどうか
+  byte shadowReg[MAX_ID + 1][4];          ///< ID毎に最後に書き込んだストレッチ/スピード/電流/温度リミット(0は不明)
+  ShadowStats shadowStats;                ///< シャドウレジスタのカウンタ
+  IcsTelemetry *telemetry;                ///< トランザクションの記録先(nullptrなら記録しない)
 
   //関数
 
@@ -144,7 +176,16 @@ class IcsBaseClass
 	* @attention 送信データ数、受信データ数はコマンドによって違うので注意する
 	* @attention この関数は外部に書く事
 	**/
-     virtual bool synchronize(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen);
+     virtual bool synchronize(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen) = 0;
+
+     /**
+     * @brief IcsBus<IcsBaseClass>から使う送受信(synchronizeを呼ぶだけ)
+     * @note IcsBus<IcsHardSerialClass>ではIcsHardSerialClass::transactが直接呼ばれ、仮想関数を通らない
+     **/
+     bool transact(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen) {return synchronize(txBuf, txLen, rxBuf, rxLen);}
+
+     //複数フレームの一括送受信
+     virtual byte synchronizeMulti(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen, byte count, bool *okFlags);
    
   //servo関連
   public:
@@ -152,6 +193,9 @@ class IcsBaseClass
       //サーボ位置決め設定
       int setPos(byte id,unsigned int pos);    //目標値設定
       int setFree(byte id);    //サーボ脱力＋現在値読込
+
+      //複数サーボの位置決めを一括で行う
+      int setPosMulti(const byte *ids, const unsigned int *positions, byte count, int *rePos);
       
       //各種パラメータ書込み
       int setStrc(byte id, unsigned int strc);    //ストレッチ書込 1～127  1(弱）  <=>    127(強）
@@ -168,12 +212,58 @@ class IcsBaseClass
       int getID();
       int setID(byte id);
 
+  //シャドウレジスタ(書込み済みパラメータのキャッシュ)
+  public:
+      void enableShadow(bool enable);
+      /**
+      *	@brief シャドウレジスタを使っているかどうか
+      **/
+      bool isShadowEnabled() const {return shadowEnabled;}
+      void invalidateShadow(byte id);
+      void invalidateShadowAll();
+      bool shadowHit(byte id, byte sc, unsigned int val);
+      void shadowStore(byte id, byte sc, unsigned int val);
+      /**
+      *	@brief シャドウレジスタのカウンタを返す
+      **/
+      const ShadowStats &getShadowStats() const {return shadowStats;}
+      void resetShadowStats();
+
+  //テレメトリ(ID毎のトランザクションの記録)
+  public:
+      /**
+      *	@brief トランザクションの記録先を登録する
+      *	@param[in] *t 記録先(nullptrで記録をやめる)
+      **/
+      void attachTelemetry(IcsTelemetry *t) {telemetry = t;}
+      /**
+      *	@brief トランザクションの記録先を返す
+      **/
+      IcsTelemetry *getTelemetry() const {return telemetry;}
+      /**
+      *	@brief トランザクションを記録する(記録先が無ければ何もしない)
+      **/
+      inline void recordTelemetry(byte id, IcsTelemetry::Result result, unsigned long us)
+      {
+        if (telemetry != nullptr)
+        {
+          telemetry->record(id, result, us);
+        }
+      }
+
   protected : 
       //サーボIDリミット
       byte idMax(byte id);
 
+      //パラメータ書込み(setStrc/setSpd/setCur/setTmpの共通部分)
+      int writeParam(byte id, byte sc, unsigned int val);
+
       ////サーボ可動範囲　パラメータ範囲　リミット設定
       bool maxMin(int maxPos, int minPos, int val);
+
+  public:
+      //返信の先頭バイトが送信コマンドに対応しているか確認
+      static bool isReplyOf(const byte *txCmd, const byte *rxCmd);
       
   //角度関連
   public:    
@@ -187,6 +277,47 @@ class IcsBaseClass
       //角度変換 x100 角度からPOSへ変換
       static int posDeg100(int pos);
 
+      /**
+      * @brief 角度データx100(int型)をポジションデータに変換(定数式)
+      * @param[in] centiDeg 角度(deg x100)
+      * @return ポジションデータ
+      * @retval -1 範囲外
+      * @note degPos(centiDeg / 100.0f)と-18000～18000のすべての値で同じ結果になる
+      * @note 定数を渡すとコンパイル時に計算される
+      **/
+      static constexpr int degPosCenti(int centiDeg)
+      {
+        return (centiDeg > MAX_100DEG || centiDeg < MIN_100DEG) ? ICS_FALSE
+               : (int)(((long)centiDeg * DEG_POS_NUM) / CENTI_DEG_DEN) + POS_CENTER;
+      }
+      /**
+      * @brief ポジションデータを角度データx100(int型)に変換(定数式)
+      * @param[in] pos ポジションデータ
+      * @return 角度(deg x100 四捨五入)
+      * @retval #ANGLE_I_FALSE 正方向範囲外
+      * @retval -#ANGLE_I_FALSE 負方向範囲外
+      * @note posDeg(pos) x100 との差は0.5以下
+      **/
+      static constexpr int posCentiDeg(int pos)
+      {
+        return (pos - POS_CENTER >= POS_LIMIT) ? ANGLE_I_FALSE
+               : (pos - POS_CENTER <= -POS_LIMIT) ? -ANGLE_I_FALSE
+               : (int)(((long)(pos - POS_CENTER) * CENTI_DEG_DEN + (pos >= POS_CENTER ? DEG_POS_NUM / 2 : -DEG_POS_NUM / 2)) / DEG_POS_NUM);
+      }
+      /**
+      * @brief 角度データ(float型)を単精度だけでポジションデータに変換
+      * @param[in] deg 角度(deg)
+      * @return ポジションデータ
+      * @retval -1 範囲外
+      * @note degPosは29.633(double)を掛けるので、ESP32ではソフトウェアの倍精度演算になる
+      * @note 掛け算の丸めの違いで、整数の境目ちょうど付近の入力(約0.01%)だけdegPosと1ずれる
+      **/
+      static inline int degPosF(float deg)
+      {
+        return (deg > MAX_DEG || deg < MIN_DEG) ? ICS_FALSE
+               : (int)(deg * (DEG_POS_NUM / 1000.0f)) + POS_CENTER;
+      }
+
     //KRR関連
     public:
       //KRRからボタンデータ受信
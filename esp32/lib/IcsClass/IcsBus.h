@@ -0,0 +1,172 @@
+/**
+* @file IcsBus.h
+* @brief ICS3.5/3.6 compile-time bound servo bus header file
+* @date 2026/10/16
+* @version 1.0.0
+
+* @par 概要
+* 送受信を行うクラス(Transport)をテンプレート引数で受け取り、サーボのコマンドを送る。<br>
+* 仮想関数を通らないので、コマンドの組み立てから送受信の呼び出しまでがインライン展開される。<br>
+* 返信はIcsCommand::validReply()で確認し、送ったコマンドへの返信でなければ失敗にする。<br>
+* IcsBaseClassのコマンド関数もこのテンプレートで実装している。<br>
+
+* @par Transportの条件
+* 次の関数を持っていること(IcsHardSerialClass、IcsBaseClassなど)<br>
+* bool transact(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen);<br>
+**/
+
+#ifndef _ics_Bus_h_
+#define _ics_Bus_h_
+
+#include <Arduino.h>
+#include "IcsCommand.h"
+
+//IcsBusクラス///////////////////////////////////////////////////
+/**
+* @class IcsBus
+* @brief 送受信クラスをコンパイル時に決めたICSバス
+* @tparam Transport transact()を持つ送受信クラス
+**/
+template <class Transport>
+class IcsBus
+{
+  //固定値
+  public:
+  static constexpr int ICS_FALSE = -1;  ///< ICS通信等々で失敗したときの値
+
+  //コンストラクタ
+  public:
+  /**
+  * @brief コンストラクタ
+  * @param[in] &transport 送受信に使うクラス(begin()済みであること)
+  **/
+  explicit IcsBus(Transport &transport) : transport(transport) {}
+
+  //変数
+  protected:
+  Transport &transport;   ///<送受信に使うクラス
+
+  //関数
+  public:
+  /**
+  * @brief 送受信に使うクラスを返す
+  **/
+  Transport &getTransport() {return transport;}
+
+  /**
+  * @brief サーボモータの角度を変更します
+  * @param[in] id サーボモータのID番号
+  * @param[in] pos ポジションデータ
+  * @return ポジションデータ
+  * @retval -1 範囲外、通信失敗、返信が送ったコマンドと合わない
+  **/
+  int setPos(byte id, unsigned int pos)
+  {
+    byte txCmd[IcsCommand::POS_TX_LEN];
+    byte rxCmd[IcsCommand::POS_RX_LEN];
+
+    if (!IcsCommand::validId(id) || !IcsCommand::validPos(pos)) //範囲外の時
+    {
+      return ICS_FALSE;
+    }
+    IcsCommand::encodePos(txCmd, id, pos);
+    if (!transport.transact(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd) ||
+        !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd))
+    {
+      return ICS_FALSE;
+    }
+    return IcsCommand::decodePos(rxCmd[1], rxCmd[2]);
+  }
+
+  /**
+  * @brief サーボモータをフリー(脱力)状態にします
+  * @param[in] id サーボモータのID番号
+  * @return ポジションデータ
+  * @retval -1 範囲外、通信失敗、返信が送ったコマンドと合わない
+  **/
+  int setFree(byte id)
+  {
+    byte txCmd[IcsCommand::POS_TX_LEN];
+    byte rxCmd[IcsCommand::POS_RX_LEN];
+
+    if (!IcsCommand::validId(id)) //範囲外の時
+    {
+      return ICS_FALSE;
+    }
+    IcsCommand::encodeFree(txCmd, id);
+    if (!transport.transact(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd) ||
+        !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd))
+    {
+      return ICS_FALSE;
+    }
+    return IcsCommand::decodePos(rxCmd[1], rxCmd[2]);
+  }
+
+  /**
+  * @brief パラメータを書き込みます
+  * @param[in] id サーボモータのID番号
+  * @param[in] sc サブコマンド(IcsCommand::SC_STRC ～ IcsCommand::SC_TMP)
+  * @param[in] val 書き込む値
+  * @return 書き込んだ値
+  * @retval -1 範囲外、通信失敗、返信が送ったコマンドと合わない
+  **/
+  int setParam(byte id, byte sc, unsigned int val)
+  {
+    byte txCmd[IcsCommand::WRITE_TX_LEN];
+    byte rxCmd[IcsCommand::WRITE_RX_LEN];
+
+    if (!IcsCommand::validId(id) || !IcsCommand::validParam(sc, val)) //範囲外の時
+    {
+      return ICS_FALSE;
+    }
+    IcsCommand::encodeWrite(txCmd, id, sc, val);
+    if (!transport.transact(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd) ||
+        !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd))
+    {
+      return ICS_FALSE;
+    }
+    return rxCmd[2];
+  }
+
+  /**
+  * @brief パラメータを読み込みます
+  * @param[in] id サーボモータのID番号
+  * @param[in] sc サブコマンド(IcsCommand::SC_STRC ～ IcsCommand::SC_POS)
+  * @return 読み込んだ値(SC_POSはポジションデータ)
+  * @retval -1 範囲外、通信失敗、返信が送ったコマンドと合わない
+  **/
+  int getParam(byte id, byte sc)
+  {
+    byte txCmd[IcsCommand::READ_TX_LEN];
+    byte rxCmd[4];
+
+    if (!IcsCommand::validId(id) || sc < IcsCommand::SC_STRC || sc > IcsCommand::SC_POS) //範囲外の時
+    {
+      return ICS_FALSE;
+    }
+    IcsCommand::encodeRead(txCmd, id, sc);
+    if (!transport.transact(txCmd, sizeof txCmd, rxCmd, IcsCommand::readRxLen(sc)) ||
+        !IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, IcsCommand::readRxLen(sc)))
+    {
+      return ICS_FALSE;
+    }
+    if (sc == IcsCommand::SC_POS)
+    {
+      return IcsCommand::decodePos(rxCmd[2], rxCmd[3]);
+    }
+    return rxCmd[2];
+  }
+
+  int setStrc(byte id, unsigned int strc) {return setParam(id, IcsCommand::SC_STRC, strc);}   ///< ストレッチ書込 1～127
+  int setSpd(byte id, unsigned int spd) {return setParam(id, IcsCommand::SC_SPD, spd);}       ///< スピード書込 1～127
+  int setCur(byte id, unsigned int curlim) {return setParam(id, IcsCommand::SC_CUR, curlim);} ///< 電流制限値書込 1～63
+  int setTmp(byte id, unsigned int tmplim) {return setParam(id, IcsCommand::SC_TMP, tmplim);} ///< 温度上限書込 1～127
+
+  int getStrc(byte id) {return getParam(id, IcsCommand::SC_STRC);}  ///< ストレッチ読込
+  int getSpd(byte id) {return getParam(id, IcsCommand::SC_SPD);}    ///< スピード読込
+  int getCur(byte id) {return getParam(id, IcsCommand::SC_CUR);}    ///< 電流値読込
+  int getTmp(byte id) {return getParam(id, IcsCommand::SC_TMP);}    ///< 現在温度読込
+  int getPos(byte id) {return getParam(id, IcsCommand::SC_POS);}    ///< 現在位置読込 ※ICS3.6以降で有効
+};
+
+#endif
@@ -0,0 +1,186 @@
+/**
+* @file IcsCommand.h
+* @brief ICS3.5/3.6 command encoding header file
+* @date 2026/10/16
+* @version 1.0.0
+
+* @par 概要
+* ICSのコマンドの組み立てと返信の読み取りだけをまとめたヘッダ。<br>
+* 通信は行わないので、IcsBaseClass、IcsBus、IcsAsyncClassから共通で使う。<br>
+* すべてインライン関数なので、呼び出し側に展開される。<br>
+**/
+
+#ifndef _ics_Command_h_
+#define _ics_Command_h_
+
+#include <Arduino.h>
+
+//IcsCommandクラス///////////////////////////////////////////////////
+/**
+* @class IcsCommand
+* @brief ICSのコマンドの組み立てと返信の読み取り
+* @brief 値の範囲はIcsBaseClassと同じ
+**/
+class IcsCommand
+{
+  //固定値
+  public:
+  static constexpr byte CMD_POS   = 0x80;   ///< ポジション設定(0のときはフリー)
+  static constexpr byte CMD_READ  = 0xA0;   ///< パラメータ読出し
+  static constexpr byte CMD_WRITE = 0xC0;   ///< パラメータ書込み
+  static constexpr byte CMD_ID    = 0xE0;   ///< ID読み書き(1対1接続のみ)
+  static constexpr byte CMD_MASK  = 0xE0;   ///< コマンド部分
+  static constexpr byte ID_MASK   = 0x1F;   ///< ID部分
+
+  static constexpr byte SC_STRC = 0x01;  ///< ストレッチ
+  static constexpr byte SC_SPD  = 0x02;  ///< スピード
+  static constexpr byte SC_CUR  = 0x03;  ///< 電流(書込みは電流リミット)
+  static constexpr byte SC_TMP  = 0x04;  ///< 温度(書込みは温度リミット)
+  static constexpr byte SC_POS  = 0x05;  ///< 現在位置(読出しのみ ICS3.6以降)
+
+  static constexpr byte MAX_ID = 31;               ///< サーボIDの最大値
+  static constexpr unsigned int MAX_POS = 11500;   ///< ポジションの最大値
+  static constexpr unsigned int MIN_POS = 3500;    ///< ポジションの最小値
+
+  static constexpr byte POS_TX_LEN = 3;     ///< ポジション設定の送信データ数
+  static constexpr byte POS_RX_LEN = 3;     ///< ポジション設定の受信データ数
+  static constexpr byte WRITE_TX_LEN = 3;   ///< パラメータ書込みの送信データ数
+  static constexpr byte WRITE_RX_LEN = 3;   ///< パラメータ書込みの受信データ数
+  static constexpr byte READ_TX_LEN = 2;    ///< パラメータ読出しの送信データ数
+
+  //範囲の確認
+  public:
+  /**
+  * @brief IDが範囲内か
+  **/
+  static constexpr bool validId(byte id) {return id <= MAX_ID;}
+  /**
+  * @brief ポジションデータが範囲内か
+  **/
+  static constexpr bool validPos(unsigned int pos) {return pos >= MIN_POS && pos <= MAX_POS;}
+  /**
+  * @brief 書き込むパラメータが範囲内か(電流リミットは1～63、他は1～127)
+  **/
+  static constexpr bool validParam(byte sc, unsigned int val)
+  {
+    return sc >= SC_STRC && sc <= SC_TMP && val >= 1 && val <= (sc == SC_CUR ? 63u : 127u);
+  }
+  /**
+  * @brief パラメータ読出しの受信データ数
+  **/
+  static constexpr byte readRxLen(byte sc) {return (sc == SC_POS) ? 4 : 3;}
+
+  //コマンドの組み立て
+  public:
+  /**
+  * @brief ポジション設定
+  * @param[out] *tx 送信データ(3バイト)
+  **/
+  static inline void encodePos(byte *tx, byte id, unsigned int pos)
+  {
+    tx[0] = CMD_POS + id;             // CMD
+    tx[1] = ((pos >> 7) & 0x007F);    // POS_H
+    tx[2] = (pos & 0x007F);           // POS_L
+  }
+  /**
+  * @brief フリー(ポジション0)
+  * @param[out] *tx 送信データ(3バイト)
+  **/
+  static inline void encodeFree(byte *tx, byte id)
+  {
+    tx[0] = CMD_POS + id;    // CMD
+    tx[1] = 0;
+    tx[2] = 0;
+  }
+  /**
+  * @brief パラメータ書込み
+  * @param[out] *tx 送信データ(3バイト)
+  **/
+  static inline void encodeWrite(byte *tx, byte id, byte sc, byte val)
+  {
+    tx[0] = CMD_WRITE + id;  // CMD
+    tx[1] = sc;              // SC
+    tx[2] = val;
+  }
+  /**
+  * @brief パラメータ読出し
+  * @param[out] *tx 送信データ(2バイト)
+  **/
+  static inline void encodeRead(byte *tx, byte id, byte sc)
+  {
+    tx[0] = CMD_READ + id;   // CMD
+    tx[1] = sc;              // SC
+  }
+
+  //返信の読み取り
+  public:
+  /**
+  * @brief 7bitずつに分かれたポジションデータを戻す
+  **/
+  static constexpr int decodePos(byte hi, byte lo)
+  {
+    return ((hi << 7) & 0x3F80) + (lo & 0x007F);
+  }
+  /**
+  * @brief 返信の先頭バイトが送信したコマンドに対する返信か
+  * @note ICSの返信コマンドは送信コマンドの最上位ビットを0にしたもの
+  **/
+  static inline bool isReplyOf(const byte *tx, const byte *rx)
+  {
+    return rx[0] == (tx[0] & 0x7F);
+  }
+  /**
+  * @brief 先頭以外のバイトがデータ(最上位ビットが0)か
+  * @note ICSでは最上位ビットが1のバイトはコマンドだけなので、1ならフレームがずれている
+  **/
+  static inline bool validData(const byte *rx, byte rxLen)
+  {
+    for (byte i = 1; i < rxLen; i++)
+    {
+      if (rx[i] & 0x80)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+  /**
+  * @brief 返信が送信したコマンドに対するものか(コマンドの種類毎に確認する)
+  * @param[in] *tx 送信データ
+  * @param[in] txLen 送信データ数
+  * @param[in] *rx 受信データ(rxLenバイトそろっていること)
+  * @param[in] rxLen 受信データ数
+  * @note ポジション設定は先頭、パラメータの読み書きは先頭とサブコマンド、その後はデータを確認する
+  * @note ID書込みは返ってきたIDが書き込んだIDと同じか、ID読出しは先頭がIDコマンドかだけ確認する
+  * @note 長さの違うコマンド(KRRなど)は先頭だけ確認する
+  **/
+  static inline bool validReply(const byte *tx, byte txLen, const byte *rx, byte rxLen)
+  {
+    if (rxLen == 0)
+    {
+      return true;
+    }
+    switch (tx[0] & CMD_MASK)
+    {
+      case CMD_ID:
+        return (rx[0] & CMD_MASK) == CMD_ID && (txLen < 2 || tx[1] == 0 || rx[0] == tx[0]);
+      case CMD_POS:
+        return isReplyOf(tx, rx) && (txLen != POS_TX_LEN || validData(rx, rxLen));
+      case CMD_READ:
+      case CMD_WRITE:
+        if (txLen != READ_TX_LEN && txLen != WRITE_TX_LEN)
+        {
+          return isReplyOf(tx, rx);
+        }
+        return isReplyOf(tx, rx) && rxLen >= 2 && rx[1] == tx[1] && validData(rx, rxLen);
+      default:
+        return true;
+    }
+  }
+  /**
+  * @brief 送信データのID
+  **/
+  static constexpr byte idOf(byte cmd) {return cmd & ID_MASK;}
+};
+
+#endif
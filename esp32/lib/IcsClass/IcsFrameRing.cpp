@@ -0,0 +1,151 @@
+/**
+*	@file IcsFrameRing.cpp
+*	@brief ICS3.5/3.6 preallocated frame ring
+*	@date	2026/10/17
+*	@version 1.0.0
+**/
+
+#include "IcsFrameRing.h"
+
+/**
+*	@brief コンストラクタ
+**/
+IcsFrameRing::IcsFrameRing()
+{
+  memset(frames, 0, sizeof(frames));
+  head = 0;
+  count = 0;
+}
+
+/**
+* @brief 次の枠を取る
+* @param[in] txLen 送信データ数
+* @param[in] rxLen 受信データ数
+* @retval nullptr すべての枠が送っていないフレーム
+**/
+IcsFrameRing::Frame *IcsFrameRing::acquire(byte txLen, byte rxLen)
+{
+  if (count >= FRAME_NUM)
+  {
+    return nullptr;
+  }
+  Frame *f = &frames[head];
+  head = (head + 1) % FRAME_NUM;
+  count++;
+  f->txLen = txLen;
+  f->rxLen = rxLen;
+  f->rxCount = 0;
+  f->ok = false;
+  return f;
+}
+
+
+
+//コマンドの組み立て ///////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief ポジション設定を枠に組み立てる
+* @return 組み立てた枠
+* @retval nullptr 範囲外、またはリングがいっぱい
+**/
+IcsFrameRing::Frame *IcsFrameRing::pushPos(byte id, unsigned int pos)
+{
+  if (!IcsCommand::validId(id) || !IcsCommand::validPos(pos))
+  {
+    return nullptr;
+  }
+  Frame *f = acquire(IcsCommand::POS_TX_LEN, IcsCommand::POS_RX_LEN);
+  if (f != nullptr)
+  {
+    IcsCommand::encodePos(f->tx(), id, pos);
+  }
+  return f;
+}
+
+/**
+* @brief フリー(脱力)を枠に組み立てる
+* @return 組み立てた枠
+* @retval nullptr 範囲外、またはリングがいっぱい
+**/
+IcsFrameRing::Frame *IcsFrameRing::pushFree(byte id)
+{
+  if (!IcsCommand::validId(id))
+  {
+    return nullptr;
+  }
+  Frame *f = acquire(IcsCommand::POS_TX_LEN, IcsCommand::POS_RX_LEN);
+  if (f != nullptr)
+  {
+    IcsCommand::encodeFree(f->tx(), id);
+  }
+  return f;
+}
+
+/**
+* @brief パラメータ書込みを枠に組み立てる
+* @return 組み立てた枠
+* @retval nullptr 範囲外、またはリングがいっぱい
+**/
+IcsFrameRing::Frame *IcsFrameRing::pushWrite(byte id, byte sc, byte val)
+{
+  if (!IcsCommand::validId(id) || !IcsCommand::validParam(sc, val))
+  {
+    return nullptr;
+  }
+  Frame *f = acquire(IcsCommand::WRITE_TX_LEN, IcsCommand::WRITE_RX_LEN);
+  if (f != nullptr)
+  {
+    IcsCommand::encodeWrite(f->tx(), id, sc, val);
+  }
+  return f;
+}
+
+/**
+* @brief パラメータ読出しを枠に組み立てる
+* @return 組み立てた枠
+* @retval nullptr 範囲外、またはリングがいっぱい
+**/
+IcsFrameRing::Frame *IcsFrameRing::pushRead(byte id, byte sc)
+{
+  if (!IcsCommand::validId(id) || sc < IcsCommand::SC_STRC || sc > IcsCommand::SC_POS)
+  {
+    return nullptr;
+  }
+  Frame *f = acquire(IcsCommand::READ_TX_LEN, IcsCommand::readRxLen(sc));
+  if (f != nullptr)
+  {
+    IcsCommand::encodeRead(f->tx(), id, sc);
+  }
+  return f;
+}
+
+
+
+//返信の読み取り ///////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 枠の中の返信から値を取り出す
+* @param[in] *frame transactRing()で送受信した枠
+* @return ポジション設定とフリーは現在位置、書込みは書き込んだ値、読出しは読んだ値(SC_POSはポジションデータ)
+* @retval -1 失敗した、またはまだ送っていない
+**/
+int IcsFrameRing::value(const Frame *frame)
+{
+  if (frame == nullptr || !frame->ok)
+  {
+    return -1;
+  }
+  const byte *tx = frame->tx();
+  const byte *rx = frame->rx();
+  switch (tx[0] & IcsCommand::CMD_MASK)
+  {
+    case IcsCommand::CMD_POS:
+      return IcsCommand::decodePos(rx[1], rx[2]);
+    case IcsCommand::CMD_READ:
+      if (tx[1] == IcsCommand::SC_POS)
+      {
+        return IcsCommand::decodePos(rx[2], rx[3]);
+      }
+      return rx[2];
+    default:
+      return rx[2];
+  }
+}
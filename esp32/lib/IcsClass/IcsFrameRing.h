@@ -0,0 +1,111 @@
+/**
+* @file IcsFrameRing.h
+* @brief ICS3.5/3.6 preallocated frame ring header file
+* @date 2026/10/17
+* @version 1.0.0
+
+* @par 概要
+* 送信フレームと返信を、あらかじめ確保したリングの1つの枠に並べて置く。<br>
+* コマンドは枠の中に直接組み立て、返信は送信データのすぐ後ろにUARTから直接読み込み、<br>
+* その場で照合と値の取り出しを行う。コマンド毎のスタックの配列やコピーが無い。<br>
+* 送受信はIcsHardSerialClass::transactRing()で、積んだ順にまとめて行う。<br>
+
+* @par 使い方
+* 1. pushPos()等で枠を取り、返ってきたポインタを覚えておく<br>
+* 2. transactRing()で積んだフレームをすべて送受信する<br>
+* 3. value()で結果を読む。枠はリングを一周して上書きされるまで読める<br>
+* @note 枠は4バイト境界にそろえてあるので、DMAを使うドライバにもそのまま渡せる
+**/
+
+#ifndef _ics_FrameRing_h_
+#define _ics_FrameRing_h_
+
+#include <Arduino.h>
+#include "IcsCommand.h"
+
+//IcsFrameRingクラス///////////////////////////////////////////////////
+/**
+* @class IcsFrameRing
+* @brief 送信と返信を同じ枠に置くフレームのリング
+**/
+class IcsFrameRing
+{
+  //固定値
+  public:
+  static constexpr byte FRAME_NUM = 16;     ///< リングの枠の数
+  static constexpr byte MAX_TX = 3;         ///< 1フレームの送信データ数の最大値
+  static constexpr byte MAX_RX = 4;         ///< 1フレームの受信データ数の最大値
+  static constexpr byte FRAME_SIZE = 8;     ///< 1つの枠の大きさ(送信 + 返信)
+
+  //クラス内の型定義
+  public:
+  /**
+  * @struct Frame
+  * @brief 1つの枠 送信データの直後に返信を読み込む
+  * @note 配線のエコーも返信の場所に読んで、送信データと照合してから返信で上書きする
+  **/
+  struct alignas(4) Frame
+  {
+    byte buf[FRAME_SIZE];  ///< 送信データ、続けて返信
+    byte txLen;            ///< 送信データ数
+    byte rxLen;            ///< 受信データ数
+    byte rxCount;          ///< 受信できたデータ数
+    bool ok;               ///< 返信が送信したコマンドに対するものだった
+
+    /**
+    *	@brief 送信データ
+    **/
+    byte *tx() {return buf;}
+    const byte *tx() const {return buf;}
+    /**
+    *	@brief 返信(送信データの直後)
+    **/
+    byte *rx() {return buf + txLen;}
+    const byte *rx() const {return buf + txLen;}
+    /**
+    *	@brief 送信先のID
+    **/
+    byte id() const {return IcsCommand::idOf(buf[0]);}
+  };
+
+  //コンストラクタ
+  public:
+    IcsFrameRing();
+
+  //変数
+  protected:
+  Frame frames[FRAME_NUM];  ///< 枠
+  byte head;                ///< 次に積む枠
+  byte count;               ///< 送っていない枠の数
+
+  //関数
+  public:
+    Frame *pushPos(byte id, unsigned int pos);
+    Frame *pushFree(byte id);
+    Frame *pushWrite(byte id, byte sc, byte val);
+    Frame *pushRead(byte id, byte sc);
+
+    /**
+    *	@brief 送っていないフレームの数
+    **/
+    byte pending() const {return count;}
+    /**
+    *	@brief 次に送るフレーム(無ければnullptr)
+    **/
+    Frame *front() {return (count == 0) ? nullptr : &frames[(byte)(head + FRAME_NUM - count) % FRAME_NUM];}
+    /**
+    *	@brief 先頭のフレームを送り終わった
+    **/
+    void pop() {if (count > 0) {count--;}}
+    /**
+    *	@brief 送っていないフレームを捨てる
+    **/
+    void clear() {count = 0;}
+
+    static int value(const Frame *frame);
+
+  protected:
+    Frame *acquire(byte txLen, byte rxLen);
+};
+
+#endif
@@ -16,7 +16,14 @@
 **/
 IcsHardSerialClass::IcsHardSerialClass()
 {
-	
+  transportMode = TRANSPORT_GPIO;
+  timeoutMode = TIMEOUT_FIXED;
+  responseLatencyUs = RESPONSE_LATENCY_US;
+  latencyLearning = false;
+  measuredLatencyUs = 0;
+  echoEnabled = false;
+  autoResync = false;
+  resetResyncStats();
 }
 
 
@@ -31,6 +38,14 @@ IcsHardSerialClass::IcsHardSerialClass(HardwareSerial *icsSerial,byte enpin)
 {
   icsHardSerial = icsSerial;
   enPin = enpin;
+  transportMode = TRANSPORT_GPIO;
+  timeoutMode = TIMEOUT_FIXED;
+  responseLatencyUs = RESPONSE_LATENCY_US;
+  latencyLearning = false;
+  measuredLatencyUs = 0;
+  echoEnabled = false;
+  autoResync = false;
+  resetResyncStats();
 }
 
 /**
@@ -47,6 +62,14 @@ IcsHardSerialClass::IcsHardSerialClass(HardwareSerial *hardSerial,byte enpin, lo
   enPin = enpin;
   baudRate = baudrate;
   timeOut = timeout;
+  transportMode = TRANSPORT_GPIO;
+  timeoutMode = TIMEOUT_FIXED;
+  responseLatencyUs = RESPONSE_LATENCY_US;
+  latencyLearning = false;
+  measuredLatencyUs = 0;
+  echoEnabled = false;
+  autoResync = false;
+  resetResyncStats();
 }
 
 
@@ -80,6 +103,12 @@ bool IcsHardSerialClass::begin()
 
   icsHardSerial->begin(baudRate,SERIAL_8E1);
   icsHardSerial->setTimeout(timeOut);
+
+  if (transportMode == TRANSPORT_RS485_HW && beginRs485())
+  {
+    return true;
+  }
+
   pinMode(enPin, OUTPUT);
   enLow();
   
@@ -120,6 +149,327 @@ bool IcsHardSerialClass::begin(HardwareSerial *serial,int enpin,long baudrate,in
   return begin();
 }
 
+/**
+* @brief 通信速度だけを変える
+* @param[in] baudrate ICSの通信速度(115200,625000,1250000(1.25M)bps)
+* @retval true 変更した
+* @retval false begin()していない、または速度が不正
+* @note ピンや送受信の切替方法は設定し直さないので、通信中でなければいつ呼んでもよい
+* @note サーボの通信速度は変わらない(サーボ側はICSマネージャでROMに書き込む)
+**/
+bool IcsHardSerialClass::setBaudRate(long baudrate)
+{
+  if (icsHardSerial == nullptr || baudrate <= 0)
+  {
+    return false;
+  }
+  baudRate = baudrate;
+  icsHardSerial->updateBaudRate(baudRate);
+  return true;
+}
+
+
+
+//送受信の切替方法 /////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 送受信の切替方法を設定する
+* @param[in] mode 切替方法( #TRANSPORT_GPIO / #TRANSPORT_RS485_HW )
+* @retval true 設定完了
+* @retval false このボードではRS485モードが使えない
+* @attention 設定はbegin()で反映されるので、begin()より前に呼ぶ事
+* @attention RS485モードではenPinがUARTのRTSに割り当てられる。外部でpinMode/digitalWriteしない事
+**/
+bool IcsHardSerialClass::setTransportMode(TransportMode mode)
+{
+#ifndef ICS_HAS_RS485_HW
+  if (mode == TRANSPORT_RS485_HW)
+  {
+    return false;
+  }
+#endif
+  transportMode = mode;
+  return true;
+}
+
+/**
+* @brief UARTをRS485半二重モードにする
+* @retval true 設定完了
+* @retval false 設定失敗(transportModeをGPIOでの切替に戻す)
+* @note 送信中だけRTS(enPin)がHになり、送信完了と同時にハードウェアで受信に切り替わる
+* @note RX FIFOタイムアウトを短くして、返信の最後のバイトが届いてすぐに読めるようにする
+**/
+bool IcsHardSerialClass::beginRs485()
+{
+#ifdef ICS_HAS_RS485_HW
+  if (icsHardSerial->setPins(-1, -1, -1, enPin) &&
+      icsHardSerial->setMode(UART_MODE_RS485_HALF_DUPLEX))
+  {
+    icsHardSerial->setRxTimeout(RS485_RX_TIMEOUT_SYMBOLS);
+    return true;
+  }
+#endif
+
+  //使えなかったときは従来の方法に戻す
+  transportMode = TRANSPORT_GPIO;
+  return false;
+}
+
+
+
+//エコー ///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 送信したデータが受信側に回り込む(エコーが返る)配線かどうかを設定する
+* @param[in] echo trueでエコーあり。送信したデータ数だけ読み捨ててから返信を読む
+* @note 送受信を1本の信号線にまとめ、受信を止めない回路ではエコーが返る
+**/
+void IcsHardSerialClass::setEcho(bool echo)
+{
+  echoEnabled = echo;
+}
+
+
+
+//受信タイムアウト ///////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 受信タイムアウトの決め方を設定する
+* @param[in] mode #TIMEOUT_FIXED (timeOut ms固定) / #TIMEOUT_COMPUTED (コマンド毎に計算)
+* @note 計算したタイムアウトは数百us程度なので、返信しないIDがあってもloop()がほとんど止まらない
+**/
+void IcsHardSerialClass::setTimeoutMode(TimeoutMode mode)
+{
+  timeoutMode = mode;
+}
+
+/**
+* @brief サーボの応答時間の見込みを設定する
+* @param[in] us 送信完了から返信の先頭バイトが始まるまでの時間(us)
+* @note 通信速度を下げたサーボや、応答遅延を設定したサーボではこの値を大きくする
+**/
+void IcsHardSerialClass::setResponseLatencyUs(unsigned long us)
+{
+  responseLatencyUs = us;
+}
+
+/**
+* @brief 実測した応答時間をタイムアウトに反映するかどうか
+* @param[in] enable trueで有効。実測値はクリアする
+* @note 有効にすると、実測の最大値の1.5倍が見込みを超えた時にそちらを使う
+**/
+void IcsHardSerialClass::setLatencyLearning(bool enable)
+{
+  latencyLearning = enable;
+  measuredLatencyUs = 0;
+}
+
+/**
+* @brief lenバイトを送受信するのにかかる時間(us)
+* @param[in] len バイト数
+* @return 時間(us 切り上げ)
+**/
+unsigned long IcsHardSerialClass::frameTimeUs(byte len) const
+{
+  if (baudRate <= 0)
+  {
+    return 0;
+  }
+  return ((unsigned long)len * BITS_PER_BYTE * 1000000UL + baudRate - 1) / baudRate;
+}
+
+/**
+* @brief 返信を待つ時間(us)
+* @param[in] rxLen 受信データ数
+* @return 送信完了からのタイムアウト(us)
+* @note TIMEOUT_COMPUTEDでは 応答時間 + 受信データの時間 + RX FIFOタイムアウト を使う
+* @note どちらのモードでもtimeOut(ms)を超えることはない
+**/
+unsigned long IcsHardSerialClass::replyTimeoutUs(byte rxLen) const
+{
+  unsigned long fixedUs = (unsigned long)timeOut * 1000UL;
+  if (timeoutMode == TIMEOUT_FIXED)
+  {
+    return fixedUs;
+  }
+
+  unsigned long us = responseLatencyMaxUs() + frameTimeUs(rxLen + fifoSymbols());
+  return (us < fixedUs) ? us : fixedUs;
+}
+
+/**
+* @brief サーボの応答時間の見込み(us)
+* @return setResponseLatencyUs()の値。学習が有効で、実測の最大値の1.5倍の方が大きければそちら
+**/
+unsigned long IcsHardSerialClass::responseLatencyMaxUs() const
+{
+  if (latencyLearning && measuredLatencyUs + measuredLatencyUs / 2 > responseLatencyUs)
+  {
+    return measuredLatencyUs + measuredLatencyUs / 2;
+  }
+  return responseLatencyUs;
+}
+
+/**
+* @brief 受信が終わってからreadできるようになるまでの時間(RX FIFOタイムアウト us)
+**/
+unsigned long IcsHardSerialClass::fifoTimeoutUs() const
+{
+  return frameTimeUs(fifoSymbols());
+}
+
+/**
+* @brief 実測した応答時間を記録する
+* @param[in] us 送信完了から返信を受け取り終わるまでの時間から、受信データの時間を引いたもの(us)
+* @note IcsAsyncClassの返信はpoll()の間隔が入ってしまうので記録しない
+**/
+void IcsHardSerialClass::recordLatencyUs(unsigned long us)
+{
+  if (us > measuredLatencyUs)
+  {
+    measuredLatencyUs = us;
+  }
+}
+
+
+
+//返信のずれからの復帰 /////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 返信がずれた時に自動で再同期するかどうかを設定する
+* @param[in] enable trueで有効
+* @note 有効にすると、transact、synchronizeMultiで返信が途中で切れた、化けていた、エコーが違った時にresync()する
+* @note 返信が1バイトも来なかった時は再同期しない(返信しないIDで毎回再確認しないように)
+**/
+void IcsHardSerialClass::setAutoResync(bool enable)
+{
+  autoResync = enable;
+}
+
+/**
+* @brief 受信したバイトとフレームの区切りを合わせ直す
+* @param[in] id 最後に通信したサーボのID(再確認に使う)
+* @retval true 同期が戻った(再確認の返信が正しかった)
+* @retval false 線が静かにならない、または再確認の返信が正しくなかった
+* @note 1. 受信バッファを読み捨てる 2. 線がresyncGapUs()静かになるまで読み捨て続ける 3. idにRESYNC_PROBE_SCの読出しを送って返信を確認する
+* @note 遅れて届いた返信の残りを次のトランザクションが読まないので、ずれが続けて失敗することがない
+* @note かかる時間は最大で resyncGapUs() x RESYNC_MAX_GAPS + 読出し1回。再確認は1回だけでリトライしない
+**/
+bool IcsHardSerialClass::resync(byte id)
+{
+  if (icsHardSerial == nullptr)
+  {
+    return false;
+  }
+
+  unsigned long gapUs = resyncGapUs();
+  unsigned long start = micros();
+  unsigned long quietUs = start;   //最後にバイトが届いた時刻
+  unsigned long drained = 0;
+  bool ok = true;
+
+  while (micros() - quietUs < gapUs) //フレームの区切り(静かな時間)を待つ
+  {
+    if (micros() - start >= gapUs * RESYNC_MAX_GAPS)
+    {
+      ok = false;   //ずっと何か届いている
+      break;
+    }
+    if (icsHardSerial->available() > 0)
+    {
+      icsHardSerial->read();   //空読み
+      drained++;
+      quietUs = micros();
+      continue;
+    }
+    delayMicroseconds(1);
+  }
+
+  if (ok) //最後のIDに読出しを送って、返信の区切りが合っているか確かめる
+  {
+    byte txCmd[IcsCommand::READ_TX_LEN];
+    byte rxCmd[3];
+    IcsCommand::encodeRead(txCmd, id, RESYNC_PROBE_SC);
+    sendFrame(txCmd, sizeof txCmd);
+    int rxSize = readReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
+    ok = (rxSize == sizeof rxCmd) && IcsCommand::validReply(txCmd, sizeof txCmd, rxCmd, sizeof rxCmd);
+  }
+
+  countResync(id, ok, drained);
+  return ok;
+}
+
+/**
+* @brief 再同期で待つ静かな時間(us)
+* @return 応答時間の見込み + RESYNC_GAP_SYMBOLSバイトの時間
+* @note これだけ何も届かなければ、フレームの途中ではなく、遅れている返信も無いとみなす
+**/
+unsigned long IcsHardSerialClass::resyncGapUs() const
+{
+  return responseLatencyMaxUs() + frameTimeUs(RESYNC_GAP_SYMBOLS);
+}
+
+/**
+* @brief 再同期を数える
+* @param[in] id 再確認したID
+* @param[in] recovered 同期が戻ったか
+* @param[in] drainedBytes 読み捨てたバイト数
+* @note IcsAsyncClassはpoll()の中で同じ手順を止まらずに行い、ここで数える
+**/
+void IcsHardSerialClass::countResync(byte id, bool recovered, unsigned long drainedBytes)
+{
+  resyncStats.triggered++;
+  if (recovered)
+  {
+    resyncStats.recovered++;
+  }
+  else
+  {
+    resyncStats.failed++;
+  }
+  resyncStats.drainedBytes += drainedBytes;
+  resyncStats.lastId = id;
+}
+
+/**
+* @brief 再同期の回数をクリアする
+**/
+void IcsHardSerialClass::resetResyncStats()
+{
+  memset(&resyncStats, 0, sizeof(resyncStats));
+}
+
+
+
+//フレーム送信 /////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 1フレームを送信して受信待ちに切り替える(返信は読まない)
+* @param[in] *txBuf 送信データ
+* @param[in] txLen 送信データ数
+* @param[in] drainRx trueなら送信前に受信バッファに残っているデータを捨てる
+* @retval true 送信完了
+* @retval false シリアルが設定されていない
+* @note IcsAsyncClassのストリーミングでは、まだ読んでいない返信を残すためにdrainRxをfalseにする
+* @note 送信が終わるまでは待つが、返信は待たない。返信はgetSerial()から読む
+* @note 受信バッファは送信前(バスが静かな間)に消す。送信後に消すとサーボの返信の先頭と競合する
+* @note エコーがある配線ではエコーも受信バッファに残るので、readReply等でtxLenバイト読み捨てる
+* @note synchronize、synchronizeMultiおよびIcsAsyncから使う
+**/
+bool IcsHardSerialClass::sendFrame(const byte *txBuf, byte txLen, bool drainRx)
+{
+	if(icsHardSerial == nullptr )
+	{
+		return false;
+	}
+
+	while (drainRx && icsHardSerial->available() > 0) //前の通信の残りを消す
+	{
+		icsHardSerial->read();		//空読み
+	}
+
+	txBegin(); //送信切替
+	icsHardSerial->write(txBuf, txLen);
+	icsHardSerial->flush();   //待つ
+	txEnd();  //受信切替
+	return true;
+}
+
 
 
 //データ送受信 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -135,6 +485,24 @@ bool IcsHardSerialClass::begin(HardwareSerial *serial,int enpin,long baudrate,in
 * @date 2020/02/18 protectedからpublicに変更
 **/
 bool IcsHardSerialClass::synchronize(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen)
+{
+	return transact(txBuf, txLen, rxBuf, rxLen);
+}
+
+/**
+* @brief ICS通信の送受信(仮想関数を通らない版)
+* @param[in,out] *txBuf
+* @param[in] txLen
+* @param[out] *rxBuf 受信格納バッファ
+* @param[in] rxLen  受信データ数
+* @retval true 通信成功
+* @retval false 通信失敗
+* @note IcsBus<IcsHardSerialClass>からはこちらが直接呼ばれる
+* @note 返信はIcsCommand::validReply()で確認し、送ったコマンドへの返信でなければ失敗にする(テレメトリはRESULT_BAD_REPLY)
+* @note テレメトリが登録されていれば、結果の種類と送信開始から受信完了(またはタイムアウト)までの時間を記録する
+* @note setAutoResync(true)なら、返信がずれていた時はresync()してから戻る
+**/
+bool IcsHardSerialClass::transact(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen)
 {
 	int rxSize; //受信数
 
@@ -146,32 +514,291 @@ bool IcsHardSerialClass::synchronize(byte *txBuf, byte txLen, byte *rxBuf, byte
 	}
 
 	icsHardSerial->flush(); //待つ
-	enHigh(); //送信切替
-	icsHardSerial->write(txBuf, txLen);
-	icsHardSerial->flush();   //待つ
-	
-	while (icsHardSerial->available() > 0) //受信バッファを消す
+	unsigned long start = micros();
+	sendFrame(txBuf, txLen);
+
+	rxSize = readReply(txBuf, txLen, rxBuf, rxLen);
+	IcsTelemetry::Result result = IcsTelemetry::classify(rxSize, rxLen);
+	if (result == IcsTelemetry::RESULT_OK && !IcsCommand::validReply(txBuf, txLen, rxBuf, rxLen)) //返信の確認
 	{
-		// buff = icsSerial->read();	//空読み
-		icsHardSerial->read();		//空読み
+		result = IcsTelemetry::RESULT_BAD_REPLY;
 	}
+	recordTelemetry(IcsCommand::idOf(txBuf[0]), result, micros() - start);
 
-	enLow();  //受信切替
+	if (autoResync && isMisaligned(result)) //次のトランザクションまでずれが続かないようにする
+	{
+		resync(IcsCommand::idOf(txBuf[0]));
+	}
+	return result == IcsTelemetry::RESULT_OK;
+}
 
 
-	rxSize = icsHardSerial->readBytes(rxBuf, rxLen);
 
-	if (rxSize != rxLen) //受信数確認
+/**
+* @brief 送信直後から返信を読む
+* @param[in] *txBuf 送信したデータ(エコーの照合に使う)
+* @param[in] txLen 送信したデータ数
+* @param[out] *rxBuf 受信格納バッファ
+* @param[in] rxLen 受信データ数
+* @return 受信できたデータ数
+* @retval -1 エコーが送信データと違った(送信が衝突した)
+* @note エコーがある配線ではちょうどtxLenバイトをエコーとして読み、その次から返信として扱う
+* @note TIMEOUT_FIXEDではreadBytes(1バイトごとにtimeOut ms)と同じ
+* @note TIMEOUT_COMPUTEDではreplyTimeoutUs()をmicros()で測り、フレーム全体のタイムアウトにする
+**/
+int IcsHardSerialClass::readReply(const byte *txBuf, byte txLen, byte *rxBuf, byte rxLen)
+{
+	byte echoLen = echoEnabled ? txLen : 0;
+
+	if (timeoutMode == TIMEOUT_FIXED)
 	{
-		return false;
+		for (byte i = 0; i < echoLen; i++)
+		{
+			byte echo;
+			if (icsHardSerial->readBytes(&echo, 1) != 1)
+			{
+				return 0;
+			}
+			if (echo != txBuf[i])
+			{
+				return -1;
+			}
+		}
+		return icsHardSerial->readBytes(rxBuf, rxLen);
 	}
-	return true;
 
-	
+	unsigned long start = micros();
+	unsigned long timeoutUs = replyTimeoutUs(rxLen);
+	byte echoCount = 0;
+	byte rxSize = 0;
+
+	while (rxSize < rxLen)
+	{
+		if (icsHardSerial->available() > 0)
+		{
+			byte c = icsHardSerial->read();
+			if (echoCount < echoLen) //エコー
+			{
+				if (c != txBuf[echoCount++])
+				{
+					return -1;   //送信が衝突した
+				}
+				continue;
+			}
+			rxBuf[rxSize++] = c;
+			continue;
+		}
+		if (micros() - start >= timeoutUs)
+		{
+			return rxSize;
+		}
+		delayMicroseconds(1);
+	}
+
+	if (latencyLearning)
+	{
+		unsigned long elapsed = micros() - start;
+		unsigned long wireUs = frameTimeUs(rxLen);
+		recordLatencyUs(elapsed > wireUs ? elapsed - wireUs : 0);
+	}
+	return rxSize;
 }
 
 
 
+//複数フレームの一括送受信 ///////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 同じ長さのコマンドを複数まとめて送受信する
+* @param[in,out] *txBuf 送信データ(txLen x count バイトを連続して格納)
+* @param[in] txLen 1フレームの送信データ数
+* @param[out] *rxBuf 受信格納バッファ(rxLen x count バイト)
+* @param[in] rxLen 1フレームの受信データ数
+* @param[in] count フレーム数
+* @param[out] *okFlags フレームごとの成否(count個)
+* @return 通信に成功したフレーム数
+* @note ICSは半二重なので返信を待たずに次のフレームは送れない。
+* @note 送信前のflushは最初の1回だけにして、フレームの間は送信→切替→受信を詰めて行う
+* @note エコーの扱いはsynchronizeと同じ
+* @note 返信はIcsCommand::validReply()で照合し、ずれていたらそのフレームは失敗にする(テレメトリはRESULT_BAD_REPLY)
+* @note setAutoResync(true)なら、ずれていたフレームの後でresync()してから次のフレームを送る
+**/
+byte IcsHardSerialClass::synchronizeMulti(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen, byte count, bool *okFlags)
+{
+	byte okCount = 0;
+
+	//シリアル初期化確認
+	if(icsHardSerial == nullptr )
+	{
+		for (byte i = 0; i < count; i++)
+		{
+			okFlags[i] = false;
+		}
+		return 0;
+	}
 
+	icsHardSerial->flush(); //前回の送信が終わるのを待つのは1回だけ
 
+	for (byte i = 0; i < count; i++)
+	{
+		byte *tx = txBuf + i * txLen;
+		byte *rx = rxBuf + i * rxLen;
+
+		unsigned long start = micros();
+		sendFrame(tx, txLen);
+
+		int rxSize = readReply(tx, txLen, rx, rxLen);
+
+		okFlags[i] = (rxSize == rxLen) && IcsCommand::validReply(tx, txLen, rx, rxLen);
+		IcsTelemetry::Result result = IcsTelemetry::classify(rxSize, rxLen);
+		if (result == IcsTelemetry::RESULT_OK && !okFlags[i])
+		{
+			result = IcsTelemetry::RESULT_BAD_REPLY;
+		}
+		recordTelemetry(IcsCommand::idOf(tx[0]), result, micros() - start);
+		if (okFlags[i])
+		{
+			okCount++;
+		}
+		else if (autoResync && isMisaligned(result)) //残りのフレームがずれた返信を読まないようにする
+		{
+			resync(IcsCommand::idOf(tx[0]));
+		}
+	}
+
+	return okCount;
+}
 
+
+
+//リングの送受信 /////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief リングに積んだフレームをすべて送受信する
+* @param[in,out] &ring 送るフレームを積んだリング(送ったフレームは取り除く)
+* @return 通信に成功したフレーム数
+* @note 送信データは枠から直接送り、返信は枠の送信データの直後にUARTから直接読み込む
+* @note 返信のタイムアウトは受信データ数毎に1回だけ計算する
+* @note 照合、テレメトリ、再同期はsynchronizeMultiと同じ
+**/
+byte IcsHardSerialClass::transactRing(IcsFrameRing &ring)
+{
+	byte okCount = 0;
+	unsigned long timeoutUs[IcsFrameRing::MAX_RX + 1] = {};
+
+	//シリアル初期化確認
+	if(icsHardSerial == nullptr )
+	{
+		ring.clear();
+		return 0;
+	}
+
+	icsHardSerial->flush(); //前回の送信が終わるのを待つのは1回だけ
+
+	IcsFrameRing::Frame *f;
+	while ((f = ring.front()) != nullptr)
+	{
+		if (timeoutUs[f->rxLen] == 0)
+		{
+			timeoutUs[f->rxLen] = replyTimeoutUs(f->rxLen);
+		}
+
+		unsigned long start = micros();
+		sendFrame(f->tx(), f->txLen);
+		int rxSize = readReplyInPlace(*f, timeoutUs[f->rxLen]);
+		f->rxCount = (rxSize > 0) ? rxSize : 0;
+
+		f->ok = (rxSize == f->rxLen) && IcsCommand::validReply(f->tx(), f->txLen, f->rx(), f->rxLen);
+		IcsTelemetry::Result result = IcsTelemetry::classify(rxSize, f->rxLen);
+		if (result == IcsTelemetry::RESULT_OK && !f->ok)
+		{
+			result = IcsTelemetry::RESULT_BAD_REPLY;
+		}
+		recordTelemetry(f->id(), result, micros() - start);
+		if (f->ok)
+		{
+			okCount++;
+		}
+		else if (autoResync && isMisaligned(result)) //残りのフレームがずれた返信を読まないようにする
+		{
+			resync(f->id());
+		}
+		ring.pop();
+	}
+
+	return okCount;
+}
+
+/**
+* @brief 送信直後から返信を枠の中に読む
+* @param[in,out] &frame 送信した枠(返信は送信データの直後に入る)
+* @param[in] timeoutUs 返信全体のタイムアウト(us) TIMEOUT_COMPUTEDの時だけ使う
+* @return 受信できたデータ数
+* @retval -1 エコーが送信データと違った(送信が衝突した)
+* @note 届いている分をまとめてread(buf, len)で読むので、1バイトずつのread()を呼ばない
+* @note エコーは返信の場所に読んで送信データと照合し、その後の返信で上書きする
+* @note TIMEOUT_FIXEDではreadReplyと同じくreadBytesで読む
+**/
+int IcsHardSerialClass::readReplyInPlace(IcsFrameRing::Frame &frame, unsigned long timeoutUs)
+{
+	byte *rx = frame.rx();
+	byte echoLen = echoEnabled ? frame.txLen : 0;
+
+	if (timeoutMode == TIMEOUT_FIXED)
+	{
+		if (echoLen > 0)
+		{
+			if (icsHardSerial->readBytes(rx, echoLen) != echoLen)
+			{
+				return 0;
+			}
+			if (memcmp(rx, frame.tx(), echoLen) != 0)
+			{
+				return -1;
+			}
+		}
+		return icsHardSerial->readBytes(rx, frame.rxLen);
+	}
+
+	unsigned long start = micros();
+	byte want = (echoLen > 0) ? echoLen : frame.rxLen;
+	byte got = 0;
+	bool echo = (echoLen > 0);
+
+	while (true)
+	{
+		int avail = icsHardSerial->available();
+		if (avail > 0)
+		{
+			byte n = (avail < want - got) ? avail : want - got;
+			got += icsHardSerial->read(rx + got, n);
+			if (got < want)
+			{
+				continue;
+			}
+			if (!echo)
+			{
+				break;
+			}
+			if (memcmp(rx, frame.tx(), echoLen) != 0)
+			{
+				return -1;   //送信が衝突した
+			}
+			echo = false;
+			want = frame.rxLen;
+			got = 0;
+			continue;
+		}
+		if (micros() - start >= timeoutUs)
+		{
+			return echo ? 0 : got;
+		}
+		delayMicroseconds(1);
+	}
+
+	if (latencyLearning)
+	{
+		unsigned long elapsed = micros() - start;
+		unsigned long wireUs = frameTimeUs(frame.rxLen);
+		recordLatencyUs(elapsed > wireUs ? elapsed - wireUs : 0);
+	}
+	return got;
+}
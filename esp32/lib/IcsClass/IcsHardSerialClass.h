@@ -14,6 +14,12 @@
 
 #include <Arduino.h>
 #include <IcsBaseClass.h>
+#include <IcsFrameRing.h>
+
+//UARTのRS485半二重モード(RTSによる自動方向切替)が使えるかどうか
+#if defined(ARDUINO_ARCH_ESP32) || defined(ICS_HOST_MOCK)
+#define ICS_HAS_RS485_HW 1
+#endif
 
 //IcsHardSerialClassクラス///////////////////////////////////////////////////
 /**
@@ -25,6 +31,48 @@ class IcsHardSerialClass : public IcsBaseClass
 {
   //クラス内の型定義
   public:
+	/**
+	* @enum TransportMode
+	* @brief 送受信の切替方法
+	**/
+	enum TransportMode : byte
+	{
+		TRANSPORT_GPIO = 0,      ///< enPinをdigitalWriteで切り替える(従来の方法)
+		TRANSPORT_RS485_HW = 1,  ///< UARTのRS485半二重モードでenPin(RTS)をハードウェアで切り替える
+	};
+
+	static constexpr byte RS485_RX_TIMEOUT_SYMBOLS = 1; ///< RS485モードでのRX FIFOタイムアウト(シンボル数)
+	static constexpr byte DEFAULT_RX_TIMEOUT_SYMBOLS = 2; ///< GPIOモードで見込むRX FIFOタイムアウト(シンボル数)
+
+	/**
+	* @enum TimeoutMode
+	* @brief 受信タイムアウトの決め方
+	**/
+	enum TimeoutMode : byte
+	{
+		TIMEOUT_FIXED = 0,      ///< timeOut(ms)をすべてのコマンドで使う(従来の方法)
+		TIMEOUT_COMPUTED = 1,   ///< 通信速度、受信データ数、サーボの応答時間から計算する(us)
+	};
+
+	static constexpr unsigned long RESPONSE_LATENCY_US = 200; ///< サーボが受信してから返信を始めるまでの時間の見込み(us)
+	static constexpr byte BITS_PER_BYTE = 11;                 ///< 8E1の1バイトのビット数(start + 8 + parity + stop)
+
+	static constexpr byte RESYNC_GAP_SYMBOLS = 2;  ///< 再同期で応答時間に足す静かな時間(シンボル数)。ICSのフレーム内のバイトは詰めて送られる
+	static constexpr byte RESYNC_MAX_GAPS = 4;     ///< 線が静かにならない時にあきらめるまでの時間(静かな時間の倍数)
+	static constexpr byte RESYNC_PROBE_SC = IcsCommand::SC_TMP;  ///< 再確認に使う読出し(ICS3.5でも返信があり、サーボの状態を変えない)
+
+	/**
+	* @struct ResyncStats
+	* @brief 再同期の回数
+	**/
+	struct ResyncStats
+	{
+		unsigned long triggered;     ///< 再同期した回数
+		unsigned long recovered;     ///< 再確認の返信が正しく、同期が戻った回数
+		unsigned long failed;        ///< 線が静かにならない、または再確認の返信が正しくなかった回数
+		unsigned long drainedBytes;  ///< 読み捨てたバイト数
+		byte lastId;                 ///< 最後に再確認したID
+	};
 
   //コンストラクタ、デストラクタ
   public:
@@ -51,6 +99,14 @@ class IcsHardSerialClass : public IcsBaseClass
 	int enPin;         ///<イネーブルピン(送受信を切り替える)のピン番号を格納しておく変数
 	long baudRate;     ///<ICSの通信速度を格納しておく変数
 	int timeOut;               ///<通信のタイムアウト(ms)を格納しておく変数
+	TransportMode transportMode;  ///<送受信の切替方法
+	TimeoutMode timeoutMode;      ///<受信タイムアウトの決め方
+	unsigned long responseLatencyUs;  ///<サーボの応答時間の見込み(us)
+	bool latencyLearning;         ///<実測した応答時間をタイムアウトに反映するか
+	unsigned long measuredLatencyUs;  ///<実測した応答時間の最大値(us)
+	bool echoEnabled;             ///<送信したデータが受信側に回り込む配線か
+	bool autoResync;              ///<返信がずれた時に自動で再同期するか
+	ResyncStats resyncStats;      ///<再同期の回数
 
 
 
@@ -61,6 +117,74 @@ class IcsHardSerialClass : public IcsBaseClass
       bool begin();
       bool begin(long baudrate,int timeout);
       bool begin(HardwareSerial *serial,int enpin,long baudrate,int timeout);
+      bool setBaudRate(long baudrate);
+      /**
+      *	@brief 現在の通信速度(bps)を返す
+      **/
+      long getBaudRate() const {return baudRate;}
+
+  //送受信の切替方法
+  public:
+      bool setTransportMode(TransportMode mode);
+      /**
+      *	@brief 現在の送受信の切替方法を返す
+      **/
+      TransportMode getTransportMode() const {return transportMode;}
+
+  //エコー
+  public:
+      void setEcho(bool echo);
+      /**
+      *	@brief エコーが返る配線として扱っているかどうか
+      **/
+      bool getEcho() const {return echoEnabled;}
+
+  //受信タイムアウト
+  public:
+      void setTimeoutMode(TimeoutMode mode);
+      /**
+      *	@brief 現在の受信タイムアウトの決め方を返す
+      **/
+      TimeoutMode getTimeoutMode() const {return timeoutMode;}
+      void setResponseLatencyUs(unsigned long us);
+      /**
+      *	@brief setResponseLatencyUs()で設定した応答時間の見込み(us)を返す
+      **/
+      unsigned long getResponseLatencyUs() const {return responseLatencyUs;}
+      void setLatencyLearning(bool enable);
+      /**
+      *	@brief 実測した応答時間の最大値(us)を返す
+      **/
+      unsigned long getMeasuredLatencyUs() const {return measuredLatencyUs;}
+      unsigned long frameTimeUs(byte len) const;
+      unsigned long replyTimeoutUs(byte rxLen) const;
+      unsigned long responseLatencyMaxUs() const;
+      unsigned long fifoTimeoutUs() const;
+
+  //返信のずれからの復帰
+  public:
+      void setAutoResync(bool enable);
+      /**
+      *	@brief 返信がずれた時に自動で再同期するか
+      **/
+      bool getAutoResync() const {return autoResync;}
+      bool resync(byte id);
+      unsigned long resyncGapUs() const;
+      void countResync(byte id, bool recovered, unsigned long drainedBytes);
+      /**
+      *	@brief 再同期の回数を返す
+      **/
+      const ResyncStats &getResyncStats() const {return resyncStats;}
+      void resetResyncStats();
+      /**
+      *	@brief 受信したバイトとフレームの区切りがずれたかもしれない結果か
+      *	@note 返信が1バイトも来なかった時は、受信バッファにずれたバイトが残らないので含めない
+      **/
+      static bool isMisaligned(IcsTelemetry::Result result)
+      {
+        return result == IcsTelemetry::RESULT_SHORT_READ || result == IcsTelemetry::RESULT_ECHO_MISMATCH ||
+               result == IcsTelemetry::RESULT_BAD_REPLY;
+      }
 
 
   //イネーブルピンの処理
@@ -73,10 +197,44 @@ class IcsHardSerialClass : public IcsBaseClass
 	*	@brief enPinに割り当てられているピンをLにする
 	**/
 	inline void enLow(){digitalWrite(enPin, LOW);}
+	/**
+	*	@brief 送信に切り替える(RS485モードではUARTが切り替えるので何もしない)
+	**/
+	inline void txBegin(){if (transportMode == TRANSPORT_GPIO) {enHigh();}}
+	/**
+	*	@brief 受信に切り替える(RS485モードではUARTが切り替えるので何もしない)
+	**/
+	inline void txEnd(){if (transportMode == TRANSPORT_GPIO) {enLow();}}
+	/**
+	*	@brief RX FIFOタイムアウトのシンボル数
+	**/
+	inline byte fifoSymbols() const {return (transportMode == TRANSPORT_RS485_HW) ? RS485_RX_TIMEOUT_SYMBOLS : DEFAULT_RX_TIMEOUT_SYMBOLS;}
+
+	bool beginRs485();
+	int readReply(const byte *txBuf, byte txLen, byte *rxBuf, byte rxLen);
+	int readReplyInPlace(IcsFrameRing::Frame &frame, unsigned long timeoutUs);
+	void recordLatencyUs(unsigned long us);
 
   //データ送受信
   public :
       virtual bool synchronize(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen);
+      //synchronizeと同じ。IcsBusから仮想関数を通らずに呼ぶ
+      bool transact(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen);
+      virtual byte synchronizeMulti(byte *txBuf, byte txLen, byte *rxBuf, byte rxLen, byte count, bool *okFlags);
+      //リングに積んだフレームを送受信する(返信は枠の中に直接読む)
+      byte transactRing(IcsFrameRing &ring);
+
+      //送信だけ行い、返信は呼び出し側で読む(非同期処理用)
+      bool sendFrame(const byte *txBuf, byte txLen, bool drainRx = true);
+      /**
+      *	@brief ICSに割り当てているシリアルを返す
+      **/
+      HardwareSerial *getSerial() const {return icsHardSerial;}
+      /**
+      *	@brief 受信タイムアウト(ms)を返す
+      *	@note TIMEOUT_COMPUTEDではreplyTimeoutUs()の上限として使う
+      **/
+      int getTimeout() const {return timeOut;}
    
   //servo関連	//すべていっしょ
   public:
@@ -0,0 +1,185 @@
+/**
+*	@file IcsLinkProbe.cpp
+*	@brief ICS3.5/3.6 link quality probe
+*	@date	2026/10/17
+*	@version 1.0.0
+**/
+
+#include "IcsLinkProbe.h"
+
+/**
+*	@brief コンストラクタ
+*	@note 測るまではどの速度も返信なしとして扱う
+**/
+IcsLinkProbe::IcsLinkProbe()
+{
+  for (byte i = 0; i < BAUD_NUM; i++)
+  {
+    memset(&results[i], 0, sizeof(Result));
+    results[i].baudrate = baudAt(i);
+    results[i].responderId = NO_ID;
+  }
+  selectedIndex = NO_BAUD;
+  probeUs = 0;
+}
+
+/**
+* @brief index番目(遅い順)のICSの通信速度
+* @return 通信速度(bps) 範囲外は0
+**/
+long IcsLinkProbe::baudAt(byte index)
+{
+  static const long BAUDS[BAUD_NUM] = {115200, 625000, 1250000};
+  return (index < BAUD_NUM) ? BAUDS[index] : 0;
+}
+
+/**
+* @brief 通信速度の番号
+* @return 番号( #NO_BAUD はICSの速度ではない)
+**/
+byte IcsLinkProbe::baudIndex(long baudrate)
+{
+  for (byte i = 0; i < BAUD_NUM; i++)
+  {
+    if (baudAt(i) == baudrate)
+    {
+      return i;
+    }
+  }
+  return NO_BAUD;
+}
+
+
+
+//測定 ////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief すべての速度を測り、安定して一番速い速度をicsに設定する
+* @param[in] *ics 測るバス(begin()済みで、他のトランザクションが無いこと)
+* @param[in] *ids 返信を探すID(つながっているはずのサーボ)
+* @param[in] idNum idsの数
+* @param[in] frames 1つの速度で読む回数(1～ #MAX_FRAMES )
+* @return 選んだ速度の番号
+* @retval #NO_BAUD どの速度でも返信が無かった(icsの速度は元に戻す)
+* @note 安定した速度が無ければ、返信のあった中で一番誤りの少ない速度を選ぶ
+* @note 返信しない速度のタイムアウトを数えないように、測る間はテレメトリを外す
+* @note TIMEOUT_COMPUTEDにしておくと、返信しない速度で待つ時間が短い
+**/
+byte IcsLinkProbe::run(IcsHardSerialClass *ics, const byte *ids, byte idNum, unsigned int frames)
+{
+  unsigned long start = micros();
+  long originalBaud = ics->getBaudRate();
+  IcsTelemetry *telemetry = ics->getTelemetry();
+
+  if (frames < 1)
+  {
+    frames = 1;
+  }
+  if (frames > MAX_FRAMES)
+  {
+    frames = MAX_FRAMES;
+  }
+
+  ics->attachTelemetry(nullptr);
+  for (byte i = 0; i < BAUD_NUM; i++)
+  {
+    measure(ics, i, ids, idNum, frames);
+  }
+  ics->attachTelemetry(telemetry);
+
+  selectedIndex = choose();
+  ics->setBaudRate(selectedIndex == NO_BAUD ? originalBaud : baudAt(selectedIndex));
+
+  probeUs = micros() - start;
+  return selectedIndex;
+}
+
+/**
+* @brief 1つの速度を測る
+* @param[in] *ics 測るバス
+* @param[in] index 速度の番号
+* @param[in] *ids 返信を探すID
+* @param[in] idNum idsの数
+* @param[in] frames 読む回数
+**/
+void IcsLinkProbe::measure(IcsHardSerialClass *ics, byte index, const byte *ids, byte idNum, unsigned int frames)
+{
+  Result &r = results[index];
+  byte counts[128] = {};   //返信された値毎の回数(ビット化けした値を見つける)
+  unsigned long totalUs = 0;
+  unsigned int good = 0;
+
+  memset(&r, 0, sizeof(Result));
+  r.baudrate = baudAt(index);
+  r.responderId = NO_ID;
+  ics->setBaudRate(r.baudrate);
+
+  //返信するIDを探す
+  for (byte k = 0; k < idNum && r.responderId == NO_ID; k++)
+  {
+    if (ics->getStrc(ids[k]) >= 0)
+    {
+      r.responderId = ids[k];
+    }
+  }
+  if (r.responderId == NO_ID)
+  {
+    return;
+  }
+
+  byte mode = 0;
+  for (unsigned int f = 0; f < frames; f++)
+  {
+    unsigned long t0 = micros();
+    int val = ics->getStrc(r.responderId);
+    unsigned long us = micros() - t0;
+    if (val < 0 || val > 127)
+    {
+      r.errors++;
+      continue;
+    }
+    counts[val]++;
+    if (counts[val] > counts[mode])
+    {
+      mode = val;
+    }
+    good++;
+    totalUs += us;
+    if (us > r.maxLatencyUs)
+    {
+      r.maxLatencyUs = us;
+    }
+  }
+  r.frames = frames;
+  r.errors += good - counts[mode];   //多数と違う値はデータが化けていた
+  r.avgLatencyUs = (good > 0) ? totalUs / good : 0;
+  r.stable = r.errorPermille() <= STABLE_ERROR_PERMILLE;
+}
+
+/**
+* @brief 結果から速度を選ぶ
+* @return 安定した一番速い速度、無ければ返信のあった中で一番誤りの少ない速度
+**/
+byte IcsLinkProbe::choose() const
+{
+  for (byte i = BAUD_NUM; i > 0; i--)
+  {
+    if (results[i - 1].stable)
+    {
+      return i - 1;
+    }
+  }
+
+  byte best = NO_BAUD;
+  for (byte i = BAUD_NUM; i > 0; i--)
+  {
+    if (results[i - 1].responderId == NO_ID)
+    {
+      continue;
+    }
+    if (best == NO_BAUD || results[i - 1].errorPermille() < results[best].errorPermille())
+    {
+      best = i - 1;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,102 @@
+/**
+* @file IcsLinkProbe.h
+* @brief ICS3.5/3.6 link quality probe header file
+* @date 2026/10/17
+* @version 1.0.0
+
+* @par 概要
+* ICSの通信速度(115200/625000/1250000bps)を順に試し、誤り率と応答時間を測って、<br>
+* 安定して通信できる一番速い速度をIcsHardSerialClassに設定する。<br>
+* 配線が悪くてサーボを625000bpsに書き換えた時も、コードのBAUDRATEを直さずに通信できる。<br>
+
+* @par 測り方
+* 1. IcsHardSerialClass::setBaudRate()で速度を変え、候補のIDに読出しを送って返信するIDを探す<br>
+* 2. 見つかったIDのストレッチを決まった回数読む。返信が無い、形が正しくない、<br>
+*    多数の値と違う値を返した時を誤りとして数え、成功した読出しの時間を応答時間とする<br>
+* @note サーボの通信速度はROMの設定なので、ここでは変えない。サーボが返信する速度の中から選ぶ
+**/
+
+#ifndef _ics_LinkProbe_h_
+#define _ics_LinkProbe_h_
+
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+
+//IcsLinkProbeクラス///////////////////////////////////////////////////
+/**
+* @class IcsLinkProbe
+* @brief 通信速度毎の通信品質を測って速度を選ぶクラス
+**/
+class IcsLinkProbe
+{
+  //固定値
+  public:
+  static constexpr byte BAUD_NUM = 3;                    ///< ICSの通信速度の数
+  static constexpr byte NO_BAUD = 0xFF;                  ///< 選べる速度が無い
+  static constexpr byte NO_ID = 0xFF;                    ///< 返信するIDが無い
+  static constexpr unsigned int DEFAULT_FRAMES = 32;     ///< 1つの速度で読む回数
+  static constexpr unsigned int MAX_FRAMES = 255;        ///< 1つの速度で読む回数の上限
+  static constexpr unsigned int STABLE_ERROR_PERMILLE = 10;  ///< これ以下の誤り率(千分率)なら安定とみなす
+
+  //クラス内の型定義
+  public:
+  /**
+  * @struct Result
+  * @brief 1つの速度の測定結果
+  **/
+  struct Result
+  {
+    long baudrate;               ///< 通信速度(bps)
+    byte responderId;            ///< 測ったID( #NO_ID は返信が無かった)
+    unsigned int frames;         ///< 読出しの回数
+    unsigned int errors;         ///< 誤りの回数
+    unsigned long avgLatencyUs;  ///< 成功した読出しの平均時間(us)
+    unsigned long maxLatencyUs;  ///< 成功した読出しの最大時間(us)
+    bool stable;                 ///< 誤り率が #STABLE_ERROR_PERMILLE 以下
+
+    /**
+    *	@brief 誤り率(千分率) 返信が無かった速度は1000
+    **/
+    unsigned int errorPermille() const {return (frames == 0) ? 1000 : (unsigned int)((errors * 1000UL) / frames);}
+  };
+
+  //コンストラクタ
+  public:
+    IcsLinkProbe();
+
+  //変数
+  protected:
+  Result results[BAUD_NUM];   ///< 速度毎の結果(遅い順)
+  byte selectedIndex;         ///< 選んだ速度の番号
+  unsigned long probeUs;      ///< 最後のrun()にかかった時間(us)
+
+  //関数
+  public:
+    static long baudAt(byte index);
+    static byte baudIndex(long baudrate);
+
+    byte run(IcsHardSerialClass *ics, const byte *ids, byte idNum, unsigned int frames = DEFAULT_FRAMES);
+
+    /**
+    *	@brief index番目(遅い順)の速度の結果
+    **/
+    const Result &result(byte index) const {return results[index < BAUD_NUM ? index : 0];}
+    /**
+    *	@brief 最後のrun()で選んだ速度の番号( #NO_BAUD は選べなかった)
+    **/
+    byte selected() const {return selectedIndex;}
+    /**
+    *	@brief 最後のrun()で選んだ速度(bps) 選べなかった時は0
+    **/
+    long selectedBaud() const {return (selectedIndex == NO_BAUD) ? 0 : results[selectedIndex].baudrate;}
+    /**
+    *	@brief 最後のrun()にかかった時間(us)
+    **/
+    unsigned long lastProbeUs() const {return probeUs;}
+
+  protected:
+    void measure(IcsHardSerialClass *ics, byte index, const byte *ids, byte idNum, unsigned int frames);
+    byte choose() const;
+};
+
+#endif
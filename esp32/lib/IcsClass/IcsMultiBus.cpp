@@ -0,0 +1,202 @@
+/**
+*	@file IcsMultiBus.cpp
+*	@brief ICS3.5/3.6 multi-UART servo bus router
+*	@date	2026/10/16
+*	@version 1.0.0
+**/
+
+#include "IcsMultiBus.h"
+
+/**
+*	@brief コンストラクタ
+*	@note バスは空、どのIDも割り当てていない状態で始まる
+**/
+IcsMultiBus::IcsMultiBus()
+{
+  busNum = 0;
+  for (byte i = 0; i < MAX_BUS; i++)
+  {
+    buses[i] = nullptr;
+  }
+  memset(route, NO_BUS, sizeof(route));
+}
+
+
+
+//バスの登録 //////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief バスを登録し、firstId～lastIdをそのバスに割り当てる
+* @param[in] *bus 非同期エンジン(begin()済みのIcsHardSerialClassを持つこと)
+* @param[in] firstId 割り当てる最初のID
+* @param[in] lastId 割り当てる最後のID
+* @retval true 登録した
+* @retval false バスがいっぱい、IDが範囲外、または別のバスに割り当て済みのIDがある
+* @note 同じバスを続けて渡すと、そのバスに割り当てるIDを追加する
+**/
+bool IcsMultiBus::addBus(IcsAsyncClass *bus, byte firstId, byte lastId)
+{
+  if (bus == nullptr || firstId > lastId || !IcsCommand::validId(lastId))
+  {
+    return false;
+  }
+
+  byte index = busNum;
+  if (busNum > 0 && buses[busNum - 1] == bus)
+  {
+    index = busNum - 1;
+  }
+  else if (busNum >= MAX_BUS)
+  {
+    return false;
+  }
+
+  for (byte id = firstId; id <= lastId; id++)
+  {
+    if (route[id] != NO_BUS && route[id] != index)
+    {
+      return false;
+    }
+  }
+  for (byte id = firstId; id <= lastId; id++)
+  {
+    route[id] = index;
+  }
+  buses[index] = bus;
+  if (index == busNum)
+  {
+    busNum++;
+  }
+  return true;
+}
+
+/**
+* @brief IDを割り当てたバスの番号
+* @retval #NO_BUS 割り当てていない
+**/
+byte IcsMultiBus::busIndexOf(byte id) const
+{
+  return IcsCommand::validId(id) ? route[id] : NO_BUS;
+}
+
+/**
+* @brief IDを割り当てたバス
+* @retval nullptr 割り当てていない
+**/
+IcsAsyncClass *IcsMultiBus::busFor(byte id) const
+{
+  byte index = busIndexOf(id);
+  return (index == NO_BUS) ? nullptr : buses[index];
+}
+
+/**
+* @brief IDを割り当てたバスのICSクラス(ブロッキングの通信に使う)
+* @retval nullptr 割り当てていない
+* @attention そのバスのIcsAsyncClassが処理中の時は、先にwaitAllで終わらせる事
+**/
+IcsHardSerialClass *IcsMultiBus::icsFor(byte id) const
+{
+  IcsAsyncClass *bus = busFor(id);
+  return (bus == nullptr) ? nullptr : bus->getIcs();
+}
+
+
+
+//トランザクションの登録 //////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief ポジション設定をIDのバスに登録する
+* @return バスのハンドル
+* @retval IcsAsyncClass::HANDLE_NONE IDが割り当てられていない、またはキューがいっぱい
+**/
+int IcsMultiBus::submitSetPos(byte id, unsigned int pos, IcsAsyncClass::Callback cb, void *ctx)
+{
+  IcsAsyncClass *bus = busFor(id);
+  return (bus == nullptr) ? IcsAsyncClass::HANDLE_NONE : bus->submitSetPos(id, pos, cb, ctx);
+}
+
+/**
+* @brief パラメータ書込みをIDのバスに登録する
+* @return バスのハンドル
+* @retval IcsAsyncClass::HANDLE_NONE IDが割り当てられていない、またはキューがいっぱい
+* @retval IcsAsyncClass::HANDLE_SKIPPED シャドウレジスタと同じ値なので送らなかった
+**/
+int IcsMultiBus::submitSetParam(byte id, byte sc, byte val, IcsAsyncClass::Callback cb, void *ctx)
+{
+  IcsAsyncClass *bus = busFor(id);
+  return (bus == nullptr) ? IcsAsyncClass::HANDLE_NONE : bus->submitSetParam(id, sc, val, cb, ctx);
+}
+
+/**
+* @brief パラメータ読出しをIDのバスに登録する
+* @return バスのハンドル
+* @retval IcsAsyncClass::HANDLE_NONE IDが割り当てられていない、またはキューがいっぱい
+**/
+int IcsMultiBus::submitGetParam(byte id, byte sc, IcsAsyncClass::Callback cb, void *ctx)
+{
+  IcsAsyncClass *bus = busFor(id);
+  return (bus == nullptr) ? IcsAsyncClass::HANDLE_NONE : bus->submitGetParam(id, sc, cb, ctx);
+}
+
+
+
+//状態機械 ////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief すべてのバスを進める
+* @note 各バスは送信(数十us)だけ行って戻るので、返信待ちは重なる
+**/
+void IcsMultiBus::poll()
+{
+  for (byte i = 0; i < busNum; i++)
+  {
+    buses[i]->poll();
+  }
+}
+
+/**
+* @brief すべてのバスが完了するまでpoll()を回す
+* @param[in] timeoutUs 待つ時間の上限(us)
+* @retval true すべて完了した
+* @retval false 時間内に終わらなかった
+**/
+bool IcsMultiBus::waitAll(unsigned long timeoutUs)
+{
+  unsigned long start = micros();
+  poll();
+  while (busy())
+  {
+    if (micros() - start >= timeoutUs)
+    {
+      return false;
+    }
+    delayMicroseconds(1);
+    poll();
+  }
+  return true;
+}
+
+/**
+* @brief どれかのバスが処理中またはキューに残っているか
+**/
+bool IcsMultiBus::busy() const
+{
+  for (byte i = 0; i < busNum; i++)
+  {
+    if (buses[i]->busy())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* @brief すべてのバスの未完了のトランザクション数
+**/
+byte IcsMultiBus::pending() const
+{
+  byte n = 0;
+  for (byte i = 0; i < busNum; i++)
+  {
+    n += buses[i]->pending();
+  }
+  return n;
+}
@@ -0,0 +1,72 @@
+/**
+* @file IcsMultiBus.h
+* @brief ICS3.5/3.6 multi-UART servo bus router header file
+* @date 2026/10/16
+* @version 1.0.0
+
+* @par 概要
+* 複数のUART(IcsHardSerialClass + IcsAsyncClass)にサーボIDを振り分け、まとめて進める。<br>
+* poll()はすべてのバスを順に進めるので、片方の返信を待つ間にもう片方が送受信できる。<br>
+* 例: ID1～3(右ヒレ)をSerial2、ID4～6(左ヒレ)をSerial1にすると、全身の更新がほぼ半分の時間で終わる。<br>
+**/
+
+#ifndef _ics_MultiBus_h_
+#define _ics_MultiBus_h_
+
+#include <Arduino.h>
+#include <IcsAsyncClass.h>
+
+//IcsMultiBusクラス///////////////////////////////////////////////////
+/**
+* @class IcsMultiBus
+* @brief サーボIDをUART毎の非同期エンジンに振り分けるクラス
+* @brief ハンドルはバス毎なので、結果はbusFor(id)から見る
+**/
+class IcsMultiBus
+{
+  //固定値
+  public:
+  static constexpr byte MAX_BUS = 3;       ///< バスの最大数(ESP32のUARTの数)
+  static constexpr byte NO_BUS = 0xFF;     ///< どのバスにも割り当てていないID
+
+  //コンストラクタ
+  public:
+    IcsMultiBus();
+
+  //変数
+  protected:
+  IcsAsyncClass *buses[MAX_BUS];             ///< バス毎の非同期エンジン
+  byte busNum;                               ///< 登録したバスの数
+  byte route[IcsCommand::MAX_ID + 1];        ///< ID -> バスの番号
+
+  //関数
+  public:
+    //バスの登録
+    bool addBus(IcsAsyncClass *bus, byte firstId, byte lastId);
+    /**
+    *	@brief 登録したバスの数
+    **/
+    byte busCount() const {return busNum;}
+    /**
+    *	@brief 番号でバスを返す
+    **/
+    IcsAsyncClass *getBus(byte index) const {return (index < busNum) ? buses[index] : nullptr;}
+    byte busIndexOf(byte id) const;
+    IcsAsyncClass *busFor(byte id) const;
+    IcsHardSerialClass *icsFor(byte id) const;
+
+    //トランザクションの登録(IDのバスに積む)
+    int submitSetPos(byte id, unsigned int pos, IcsAsyncClass::Callback cb = nullptr, void *ctx = nullptr);
+    int submitSetParam(byte id, byte sc, byte val, IcsAsyncClass::Callback cb = nullptr, void *ctx = nullptr);
+    int submitGetParam(byte id, byte sc, IcsAsyncClass::Callback cb = nullptr, void *ctx = nullptr);
+
+    //すべてのバスを進める loop()から毎回呼ぶ
+    void poll();
+    //すべてのバスが完了するまでpoll()を回す
+    bool waitAll(unsigned long timeoutUs);
+
+    bool busy() const;
+    byte pending() const;
+};
+
+#endif
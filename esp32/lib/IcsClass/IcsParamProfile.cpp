@@ -0,0 +1,309 @@
+/**
+*	@file IcsParamProfile.cpp
+*	@brief ICS3.5/3.6 servo parameter profile
+*	@date	2026/10/17
+*	@version 1.0.0
+**/
+
+#include "IcsParamProfile.h"
+
+/**
+*	@brief コンストラクタ
+*	@note すべて #KEEP (何も書き込まない)で始まる
+**/
+IcsParamProfile::IcsParamProfile()
+{
+  clear();
+  memset(&applyStats, 0, sizeof(applyStats));
+  jobCount = 0;
+}
+
+/**
+* @brief すべて #KEEP にする
+**/
+void IcsParamProfile::clear()
+{
+  memset(values, KEEP, sizeof(values));
+}
+
+/**
+* @brief 1つのIDの値をまとめて設定する
+* @param[in] id サーボモータのID番号
+* @param[in] stretch ストレッチ(1～127、#KEEPは書き込まない)
+* @param[in] speed スピード(1～127、#KEEPは書き込まない)
+* @param[in] currentLimit 電流リミット(1～63、#KEEPは書き込まない)
+* @param[in] tempLimit 温度リミット(1～127、#KEEPは書き込まない)
+* @retval true 設定した
+* @retval false IDか値が範囲外(何も変えない)
+**/
+bool IcsParamProfile::set(byte id, byte stretch, byte speed, byte currentLimit, byte tempLimit)
+{
+  const byte v[PARAM_NUM] = {stretch, speed, currentLimit, tempLimit};
+
+  if (!IcsCommand::validId(id))
+  {
+    return false;
+  }
+  for (byte i = 0; i < PARAM_NUM; i++)
+  {
+    if (v[i] != KEEP && !IcsCommand::validParam(i + 1, v[i]))
+    {
+      return false;
+    }
+  }
+  memcpy(values[id], v, PARAM_NUM);
+  return true;
+}
+
+/**
+* @brief 1つのパラメータを設定する
+* @param[in] id サーボモータのID番号
+* @param[in] sc サブコマンド( #SC_STRC ～ #SC_TMP )
+* @param[in] val 値(#KEEPは書き込まない)
+* @retval true 設定した
+* @retval false IDか値が範囲外
+**/
+bool IcsParamProfile::setParam(byte id, byte sc, byte val)
+{
+  if (!IcsCommand::validId(id) || sc < IcsCommand::SC_STRC || sc > IcsCommand::SC_TMP)
+  {
+    return false;
+  }
+  if (val != KEEP && !IcsCommand::validParam(sc, val))
+  {
+    return false;
+  }
+  values[id][sc - 1] = val;
+  return true;
+}
+
+/**
+* @brief 設定した値を返す
+* @return 値(範囲外や未設定は #KEEP )
+**/
+byte IcsParamProfile::getParam(byte id, byte sc) const
+{
+  if (!IcsCommand::validId(id) || sc < IcsCommand::SC_STRC || sc > IcsCommand::SC_TMP)
+  {
+    return KEEP;
+  }
+  return values[id][sc - 1];
+}
+
+
+
+//書込み //////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 読出し→差分→書込み→確認の順にサーボへ書き込む
+* @param[in] *bus 書き込むバス(IDの割り当て済み)
+* @param[in] *table 居るサーボの表(nullptrならバスに割り当てた全ID)
+* @param[in] timeoutUs 全体のタイムアウト(us)
+* @retval true すべて書き込んで確かめた
+* @retval false 確かめられなかった値がある、または時間切れ(結果はgetApplyStats())
+* @note 他のトランザクションとは同じキューに積むので、モーションの送信中に呼んでもよい
+* @note 読めなかった値は違うものとして書き込む
+* @note 時間切れになった手順で止め、その先は送らない。残った返信は次のapply()の始めに待つ
+**/
+bool IcsParamProfile::apply(IcsMultiBus *bus, const IcsServoTable *table, unsigned long timeoutUs)
+{
+  unsigned long start = micros();
+  unsigned long deadlineUs = start + timeoutUs;
+  int jobNum = 0;
+
+  memset(&applyStats, 0, sizeof(applyStats));
+
+  //前のapply()が時間切れで残したトランザクションは、返信をjobsに書くので終わるまで待つ
+  if (!drain(bus, deadlineUs))
+  {
+    applyStats.elapsedUs = micros() - start;
+    return false;
+  }
+
+  //1. 読めるパラメータを読む
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    if (bus->busIndexOf(id) == IcsMultiBus::NO_BUS || (table != nullptr && !table->present(id)))
+    {
+      continue;
+    }
+    for (byte sc = IcsCommand::SC_STRC; sc <= IcsCommand::SC_TMP; sc++)
+    {
+      if (values[id][sc - 1] != KEEP && readable(sc))
+      {
+        jobs[jobNum++] = {id, sc, values[id][sc - 1], false, false, -1};
+      }
+    }
+  }
+  applyStats.reads = jobNum;
+  if (!run(bus, jobNum, false, deadlineUs))
+  {
+    applyStats.elapsedUs = micros() - start;
+    return false;
+  }
+
+  //2. 違うものだけ残し、読めないパラメータを足す
+  int writeNum = 0;
+  for (int i = 0; i < jobNum; i++)
+  {
+    Job &j = jobs[i];
+    if (j.result < 0)
+    {
+      applyStats.readFailures++;
+    }
+    else if (j.result == j.val)
+    {
+      applyStats.matched++;
+      bus->icsFor(j.id)->shadowStore(j.id, j.sc, j.val);   //次からは送らない
+      continue;
+    }
+    else
+    {
+      bus->icsFor(j.id)->invalidateShadow(j.id);   //電源の入れ直しなどで書いた値から変わっている
+    }
+    jobs[writeNum++] = {j.id, j.sc, j.val, false, false, -1};
+  }
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    if (bus->busIndexOf(id) == IcsMultiBus::NO_BUS || (table != nullptr && !table->present(id)))
+    {
+      continue;
+    }
+    for (byte sc = IcsCommand::SC_STRC; sc <= IcsCommand::SC_TMP; sc++)
+    {
+      if (values[id][sc - 1] != KEEP && !readable(sc))
+      {
+        jobs[writeNum++] = {id, sc, values[id][sc - 1], false, false, -1};
+      }
+    }
+  }
+  if (!run(bus, writeNum, true, deadlineUs))
+  {
+    applyStats.elapsedUs = micros() - start;
+    return false;
+  }
+
+  //3. 書込みの返信を確かめ、読めるものは読み直す
+  int verifyNum = 0;
+  for (int i = 0; i < writeNum; i++)
+  {
+    Job &j = jobs[i];
+    if (j.result != j.val)
+    {
+      applyStats.verifyFailures++;
+    }
+    else if (j.sent && readable(j.sc))
+    {
+      jobs[verifyNum++] = {j.id, j.sc, j.val, false, false, -1};
+    }
+  }
+  if (!run(bus, verifyNum, false, deadlineUs))
+  {
+    applyStats.elapsedUs = micros() - start;
+    return false;
+  }
+  for (int i = 0; i < verifyNum; i++)
+  {
+    if (jobs[i].result != jobs[i].val)
+    {
+      applyStats.verifyFailures++;
+      bus->icsFor(jobs[i].id)->invalidateShadow(jobs[i].id);   //次のapply()で書き直す
+    }
+  }
+
+  applyStats.elapsedUs = micros() - start;
+  return applyStats.verifyFailures == 0;
+}
+
+/**
+* @brief jobsの先頭からjobNum個をすべてバスに積み、完了するまで待つ
+* @param[in] *bus バス
+* @param[in] jobNum jobsの数
+* @param[in] write trueなら書込み、falseなら読出し
+* @param[in] deadlineUs あきらめる時刻(us)
+* @retval true すべて完了した
+* @retval false 時間切れ(残りのjobは失敗のまま。積んだものはdrain()で待つ)
+* @note バス毎のキューがいっぱいの時は、空くまで後に回す
+* @note 時刻は積む前に確かめるので、時間切れの後は何も積まない
+**/
+bool IcsParamProfile::run(IcsMultiBus *bus, int jobNum, bool write, unsigned long deadlineUs)
+{
+  bool allSent = false;
+
+  jobCount = jobNum;
+  while (!allSent || bus->busy())
+  {
+    if ((long)(micros() - deadlineUs) >= 0)
+    {
+      return false;
+    }
+    allSent = true;
+    for (int i = 0; i < jobNum; i++)
+    {
+      Job &j = jobs[i];
+      if (j.sent || j.done)
+      {
+        continue;
+      }
+      int handle = write ? bus->submitSetParam(j.id, j.sc, j.val, onJobDone, &j)
+                         : bus->submitGetParam(j.id, j.sc, onJobDone, &j);
+      if (handle == IcsAsyncClass::HANDLE_SKIPPED)
+      {
+        j.done = true;   //シャドウレジスタと同じ値
+        j.result = j.val;
+        applyStats.skipped++;
+        continue;
+      }
+      if (handle == IcsAsyncClass::HANDLE_NONE)
+      {
+        allSent = false;   //キューが空くまで待つ
+        continue;
+      }
+      j.sent = true;
+      if (write)
+      {
+        applyStats.writes++;
+      }
+    }
+
+    bus->poll();
+    delayMicroseconds(1);
+  }
+  return true;
+}
+
+/**
+* @brief 前のrun()で積んだまま終わっていないjobを待つ
+* @param[in] *bus バス
+* @param[in] deadlineUs あきらめる時刻(us)
+* @retval true jobsを使ってよい
+* @retval false 時間切れ(jobsはまだ返信の書き先)
+**/
+bool IcsParamProfile::drain(IcsMultiBus *bus, unsigned long deadlineUs)
+{
+  for (int i = 0; i < jobCount; i++)
+  {
+    while (jobs[i].sent && !jobs[i].done)
+    {
+      if ((long)(micros() - deadlineUs) >= 0)
+      {
+        return false;
+      }
+      bus->poll();
+      delayMicroseconds(1);
+    }
+  }
+  jobCount = 0;
+  return true;
+}
+
+/**
+* @brief 読出しと書込みの完了(どちらも返信の3バイト目が値)
+**/
+void IcsParamProfile::onJobDone(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx)
+{
+  (void)handle;
+  (void)rxLen;
+  Job *j = static_cast<Job *>(ctx);
+  j->done = true;
+  j->result = ok ? rxBuf[2] : -1;
+}
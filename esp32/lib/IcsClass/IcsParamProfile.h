@@ -0,0 +1,105 @@
+/**
+* @file IcsParamProfile.h
+* @brief ICS3.5/3.6 servo parameter profile header file
+* @date 2026/10/17
+* @version 1.0.0
+
+* @par 概要
+* ID毎のストレッチ・スピード・電流リミット・温度リミットをまとめて持ち、バスに書き込む。<br>
+* 書込みは読出し→差分→書込み→確認の順に、すべてIcsMultiBusに積んでまとめて進めるので、<br>
+* 変わっていない値は送らず、モードの切り替えでもモーションの周期(20ms)より十分短く終わる。<br>
+
+* @par 書込みの手順
+* 1. ストレッチとスピードを読む(読めない電流・温度リミットはシャドウレジスタに任せる)<br>
+* 2. 読んだ値と同じものは送らず、シャドウレジスタに入れる。違うものと電流・温度リミットを書き込む<br>
+* 3. 書込みの返信(エコーした値)を確かめ、書き込んだストレッチとスピードは読み直して確かめる<br>
+* @note 電流・温度リミットの読出しは、リミットではなく今の電流値・温度を返すので読み直せない
+**/
+
+#ifndef _ics_ParamProfile_h_
+#define _ics_ParamProfile_h_
+
+#include <Arduino.h>
+#include <IcsMultiBus.h>
+#include <IcsServoTable.h>
+
+//IcsParamProfileクラス///////////////////////////////////////////////////
+/**
+* @class IcsParamProfile
+* @brief ID毎のサーボのパラメータの組
+**/
+class IcsParamProfile
+{
+  //固定値
+  public:
+  static constexpr byte PARAM_NUM = IcsCommand::SC_TMP;   ///< 1IDのパラメータ数(SC_STRC～SC_TMP)
+  static constexpr byte KEEP = 0;                         ///< 書き込まない(サーボの値のまま)
+  static constexpr unsigned long DEFAULT_APPLY_TIMEOUT_US = 20000;  ///< apply()全体のタイムアウト(us)
+
+  //クラス内の型定義
+  public:
+  /**
+  * @struct ApplyStats
+  * @brief 最後のapply()の結果
+  **/
+  struct ApplyStats
+  {
+    unsigned long reads;           ///< 差分を取るために読んだ数
+    unsigned long readFailures;    ///< 読めなかった数(書き込む側に回す)
+    unsigned long matched;         ///< 読んだ値と同じなので送らなかった数
+    unsigned long skipped;         ///< シャドウレジスタと同じなので送らなかった数
+    unsigned long writes;          ///< 書き込んだ数
+    unsigned long verifyFailures;  ///< 書込みの返信か読み直しが合わなかった数
+    unsigned long elapsedUs;       ///< かかった時間(us)
+  };
+
+  //コンストラクタ
+  public:
+    IcsParamProfile();
+
+  protected:
+  /**
+  * @struct Job
+  * @brief 1つのパラメータの読出しか書込み
+  **/
+  struct Job
+  {
+    byte id;
+    byte sc;
+    byte val;      ///< 書き込む値
+    bool sent;     ///< バスに積んだ
+    bool done;     ///< 完了した(成功とは限らない)
+    int result;    ///< 読んだ値か書込みの返信の値(-1は失敗)
+  };
+  static constexpr int MAX_JOBS = (IcsCommand::MAX_ID + 1) * PARAM_NUM;
+
+  //変数
+  protected:
+  byte values[IcsCommand::MAX_ID + 1][PARAM_NUM];   ///< ID毎の値(#KEEPは書き込まない)
+  ApplyStats applyStats;                            ///< 最後のapply()の結果
+  Job jobs[MAX_JOBS];                               ///< apply()の読出しと書込み(時間切れで残った返信の書き先なのでメンバに持つ)
+  int jobCount;                                     ///< 最後にrun()したjobsの数
+
+  //関数
+  public:
+    void clear();
+    bool set(byte id, byte stretch, byte speed, byte currentLimit, byte tempLimit);
+    bool setParam(byte id, byte sc, byte val);
+    byte getParam(byte id, byte sc) const;
+
+    bool apply(IcsMultiBus *bus, const IcsServoTable *table = nullptr,
+               unsigned long timeoutUs = DEFAULT_APPLY_TIMEOUT_US);
+
+    /**
+    *	@brief 最後のapply()の結果
+    **/
+    const ApplyStats &getApplyStats() const {return applyStats;}
+
+  protected:
+    static bool readable(byte sc) {return sc == IcsCommand::SC_STRC || sc == IcsCommand::SC_SPD;}
+    bool run(IcsMultiBus *bus, int jobNum, bool write, unsigned long deadlineUs);
+    bool drain(IcsMultiBus *bus, unsigned long deadlineUs);
+    static void onJobDone(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx);
+};
+
+#endif
@@ -0,0 +1,568 @@
+/**
+*	@file IcsScheduler.cpp
+*	@brief ICS3.5/3.6 priority bus scheduler
+*	@date	2026/10/17
+*	@version 1.0.0
+**/
+
+#include "IcsScheduler.h"
+
+/**
+*	@brief コンストラクタ
+*	@param[in] *bus 送り先のバス(IDの割り当て済みであること)
+*	@note ティック無し(読出しはバスが空いていれば送る)で始まる
+**/
+IcsScheduler::IcsScheduler(IcsMultiBus *bus)
+{
+  this->bus = bus;
+  memset(queued, 0, sizeof(queued));
+  tickStartUs = 0;
+  tickPeriodUs = 0;
+  guardUs = DEFAULT_GUARD_US;
+  tickCount = 0;
+  memset(deferTick, 0, sizeof(deferTick));
+  jitterUs = DEFAULT_JITTER_US;
+  pollUs = 0;
+  memset(slots, 0, sizeof(slots));
+  resetStats();
+}
+
+/**
+* @brief カウンタを消す
+**/
+void IcsScheduler::resetStats()
+{
+  memset(&stats, 0, sizeof(stats));
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    memset(&slots[id].stats, 0, sizeof(SlotStats));
+  }
+}
+
+
+
+//ティック ////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief ティック(モーション更新)の始まりを知らせる
+* @param[in] periodUs 次のティックまでの時間(us)
+* @note モーションを積む直前に呼ぶ。次のティックまでに終わらない読出しは送らなくなる
+* @note この時にバスがまだ使われていれば、前のティックのモーションが間に合っていない
+* @note 前のティックで置いたまま送れなかったスロットは見送りとして数えて捨てる
+**/
+void IcsScheduler::beginTick(unsigned long periodUs)
+{
+  if (bus->busy())
+  {
+    stats.lateTicks++;
+  }
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    if (slots[id].staged)
+    {
+      slots[id].staged = false;
+      slots[id].stats.missed++;
+    }
+  }
+  tickStartUs = micros();
+  tickPeriodUs = periodUs;
+  tickCount++;
+}
+
+/**
+* @brief ティックをやめる(モーションを止めた時)
+* @note 以降の読出しはバスが空いていればすぐに送る
+* @note 置いたまま送っていないスロットは捨てる(脱力した後にポジションを送らないように 見送りには数えない)
+**/
+void IcsScheduler::endTicks()
+{
+  tickPeriodUs = 0;
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    slots[id].staged = false;
+  }
+}
+
+/**
+* @brief 次のティックまでに読出しに使える時間(us)
+* @return 次のティックの時刻 - 空けておく時間 - 現在時刻 (負は使えない)
+* @note ティック無し、または2周期以上beginTick()が来ない時はモーションが止まったとみなし、LONG_MAXを返す
+**/
+long IcsScheduler::slackUs() const
+{
+  if (tickPeriodUs == 0)
+  {
+    return 0x7FFFFFFFL;
+  }
+  unsigned long elapsed = micros() - tickStartUs;
+  if (elapsed >= 2 * tickPeriodUs)
+  {
+    return 0x7FFFFFFFL;
+  }
+  return (long)tickPeriodUs - (long)guardUs - (long)elapsed;
+}
+
+/**
+* @brief 読出し1回にかかる最悪の時間(us)
+* @param[in] id サーボID
+* @param[in] sc サブコマンド
+* @return 送信 + 返信のタイムアウト(us)
+* @retval 0 IDがどのバスにも割り当てられていない
+**/
+unsigned long IcsScheduler::readCostUs(byte id, byte sc) const
+{
+  IcsHardSerialClass *ics = bus->icsFor(id);
+  if (ics == nullptr)
+  {
+    return 0;
+  }
+  return ics->frameTimeUs(IcsCommand::READ_TX_LEN) + ics->replyTimeoutUs(IcsCommand::readRxLen(sc));
+}
+
+/**
+* @brief 今送れば次のティックと、そのバスの次のスロットまでに終わるか
+* @param[in] busIndex バスの番号
+* @param[in] costUs 最悪の時間(us)
+**/
+bool IcsScheduler::fitsBefore(byte busIndex, unsigned long costUs) const
+{
+  long slack = slackUs();
+  unsigned long now = micros();
+
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    const Slot &s = slots[id];
+    if (!s.staged || bus->busIndexOf(id) != busIndex)
+    {
+      continue;
+    }
+    long untilSlot = (long)(tickStartUs + s.offsetUs - now) - (long)jitterUs;
+    if (untilSlot < slack)
+    {
+      slack = untilSlot;
+    }
+  }
+  return slack >= 0 && (unsigned long)slack >= costUs;
+}
+
+
+
+//モーション //////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief ポジション設定をすぐにバスへ積む
+* @return バスのハンドル(IcsMultiBus::submitSetPosと同じ)
+**/
+int IcsScheduler::submitMotionPos(byte id, unsigned int pos, IcsAsyncClass::Callback cb, void *ctx)
+{
+  int h = bus->submitSetPos(id, pos, cb, ctx);
+  if (h >= 0)
+  {
+    stats.issued[PRIO_MOTION]++;
+  }
+  return h;
+}
+
+/**
+* @brief パラメータ書込みをすぐにバスへ積む
+* @return バスのハンドル(IcsMultiBus::submitSetParamと同じ)
+**/
+int IcsScheduler::submitMotionParam(byte id, byte sc, byte val, IcsAsyncClass::Callback cb, void *ctx)
+{
+  int h = bus->submitSetParam(id, sc, val, cb, ctx);
+  if (h >= 0)
+  {
+    stats.issued[PRIO_MOTION]++;
+  }
+  return h;
+}
+
+
+
+//時間割り ////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief サーボ1つのスロットに必要な時間(us)
+* @param[in] id サーボID
+* @return スピードの書込みとポジション設定の、送信 + 返信のタイムアウト(us)
+* @retval 0 IDがどのバスにも割り当てられていない
+**/
+unsigned long IcsScheduler::motionCostUs(byte id) const
+{
+  IcsHardSerialClass *ics = bus->icsFor(id);
+  if (ics == nullptr)
+  {
+    return 0;
+  }
+  return ics->frameTimeUs(IcsCommand::WRITE_TX_LEN) + ics->replyTimeoutUs(IcsCommand::WRITE_RX_LEN) +
+         ics->frameTimeUs(IcsCommand::POS_TX_LEN) + ics->replyTimeoutUs(IcsCommand::POS_RX_LEN);
+}
+
+/**
+* @brief idsのサーボにスロットを割り当てる(それ以外のスロットは消す)
+* @param[in] *ids サーボID
+* @param[in] idNum idsの数
+* @param[in] periodUs ティックの周期(us)
+* @param[in] spread falseならバス毎にティックの始めから詰めて並べ、trueなら周期の中に等間隔に並べる
+* @retval true 割り当てた
+* @retval false どのバスにも割り当てていないIDがある、または周期に収まらない(スロットは変えない)
+* @note スロットの長さはmotionCostUs()に送信の遅れの許容(setJitterUs())を足したもので、バス毎にIDの小さい順に並べる
+* @note setPollUs()の周期があれば、スロットの時刻と長さはその倍数にする(スロットの時刻にpoll()が来る)
+* @note 詰めて並べると残りの時間をまとめて読出しに使え、等間隔ならサーボ間の遅れが周期に散らばる
+**/
+bool IcsScheduler::layoutSlots(const byte *ids, byte idNum, unsigned long periodUs, bool spread)
+{
+  byte order[IcsCommand::MAX_ID + 1];
+  byte orderNum = 0;
+
+  //IDの小さい順に並べる
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    for (byte k = 0; k < idNum; k++)
+    {
+      if (ids[k] == id)
+      {
+        if (bus->busFor(id) == nullptr)
+        {
+          return false;
+        }
+        order[orderNum++] = id;
+        break;
+      }
+    }
+  }
+
+  //バス毎に詰めた長さと、一番長いスロットを求める
+  unsigned long packedUs[IcsMultiBus::MAX_BUS] = {};
+  unsigned long maxLengthUs[IcsMultiBus::MAX_BUS] = {};
+  byte count[IcsMultiBus::MAX_BUS] = {};
+  for (byte k = 0; k < orderNum; k++)
+  {
+    byte b = bus->busIndexOf(order[k]);
+    unsigned long len = alignPollUs(motionCostUs(order[k]) + jitterUs);
+    packedUs[b] += len;
+    if (len > maxLengthUs[b])
+    {
+      maxLengthUs[b] = len;
+    }
+    count[b]++;
+  }
+  unsigned long spacingUs[IcsMultiBus::MAX_BUS] = {};
+  for (byte b = 0; b < IcsMultiBus::MAX_BUS; b++)
+  {
+    if (count[b] > 0)
+    {
+      spacingUs[b] = periodUs / count[b];
+      spacingUs[b] -= (pollUs == 0) ? 0 : spacingUs[b] % pollUs;   //等間隔もpoll()の周期の倍数で
+    }
+    if (packedUs[b] > periodUs || (spread && count[b] > 0 && maxLengthUs[b] > spacingUs[b]))
+    {
+      return false;
+    }
+  }
+
+  clearSlots();
+  unsigned long nextUs[IcsMultiBus::MAX_BUS] = {};
+  byte index[IcsMultiBus::MAX_BUS] = {};
+  for (byte k = 0; k < orderNum; k++)
+  {
+    byte id = order[k];
+    byte b = bus->busIndexOf(id);
+    unsigned long len = alignPollUs(motionCostUs(id) + jitterUs);
+    unsigned long offset = spread ? spacingUs[b] * index[b] : nextUs[b];
+    setSlot(id, offset, len);
+    nextUs[b] += len;
+    index[b]++;
+  }
+  return true;
+}
+
+/**
+* @brief 1つのサーボにスロットを割り当てる
+* @param[in] id サーボID
+* @param[in] offsetUs ティックの始まりからの時刻(us)
+* @param[in] lengthUs スロットの長さ(us) 返信までこの中に終わらなければ超過として数える
+* @retval true 割り当てた
+* @retval false IDが範囲外、またはどのバスにも割り当てていない
+* @note 同じバスのスロットが重ならないようにするのは呼び出し側
+**/
+bool IcsScheduler::setSlot(byte id, unsigned long offsetUs, unsigned long lengthUs)
+{
+  if (!IcsCommand::validId(id) || bus->busFor(id) == nullptr)
+  {
+    return false;
+  }
+  Slot &s = slots[id];
+  s.enabled = true;
+  s.offsetUs = offsetUs;
+  s.lengthUs = lengthUs;
+  s.staged = false;
+  return true;
+}
+
+/**
+* @brief すべてのスロットを消す(置いたポジションも捨てる)
+* @note カウンタは残す
+**/
+void IcsScheduler::clearSlots()
+{
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    slots[id].enabled = false;
+    slots[id].staged = false;
+  }
+}
+
+/**
+* @brief このティックでスロットの時刻に送るポジションを置く
+* @param[in] id サーボID
+* @param[in] pos ポジション
+* @param[in] speed スピード(1～127、0は送らない) シャドウレジスタと同じなら送らない
+* @param[in] cb ポジション設定の完了時に呼ぶ関数
+* @param[in] *ctx cbに渡すポインタ
+* @retval true 置いた(スロットの無いIDはすぐにバスへ積んだ)
+* @retval false 範囲外、またはバスがいっぱい
+* @note beginTick()の後に呼ぶ。スロットの時刻を過ぎていれば次のpoll()で送る
+* @note 同じティックで2回置くと後の値を送る
+**/
+bool IcsScheduler::stageMotion(byte id, unsigned int pos, byte speed, IcsAsyncClass::Callback cb, void *ctx)
+{
+  if (!hasSlot(id))
+  {
+    if (speed != 0)
+    {
+      submitMotionParam(id, IcsCommand::SC_SPD, speed);
+    }
+    return submitMotionPos(id, pos, cb, ctx) >= 0;
+  }
+  if (!IcsCommand::validPos(pos) || (speed != 0 && !IcsCommand::validParam(IcsCommand::SC_SPD, speed)))
+  {
+    return false;
+  }
+  Slot &s = slots[id];
+  s.staged = true;
+  s.pos = pos;
+  s.speed = speed;
+  s.cb = cb;
+  s.ctx = ctx;
+  return true;
+}
+
+/**
+* @brief 時刻になったスロットのうち一番早いものを送る
+* @param[in] busIndex バスの番号
+* @retval true 送った
+* @retval false バスが使われている、または時刻になったスロットが無い
+* @note 前のスロットが超過していればバスが空くまで待って送り、遅れとして数える
+* @note ティックの無い時(endTicks()の後)は送らない
+**/
+bool IcsScheduler::issueSlot(byte busIndex)
+{
+  IcsAsyncClass *target = bus->getBus(busIndex);
+  if (tickPeriodUs == 0 || target == nullptr || target->busy())
+  {
+    return false;
+  }
+
+  unsigned long now = micros();
+  Slot *next = nullptr;
+  byte nextId = 0;
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    Slot &s = slots[id];
+    if (!s.staged || bus->busIndexOf(id) != busIndex || (long)(now - (tickStartUs + s.offsetUs)) < 0)
+    {
+      continue;
+    }
+    if (next == nullptr || s.offsetUs < next->offsetUs)
+    {
+      next = &s;
+      nextId = id;
+    }
+  }
+  if (next == nullptr)
+  {
+    return false;
+  }
+
+  if (next->speed != 0)
+  {
+    submitMotionParam(nextId, IcsCommand::SC_SPD, next->speed);
+  }
+  if (submitMotionPos(nextId, next->pos, onSlotDone, next) < 0)
+  {
+    return false;   //キューがいっぱい(次のpoll()で送る)
+  }
+  next->staged = false;
+  next->dueUs = tickStartUs + next->offsetUs;
+
+  SlotStats &st = next->stats;
+  unsigned long jitter = now - next->dueUs;
+  st.sent++;
+  if (jitter > jitterUs)
+  {
+    st.late++;
+  }
+  if (jitter > st.maxJitterUs)
+  {
+    st.maxJitterUs = jitter;
+  }
+  return true;
+}
+
+/**
+* @brief これから送るポジション設定を、サーボが受け取る時刻の見込み
+* @param[in] *ids サーボID(スロットが無ければこの順に送るとする)
+* @param[in] idNum idsの数
+* @param[out] *sendUs ids毎の時刻(us micros()の値)
+* @note スロットがあればティックの始まり+スロットの時刻、無ければ今からバス毎に前のIDの分だけ遅らせる
+* @note スピードはシャドウレジスタで省かれ(毎回同じ値を送る)、バスは空いているとして見積もる
+* @note 返信を待つ時間はsetResponseLatencyUs()の見込みとUARTのFIFOのタイムアウトで、ストリーミング中は待たない
+* @note setPollUs()の周期があれば、スロットや次のフレームは次のpoll()の時刻に送るとする
+**/
+void IcsScheduler::predictSendUs(const byte *ids, byte idNum, unsigned long *sendUs) const
+{
+  unsigned long nextUs[IcsMultiBus::MAX_BUS];
+  unsigned long now = micros();
+  for (byte b = 0; b < IcsMultiBus::MAX_BUS; b++)
+  {
+    nextUs[b] = now;
+  }
+
+  for (byte k = 0; k < idNum; k++)
+  {
+    byte id = ids[k];
+    IcsAsyncClass *async = bus->busFor(id);
+    if (async == nullptr)
+    {
+      sendUs[k] = now;
+      continue;
+    }
+    IcsHardSerialClass *ics = async->getIcs();
+    unsigned long txUs = ics->frameTimeUs(IcsCommand::POS_TX_LEN);
+    if (hasSlot(id))
+    {
+      sendUs[k] = tickStartUs + alignPollUs(slots[id].offsetUs) + txUs;
+      continue;
+    }
+    byte b = bus->busIndexOf(id);
+    sendUs[k] = nextUs[b] + txUs;
+    nextUs[b] = sendUs[k];
+    if (!async->streaming())
+    {
+      nextUs[b] += ics->getResponseLatencyUs() + ics->frameTimeUs(IcsCommand::POS_RX_LEN) + ics->fifoTimeoutUs();
+      nextUs[b] = now + alignPollUs(nextUs[b] - now);   //返信を受け取ったpoll()で次を送る
+    }
+  }
+}
+
+/**
+* @brief スロットのポジション設定の完了(超過を数えて、置いた時のcbを呼ぶ)
+**/
+void IcsScheduler::onSlotDone(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx)
+{
+  Slot *s = static_cast<Slot *>(ctx);
+  if ((long)(micros() - (s->dueUs + s->lengthUs)) > 0)
+  {
+    s->stats.overruns++;
+  }
+  if (s->cb != nullptr)
+  {
+    s->cb(handle, ok, rxBuf, rxLen, s->ctx);
+  }
+}
+
+
+
+//読出し //////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief 読出しをキューに置く
+* @param[in] prio 優先度( #PRIO_SAFETY / #PRIO_TELEMETRY )
+* @param[in] id サーボID
+* @param[in] sc サブコマンド( IcsCommand::SC_STRC ～ IcsCommand::SC_POS )
+* @param[in] cb 完了時に呼ぶ関数
+* @param[in] *ctx cbに渡すポインタ
+* @retval true キューに置いた
+* @retval false 優先度、ID、サブコマンドが範囲外、またはキューがいっぱい
+**/
+bool IcsScheduler::requestRead(Priority prio, byte id, byte sc, IcsAsyncClass::Callback cb, void *ctx)
+{
+  if (prio == PRIO_MOTION || prio >= PRIO_COUNT || bus->busFor(id) == nullptr ||
+      sc < IcsCommand::SC_STRC || sc > IcsCommand::SC_POS)
+  {
+    return false;
+  }
+  if (queued[prio] >= READ_QUEUE_SIZE)
+  {
+    stats.dropped++;
+    return false;
+  }
+
+  Request &r = queues[prio][queued[prio]++];
+  r.id = id;
+  r.sc = sc;
+  r.cb = cb;
+  r.ctx = ctx;
+  return true;
+}
+
+/**
+* @brief 空いているバスに次の読出しを送る
+* @param[in] busIndex バスの番号
+* @retval true 送った
+* @retval false バスが使われている、送るものが無い、または次のティックまでに終わらない
+* @note 優先度の高いものが入らない時は、低いものも送らない
+**/
+bool IcsScheduler::issueNext(byte busIndex)
+{
+  IcsAsyncClass *target = bus->getBus(busIndex);
+  if (target == nullptr || target->busy())
+  {
+    return false;
+  }
+
+  for (byte prio = PRIO_SAFETY; prio < PRIO_COUNT; prio++)
+  {
+    Request *q = queues[prio];
+    for (byte i = 0; i < queued[prio]; i++)
+    {
+      if (bus->busIndexOf(q[i].id) != busIndex)
+      {
+        continue;
+      }
+      if (!fitsBefore(busIndex, readCostUs(q[i].id, q[i].sc)))
+      {
+        if (deferTick[busIndex] != tickCount)   //1ティックに1回だけ数える
+        {
+          deferTick[busIndex] = tickCount;
+          stats.deferred++;
+        }
+        return false;
+      }
+      if (target->submitGetParam(q[i].id, q[i].sc, q[i].cb, q[i].ctx) < 0)
+      {
+        return false;
+      }
+      stats.issued[prio]++;
+      //詰める(キューは短いので順番を保ったまま動かす)
+      queued[prio]--;
+      memmove(&q[i], &q[i + 1], (queued[prio] - i) * sizeof(Request));
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* @brief バスを進め、時刻になったスロットと、空いたバスに読出しを送る
+* @note 1回の呼び出しで1つのバスに送るのはスロットか読出しの1つだけ
+* @note スロットの時刻の正確さはpoll()を呼ぶ間隔で決まる
+**/
+void IcsScheduler::poll()
+{
+  bus->poll();
+  for (byte b = 0; b < bus->busCount(); b++)
+  {
+    if (issueSlot(b) || issueNext(b))
+    {
+      bus->getBus(b)->poll();   //すぐに送る
+    }
+  }
+}
@@ -0,0 +1,222 @@
+/**
+* @file IcsScheduler.h
+* @brief ICS3.5/3.6 priority bus scheduler header file
+* @date 2026/10/17
+* @version 1.0.0
+
+* @par 概要
+* モーションの書込み、安全のための読出し、バックグラウンドのテレメトリ読出しを優先度で分けて送る。<br>
+* モーションは登録したらすぐにバスへ積む。読出しはキューに置き、バスが空いていて、<br>
+* 次のティック(モーション更新)までに最悪でも終わる時だけ送る。<br>
+* そのため、読出しがモーションの送信をティックの後ろへ押し出すことはない。<br>
+
+* @par 使い方
+* - loop()で毎回poll()を呼ぶ<br>
+* - モーションを送る直前にbeginTick(周期)を呼ぶ<br>
+* - 読出しはrequestRead()でキューに置く(結果はコールバックで受け取る)<br>
+
+* @par 時間割り(TDMA)
+* layoutSlots()でサーボ毎にティックの中の決まった時刻(スロット)を割り当てると、<br>
+* stageMotion()で置いたポジションはpoll()がそのスロットの時刻に送る。<br>
+* 前のサーボの再送やタイムアウトで後ろのサーボが遅れないので、どのサーボも周期どおりに更新される。<br>
+* 読出しは次のスロットまでに終わる時だけ送る。スロットの長さで終わらなかった時は、そのスロットの超過として数える。<br>
+* predictSendUs()はサーボ毎にポジションが届く時刻の見込みを返すので、軌道はその時刻で計算できる。<br>
+* タイマーで決まった周期にpoll()を呼ぶ時は、setPollUs()とsetJitterUs()にその周期を設定すると、<br>
+* スロットの時刻がpoll()の時刻と揃い、見込みにもpoll()を待つ時間が入る。<br>
+**/
+
+#ifndef _ics_Scheduler_h_
+#define _ics_Scheduler_h_
+
+#include <Arduino.h>
+#include <IcsMultiBus.h>
+
+//IcsSchedulerクラス///////////////////////////////////////////////////
+/**
+* @class IcsScheduler
+* @brief ティックの空き時間にだけ読出しを送るスケジューラ
+**/
+class IcsScheduler
+{
+  //クラス内の型定義
+  public:
+  /**
+  * @enum Priority
+  * @brief トランザクションの優先度(小さいほど優先)
+  **/
+  enum Priority : byte
+  {
+    PRIO_MOTION = 0,     ///< ポジション、スピードの書込み(すぐに送る)
+    PRIO_SAFETY,         ///< 温度、電流などの安全のための読出し
+    PRIO_TELEMETRY,      ///< バックグラウンドの読出し
+    PRIO_COUNT           ///< 優先度の数
+  };
+
+  /**
+  * @struct Stats
+  * @brief スケジューラのカウンタ
+  **/
+  struct Stats
+  {
+    unsigned long issued[PRIO_COUNT];   ///< 優先度毎に送った数
+    unsigned long deferred;             ///< 次のティックまでに終わらないので読出しを見送ったティックの数(バス毎)
+    unsigned long dropped;              ///< キューがいっぱいで受け付けなかった読出しの数
+    unsigned long lateTicks;            ///< beginTick()の時にまだバスが使われていた回数
+  };
+
+  /**
+  * @struct SlotStats
+  * @brief スロット(ID)毎のカウンタ
+  **/
+  struct SlotStats
+  {
+    unsigned long sent;          ///< スロットで送った数
+    unsigned long late;          ///< スロットの時刻から許容時間より遅れて送った数
+    unsigned long overruns;      ///< スロットの長さの中で返信まで終わらなかった数
+    unsigned long missed;        ///< 置いたが次のティックまでに送れなかった数
+    unsigned long maxJitterUs;   ///< スロットの時刻から送るまでの最大の遅れ(us)
+  };
+
+  //固定値
+  public:
+  static constexpr byte READ_QUEUE_SIZE = 16;            ///< 優先度毎の読出しキューの長さ
+  static constexpr unsigned long DEFAULT_GUARD_US = 500; ///< ティックの直前に空けておく時間(us)
+  static constexpr unsigned long DEFAULT_JITTER_US = 50; ///< スロットの時刻からこれ以上遅れたら遅れとして数える(us)
+
+  //コンストラクタ
+  public:
+    explicit IcsScheduler(IcsMultiBus *bus);
+
+  //変数
+  protected:
+  /**
+  * @struct Request
+  * @brief キューに置いた読出し
+  **/
+  struct Request
+  {
+    byte id;                       ///< サーボID
+    byte sc;                       ///< サブコマンド
+    IcsAsyncClass::Callback cb;    ///< 完了時の関数
+    void *ctx;                     ///< cbに渡すポインタ
+  };
+
+  /**
+  * @struct Slot
+  * @brief 1つのサーボのスロット
+  **/
+  struct Slot
+  {
+    bool enabled;                  ///< スロットを割り当てた
+    unsigned long offsetUs;        ///< ティックの始まりからスロットまでの時間(us)
+    unsigned long lengthUs;        ///< スロットの長さ(us)
+    bool staged;                   ///< このティックで送るポジションがある
+    unsigned int pos;              ///< 送るポジション
+    byte speed;                    ///< 送るスピード(0は送らない)
+    IcsAsyncClass::Callback cb;    ///< ポジション設定の完了時の関数
+    void *ctx;                     ///< cbに渡すポインタ
+    unsigned long dueUs;           ///< 送ったスロットの時刻(us)
+    SlotStats stats;               ///< カウンタ
+  };
+
+  IcsMultiBus *bus;                                      ///< 送り先のバス
+  Request queues[PRIO_COUNT][READ_QUEUE_SIZE];           ///< 優先度毎の読出しキュー(PRIO_MOTIONは使わない)
+  byte queued[PRIO_COUNT];                               ///< 優先度毎のキューの長さ
+  unsigned long tickStartUs;                             ///< 最後のbeginTick()の時刻(us)
+  unsigned long tickPeriodUs;                            ///< ティックの周期(us 0はティック無し)
+  unsigned long guardUs;                                 ///< ティックの直前に空けておく時間(us)
+  unsigned long tickCount;                               ///< beginTick()の回数
+  unsigned long deferTick[IcsMultiBus::MAX_BUS];         ///< 最後に見送りを数えたティックの番号(バス毎)
+  Stats stats;                                           ///< カウンタ
+  Slot slots[IcsCommand::MAX_ID + 1];                    ///< ID毎のスロット
+  unsigned long jitterUs;                                ///< 遅れとして数える時間(us)
+  unsigned long pollUs;                                  ///< poll()を呼ぶ周期(us 0は絶えず呼ぶ)
+
+  //関数
+  public:
+    //ティック
+    void beginTick(unsigned long periodUs);
+    void endTicks();
+    long slackUs() const;
+    /**
+    *	@brief ティックの直前に空けておく時間を設定する
+    *	@param[in] us 時間(us) beginTick()からモーションを積むまでの遅れより大きくする
+    **/
+    void setGuardUs(unsigned long us) {guardUs = us;}
+
+    //モーション(すぐにバスへ積む)
+    int submitMotionPos(byte id, unsigned int pos, IcsAsyncClass::Callback cb = nullptr, void *ctx = nullptr);
+    int submitMotionParam(byte id, byte sc, byte val, IcsAsyncClass::Callback cb = nullptr, void *ctx = nullptr);
+
+    //時間割り(スロットの時刻に送る)
+    bool layoutSlots(const byte *ids, byte idNum, unsigned long periodUs, bool spread = false);
+    bool setSlot(byte id, unsigned long offsetUs, unsigned long lengthUs);
+    void clearSlots();
+    /**
+    *	@brief IDにスロットがあるか
+    **/
+    bool hasSlot(byte id) const {return IcsCommand::validId(id) && slots[id].enabled;}
+    /**
+    *	@brief IDのスロットの時刻(ティックの始まりから us)
+    **/
+    unsigned long slotOffsetUs(byte id) const {return hasSlot(id) ? slots[id].offsetUs : 0;}
+    /**
+    *	@brief IDのスロットの長さ(us)
+    **/
+    unsigned long slotLengthUs(byte id) const {return hasSlot(id) ? slots[id].lengthUs : 0;}
+    unsigned long motionCostUs(byte id) const;
+    bool stageMotion(byte id, unsigned int pos, byte speed = 0, IcsAsyncClass::Callback cb = nullptr, void *ctx = nullptr);
+    /**
+    *	@brief IDのスロットのカウンタを返す(範囲外はID0)
+    **/
+    const SlotStats &getSlotStats(byte id) const {return slots[IcsCommand::validId(id) ? id : 0].stats;}
+    /**
+    *	@brief 遅れとして数える時間を設定する
+    *	@param[in] us 時間(us) loop()の1回の時間より大きくする
+    **/
+    void setJitterUs(unsigned long us) {jitterUs = us;}
+    /**
+    *	@brief poll()を呼ぶ周期を設定する
+    *	@param[in] us 周期(us) タイマーで呼ぶ時の周期、0はloop()で絶えず呼ぶ
+    *	@note layoutSlots()はスロットの時刻と長さをこの周期の倍数にし、predictSendUs()は次のpoll()まで待つ時間を足す
+    *	@note beginTick()もpoll()と同じタイマーから呼ぶこと(スロットの時刻がpoll()の時刻と揃う)
+    **/
+    void setPollUs(unsigned long us) {pollUs = us;}
+    void predictSendUs(const byte *ids, byte idNum, unsigned long *sendUs) const;
+    /**
+    *	@brief predictSendUs()の時刻がnowUsから何us後か
+    *	@return 時間(us) 見込みの時刻が既に過ぎていれば0
+    *	@note スロットの時刻はティックの始まりからなので、ティックの処理が長いと過ぎていることがある(符号付きで比べる)
+    **/
+    static unsigned long sendOffsetUs(unsigned long sendUs, unsigned long nowUs) {long d = (long)(sendUs - nowUs); return (d > 0) ? (unsigned long)d : 0;}
+
+    //読出し(空き時間に送る)
+    bool requestRead(Priority prio, byte id, byte sc, IcsAsyncClass::Callback cb = nullptr, void *ctx = nullptr);
+    /**
+    *	@brief 優先度のキューに残っている読出しの数
+    **/
+    byte queuedReads(Priority prio) const {return (prio < PRIO_COUNT) ? queued[prio] : 0;}
+
+    //バスを進め、空いているバスに読出しを送る loop()から毎回呼ぶ
+    void poll();
+
+    /**
+    *	@brief カウンタを返す
+    **/
+    const Stats &getStats() const {return stats;}
+    void resetStats();
+
+    unsigned long readCostUs(byte id, byte sc) const;
+
+  protected:
+    /**
+    *	@brief 時間をpoll()の周期の倍数に切り上げる
+    **/
+    unsigned long alignPollUs(unsigned long us) const {return (pollUs == 0) ? us : (us + pollUs - 1) / pollUs * pollUs;}
+    bool fitsBefore(byte busIndex, unsigned long costUs) const;
+    bool issueNext(byte busIndex);
+    bool issueSlot(byte busIndex);
+    static void onSlotDone(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx);
+};
+
+#endif
@@ -0,0 +1,188 @@
+/**
+*	@file IcsServoTable.cpp
+*	@brief ICS3.5/3.6 live servo table
+*	@date	2026/10/17
+*	@version 1.0.0
+**/
+
+#include "IcsServoTable.h"
+
+/**
+*	@brief コンストラクタ
+*	@note 空の表で始まる
+**/
+IcsServoTable::IcsServoTable()
+{
+  clear();
+  discoverUs = 0;
+}
+
+/**
+* @brief 表を空にする
+**/
+void IcsServoTable::clear()
+{
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    entries[id].present = false;
+    entries[id].icsVersion = VERSION_UNKNOWN;
+    entries[id].position = -1;
+  }
+  idCount = 0;
+}
+
+/**
+* @brief 問い合わせずにIDを表に加える
+* @param[in] id サーボID
+* @param[in] icsVersion ICSのバージョン(わからなければ #VERSION_UNKNOWN)
+* @param[in] position 現在位置(わからなければ-1)
+* @retval true 加えた(すでに居れば情報を上書きする)
+* @retval false IDが範囲外
+* @note サーボの電源が後から入るなど、問い合わせで見つからなかったIDを使う時に呼ぶ
+**/
+bool IcsServoTable::add(byte id, byte icsVersion, int position)
+{
+  if (!IcsCommand::validId(id))
+  {
+    return false;
+  }
+
+  if (!entries[id].present) //小さい順に並ぶように入れる
+  {
+    byte k = idCount;
+    while (k > 0 && ids[k - 1] > id)
+    {
+      ids[k] = ids[k - 1];
+      k--;
+    }
+    ids[k] = id;
+    idCount++;
+  }
+  entries[id].present = true;
+  entries[id].icsVersion = icsVersion;
+  entries[id].position = position;
+  return true;
+}
+
+
+
+//問い合わせ //////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief バスに居るサーボを問い合わせて表を作り直す
+* @param[in] *bus 問い合わせるバス(IDの割り当て済みで、他のトランザクションが無いこと)
+* @param[in] firstId 問い合わせる最初のID
+* @param[in] lastId 問い合わせる最後のID
+* @param[in] timeoutUs 問い合わせ全体のタイムアウト(us)
+* @return 見つかったサーボの数
+* @note どのバスにも割り当てていないIDは問い合わせない
+* @note 返信しないIDで待つ時間はIcsHardSerialClassの受信タイムアウトなので、TIMEOUT_COMPUTEDにしておく
+* @note 返信しないIDはテレメトリにタイムアウトとして記録される
+**/
+byte IcsServoTable::discover(IcsMultiBus *bus, byte firstId, byte lastId, unsigned long timeoutUs)
+{
+  unsigned long start = micros();
+  unsigned long deadlineUs = start + timeoutUs;
+  bool targets[IcsCommand::MAX_ID + 1];
+
+  clear();
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    targets[id] = id >= firstId && id <= lastId && bus->busIndexOf(id) != IcsMultiBus::NO_BUS;
+  }
+  probe(bus, IcsCommand::SC_TMP, targets, deadlineUs);   //居るか
+
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    targets[id] = entries[id].present;
+  }
+  probe(bus, IcsCommand::SC_POS, targets, deadlineUs);   //ICS3.6なら現在位置も返る
+
+  idCount = 0;
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    if (!entries[id].present)
+    {
+      continue;
+    }
+    if (entries[id].icsVersion == VERSION_UNKNOWN)
+    {
+      entries[id].icsVersion = VERSION_35;
+    }
+    ids[idCount++] = id;
+  }
+
+  discoverUs = micros() - start;
+  return idCount;
+}
+
+/**
+* @brief targetsのIDすべてにscの読出しを送り、返信が揃うまで待つ
+* @param[in] *bus 問い合わせるバス
+* @param[in] sc サブコマンド
+* @param[in] *targets ID毎に送るかどうか
+* @param[in] deadlineUs あきらめる時刻(us)
+* @retval true すべて完了した
+* @retval false 時間切れ(残りのトランザクションはバスに残る)
+* @note バス毎のキューがいっぱいの時は、そのバスのIDだけ後に回し、他のバスには積み続ける
+**/
+bool IcsServoTable::probe(IcsMultiBus *bus, byte sc, const bool *targets, unsigned long deadlineUs)
+{
+  IcsAsyncClass::Callback cb = (sc == IcsCommand::SC_POS) ? onPosition : onTemperature;
+  bool sent[IcsCommand::MAX_ID + 1] = {};
+  bool allSent = false;
+
+  while (!allSent || bus->busy())
+  {
+    allSent = true;
+    for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+    {
+      if (!targets[id] || sent[id])
+      {
+        continue;
+      }
+      if (bus->submitGetParam(id, sc, cb, this) == IcsAsyncClass::HANDLE_NONE)
+      {
+        allSent = false;   //キューが空くまで待つ
+        continue;
+      }
+      sent[id] = true;
+    }
+
+    bus->poll();
+    if ((long)(micros() - deadlineUs) >= 0)
+    {
+      return false;
+    }
+    delayMicroseconds(1);
+  }
+  return true;
+}
+
+/**
+* @brief 温度の読出しの完了(返信があれば居る)
+**/
+void IcsServoTable::onTemperature(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx)
+{
+  (void)handle;
+  (void)rxLen;
+  if (ok)
+  {
+    IcsServoTable *table = static_cast<IcsServoTable *>(ctx);
+    table->entries[IcsCommand::idOf(rxBuf[0])].present = true;
+  }
+}
+
+/**
+* @brief 現在位置の読出しの完了(返信があればICS3.6)
+**/
+void IcsServoTable::onPosition(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx)
+{
+  (void)handle;
+  (void)rxLen;
+  if (ok)
+  {
+    Entry &e = static_cast<IcsServoTable *>(ctx)->entries[IcsCommand::idOf(rxBuf[0])];
+    e.icsVersion = VERSION_36;
+    e.position = IcsCommand::decodePos(rxBuf[2], rxBuf[3]);
+  }
+}
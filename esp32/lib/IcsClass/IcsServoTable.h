@@ -0,0 +1,97 @@
+/**
+* @file IcsServoTable.h
+* @brief ICS3.5/3.6 live servo table header file
+* @date 2026/10/17
+* @version 1.0.0
+
+* @par 概要
+* 起動時にIDを順に問い合わせ、返信のあったサーボだけを表にする。<br>
+* 問い合わせはIcsMultiBusに積むので、バスが複数あれば同時に進み、<br>
+* 返信しないIDは計算したタイムアウト(数百us)で次へ進む。<br>
+* モーションや脱力のループは表のIDだけを回すので、居ないサーボで毎回タイムアウトを待たない。<br>
+
+* @par 問い合わせの手順
+* 1. 全IDに温度の読出しを送る(ICS3.5/3.6どちらも返信する)<br>
+* 2. 返信のあったIDに現在位置の読出しを送る。返信があればICS3.6で位置もわかる。無ければICS3.5<br>
+**/
+
+#ifndef _ics_ServoTable_h_
+#define _ics_ServoTable_h_
+
+#include <Arduino.h>
+#include <IcsMultiBus.h>
+
+//IcsServoTableクラス///////////////////////////////////////////////////
+/**
+* @class IcsServoTable
+* @brief バスに居るサーボの表
+**/
+class IcsServoTable
+{
+  //固定値
+  public:
+  static constexpr byte VERSION_UNKNOWN = 0;   ///< 問い合わせずに登録した(ICSのバージョン不明)
+  static constexpr byte VERSION_35 = 35;       ///< ICS3.5(現在位置の読出しに返信しない)
+  static constexpr byte VERSION_36 = 36;       ///< ICS3.6以降
+  static constexpr unsigned long DEFAULT_DISCOVER_TIMEOUT_US = 200000;  ///< 問い合わせ全体のタイムアウト(us)
+
+  //クラス内の型定義
+  public:
+  /**
+  * @struct Entry
+  * @brief 1つのIDの情報
+  **/
+  struct Entry
+  {
+    bool present;        ///< 返信があった(または登録した)
+    byte icsVersion;     ///< #VERSION_35 / #VERSION_36 / #VERSION_UNKNOWN
+    int position;        ///< 問い合わせた時の現在位置(-1は不明)
+  };
+
+  //コンストラクタ
+  public:
+    IcsServoTable();
+
+  //変数
+  protected:
+  Entry entries[IcsCommand::MAX_ID + 1];   ///< ID毎の情報
+  byte ids[IcsCommand::MAX_ID + 1];        ///< 居るIDを小さい順に並べたもの
+  byte idCount;                            ///< 居るIDの数
+  unsigned long discoverUs;                ///< 最後の問い合わせにかかった時間(us)
+
+  //関数
+  public:
+    byte discover(IcsMultiBus *bus, byte firstId = 0, byte lastId = IcsCommand::MAX_ID,
+                  unsigned long timeoutUs = DEFAULT_DISCOVER_TIMEOUT_US);
+    void clear();
+    bool add(byte id, byte icsVersion = VERSION_UNKNOWN, int position = -1);
+
+    /**
+    *	@brief 居るIDの数
+    **/
+    byte count() const {return idCount;}
+    /**
+    *	@brief index番目(0から)に小さい居るID
+    *	@note for (byte k = 0; k < table.count(); k++) { byte id = table.idAt(k); ... } のように回す
+    **/
+    byte idAt(byte index) const {return ids[index];}
+    /**
+    *	@brief IDのサーボが居るか
+    **/
+    bool present(byte id) const {return IcsCommand::validId(id) && entries[id].present;}
+    /**
+    *	@brief IDの情報を返す(範囲外はID0)
+    **/
+    const Entry &get(byte id) const {return entries[IcsCommand::validId(id) ? id : 0];}
+    /**
+    *	@brief 最後のdiscover()にかかった時間(us)
+    **/
+    unsigned long lastDiscoverUs() const {return discoverUs;}
+
+  protected:
+    bool probe(IcsMultiBus *bus, byte sc, const bool *targets, unsigned long deadlineUs);
+    static void onTemperature(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx);
+    static void onPosition(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx);
+};
+
+#endif
@@ -0,0 +1,154 @@
+/**
+*	@file IcsTelemetry.cpp
+*	@brief ICS3.5/3.6 bus transaction telemetry
+*	@date	2026/10/16
+*	@version 1.0.0
+**/
+
+#include "IcsTelemetry.h"
+
+/**
+*	@brief コンストラクタ
+**/
+IcsTelemetry::IcsTelemetry()
+{
+  reset();
+}
+
+/**
+* @brief すべての記録を消す
+**/
+void IcsTelemetry::reset()
+{
+  memset(stats, 0, sizeof(stats));
+  badIdCount = 0;
+}
+
+/**
+* @brief 時間が入るヒストグラムのビン
+* @param[in] us 時間(us)
+* @return ビンの番号(0～#HIST_BUCKETS -1)
+**/
+byte IcsTelemetry::bucketOf(unsigned long us)
+{
+  byte b = 0;
+  us >>= HIST_FIRST_SHIFT;
+  while (us > 0 && b < HIST_BUCKETS - 1)
+  {
+    us >>= 1;
+    b++;
+  }
+  return b;
+}
+
+/**
+* @brief 1トランザクションを記録する
+* @param[in] id サーボのID
+* @param[in] result 結果
+* @param[in] us 送信開始から完了(またはタイムアウト)までの時間(us)。送らなかった時は0
+* @note 範囲外で送らなかったものはヒストグラムに入れない
+**/
+void IcsTelemetry::record(byte id, Result result, unsigned long us)
+{
+  if (id > IcsCommand::MAX_ID || result >= RESULT_COUNT)
+  {
+    if (badIdCount < 0xFF)
+    {
+      badIdCount++;
+    }
+    return;
+  }
+
+  IdStats &s = stats[id];
+  s.count[result]++;
+  if (result == RESULT_OUT_OF_RANGE)
+  {
+    return;
+  }
+
+  s.totalUs += us;
+  if (us > s.maxUs)
+  {
+    s.maxUs = us;
+  }
+  uint16_t &h = s.hist[bucketOf(us)];
+  if (h < 0xFFFF)
+  {
+    h++;
+  }
+}
+
+/**
+* @brief IDの失敗の合計
+* @param[in] id サーボのID
+**/
+uint32_t IcsTelemetry::failures(byte id) const
+{
+  const IdStats &s = get(id);
+  uint32_t n = 0;
+  for (byte r = RESULT_OK + 1; r < RESULT_COUNT; r++)
+  {
+    n += s.count[r];
+  }
+  return n;
+}
+
+/**
+* @brief 記録をバイナリにまとめる(形式はIcsTelemetry.hを参照)
+* @param[out] *buf 書き込み先
+* @param[in] size bufのバイト数(#SNAPSHOT_MAX あれば必ず入る)
+* @return 書き込んだバイト数
+* @retval 0 ヘッダも入らない
+* @note 入りきらないIDは省き、ヘッダのIDの数は実際に書いた数にする
+**/
+size_t IcsTelemetry::snapshot(byte *buf, size_t size) const
+{
+  if (size < HEADER_SIZE)
+  {
+    return 0;
+  }
+
+  buf[0] = 'I';
+  buf[1] = 'T';
+  buf[2] = SNAPSHOT_VERSION;
+  buf[3] = 0;
+  buf[4] = RESULT_COUNT;
+  buf[5] = HIST_BUCKETS;
+  buf[6] = HIST_FIRST_SHIFT;
+  buf[7] = badIdCount;
+
+  size_t pos = HEADER_SIZE;
+  for (byte id = 0; id <= IcsCommand::MAX_ID; id++)
+  {
+    const IdStats &s = stats[id];
+    uint32_t total = 0;
+    for (byte r = 0; r < RESULT_COUNT; r++)
+    {
+      total += s.count[r];
+    }
+    if (total == 0)
+    {
+      continue;   //記録のないIDは送らない
+    }
+    if (pos + RECORD_SIZE > size)
+    {
+      break;
+    }
+
+    byte *p = buf + pos;
+    *p++ = id;
+    for (byte r = 0; r < RESULT_COUNT; r++)
+    {
+      memcpy(p, &s.count[r], 4);
+      p += 4;
+    }
+    memcpy(p, &s.totalUs, 4);
+    p += 4;
+    memcpy(p, &s.maxUs, 4);
+    p += 4;
+    memcpy(p, s.hist, 2 * HIST_BUCKETS);
+    pos += RECORD_SIZE;
+    buf[3]++;
+  }
+  return pos;
+}
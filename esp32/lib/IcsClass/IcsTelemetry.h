@@ -0,0 +1,111 @@
+/**
+* @file IcsTelemetry.h
+* @brief ICS3.5/3.6 bus transaction telemetry header file
+* @date 2026/10/16
+* @version 1.0.0
+
+* @par 概要
+* ID毎にトランザクションの数、失敗の種類、バスを使った時間のヒストグラムを数える。<br>
+* IcsBaseClass::attachTelemetry()で登録すると、IcsHardSerialClassとIcsAsyncClassが記録する。<br>
+* snapshot()でバイナリにまとめて、TCPなどで外に送れる。<br>
+
+* @par スナップショットの形式(リトルエンディアン)
+* ヘッダ 8バイト<br>
+* - [0] 'I' [1] 'T' [2] バージョン(#SNAPSHOT_VERSION) [3] IDの数(n)<br>
+* - [4] 結果の種類の数(#RESULT_COUNT) [5] ヒストグラムのビン数(#HIST_BUCKETS) [6] 最初のビンの幅(2^x us)<br>
+* - [7] 範囲外のIDで呼ばれた回数(255で飽和)<br>
+* ID毎のレコード(#RECORD_SIZE バイト) x n 、記録のあるIDだけ<br>
+* - [0] ID<br>
+* - uint32 x #RESULT_COUNT 結果の種類毎の回数(Result順)<br>
+* - uint32 バスを使った時間の合計(us) 、uint32 最大(us)<br>
+* - uint16 x #HIST_BUCKETS ヒストグラム(65535で飽和)<br>
+**/
+
+#ifndef _ics_Telemetry_h_
+#define _ics_Telemetry_h_
+
+#include <Arduino.h>
+#include "IcsCommand.h"
+
+//IcsTelemetryクラス///////////////////////////////////////////////////
+/**
+* @class IcsTelemetry
+* @brief ICSのトランザクションをID毎に数えるクラス
+**/
+class IcsTelemetry
+{
+  //クラス内の型定義
+  public:
+  /**
+  * @enum Result
+  * @brief トランザクションの結果
+  **/
+  enum Result : byte
+  {
+    RESULT_OK = 0,          ///< 成功
+    RESULT_TIMEOUT,         ///< 返信が1バイトも来なかった
+    RESULT_SHORT_READ,      ///< 返信が途中までしか来なかった
+    RESULT_ECHO_MISMATCH,   ///< エコーが送信データと違った(送信の衝突)
+    RESULT_OUT_OF_RANGE,    ///< 引数が範囲外で送らなかった
+    RESULT_BAD_REPLY,       ///< 返信の先頭が送信コマンドと合わない
+    RESULT_COUNT            ///< 結果の種類の数
+  };
+
+  //固定値
+  public:
+  static constexpr byte HIST_BUCKETS = 12;     ///< ヒストグラムのビン数
+  static constexpr byte HIST_FIRST_SHIFT = 6;  ///< 最初のビンは 0～63us 、以降は幅が倍になる(最後は65536us以上)
+  static constexpr byte SNAPSHOT_VERSION = 1;  ///< スナップショットの形式の版
+  static constexpr size_t HEADER_SIZE = 8;     ///< スナップショットのヘッダのバイト数
+  static constexpr size_t RECORD_SIZE = 1 + 4 * RESULT_COUNT + 4 + 4 + 2 * HIST_BUCKETS;  ///< ID毎のレコードのバイト数
+  static constexpr size_t SNAPSHOT_MAX = HEADER_SIZE + RECORD_SIZE * (IcsCommand::MAX_ID + 1);  ///< スナップショットの最大バイト数
+
+  /**
+  * @struct IdStats
+  * @brief 1つのIDの記録
+  **/
+  struct IdStats
+  {
+    uint32_t count[RESULT_COUNT];    ///< 結果の種類毎の回数
+    uint32_t totalUs;                ///< バスを使った時間の合計(us)
+    uint32_t maxUs;                  ///< バスを使った時間の最大(us)
+    uint16_t hist[HIST_BUCKETS];     ///< バスを使った時間のヒストグラム
+  };
+
+  //コンストラクタ
+  public:
+    IcsTelemetry();
+
+  //変数
+  protected:
+  IdStats stats[IcsCommand::MAX_ID + 1];   ///< ID毎の記録
+  byte badIdCount;                         ///< 範囲外のIDで呼ばれた回数
+
+  //関数
+  public:
+    void record(byte id, Result result, unsigned long us);
+    void reset();
+    size_t snapshot(byte *buf, size_t size) const;
+
+    /**
+    *	@brief IDの記録を返す
+    **/
+    const IdStats &get(byte id) const {return stats[id & IcsCommand::ID_MASK];}
+    uint32_t failures(byte id) const;
+
+    static byte bucketOf(unsigned long us);
+    /**
+    *	@brief 受信できたデータ数から結果を決める
+    *	@param[in] rxSize 受信できたデータ数(負はエコーの不一致)
+    *	@param[in] rxLen 受信するはずだったデータ数
+    **/
+    static inline Result classify(int rxSize, byte rxLen)
+    {
+      return (rxSize < 0) ? RESULT_ECHO_MISMATCH
+             : (rxSize == 0) ? RESULT_TIMEOUT
+             : (rxSize < rxLen) ? RESULT_SHORT_READ
+             : RESULT_OK;
+    }
+};
+
+#endif
@@ -0,0 +1,415 @@
+/**
+*	@file MotionTask.cpp
+*	@brief fixed-rate motion task
+*	@date	2026/10/17
+*	@version 1.0.0
+**/
+
+#include "MotionTask.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <esp_timer.h>
+#else
+#include <time.h>
+#include <errno.h>
+#endif
+
+/**
+*	@brief コンストラクタ
+**/
+MotionTask::MotionTask()
+{
+  tickFunc = nullptr;
+  pollFunc = nullptr;
+  ctx = nullptr;
+  periodUs = 0;
+  pollUs = 0;
+  divider = 1;
+  startUs = 0;
+  timerCount = 0;
+  runningFlag = false;
+  stopping = false;
+  memset(&stats, 0, sizeof(stats));
+#if defined(ARDUINO_ARCH_ESP32)
+  task = nullptr;
+  timer = nullptr;
+  mutex = xSemaphoreCreateMutex();
+#else
+  pthread_mutex_init(&mutex, nullptr);
+  pthread_mutex_init(&notifyMutex, nullptr);
+  pthread_cond_init(&notifyCond, nullptr);
+  notifyCount = 0;
+#endif
+}
+
+/**
+*	@brief デストラクタ タスクを止める
+**/
+MotionTask::~MotionTask()
+{
+  stop();
+#if !defined(ARDUINO_ARCH_ESP32)
+  pthread_cond_destroy(&notifyCond);
+  pthread_mutex_destroy(&notifyMutex);
+  pthread_mutex_destroy(&mutex);
+#endif
+}
+
+
+
+//開始と停止 ///////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief タイマーとタスクを動かす
+* @param[in] periodUs モーションの周期(us)
+* @param[in] pollUs タイマーの周期(us) periodUsを割り切る値
+* @param[in] tick periodUs毎に呼ぶ関数
+* @param[in] poll pollUs毎(ティックの時はtickの後)に呼ぶ関数 nullptrなら呼ばない
+* @param[in] *ctx 関数に渡すポインタ
+* @param[in] core タスクを動かすコア(ESP32のみ)
+* @param[in] priority タスクの優先度(ESP32のみ)
+* @retval true 動き出した
+* @retval false 既に動いている、周期が割り切れない、またはタスクかタイマーを作れなかった
+* @note 関数はlock()した状態で呼ぶ
+**/
+bool MotionTask::start(unsigned long periodUs, unsigned long pollUs, TickFunc tick, TickFunc poll, void *ctx,
+                       byte core, byte priority)
+{
+  if (runningFlag || tick == nullptr || pollUs == 0 || periodUs < pollUs || periodUs % pollUs != 0)
+  {
+    return false;
+  }
+  this->tickFunc = tick;
+  this->pollFunc = poll;
+  this->ctx = ctx;
+  this->periodUs = periodUs;
+  this->pollUs = pollUs;
+  divider = periodUs / pollUs;
+  timerCount = 0;
+  stopping = false;
+  resetStats();
+
+  runningFlag = true;
+  if (!startBackend(core, priority))
+  {
+    runningFlag = false;
+    return false;
+  }
+  return true;
+}
+
+/**
+* @brief タイマーとタスクを止める 実行中のティックは最後まで動く
+**/
+void MotionTask::stop()
+{
+  if (!runningFlag)
+  {
+    return;
+  }
+  stopping = true;
+  stopBackend();
+  runningFlag = false;
+}
+
+/**
+* @brief タスクと同じデータを触る前に呼ぶ ティックが終わるまで待つ
+**/
+void MotionTask::lock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+  xSemaphoreTake(mutex, portMAX_DELAY);
+#else
+  pthread_mutex_lock(&mutex);
+#endif
+}
+
+/**
+* @brief lock()を解く
+**/
+void MotionTask::unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+  xSemaphoreGive(mutex);
+#else
+  pthread_mutex_unlock(&mutex);
+#endif
+}
+
+/**
+* @brief 遅れとオーバーランを0にする
+**/
+void MotionTask::resetStats()
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+
+
+//タスク ///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+* @brief タスクの本体 タイマーを待ち、関数を呼ぶ
+* @note タイマーの回数から今回のティックの時刻を決めるので、遅れは前のティックに積み重ならない
+**/
+void MotionTask::run()
+{
+  while (!stopping)
+  {
+    unsigned long n = waitTimer();
+    if (n == 0)
+    {
+      continue;
+    }
+    unsigned long prevTicks = timerCount / divider;
+    timerCount += n;
+    unsigned long tickNum = timerCount / divider;
+
+    lock();
+    if (tickNum != prevTicks)
+    {
+      // 長いティックの後に溜まった分は呼ばずに見送る
+      stats.missedTicks += tickNum - prevTicks - 1;
+      unsigned long dueUs = startUs + tickNum * periodUs;
+      unsigned long beginUs = nowUs();
+      long late = (long)(beginUs - dueUs);
+      stats.lastJitterUs = (late > 0) ? (unsigned long)late : 0;
+      stats.sumJitterUs += stats.lastJitterUs;
+      if (stats.lastJitterUs > stats.maxJitterUs)
+      {
+        stats.maxJitterUs = stats.lastJitterUs;
+      }
+
+      tickFunc(ctx);
+
+      unsigned long endUs = nowUs();
+      if (endUs - beginUs > stats.maxRunUs)
+      {
+        stats.maxRunUs = endUs - beginUs;
+      }
+      if ((long)(endUs - dueUs) > (long)periodUs)
+      {
+        stats.overruns++;
+      }
+      stats.ticks++;
+    }
+    if (pollFunc != nullptr)
+    {
+      pollFunc(ctx);
+      stats.polls++;
+    }
+    unlock();
+  }
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+MotionTask *MotionTask::active = nullptr;
+
+/**
+* @brief 今の時刻(us) タスクとタイマーで同じ時計
+**/
+unsigned long MotionTask::nowUs()
+{
+  return (unsigned long)esp_timer_get_time();
+}
+
+/**
+* @brief タイマーの割り込み タスクに通知するだけ
+**/
+void IRAM_ATTR MotionTask::onTimer()
+{
+  BaseType_t woken = pdFALSE;
+  if (active != nullptr && active->task != nullptr)
+  {
+    vTaskNotifyGiveFromISR(active->task, &woken);
+  }
+  if (woken == pdTRUE)
+  {
+    portYIELD_FROM_ISR();
+  }
+}
+
+/**
+* @brief タスクの入口
+**/
+void MotionTask::taskEntry(void *arg)
+{
+  MotionTask *self = static_cast<MotionTask *>(arg);
+  self->run();
+  self->task = nullptr;
+  vTaskDelete(nullptr);
+}
+
+/**
+* @brief タイマーを待つ
+* @return 前回から鳴った回数 止める時は0で戻る
+**/
+unsigned long MotionTask::waitTimer()
+{
+  return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+}
+
+/**
+* @brief タスクをコアに固定して作り、タイマーを動かす
+**/
+bool MotionTask::startBackend(byte core, byte priority)
+{
+  if (active != nullptr || mutex == nullptr)
+  {
+    return false;
+  }
+  if (xTaskCreatePinnedToCore(taskEntry, "motion", STACK_SIZE, this, priority, &task, core) != pdPASS)
+  {
+    task = nullptr;
+    return false;
+  }
+  active = this;
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  timer = timerBegin(1000000);
+  if (timer != nullptr)
+  {
+    timerAttachInterrupt(timer, &onTimer);
+    startUs = nowUs();
+    timerAlarm(timer, pollUs, true, 0);
+  }
+#else
+  timer = timerBegin(TIMER_NUM, 80, true);  // 80MHz / 80 = 1us
+  if (timer != nullptr)
+  {
+    timerAttachInterrupt(timer, &onTimer, true);
+    timerAlarmWrite(timer, pollUs, true);
+    startUs = nowUs();
+    timerAlarmEnable(timer);
+  }
+#endif
+  if (timer == nullptr)
+  {
+    stopBackend();
+    return false;
+  }
+  return true;
+}
+
+/**
+* @brief タイマーを止め、タスクが抜けるのを待つ
+**/
+void MotionTask::stopBackend()
+{
+  stopping = true;
+  if (timer != nullptr)
+  {
+    timerEnd(timer);
+    timer = nullptr;
+  }
+  while (task != nullptr)
+  {
+    delay(1);
+  }
+  active = nullptr;
+}
+
+#else
+
+/**
+* @brief 今の時刻(us) タスクとタイマーで同じ時計
+* @note ホストではHostSimの仮想時計ではなく実際の時刻
+**/
+unsigned long MotionTask::nowUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)(ts.tv_nsec / 1000);
+}
+
+/**
+* @brief タスクの代わりのスレッドの入口
+**/
+void *MotionTask::taskEntry(void *arg)
+{
+  static_cast<MotionTask *>(arg)->run();
+  return nullptr;
+}
+
+/**
+* @brief ハードウェアタイマーの代わり 絶対時刻でpollUs毎に起きて通知する
+**/
+void *MotionTask::timerEntry(void *arg)
+{
+  MotionTask *self = static_cast<MotionTask *>(arg);
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  self->startUs = (unsigned long)next.tv_sec * 1000000UL + (unsigned long)(next.tv_nsec / 1000);
+  next.tv_nsec = (next.tv_nsec / 1000) * 1000;  // startUsとそろえる
+  while (!self->stopping)
+  {
+    next.tv_nsec += (long)self->pollUs * 1000L;
+    while (next.tv_nsec >= 1000000000L)
+    {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) == EINTR)
+    {
+    }
+    pthread_mutex_lock(&self->notifyMutex);
+    self->notifyCount++;
+    pthread_cond_signal(&self->notifyCond);
+    pthread_mutex_unlock(&self->notifyMutex);
+  }
+  return nullptr;
+}
+
+/**
+* @brief タイマーを待つ
+* @return 前回から鳴った回数 止める時は0で戻る
+**/
+unsigned long MotionTask::waitTimer()
+{
+  pthread_mutex_lock(&notifyMutex);
+  while (notifyCount == 0 && !stopping)
+  {
+    pthread_cond_wait(&notifyCond, &notifyMutex);
+  }
+  unsigned long n = notifyCount;
+  notifyCount = 0;
+  pthread_mutex_unlock(&notifyMutex);
+  return n;
+}
+
+/**
+* @brief タスクとタイマーのスレッドを作る(コアと優先度は使わない)
+**/
+bool MotionTask::startBackend(byte core, byte priority)
+{
+  (void)core;
+  (void)priority;
+  notifyCount = 0;
+  if (pthread_create(&taskThread, nullptr, taskEntry, this) != 0)
+  {
+    return false;
+  }
+  if (pthread_create(&timerThread, nullptr, timerEntry, this) != 0)
+  {
+    stopping = true;
+    pthread_mutex_lock(&notifyMutex);
+    pthread_cond_signal(&notifyCond);
+    pthread_mutex_unlock(&notifyMutex);
+    pthread_join(taskThread, nullptr);
+    return false;
+  }
+  return true;
+}
+
+/**
+* @brief タイマーを止め、タスクが抜けるのを待つ
+**/
+void MotionTask::stopBackend()
+{
+  pthread_join(timerThread, nullptr);
+  pthread_mutex_lock(&notifyMutex);
+  stopping = true;
+  pthread_cond_signal(&notifyCond);
+  pthread_mutex_unlock(&notifyMutex);
+  pthread_join(taskThread, nullptr);
+}
+
+#endif
@@ -0,0 +1,163 @@
+/**
+* @file MotionTask.h
+* @brief fixed-rate motion task header file
+* @date 2026/10/17
+* @version 1.0.0
+
+* @par 概要
+* モーションの更新をloop()から外し、ハードウェアタイマーで起こす専用のタスクで一定周期に実行する。<br>
+* ESP32ではFreeRTOSのタスクを指定したコア(既定はコア1)に固定する。WiFiとlwIPのタスクはコア0で動くので、<br>
+* モーションは通信の処理に遅らされず、loop()より高い優先度で割り込んで動く。<br>
+* タイマーはポーリングの周期(pollUs)で鳴り、毎回バスを進める関数を、周期(periodUs)毎にモーションの関数を呼ぶ。<br>
+* ティック毎にタイマーの時刻からの遅れ(ジッタ)と、周期内に終わらなかった回数(オーバーラン)を数える。<br>
+* ESP32以外ではPOSIXスレッドで同じ動きをするので、ホストでテストできる(コアの指定は無視する)。
+
+* @par 使い方
+* 1. start()に周期と関数を渡す<br>
+* 2. タスクと同じデータやバスをloop()から触る時はlock()/unlock()(またはGuard)で囲む<br>
+* 3. getStats()で遅れとオーバーランを見る<br>
+* @note タイマーの割り込みは1つなので、同時に動かせるMotionTaskは1つだけ
+**/
+
+#ifndef _motion_task_h_
+#define _motion_task_h_
+
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#else
+#include <pthread.h>
+#endif
+
+//MotionTaskクラス///////////////////////////////////////////////////
+/**
+* @class MotionTask
+* @brief タイマーで起こす一定周期のモーションタスク
+**/
+class MotionTask
+{
+  //固定値
+  public:
+  static constexpr byte DEFAULT_CORE = 1;           ///< 既定のコア(WiFiはコア0)
+  static constexpr byte DEFAULT_PRIORITY = 10;      ///< 既定の優先度(loop()は1)
+  static constexpr unsigned int STACK_SIZE = 8192;  ///< タスクのスタック(バイト)
+  static constexpr byte TIMER_NUM = 0;              ///< 使うハードウェアタイマーの番号
+
+  //クラス内の型定義
+  public:
+  /**
+  * @brief タスクから呼ぶ関数
+  * @param[in] *ctx start()に渡したポインタ
+  **/
+  typedef void (*TickFunc)(void *ctx);
+
+  /**
+  * @struct Stats
+  * @brief ティックの遅れとオーバーラン
+  **/
+  struct Stats
+  {
+    unsigned long ticks;         ///< モーションの関数を呼んだ回数
+    unsigned long polls;         ///< ポーリングの関数を呼んだ回数
+    unsigned long overruns;      ///< 終わった時にタイマーの時刻から周期を過ぎていた回数
+    unsigned long missedTicks;   ///< 前のティックが長くて呼べなかったティック
+    unsigned long maxJitterUs;   ///< タイマーの時刻から呼ぶまでの遅れの最大(us)
+    unsigned long lastJitterUs;  ///< 最後のティックの遅れ(us)
+    unsigned long sumJitterUs;   ///< 遅れの合計(平均用)
+    unsigned long maxRunUs;      ///< モーションの関数の実行時間の最大(us)
+  };
+
+  /**
+  * @class Guard
+  * @brief スコープの間lock()する
+  **/
+  class Guard
+  {
+    public:
+    explicit Guard(MotionTask &task) : task(task) {task.lock();}
+    ~Guard() {task.unlock();}
+    private:
+    MotionTask &task;
+  };
+
+  //コンストラクタ、デストラクタ
+  public:
+    MotionTask();
+    ~MotionTask();
+
+  //変数
+  protected:
+  TickFunc tickFunc;            ///< 周期毎に呼ぶ関数
+  TickFunc pollFunc;            ///< タイマー毎に呼ぶ関数(nullptrなら呼ばない)
+  void *ctx;                    ///< 関数に渡すポインタ
+  unsigned long periodUs;       ///< モーションの周期(us)
+  unsigned long pollUs;         ///< タイマーの周期(us)
+  unsigned long divider;        ///< periodUs / pollUs
+  unsigned long startUs;        ///< タイマーを動かした時刻
+  unsigned long timerCount;     ///< タスクが受け取ったタイマーの回数
+  volatile bool runningFlag;    ///< 動いている
+  volatile bool stopping;       ///< 止めている途中
+  Stats stats;                  ///< 遅れとオーバーラン
+
+#if defined(ARDUINO_ARCH_ESP32)
+  TaskHandle_t task;            ///< モーションタスク
+  hw_timer_t *timer;            ///< ハードウェアタイマー
+  SemaphoreHandle_t mutex;      ///< lock()の排他
+  static MotionTask *active;    ///< 割り込みから起こすタスク
+#else
+  pthread_t taskThread;         ///< モーションタスクの代わりのスレッド
+  pthread_t timerThread;        ///< タイマーの代わりのスレッド
+  pthread_mutex_t mutex;        ///< lock()の排他
+  pthread_mutex_t notifyMutex;  ///< 通知の数の排他
+  pthread_cond_t notifyCond;    ///< 通知
+  unsigned long notifyCount;    ///< 受け取っていない通知の数
+#endif
+
+  //関数
+  public:
+    bool start(unsigned long periodUs, unsigned long pollUs, TickFunc tick, TickFunc poll, void *ctx,
+               byte core = DEFAULT_CORE, byte priority = DEFAULT_PRIORITY);
+    void stop();
+    /**
+    *	@brief タスクが動いている
+    **/
+    bool running() const {return runningFlag;}
+    /**
+    *	@brief モーションの周期(us)
+    **/
+    unsigned long getPeriodUs() const {return periodUs;}
+
+    void lock();
+    void unlock();
+
+    /**
+    *	@brief 遅れとオーバーラン
+    **/
+    const Stats &getStats() const {return stats;}
+    void resetStats();
+    /**
+    *	@brief 遅れの平均(us)
+    **/
+    unsigned long avgJitterUs() const {return (stats.ticks == 0) ? 0 : stats.sumJitterUs / stats.ticks;}
+
+    static unsigned long nowUs();
+
+  protected:
+    void run();
+    unsigned long waitTimer();
+    bool startBackend(byte core, byte priority);
+    void stopBackend();
+
+#if defined(ARDUINO_ARCH_ESP32)
+    static void taskEntry(void *arg);
+    static void IRAM_ATTR onTimer();
+#else
+    static void *taskEntry(void *arg);
+    static void *timerEntry(void *arg);
+#endif
+};
+
+#endif
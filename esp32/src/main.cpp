@@ -1,23 +1,360 @@
 #include <Arduino.h>
 #include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsMultiBus.h>
+#include <IcsScheduler.h>
+#include <IcsServoTable.h>
+#include <IcsParamProfile.h>
+#include <IcsLinkProbe.h>
+#include <MotionTask.h>
 #include "wifi_connection.h"
 #include "message_processor.h"
 #include "motion_patterns.h"
+#include "motion_math.h"
+#include "trajectory_table.h"
 
 // サーボ設定
 const byte EN_PIN = 5;
 const byte RX_PIN = 16;
 const byte TX_PIN = 17;
 const long BAUDRATE = 1250000;
-const int TIMEOUT = 20;
+const int TIMEOUT = 20;  // 受信タイムアウトの上限(ms)
+const unsigned long ICS_RESPONSE_LATENCY_US = 200;  // サーボの応答時間の見込み。タイムアウトはこれと通信速度から計算する
+const bool ICS_RS485_HW = false;  // trueにするとEN_PINをUARTのRTSとしてハードウェアで送受信を切り替える
+const bool ICS_ECHO = true;       // 送信がRXに回り込む配線(これまでの半二重の配線)ならtrue。送信したバイト数だけ読み捨てる
+                                  // 送信中に受信が止まる配線(RS485のトランシーバーなど)だけfalseにする
+const bool ICS_AUTO_RESYNC = true;  // 返信がずれていたら読み捨てて線が静かになるのを待ち、同じIDに読出しを送って確かめる
+const bool ICS_ASYNC = true;      // trueにするとモーションの送信をIcsAsyncClassで行い、返信待ちでloop()を止めない
+const unsigned long ICS_DRAIN_TIMEOUT_US = 100000;  // ブロッキング通信の前に非同期送信の完了を待つ時間
+const bool ICS_DUAL_BUS = false;  // trueにするとID4～6(左ヒレ)をSerial1に分け、左右を同時に送受信する
+const bool ICS_STREAM_POSITIONS = false;  // trueにするとポジション設定は返信を待たずに送る(返信は後から照合する)
+const byte ICS_STREAM_ACK_EVERY = 8;      // ストリーミング中もこの回数に1回は返信を待ち、返信しないサーボを見つける
+const unsigned long ICS_STREAM_LATENCY_MIN_US = 0;  // サーボの応答時間の最小値。実測して入れると応答待ちの間に次を送る
+
+// 左ヒレ用の2本目のバス(ICS_DUAL_BUSの時だけ使う) ピンは配線に合わせて変える
+const byte EN_PIN_LEFT = 4;
+const byte RX_PIN_LEFT = 25;
+const byte TX_PIN_LEFT = 26;
+const byte RIGHT_LAST_ID = 3;  // ここまでのIDをSerial2(右ヒレ)、残りをSerial1(左ヒレ)に割り当てる
+
+// サーボの状態の読出し（モーション更新の空き時間に送る）
+const bool ICS_READ_POSITION = true;  // 現在位置も読む(ICS3.6以降のサーボだけ返信する)
+const int SERVO_TEMP_WARN = 40;       // 温度の読出し値がこれ以下なら警告(値が小さいほど高温)
+
+const int SERVO_NUM = 7;  // モーションの配列の大きさ(ID1～6を使う)。実際に送るのは起動時に見つかったサーボだけ
+const unsigned long ICS_DISCOVER_TIMEOUT_US = 200000;  // 起動時の問い合わせ(全ID)を打ち切る時間
+const bool ICS_LINK_PROBE = true;  // 起動時に通信速度を順に試し、サーボが安定して返信する一番速い速度を使う(BAUDRATEは最初に試す速度)
+const unsigned int ICS_LINK_PROBE_FRAMES = 32;  // 1つの速度で読む回数
+const bool ICS_TDMA_SLOTS = true;   // trueにするとサーボ毎に周期の中の決まった時刻(スロット)に送り、前のサーボの遅れが後ろに伝わらない
+const bool ICS_TDMA_SPREAD = false; // trueにするとスロットを周期の中に等間隔に並べる(falseは周期の始めに詰め、残りを読出しに使う)
+const bool ICS_SEND_TIME_TARGETS = true;  // trueにすると遊泳の軌道をサーボ毎にポジションが届く時刻で計算する(falseは1回の時刻で全軸)
+const bool MOTION_TASK = true;  // trueにするとモーションの更新とバスの送受信を専用タスクでタイマーから一定周期に行う(falseはloop()で行う)
+const byte MOTION_TASK_CORE = 1;  // モーションタスクのコア(WiFiとlwIPはコア0で動く)
+const unsigned long MOTION_TASK_POLL_US = 500;  // バスを進める周期。モーションの周期を割り切る値にする
+
+// モード毎のサーボのパラメータ(切り替えた時に違う値だけ書き込む)
+// スピードはモーションが毎回送るので書かない。温度リミットは値が小さいほど高温まで許す
+struct ModeServoParams {
+    byte stretch;       // 1～127 大きいほど強く保持する
+    byte currentLimit;  // 1～63
+    byte tempLimit;     // 1～127
+};
+const ModeServoParams MODE_SERVO_PARAMS[] = {
+    {IcsParamProfile::KEEP, IcsParamProfile::KEEP, IcsParamProfile::KEEP},  // SERVO_OFF(脱力するので書かない)
+    {60, 40, 70},    // INIT_POSE
+    {40, 30, 70},    // STAY 弱く保持して電流と発熱を抑える
+    {100, 63, 70},   // SWIM 水の抵抗に負けないように強く
+    {80, 50, 70},    // RAISE
+    {127, 63, 60},   // EMERGENCY_SURFACE 浮上を優先して高温まで止めない
+};
+const int MODE_NUM = sizeof(MODE_SERVO_PARAMS) / sizeof(MODE_SERVO_PARAMS[0]);
+const unsigned long ICS_PROFILE_TIMEOUT_US = 10000;  // モード切り替えでパラメータを書き込む時間の上限(loop()がlock()して書くので、モーションの周期の半分)
 
-const int SERVO_NUM = 7;
+// よく使うポジション(コンパイル時に計算される)
+constexpr int POS_CENTER = IcsBaseClass::degPosCenti(0);            // 0度
+constexpr int POS_FIN_UP_RIGHT = IcsBaseClass::degPosCenti(2000);   // 右のヒレを上げる(20度)
+constexpr int POS_FIN_UP_LEFT = IcsBaseClass::degPosCenti(-2000);   // 左のヒレを上げる(-20度)
 
 // グローバル変数として定義
 IcsHardSerialClass krs(&Serial2, EN_PIN, BAUDRATE, TIMEOUT);
+IcsAsyncClass krsAsync(&krs);
+IcsHardSerialClass krsLeft(&Serial1, EN_PIN_LEFT, BAUDRATE, TIMEOUT);
+IcsAsyncClass krsLeftAsync(&krsLeft);
+IcsMultiBus servoBus;  // IDをバスに振り分ける。非同期の送受信はこちらから行う
+IcsScheduler busScheduler(&servoBus);  // モーションを優先し、読出しはティックの空き時間に送る
+IcsServoTable servoTable;  // 起動時に返信のあったサーボ(全ID)
+byte motionIds[SERVO_NUM];  // servoTableのうちモーションで使うID(1～SERVO_NUM-1)
+byte motionCount = 0;
+IcsParamProfile modeProfiles[MODE_NUM];  // CrushMode毎のパラメータ
+IcsLinkProbe linkProbes[IcsMultiBus::MAX_BUS];  // バス毎の通信品質
+unsigned long servoSlotPeriodUs = 0;  // スロットを割り当てた周期(us) 0はまだ割り当てていない
+MotionTask motionTask;  // MOTION_TASKの時、モーションの更新とpoll()を行うタスク
+
+// 読み出したサーボの状態(-1は未取得)
+struct ServoHealth {
+    int temperature = -1;
+    int current = -1;
+    int position = -1;
+};
+ServoHealth servoHealth[SERVO_NUM];
+IcsTelemetry krsTelemetry;  // ID毎の通信回数、失敗の種類、通信時間
 WiFiConnection wifiConnection;
 MessageProcessor messageProcessor;
 
+static_assert(IcsTelemetry::SNAPSHOT_MAX <= MessageProcessor::TELEMETRY_BUF_SIZE, "telemetry snapshot does not fit");
+
+// TCPのテレメトリ要求(0x60/0x61)に返すスナップショット
+size_t provideTelemetry(uint8_t* buf, size_t size, bool reset) {
+    MotionTask::Guard guard(motionTask);  // 記録はモーションタスクのバスの完了で増える
+    size_t len = krsTelemetry.snapshot(buf, size);
+    if (reset) {
+        krsTelemetry.reset();
+    }
+    return len;
+}
+
+// バス毎に通信速度を順に試して速度を選び、結果をステータス応答に載せる
+// 起動時と、TCPの通信品質の測定要求(0x70)で呼ぶ。安定した速度が全バスにあればtrue
+bool probeServoLinks() {
+    MessageProcessor::LinkStatus status;
+    bool stable = true;
+    status.baudCode = IcsLinkProbe::BAUD_NUM;  // 一番速い速度の番号から、遅いバスに合わせて下げる
+    for (byte b = 0; b < servoBus.busCount(); b++) {
+        byte ids[SERVO_NUM];
+        byte idNum = 0;
+        for (byte id = 1; id < SERVO_NUM; id++) {
+            if (servoBus.busIndexOf(id) == b) {
+                ids[idNum++] = id;
+            }
+        }
+        IcsLinkProbe &probe = linkProbes[b];
+        byte selected = probe.run(servoBus.getBus(b)->getIcs(), ids, idNum, ICS_LINK_PROBE_FRAMES);
+        Serial.printf("Link[%d]: %ld bps selected in %lu us\n", b, probe.selectedBaud(), probe.lastProbeUs());
+        for (byte i = 0; i < IcsLinkProbe::BAUD_NUM; i++) {
+            const IcsLinkProbe::Result &r = probe.result(i);
+            Serial.printf("  %ld bps: id=%d, errors=%u/%u, latency avg=%lu max=%luus%s\n", r.baudrate, r.responderId,
+                          r.errors, r.frames, r.avgLatencyUs, r.maxLatencyUs, r.stable ? " stable" : "");
+        }
+
+        // 一番悪いバスを載せる
+        if (selected == IcsLinkProbe::NO_BAUD) {
+            stable = false;
+            status.baudCode = 0;
+            status.errorPermille = 255;
+            continue;
+        }
+        const IcsLinkProbe::Result &r = probe.result(selected);
+        stable = stable && r.stable;
+        if (selected + 1 < status.baudCode) {
+            status.baudCode = selected + 1;
+        }
+        unsigned int errorPermille = (r.errorPermille() > 255) ? 255 : r.errorPermille();
+        unsigned long latencyUs = (r.avgLatencyUs > 0xFFFF) ? 0xFFFF : r.avgLatencyUs;
+        if (errorPermille > status.errorPermille) {
+            status.errorPermille = errorPermille;
+        }
+        if (latencyUs > status.latencyUs) {
+            status.latencyUs = latencyUs;
+        }
+    }
+    messageProcessor.setLinkStatus(status);
+    return stable;
+}
+
+// モーションで使うサーボにスロットを割り当てる。周期に収まらなければスロット無し(ID順にまとめて送る)
+// スロットの長さは通信速度で決まるので、速度を測り直した後も呼ぶ
+bool layoutServoSlots(unsigned long periodUs) {
+    servoSlotPeriodUs = periodUs;
+    if (!busScheduler.layoutSlots(motionIds, motionCount, periodUs, ICS_TDMA_SPREAD)) {
+        busScheduler.clearSlots();
+        Serial.printf("TDMA: slots do not fit in %lu us - sending in ID order\n", periodUs);
+        return false;
+    }
+    for (byte k = 0; k < motionCount; k++) {
+        byte id = motionIds[k];
+        Serial.printf("  Slot %d: offset=%lu us, length=%lu us\n", id, busScheduler.slotOffsetUs(id), busScheduler.slotLengthUs(id));
+    }
+    return true;
+}
+
+// 5秒ごとの通信の記録の写し
+// Serialの送信バッファが一杯になると表示で止まるので、モーションタスクのティックでは写すだけにし、loop()で表示する
+struct StatusReport {
+    byte busCount;
+    IcsBaseClass::ShadowStats shadow[IcsMultiBus::MAX_BUS];
+    IcsHardSerialClass::ResyncStats resync[IcsMultiBus::MAX_BUS];
+    IcsScheduler::Stats sched;
+    bool taskRunning;
+    MotionTask::Stats task;
+    unsigned long taskAvgJitterUs;
+    bool hasSlot[SERVO_NUM];
+    IcsScheduler::SlotStats slot[SERVO_NUM];
+    ServoHealth health[SERVO_NUM];
+    IcsAsyncClass::StreamStats stream[SERVO_NUM];
+    float streamRateHz[SERVO_NUM];
+    bool responding[SERVO_NUM];
+    IcsTelemetry::IdStats telemetry[SERVO_NUM];
+    uint32_t failures[SERVO_NUM];
+};
+StatusReport statusReport;
+volatile bool statusReportReady = false;  // 写した記録をloop()がまだ表示していない
+
+// 通信の記録を写す(ティックの中、lock()した状態で呼ぶ)
+void captureStatusReport() {
+    StatusReport &r = statusReport;
+    r.busCount = servoBus.busCount();
+    for (byte b = 0; b < r.busCount; b++) {
+        r.shadow[b] = servoBus.getBus(b)->getIcs()->getShadowStats();
+        r.resync[b] = servoBus.getBus(b)->getIcs()->getResyncStats();
+    }
+    r.sched = busScheduler.getStats();
+    r.taskRunning = motionTask.running();
+    r.task = motionTask.getStats();
+    r.taskAvgJitterUs = motionTask.avgJitterUs();
+    for (byte k = 0; k < motionCount; k++) {
+        int i = motionIds[k];
+        r.hasSlot[i] = busScheduler.hasSlot(i);
+        r.slot[i] = busScheduler.getSlotStats(i);
+        r.health[i] = servoHealth[i];
+        if (ICS_STREAM_POSITIONS) {
+            IcsAsyncClass *async = servoBus.busFor(i);
+            r.stream[i] = async->getStreamStats(i);
+            r.streamRateHz[i] = async->streamRateHz(i);
+            r.responding[i] = async->servoResponding(i);
+        }
+    }
+    for (int i = 0; i < SERVO_NUM; i++) {
+        r.telemetry[i] = krsTelemetry.get(i);
+        r.failures[i] = krsTelemetry.failures(i);
+    }
+    statusReportReady = true;
+}
+
+// 写した通信の記録を表示する(loop()でlock()の外から呼ぶ)
+void printStatusReport() {
+    if (!statusReportReady) {
+        return;
+    }
+    const StatusReport &r = statusReport;
+    // シャドウレジスタで省いた通信の数
+    for (byte b = 0; b < r.busCount; b++) {
+        Serial.printf("Shadow[%d]: skipped=%lu, written=%lu, invalidated=%lu\n", b,
+            r.shadow[b].skipped, r.shadow[b].written, r.shadow[b].invalidated);
+        // 返信のずれから再同期した回数(増え続けるなら配線やノイズを疑う)
+        const IcsHardSerialClass::ResyncStats &resync = r.resync[b];
+        if (resync.triggered > 0) {
+            Serial.printf("Resync[%d]: triggered=%lu, recovered=%lu, failed=%lu, drained=%lu, lastId=%d\n", b,
+                resync.triggered, resync.recovered, resync.failed, resync.drainedBytes, resync.lastId);
+        }
+    }
+    Serial.printf("Scheduler: motion=%lu, safety=%lu, telemetry=%lu, deferred=%lu, late=%lu\n",
+        r.sched.issued[IcsScheduler::PRIO_MOTION], r.sched.issued[IcsScheduler::PRIO_SAFETY],
+        r.sched.issued[IcsScheduler::PRIO_TELEMETRY], r.sched.deferred, r.sched.lateTicks);
+    // モーションタスクの遅れ(overrunやmissedが増えるならモーションの周期が短い)
+    if (r.taskRunning) {
+        Serial.printf("MotionTask: ticks=%lu, missed=%lu, overrun=%lu, jitter avg=%luus max=%luus, run max=%luus\n",
+            r.task.ticks, r.task.missedTicks, r.task.overruns, r.taskAvgJitterUs, r.task.maxJitterUs, r.task.maxRunUs);
+    }
+    // スロット毎の送信の遅れと超過(lateやoverrunが増えるならスロットが短い)
+    for (byte k = 0; k < motionCount; k++) {
+        int i = motionIds[k];
+        if (r.hasSlot[i]) {
+            const IcsScheduler::SlotStats &s = r.slot[i];
+            Serial.printf("Slot %d: sent=%lu, late=%lu, overrun=%lu, missed=%lu, jitter=%luus\n", i,
+                s.sent, s.late, s.overruns, s.missed, s.maxJitterUs);
+        }
+    }
+    for (byte k = 0; k < motionCount; k++) {
+        int i = motionIds[k];
+        Serial.printf("Servo %d: temp=%d, cur=%d, pos=%d\n", i,
+            r.health[i].temperature, r.health[i].current, r.health[i].position);
+    }
+    // ストリーミング中はサーボ毎の送信頻度と、サンプルACKの結果
+    for (byte k = 0; ICS_STREAM_POSITIONS && k < motionCount; k++) {
+        int i = motionIds[k];
+        const IcsAsyncClass::StreamStats &s = r.stream[i];
+        Serial.printf("Stream %d: %.1fHz, ok=%lu, bad=%lu, missing=%lu, ackFail=%lu%s\n", i,
+            r.streamRateHz[i], s.repliesOk, s.repliesBad, s.repliesMissing, s.ackFailures,
+            r.responding[i] ? "" : " NOT RESPONDING");
+    }
+    // 失敗のあったサーボだけ種類別に出す（詳細はTCPの0x60で取る）
+    for (int i = 0; i < SERVO_NUM; i++) {
+        const IcsTelemetry::IdStats &t = r.telemetry[i];
+        if (r.failures[i] > 0) {
+            Serial.printf("Servo %d: ok=%lu timeout=%lu short=%lu echo=%lu range=%lu bad=%lu max=%luus\n", i,
+                (unsigned long)t.count[IcsTelemetry::RESULT_OK],
+                (unsigned long)t.count[IcsTelemetry::RESULT_TIMEOUT],
+                (unsigned long)t.count[IcsTelemetry::RESULT_SHORT_READ],
+                (unsigned long)t.count[IcsTelemetry::RESULT_ECHO_MISMATCH],
+                (unsigned long)t.count[IcsTelemetry::RESULT_OUT_OF_RANGE],
+                (unsigned long)t.count[IcsTelemetry::RESULT_BAD_REPLY],
+                (unsigned long)t.maxUs);
+        }
+    }
+    statusReportReady = false;
+}
+
+// ティックとlock()の中で起きたことの記録
+// ティックとpoll()、lock()の中ではSerialに書かず(送信バッファが一杯になるとティックが止まる)、ここに残してloop()で表示する
+struct TickEvents {
+    bool modeChanged;
+    int modeFrom;
+    int modeTo;
+    unsigned long failures[SERVO_NUM];  // 送受信に失敗した数
+    bool hot[SERVO_NUM];                // 温度が警告の値を超えた
+    byte temperature[SERVO_NUM];
+    unsigned long busySkips;            // バスが空かず更新を見送った数
+    int busyPending;
+    bool emergencyStarted;
+    int emergencyPhase;                 // 緊急浮上の段階が変わった(0は変わっていない)
+    bool profileApplied;                // モードのパラメータを書き込んだ
+    int profileMode;
+    bool profileOk;
+    IcsParamProfile::ApplyStats profile;
+};
+TickEvents tickEvents;
+volatile bool tickEventsPending = false;  // 表示していない記録がある
+
+// 記録を表示する(loop()でlock()の外から呼ぶ 写す間だけlock()する)
+void printTickEvents() {
+    if (!tickEventsPending) {
+        return;
+    }
+    TickEvents e;
+    {
+        MotionTask::Guard guard(motionTask);
+        e = tickEvents;
+        memset(&tickEvents, 0, sizeof(tickEvents));
+        tickEventsPending = false;
+    }
+    if (e.modeChanged) {
+        Serial.printf("Mode changed from %d to %d\n", e.modeFrom, e.modeTo);
+    }
+    if (e.profileApplied) {
+        const IcsParamProfile::ApplyStats &s = e.profile;
+        Serial.printf("Profile %d %s: read=%lu, matched=%lu, skipped=%lu, written=%lu, verifyFail=%lu, %luus\n", e.profileMode,
+                      e.profileOk ? "ok" : "FAILED", s.reads, s.matched, s.skipped, s.writes, s.verifyFailures, s.elapsedUs);
+    }
+    if (e.emergencyStarted) {
+        Serial.println("Emergency Surface Mode Started");
+    }
+    static const char *const EMERGENCY_PHASES[] = {"", "STAY mode", "INIT_POSE", "SERVO_OFF"};
+    if (e.emergencyPhase > 0 && e.emergencyPhase <= 3) {
+        Serial.printf("Emergency Phase %d: %s\n", e.emergencyPhase, EMERGENCY_PHASES[e.emergencyPhase]);
+    }
+    for (int i = 0; i < SERVO_NUM; i++) {
+        if (e.failures[i] > 0) {
+            Serial.printf("Failed servo transaction for servo %d (%lu times)\n", i, e.failures[i]);
+        }
+        if (e.hot[i]) {
+            Serial.printf("WARNING: servo %d is hot (temperature=%d)\n", i, e.temperature[i]);
+        }
+    }
+    if (e.busySkips > 0) {
+        Serial.printf("Servo bus busy (%d pending) - skipped %lu updates\n", e.busyPending, e.busySkips);
+    }
+}
+
 WiFiClient currentClient;
 
 // エラーステータス
@@ -72,6 +409,8 @@ protected:
     
     unsigned long lastMotionUpdate = 0;
     const unsigned long MOTION_UPDATE_INTERVAL = 50;  // 20ms間隔で更新
+    volatile bool motionActive = false;  // モーションタスクで更新する(loop()が決める)
+    TrajectoryBank trajectories;  // 遊泳・浮遊の1周期分のポジション表(2枚を入れ替える)
 
     virtual void updateMotion() = 0;
     virtual void handleEmergencySurface() = 0;  // 追加
@@ -96,13 +435,23 @@ public:
         //モータのシリアル通信
         Serial2.begin(BAUDRATE, SERIAL_8E1, RX_PIN, TX_PIN, false, TIMEOUT);
         delay(100);
-        krs.begin();
-
-        // EN_PINの設定を追加 この部分を消すと通信はうまく行くがサーボがonにならない
-        //この部分があるとサーボがonになるが通信がうまく行かない
-        pinMode(EN_PIN, OUTPUT);
-        digitalWrite(EN_PIN, HIGH); 
-        delay(50); 
+        setupServoBus(krs, krsAsync, EN_PIN);
+        if (ICS_DUAL_BUS) {
+            Serial1.begin(BAUDRATE, SERIAL_8E1, RX_PIN_LEFT, TX_PIN_LEFT, false, TIMEOUT);
+            delay(100);
+            setupServoBus(krsLeft, krsLeftAsync, EN_PIN_LEFT);
+            servoBus.addBus(&krsAsync, 0, RIGHT_LAST_ID);
+            servoBus.addBus(&krsLeftAsync, RIGHT_LAST_ID + 1, IcsBaseClass::MAX_ID);
+        } else {
+            servoBus.addBus(&krsAsync, 0, IcsBaseClass::MAX_ID);
+        }
+        if (ICS_LINK_PROBE) {
+            probeServoLinks();  // 返信する速度がわからないと問い合わせもできないので先に測る
+        }
+        discoverServos();
+        buildModeProfiles();
+        messageProcessor.setTelemetryProvider(provideTelemetry);
+        messageProcessor.setLinkProbeHandler(requestLinkProbe);
 
 
 
@@ -112,6 +461,80 @@ public:
         }
     }
 
+    // 1本のバスの設定（UARTのbegin()は済ませておく）
+    static void setupServoBus(IcsHardSerialClass &ics, IcsAsyncClass &async, byte enPin) {
+        if (ICS_RS485_HW) {
+            ics.setTransportMode(IcsHardSerialClass::TRANSPORT_RS485_HW);
+        }
+        // 返信しないサーボで20ms止まらないように、コマンド毎にusでタイムアウトを決める
+        ics.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+        ics.setResponseLatencyUs(ICS_RESPONSE_LATENCY_US);
+        ics.setLatencyLearning(true);
+        ics.setEcho(ICS_ECHO);
+        ics.setAutoResync(ICS_AUTO_RESYNC);
+        ics.begin();
+        async.setStreaming(ICS_STREAM_POSITIONS ? ICS_STREAM_ACK_EVERY : 0, ICS_STREAM_LATENCY_MIN_US);
+
+        // EN_PINの設定を追加 この部分を消すと通信はうまく行くがサーボがonにならない
+        //この部分があるとサーボがonになるが通信がうまく行かない
+        // RS485モードではEN_PINはUARTのRTSなので触らない
+        if (ics.getTransportMode() == IcsHardSerialClass::TRANSPORT_GPIO) {
+            pinMode(enPin, OUTPUT);
+            digitalWrite(enPin, HIGH); 
+            delay(50); 
+        }
+        async.attachUartEvent();
+        ics.enableShadow(true);  // 同じスピードを毎回書き込まない
+        ics.attachTelemetry(&krsTelemetry);  // IDはバスで重ならないので1つにまとめる
+    }
+
+    // 全IDに短いタイムアウトで問い合わせ、返信のあったサーボだけを使う（バスが2本なら同時に進む）
+    // TCPの通信品質の測定要求。送信中の非同期トランザクションを終わらせてから測る
+    static bool requestLinkProbe() {
+        MotionTask::Guard guard(motionTask);  // 測定の間はバスをモーションタスクに使わせない
+        busScheduler.endTicks();
+        servoBus.waitAll(ICS_DRAIN_TIMEOUT_US);
+        bool stable = probeServoLinks();
+        if (servoSlotPeriodUs != 0) {
+            layoutServoSlots(servoSlotPeriodUs);
+        }
+        return stable;
+    }
+
+    static void discoverServos() {
+        byte found = servoTable.discover(&servoBus, 0, IcsBaseClass::MAX_ID, ICS_DISCOVER_TIMEOUT_US);
+        Serial.printf("Servo discovery: %d found in %lu us\n", found, servoTable.lastDiscoverUs());
+        motionCount = 0;
+        for (byte k = 0; k < servoTable.count(); k++) {
+            byte id = servoTable.idAt(k);
+            const IcsServoTable::Entry &e = servoTable.get(id);
+            Serial.printf("  ID %d: ICS%d.%d pos=%d\n", id, e.icsVersion / 10, e.icsVersion % 10, e.position);
+            if (id >= 1 && id < SERVO_NUM) {
+                motionIds[motionCount++] = id;
+            }
+        }
+        // サーボの電源が後から入った時に動かなくならないように、1つも無ければ全部使う
+        if (motionCount == 0) {
+            Serial.println("No servos found - using all motion IDs");
+            for (byte id = 1; id < SERVO_NUM; id++) {
+                servoTable.add(id);
+                motionIds[motionCount++] = id;
+            }
+        }
+        krsTelemetry.reset();  // 居ないIDのタイムアウトは数えない
+    }
+
+    // MODE_SERVO_PARAMSをモーションで使うIDに入れる
+    static void buildModeProfiles() {
+        for (int m = 0; m < MODE_NUM; m++) {
+            const ModeServoParams &p = MODE_SERVO_PARAMS[m];
+            modeProfiles[m].clear();
+            for (byte k = 0; k < motionCount; k++) {
+                modeProfiles[m].set(motionIds[k], p.stretch, IcsParamProfile::KEEP, p.currentLimit, p.tempLimit);
+            }
+        }
+    }
+
     virtual void loop() {
         static bool hasReceivedFirstCommand = false;  // 初回コマンド受信フラグ
         static unsigned long lastClientActivity = 0;
@@ -122,14 +545,30 @@ public:
         static WiFiClient currentClient;  // クライアントをstatic変数として保持
         static bool hasClient = false;    // クライアント接続状態を保持
 
+        // モーションタスクを動かす(動かせなければloop()で更新する)
+        static bool motionTaskTried = false;
+        if (MOTION_TASK && !motionTaskTried) {
+            motionTaskTried = true;
+            startMotionTask();
+        }
+        const bool taskDriven = motionTask.running();
+
         // 初回コマンドを受信するまではサーボオフ
         if (!hasReceivedFirstCommand) {
             if (currentMode != CrushMode::SERVO_OFF) {
-                currentMode = CrushMode::SERVO_OFF;
+                MotionTask::Guard guard(motionTask);
+                publishMode(CrushMode::SERVO_OFF);
                 setServoOff();
             }
         }
 
+        // 非同期のサーボ通信を進め、空いていれば状態の読出しを送る（全バス）
+        // モーションタスクがあればタスクが行う
+        if (!taskDriven) {
+            queueServoReads();
+            busScheduler.poll();
+        }
+
         // wifi接続
         wifiConnection.handleConnection();
 
@@ -139,7 +578,8 @@ public:
         // タイムアウトチェックをループの最初で実行
         if (!isTimeout && hasReceivedFirstCommand && (currentTime - lastClientActivity > CLIENT_TIMEOUT)) {
             Serial.println("Activity timeout - switching to SERVO_OFF");
-            currentMode = CrushMode::SERVO_OFF;
+            MotionTask::Guard guard(motionTask);
+            publishMode(CrushMode::SERVO_OFF);
             setServoOff();
             isTimeout = true;
             hasClient = false;  // クライアント接続状態もリセット
@@ -168,6 +608,7 @@ public:
                 wifiConnection.handleConnection();   
                 currentTime = millis();  // ループ内で時刻を更新 
 
+                // 受信と応答はロックの外で行い、TCPの書き込みが遅れてもモーションタスクを止めない
                 if (messageProcessor.processMessage(currentClient)) {
                     hasReceivedFirstCommand = true;  // 初回コマンド受信フラグを立てる
                     lastClientActivity = currentTime;  // メッセージを受信したら時間を更新
@@ -177,9 +618,28 @@ public:
                     auto mode = messageProcessor.getCurrentMode();
                     auto params = messageProcessor.getCurrentParams();
                     auto wingMode = messageProcessor.getCurrentWingMode();
-                    currentMode = mode;
-                    currentParams = params;  // パラメータを保存
-                    currentWingMode = wingMode;  // パラメータを保存
+                    const TrajectoryTable* trajectory = nullptr;
+                    {
+                        MotionTask::Guard guard(motionTask);  // モードとパラメータを書き換える間だけ
+                        publishMode(mode);
+                        currentParams = params;  // パラメータを保存
+                        currentWingMode = wingMode;  // パラメータを保存
+                        // 新しいパラメータの軌道表はここで作り、ティックでは引くだけにする
+                        unsigned long swaps = trajectories.swapCount();
+                        if (mode == CrushMode::SWIM) {
+                            trajectory = prepareTrajectory(TrajectoryTable::KIND_SWIM, params);
+                        } else if (mode == CrushMode::STAY) {
+                            trajectory = prepareTrajectory(TrajectoryTable::KIND_STAY, params);
+                        }
+                        if (trajectories.swapCount() == swaps) {
+                            trajectory = nullptr;  // 作り直していない
+                        }
+                    }
+                    if (trajectory != nullptr) {
+                        Serial.printf("Trajectory: %s %u samples, %u bytes, compiled in %lu us\n",
+                            (trajectory->getKind() == TrajectoryTable::KIND_SWIM) ? "swim" : "stay",
+                            trajectory->sampleCount(), (unsigned int)trajectory->usedBytes(), trajectory->compileTimeUs());
+                    }
 
                     // デバッグ出力を追加
                     Serial.printf("Mode: %d, Period: %.2f, Wing: %.1f, Max: %.1f, Y: %.2f\n",
@@ -195,7 +655,8 @@ public:
                 // タイムアウトチェックをループ内でも実行
                 if (!isTimeout && (currentTime - lastClientActivity > CLIENT_TIMEOUT)) {
                     Serial.println("Activity timeout - switching to EMERGENCY_SURFACE");
-                    currentMode = CrushMode::EMERGENCY_SURFACE;
+                    MotionTask::Guard guard(motionTask);
+                    publishMode(CrushMode::EMERGENCY_SURFACE);
                     handleEmergencySurface();
                     isTimeout = true;
                 }
@@ -211,7 +672,8 @@ public:
             handleWifiDisconnection();
             if (!isTimeout) {
                 Serial.println("WiFi disconnected - switching to SERVO_OFF");
-                currentMode = CrushMode::SERVO_OFF;
+                MotionTask::Guard guard(motionTask);
+                publishMode(CrushMode::SERVO_OFF);
                 setServoOff();
                 isTimeout = true;
             }
@@ -219,18 +681,153 @@ public:
         }
 
                 // 継続的なモーション更新（クライアント接続状態に関係なく実行）
-        if (!isTimeout &&hasReceivedFirstCommand) {
+        motionActive = !isTimeout && hasReceivedFirstCommand;
+        if (!taskDriven && motionActive) {
             if (currentTime - lastMotionUpdate >= MOTION_UPDATE_INTERVAL) {
+                if (ICS_TDMA_SLOTS && servoSlotPeriodUs == 0) {
+                    layoutServoSlots(MOTION_UPDATE_INTERVAL * 1000UL);  // ティックの周期はここで決まる
+                }
+                busScheduler.beginTick(MOTION_UPDATE_INTERVAL * 1000UL);  // 読出しは次のティックまでに終わるものだけ送る
                 updateMotion();
                 lastMotionUpdate = currentTime;
             }
         }
+        printTickEvents();    // ティックの中で起きたことと
+        printStatusReport();  // ティックで写した記録はここで表示する
     }
 
 protected:
+    // タイマーで起こすモーションタスクを動かす。loop()より高い優先度でコア1に置く
+    void startMotionTask() {
+        if (motionTask.start(MOTION_UPDATE_INTERVAL * 1000UL, MOTION_TASK_POLL_US, onMotionTick, onMotionPoll, this, MOTION_TASK_CORE)) {
+            Serial.printf("Motion task: %lu us period, %lu us poll, core %d\n", MOTION_UPDATE_INTERVAL * 1000UL, MOTION_TASK_POLL_US, MOTION_TASK_CORE);
+            // バスはタイマー毎にしか進まないので、スロットはpoll()の時刻に揃え、遅れの許容も1回分にする
+            MotionTask::Guard guard(motionTask);
+            busScheduler.setJitterUs(MOTION_TASK_POLL_US);
+            busScheduler.setPollUs(MOTION_TASK_POLL_US);
+            if (ICS_TDMA_SLOTS) {
+                layoutServoSlots(motionTask.getPeriodUs());  // 表示があるのでティックの中では割り当てない
+            }
+        } else {
+            Serial.println("Motion task failed to start - updating motion in loop()");
+        }
+    }
+
+    // パラメータの軌道表を用意する。今の表と同じなら作らない(lock()した状態かティックの中で呼ぶ)
+    // ティックの中で表示しないように、作り直した時の表示は呼んだ側で行う
+    const TrajectoryTable* prepareTrajectory(TrajectoryTable::Kind kind, const SwimParameters& params) {
+        unsigned long tickUs = motionTask.running() ? motionTask.getPeriodUs() : CrushMain::MOTION_UPDATE_INTERVAL * 1000UL;
+        return trajectories.prepare(kind, TrajectoryShape::of(params), tickUs);
+    }
+
+    // モーションタスクの周期毎(lock()した状態で呼ばれる)
+    static void onMotionTick(void *ctx) {
+        CrushMain *self = static_cast<CrushMain *>(ctx);
+        if (!self->motionActive) {
+            return;
+        }
+        if (ICS_TDMA_SLOTS && servoSlotPeriodUs == 0) {
+            layoutServoSlots(motionTask.getPeriodUs());
+        }
+        busScheduler.beginTick(motionTask.getPeriodUs());
+        self->updateMotion();
+    }
+
+    // モーションタスクのタイマー毎。非同期の送受信を進め、空いていれば読出しを送る
+    static void onMotionPoll(void *ctx) {
+        (void)ctx;
+        queueServoReads();
+        busScheduler.poll();
+    }
+
+    // 温度(安全)と電流・位置(バックグラウンド)を1軸ずつ順番にキューに置く
+    static void queueServoReads() {
+        static byte safetyIndex = 0;     // motionIdsの何番目か
+        static byte telemetryIndex = 0;
+        static bool readPosition = false;
+
+        if (busScheduler.queuedReads(IcsScheduler::PRIO_SAFETY) == 0) {
+            byte id = motionIds[safetyIndex];
+            busScheduler.requestRead(IcsScheduler::PRIO_SAFETY, id, IcsBaseClass::SC_TMP, onTemperatureRead, &servoHealth[id]);
+            safetyIndex = (safetyIndex + 1) % motionCount;
+        }
+        if (busScheduler.queuedReads(IcsScheduler::PRIO_TELEMETRY) == 0) {
+            byte id = motionIds[telemetryIndex];
+            // 位置はICS3.6以降だけ返信する(ICS3.5は電流だけ読む)
+            bool position = readPosition && servoTable.get(id).icsVersion != IcsServoTable::VERSION_35;
+            if (position) {
+                busScheduler.requestRead(IcsScheduler::PRIO_TELEMETRY, id, IcsBaseClass::SC_POS, onPositionRead, &servoHealth[id]);
+            } else if (!readPosition) {
+                busScheduler.requestRead(IcsScheduler::PRIO_TELEMETRY, id, IcsBaseClass::SC_CUR, onCurrentRead, &servoHealth[id]);
+            }
+            if (readPosition || !ICS_READ_POSITION) {
+                telemetryIndex = (telemetryIndex + 1) % motionCount;
+            }
+            readPosition = ICS_READ_POSITION && !readPosition;
+        }
+    }
+
+    static void onTemperatureRead(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx) {
+        (void)handle;
+        (void)rxLen;
+        if (!ok) {
+            return;
+        }
+        ServoHealth *h = static_cast<ServoHealth *>(ctx);
+        h->temperature = rxBuf[2];
+        if (h->temperature <= SERVO_TEMP_WARN) {
+            int id = (int)(h - servoHealth);
+            tickEvents.hot[id] = true;  // 表示はloop()
+            tickEvents.temperature[id] = h->temperature;
+            tickEventsPending = true;
+        }
+    }
+
+    static void onCurrentRead(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx) {
+        (void)handle;
+        (void)rxLen;
+        if (ok) {
+            static_cast<ServoHealth *>(ctx)->current = rxBuf[2];
+        }
+    }
+
+    static void onPositionRead(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx) {
+        (void)handle;
+        (void)rxLen;
+        if (ok) {
+            static_cast<ServoHealth *>(ctx)->position = IcsCommand::decodePos(rxBuf[2], rxBuf[3]);
+        }
+    }
+
+    // モードのパラメータを書き込む(読んで違う値だけ書き、確かめる 結果の表示はloop())
+    void applyModeProfile(CrushMode mode) {
+        int m = static_cast<int>(mode);
+        if (m < 0 || m >= MODE_NUM) {
+            return;
+        }
+        tickEvents.profileOk = modeProfiles[m].apply(&servoBus, &servoTable, ICS_PROFILE_TIMEOUT_US);
+        tickEvents.profile = modeProfiles[m].getApplyStats();
+        tickEvents.profileMode = m;
+        tickEvents.profileApplied = true;
+        tickEventsPending = true;
+    }
+
+    // モードをモーションタスクに渡す(loop()でlock()した状態で呼ぶ)
+    // 変わる時はパラメータを先に書き込むので、ティックは待ちの長い書込みをせず、新しいモードは書き込んだ後に動く
+    void publishMode(CrushMode mode) {
+        if (mode != currentMode) {
+            applyModeProfile(mode);  // ストレッチとリミットをモードに合わせる
+        }
+        currentMode = mode;
+    }
+
     void setServoOff() {
-        for (int i = 0; i < SERVO_NUM; ++i) {
-            krs.setFree(i);//変換したデータをID:0に送る
+        // 送信中の非同期トランザクションとバスを取り合わないように先に終わらせる
+        busScheduler.endTicks();
+        servoBus.waitAll(ICS_DRAIN_TIMEOUT_US);
+        for (byte k = 0; k < servoTable.count(); ++k) {
+            byte id = servoTable.idAt(k);
+            servoBus.icsFor(id)->setFree(id);  // 居るサーボだけ(居ないIDでタイムアウトを待たない)
         }
     }
 
@@ -295,14 +892,17 @@ private:
 
 protected:
     void updateMotion() override {
-        auto mode = messageProcessor.getCurrentMode();
-        auto params = messageProcessor.getCurrentParams();
+        // loop()がlock()の中で写したモード(受信中のmessageProcessorはタスクから読まない)
+        CrushMode mode = CrushMain::currentMode;
         // WiFi通信が来ても、モードが同じなら継続
         if (mode != currentMode) {
-            // モードが変更された時のみ初期化処理を行う
-            Serial.printf("Mode changed from %d to %d\n", static_cast<int>(currentMode), static_cast<int>(mode));
+            // モードが変更された時のみ初期化処理を行う(表示はloop())
+            tickEvents.modeChanged = true;
+            tickEvents.modeFrom = static_cast<int>(currentMode);
+            tickEvents.modeTo = static_cast<int>(mode);
+            tickEventsPending = true;
             currentMode = mode;
-            cycleTimer.reset();  // タイマーをリセット
+            cycleTimer.reset();  // タイマーをリセット(パラメータはloop()がモードを渡す前に書き込んだ)
             // その他の初期化処理
         }
         
@@ -349,50 +949,140 @@ private:
         
     // }
 
+    static void onServoTransactionDone(int handle, bool ok, const byte *rxBuf, byte rxLen, void *ctx) {
+        (void)handle;
+        (void)rxBuf;
+        (void)rxLen;
+        if (!ok) {
+            tickEvents.failures[*static_cast<const int *>(ctx)]++;  // 表示はloop()
+            tickEventsPending = true;
+        }
+    }
+
     void sendVec2ServoPos(int posVec[SERVO_NUM], int speedVec[SERVO_NUM]){
         //static int defaultSpeed[SERVO_NUM] = {127, 127, 127, 127, 127, 127, 127};
         static int defaultSpeed[SERVO_NUM] = {50, 50, 50, 50, 50, 50, 50};
         if (speedVec == nullptr) {
             speedVec = defaultSpeed;
         }
-        
+        if (ICS_ASYNC) {
+            sendVec2ServoPosAsync(posVec, speedVec);
+        } else {
+            sendVec2ServoPosBlocking(posVec, speedVec);
+        }
+
+        // 通信の記録(5秒ごと) ティックの中では写すだけで、表示はloop()で行う
+        static unsigned long lastShadowReport = 0;
+        if (millis() - lastShadowReport > 5000 && !statusReportReady) {
+            captureStatusReport();
+            lastShadowReport = millis();
+        }
+    }
+
+    // 返信を待たずにキューに積み、loop()のpoll()で送受信する
+    // 失敗したサーボは次の更新で新しい目標値を送るのでリトライしない
+    void sendVec2ServoPosAsync(int posVec[SERVO_NUM], int speedVec[SERVO_NUM]){
+        static const int servoIds[SERVO_NUM] = {0, 1, 2, 3, 4, 5, 6};
+
+        // スロットがあれば置くだけで、poll()がサーボ毎の時刻に送る(送れなかったスロットは次のティックで見送りとして数える)
+        if (busScheduler.hasSlot(motionIds[0])) {
+            for (byte k = 0; k < motionCount; ++k) {
+                int i = motionIds[k];
+                void *ctx = const_cast<int *>(&servoIds[i]);
+                busScheduler.stageMotion(i, posVec[i], speedVec[i], onServoTransactionDone, ctx);  // スピードは前回と同じ値なら送らない
+            }
+            return;
+        }
+
+        // 前回の更新がまだ終わっていなければ、キューを溜めないように今回は送らない
+        // バスが2本なら左右のキューは別々に進む
+        if (servoBus.busy()) {
+            tickEvents.busySkips++;  // 表示はloop()
+            tickEvents.busyPending = servoBus.pending();
+            tickEventsPending = true;
+            return;
+        }
+
+        for (byte k = 0; k < motionCount; ++k) {
+            int i = motionIds[k];
+            void *ctx = const_cast<int *>(&servoIds[i]);
+            busScheduler.submitMotionParam(i, IcsBaseClass::SC_SPD, speedVec[i], onServoTransactionDone, ctx);  // 前回と同じ値なら送らない
+            busScheduler.submitMotionPos(i, posVec[i], onServoTransactionDone, ctx);
+        }
+        servoBus.poll();  // 各バスの最初のフレームはすぐに送る
+    }
+
+    void sendVec2ServoPosBlocking(int posVec[SERVO_NUM], int speedVec[SERVO_NUM]){
         // 各サーボについて最大5回までリトライ
         const int MAX_RETRY = 5;
+
+        // 読出しはティックまでに終わっているはずだが、完了の処理を済ませてからバスを使う
+        servoBus.waitAll(ICS_DRAIN_TIMEOUT_US);
         
-        for (int i = 1; i < SERVO_NUM; ++i) {
-        //for (int i = 0; i < SERVO_NUM; ++i) {
+        for (byte k = 0; k < motionCount; ++k) {
+            int i = motionIds[k];
             // スピード設定
             int retryCount = 0;
             bool speedSet = false;
             while (retryCount < MAX_RETRY && !speedSet) {
-                if (krs.setSpd(i, speedVec[i]) != -1) {
+                if (servoBus.icsFor(i)->setSpd(i, speedVec[i]) != -1) {
                     speedSet = true;
                 } else {
                     retryCount++;
                     if (retryCount == MAX_RETRY) {
-                        Serial.printf("Failed to set speed for servo %d\n", i);
+                        tickEvents.failures[i]++;  // 表示はloop()
+                        tickEventsPending = true;
                     }
                 }
             }
-            
-            // ポジション設定
-            retryCount = 0;
-            bool posSet = false;
-            while (retryCount < MAX_RETRY && !posSet) {
-                if (krs.setPos(i, posVec[i]) != -1) {
-                    posSet = true;
-                } else {
-                    retryCount++;
-                    if (retryCount == MAX_RETRY) {
-                        Serial.printf("Failed to set position for servo %d\n", i);
-                    }
+        }
+
+        // ポジション設定（全サーボを一括送信し、失敗したIDだけリトライ）
+        byte ids[SERVO_NUM];
+        unsigned int positions[SERVO_NUM];
+        int rePos[SERVO_NUM];
+        byte count = 0;
+        for (byte k = 0; k < motionCount; ++k) {
+            ids[count] = motionIds[k];
+            positions[count] = posVec[motionIds[k]];
+            count++;
+        }
+
+        for (int retryCount = 0; retryCount < MAX_RETRY && count > 0; ++retryCount) {
+            if (servoBus.busCount() > 1) {
+                setPosJoined(ids, positions, count, rePos);  // 左右のバスを同時に使う
+            } else {
+                krs.setPosMulti(ids, positions, count, rePos);
+            }
+
+            // 失敗したIDを前に詰めて次の試行に回す
+            byte failed = 0;
+            for (byte k = 0; k < count; ++k) {
+                if (rePos[k] == -1) {
+                    ids[failed] = ids[k];
+                    positions[failed] = positions[k];
+                    failed++;
                 }
             }
-            
-            Serial.printf("Servo %d: pos=%d, speed=%d\n", i, posVec[i], speedVec[i]);
-            
-            // 各サーボ設定後に短い待機時間を入れる
-            delay(1);
+            count = failed;
+        }
+        for (byte k = 0; k < count; ++k) {
+            tickEvents.failures[ids[k]]++;  // 表示はloop()
+            tickEventsPending = true;
+        }
+    }
+
+    // setPosMultiと同じ形で、全バスに積んでから揃うまで待つ（ティック毎に合流する）
+    void setPosJoined(const byte *ids, const unsigned int *positions, byte count, int *rePos) {
+        int handles[SERVO_NUM];
+        for (byte k = 0; k < count; ++k) {
+            handles[k] = servoBus.submitSetPos(ids[k], positions[k]);
+        }
+        servoBus.waitAll(ICS_DRAIN_TIMEOUT_US);
+        for (byte k = 0; k < count; ++k) {
+            IcsAsyncClass *bus = servoBus.busFor(ids[k]);
+            bool ok = bus != nullptr && bus->status(handles[k]) == IcsAsyncClass::STATUS_DONE;
+            rePos[k] = ok ? bus->result(handles[k]) : -1;
         }
     }
 
@@ -400,7 +1090,7 @@ private:
         // if (currentMode == CrushMode::INIT_POSE) {
             int positions[SERVO_NUM];
             int speeds[SERVO_NUM] = {30, 30, 30, 30, 30, 30, 30};
-            int pos = krs.degPos(0);
+            int pos = POS_CENTER;
             for (int i = 1; i < SERVO_NUM; ++i) {
                 positions[i] = pos;
             }
@@ -416,32 +1106,18 @@ private:
         unsigned long currentTime = millis();
         //double timeRatio = fmod(currentTime, PERIOD_MS) / PERIOD_MS;  // 0.0 ~ 1.0の値
         //double currentAngle = MAX_ANGLE * sin(TWO_PI * timeRatio);    // -30 ~ +30度
-            // paramsを使用して処理
-    double timeRatio = fmod(currentTime, params.periodSec * 1000.0) / (params.periodSec * 1000.0);
-    double currentAngle = params.maxAngleDeg * sin(TWO_PI * timeRatio);
+            // paramsを使用して処理(1周期分のポジション表を引くだけ。表はパラメータが変わった時に作る)
+    const TrajectoryTable* trajectory = prepareTrajectory(TrajectoryTable::KIND_STAY, params);
+    MotionMath::Phase phase = trajectory->phaseAt(currentTime, 0);
 
         // サーボの位置と速度を設定
         int positions[SERVO_NUM] = {0};  // 0番は使わない
         int speeds[SERVO_NUM] = {127, 127, 127, 127, 127, 127, 127};  // 一定速度
         
-            // wingdegをラジアンに変換
-            double WING_DEG = 0.0;
-
-            double wingRad = WING_DEG * PI / 180.0;
-            
-            // サーボの角度を計算
-            double angle1 = currentAngle * cos(wingRad);  // サーボ1,4用
-            double angle2 = currentAngle * sin(wingRad);  // サーボ2,5用
-        
-            // 各サーボに角度を設定
-        positions[1] = krs.degPos(angle1);  // 右の上下
-        positions[2] = krs.degPos(angle2);  // 右の前後
-        positions[4] = krs.degPos(-angle1);  // 左の上下
-        positions[5] = krs.degPos(-angle2);  // 左の前後
-        
-        // 3番と6番は0度に維持
-        positions[3] = krs.degPos(0);
-        positions[6] = krs.degPos(0);
+            // 翼の角度は0度なので、上下(サーボ1,4)だけ動かし前後(サーボ2,5)と3番・6番は中心
+        for (int i = 1; i < SERVO_NUM; i++) {
+            positions[i] = trajectory->positionAt(i, phase);
+        }
         
         // サーボに送信
         sendVec2ServoPos(positions, speeds);
@@ -449,7 +1125,7 @@ private:
         // デバッグ出力（500msごと）
         static unsigned long lastDebugTime = 0;
         if (currentTime - lastDebugTime > 500) {
-            Serial.printf("Stay Mode: Current angle = %.2f\n", currentAngle);
+            Serial.printf("Stay Mode: Current angle = %.2f\n", IcsBaseClass::posCentiDeg(positions[1]) / 100.0f);
             lastDebugTime = currentTime;
         }
     }
@@ -511,60 +1187,37 @@ void handleSwimMode(const SwimParameters& params) {
     // const double LEFT_RATE = 1.0;  //0.8       // 左の振幅率
     // const double WING_ROTATION = 30.0;    // 翼の回転角度
 
-    double PERIOD_MS = params.periodSec * 1000.0;      // 2秒周期
-    double MAX_ANGLE = params.maxAngleDeg;        // 振幅±30度
-    double WING_DEG = params.wingDeg;         // 翼角度
-    double RIGHT_RATE = (1.0 + params.yRate) / 2.0; //1.2       // 右の振幅率（1.0より大きいと右に曲がる）
-    double LEFT_RATE =  (1.0 - params.yRate) / 2.0;  //0.8       // 左の振幅率
-    double WING_ROTATION = 30.0;    // 翼の回転角度
+    // 周期・振幅・sinはパラメータが変わった時に1周期分のポジション表にしておき、ここではサーボ毎の位相で引くだけ
+    const TrajectoryTable* trajectory = prepareTrajectory(TrajectoryTable::KIND_SWIM, params);
 
-    
-    // 現在の時間から基本角度を計算
+    // サーボ毎にポジションが届くまでの時間(us)。後に送るサーボほど遅いので、その時刻の軌道を送る
     unsigned long currentTime = millis();
-    double timeRatio = fmod(currentTime, PERIOD_MS) / PERIOD_MS;
-    double baseAngle = MAX_ANGLE * sin(TWO_PI * timeRatio);
-    
-    // 翼の方向計算
-    double wingRad = WING_DEG * PI / 180.0;
-    
-    // 左右の振幅調整
-    double rightAngle1 = baseAngle * RIGHT_RATE * cos(wingRad);
-    double rightAngle2 = baseAngle * RIGHT_RATE * sin(wingRad);
-    double leftAngle1 = baseAngle * LEFT_RATE * cos(wingRad);
-    double leftAngle2 = baseAngle * LEFT_RATE * sin(wingRad);
-    
-    // 3番と6番サーボの制御（前進動作用）
-    double rotationAngle = 0.0;
-    if (!params.isBackward) {  // 前進の場合
-        // baseAngle2が正から負に変化する領域（前から後ろに動かすとき）で90度
-        if (cos(TWO_PI * timeRatio) < 0) {
-            rotationAngle = WING_ROTATION;
-        }
-    } else {  // 後退の場合
-        // baseAngle2が負から正に変化する領域（後ろから前に動かすとき）で90度
-        if (cos(TWO_PI * timeRatio) > 0) {
-            rotationAngle = WING_ROTATION;
+    unsigned long offsetUs[SERVO_NUM] = {0};
+    if (ICS_SEND_TIME_TARGETS) {
+        unsigned long nowUs = micros();
+        unsigned long sendUs[SERVO_NUM];
+        busScheduler.predictSendUs(motionIds, motionCount, sendUs);
+        for (byte k = 0; k < motionCount; k++) {
+            offsetUs[motionIds[k]] = IcsScheduler::sendOffsetUs(sendUs[k], nowUs);
         }
     }
-    
+
     int positions[SERVO_NUM] = {0};
     int speeds[SERVO_NUM] = {127, 127, 127, 30, 127, 127, 30};
-    
-    // 各サーボに角度を設定
-    positions[1] = krs.degPos(rightAngle1);   // 右の上下
-    positions[2] = krs.degPos(rightAngle2);   // 右の前後
-    positions[3] = krs.degPos(rotationAngle); // 右の回転
-    positions[4] = krs.degPos(-leftAngle1);   // 左の上下
-    positions[5] = krs.degPos(-leftAngle2);   // 左の前後
-    positions[6] = krs.degPos(rotationAngle); // 左の回転
+    for (int i = 1; i < SERVO_NUM; i++) {
+        // 1,2番は右の上下・前後、4,5番は左の上下・前後
+        // 3番と6番は翼の回転(前進はcosが負、後退はcosが正の半周だけ回す)
+        positions[i] = trajectory->positionAt(i, trajectory->phaseAt(currentTime, offsetUs[i]));
+    }
     
     sendVec2ServoPos(positions, speeds);
     
     // デバッグ出力
     static unsigned long lastDebugTime = 0;
     if (currentTime - lastDebugTime > 500) {
-        Serial.printf("Swim Mode: Base=%.2f, Right=%.2f, Left=%.2f, Rotation=%.2f\n",
-            baseAngle, rightAngle1, leftAngle1, rotationAngle);
+        Serial.printf("Swim Mode: Right=%.2f, Left=%.2f, Rotation=%.2f\n",
+            IcsBaseClass::posCentiDeg(positions[1]) / 100.0f, -IcsBaseClass::posCentiDeg(positions[4]) / 100.0f,
+            IcsBaseClass::posCentiDeg(positions[3]) / 100.0f);
         lastDebugTime = currentTime;
     }
 }
@@ -649,10 +1302,10 @@ void handleRaiseMode(const WingUpMode& wingMode) {
     int speeds[SERVO_NUM] = {30, 30, 30, 30, 30, 30, 30};  // servo2,5のみ速度80
     
     // servo1,3,4,6は0度
-    positions[1] = krs.degPos(0);
-    positions[3] = krs.degPos(0);
-    positions[4] = krs.degPos(0);
-    positions[6] = krs.degPos(0);
+    positions[1] = POS_CENTER;
+    positions[3] = POS_CENTER;
+    positions[4] = POS_CENTER;
+    positions[6] = POS_CENTER;
     
     // // servo2,5は30度
     // positions[2] = krs.degPos(20);
@@ -662,18 +1315,18 @@ void handleRaiseMode(const WingUpMode& wingMode) {
     
     switch(wingMode) {
         case WingUpMode::RIGHT:
-            positions[2] = krs.degPos(20);  // 右のヒレのみ上げる
-            positions[5] = krs.degPos(0);
+            positions[2] = POS_FIN_UP_RIGHT;  // 右のヒレのみ上げる
+            positions[5] = POS_CENTER;
             break;
             
         case WingUpMode::LEFT:
-            positions[5] = krs.degPos(-20);  // 左のヒレのみ上げる
-            positions[2] = krs.degPos(0);
+            positions[5] = POS_FIN_UP_LEFT;  // 左のヒレのみ上げる
+            positions[2] = POS_CENTER;
             break;
             
         case WingUpMode::BOTH:
-            positions[2] = krs.degPos(20);   // 両方のヒレを上げる
-            positions[5] = krs.degPos(-20);
+            positions[2] = POS_FIN_UP_RIGHT;   // 両方のヒレを上げる
+            positions[5] = POS_FIN_UP_LEFT;
             break;
     }
     
@@ -746,17 +1399,21 @@ void handleEmergencySurface() {
     static bool emergencyInitialized = false;
     const unsigned long EMERGENCY_STAY_DURATION = 5000;  // 3秒間
     static CrushMode previousEmergencyMode = CrushMode::SERVO_OFF;
+    static int emergencyPhase = 0;  // 表示した段階(段階が変わった時だけloop()で表示する)
     
     // 緊急浮上モードに入った時の初期化
     if (previousEmergencyMode != CrushMode::EMERGENCY_SURFACE) {
         emergencyStartTime = millis();
         emergencyInitialized = true;
         previousEmergencyMode = CrushMode::EMERGENCY_SURFACE;
-        Serial.println("Emergency Surface Mode Started");
+        emergencyPhase = 0;
+        tickEvents.emergencyStarted = true;
+        tickEventsPending = true;
     }
     
     unsigned long currentTime = millis();
     unsigned long elapsedTime = currentTime - emergencyStartTime;
+    int phase = 0;
     
     if (elapsedTime <= EMERGENCY_STAY_DURATION) {
         // フェーズ1: 3秒間STAYモードで浮上動作
@@ -765,20 +1422,25 @@ void handleEmergencySurface() {
         stayParams.maxAngleDeg = 20.0;  // 大きめの角度で浮上
         stayParams.wingDeg = 0.0;       // 真上に動かす
         handleStayMode(stayParams);
-        Serial.println("Emergency Phase 1: STAY mode");
+        phase = 1;
     } else if (elapsedTime <= EMERGENCY_STAY_DURATION + 1000) {  // +1秒
         // フェーズ2: INIT_POSEに遷移
         handleInitMode();
-        Serial.println("Emergency Phase 2: INIT_POSE");
+        phase = 2;
     } else {
         // フェーズ3: SERVO_OFF
         setServoOff();
-        Serial.println("Emergency Phase 3: SERVO_OFF");
+        phase = 3;
         
         // 緊急モードの完了後、モードを変更
         currentMode = CrushMode::SERVO_OFF;
         emergencyInitialized = false;
     }
+    if (phase != emergencyPhase) {
+        emergencyPhase = phase;
+        tickEvents.emergencyPhase = phase;
+        tickEventsPending = true;
+    }
 }
 
 };
@@ -4,7 +4,9 @@
 MessageProcessor::MessageProcessor() 
     : currentMode(CrushMode::INIT_POSE)
     , currentWingMode(WingUpMode::BOTH)
-    , isMouthOpen(false) {
+    , isMouthOpen(false)
+    , telemetryProvider(nullptr)
+    , linkProbeHandler(nullptr) {
 }
 
 float MessageProcessor::bytesToFloat(const uint8_t* bytes) {
@@ -104,6 +106,18 @@ bool MessageProcessor::processMessage(WiFiClient& client) {
             sendResponse(client, 0x00);
             break;
 
+        case 0x07: // 通信品質の測定 (結果はステータス応答に載る)
+            if (linkProbeHandler == nullptr) {
+                sendResponse(client, 0xE0);
+            } else {
+                sendResponse(client, linkProbeHandler() ? 0x00 : 0xE4);
+            }
+            break;
+
+        case 0x06: // テレメトリ要求 (サブコマンド1は送った後に記録を消す)
+            telemetryResponse(client, subCommand == 0x01);
+            break;
+
         case 0x0F: // ステータス要求
             statusResponse(client);
             break;
@@ -115,10 +129,28 @@ bool MessageProcessor::processMessage(WiFiClient& client) {
     return true;
 }
 
+// 応答: モード, 角度x10(int16 LE), エラーフラグ, 通信速度の番号, 誤り率(千分率), 読出しの時間(uint16 LE us)
 void MessageProcessor::statusResponse(WiFiClient& client) {
     uint8_t response[8] = {0};
     response[0] = static_cast<uint8_t>(currentMode);
     int16_t currentAngle = static_cast<int16_t>(currentParams.wingDeg * 10);
     memcpy(response + 1, &currentAngle, 2);
+    response[4] = linkStatus.baudCode;
+    response[5] = linkStatus.errorPermille;
+    memcpy(response + 6, &linkStatus.latencyUs, 2);
     client.write(response, sizeof(response));
+}
+
+// 応答: 0x00, 長さ(uint16 LE), スナップショット
+void MessageProcessor::telemetryResponse(WiFiClient& client, bool reset) {
+    static uint8_t buffer[3 + TELEMETRY_BUF_SIZE];  // WiFiのタスクのスタックに載せない
+    if (telemetryProvider == nullptr) {
+        sendResponse(client, 0xE0);
+        return;
+    }
+    size_t len = telemetryProvider(buffer + 3, TELEMETRY_BUF_SIZE, reset);
+    buffer[0] = 0x00;
+    buffer[1] = len & 0xFF;
+    buffer[2] = (len >> 8) & 0xFF;
+    client.write(buffer, 3 + len);
 }
\ No newline at end of file
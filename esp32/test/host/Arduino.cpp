@@ -0,0 +1,87 @@
+// test/host/Arduino.cpp
+// 仮想時計とGPIOの模擬
+#include "Arduino.h"
+
+namespace {
+    unsigned long g_nowUs = 0;
+    unsigned long g_gpioLatencyUs = 0;
+    unsigned long g_microsStepUs = 0;
+
+    const int MAX_PINS = 64;
+    uint8_t g_pinState[MAX_PINS];
+    unsigned long g_pinWrites[MAX_PINS];
+
+    struct ListenerEntry {
+        HostSim::PinListener fn;
+        void* ctx;
+    };
+    const int MAX_LISTENERS = 8;
+    ListenerEntry g_listeners[MAX_LISTENERS];
+}
+
+namespace HostSim {
+    unsigned long nowUs() { return g_nowUs; }
+    void advanceUs(unsigned long us) { g_nowUs += us; }
+    void resetClock() {
+        g_nowUs = 0;
+        g_microsStepUs = 0;
+        memset(g_pinWrites, 0, sizeof(g_pinWrites));
+    }
+    void setGpioLatencyUs(unsigned long us) { g_gpioLatencyUs = us; }
+    void setMicrosStepUs(unsigned long us) { g_microsStepUs = us; }
+
+    void addPinListener(PinListener listener, void* ctx) {
+        for (int i = 0; i < MAX_LISTENERS; i++) {
+            if (g_listeners[i].fn == nullptr) {
+                g_listeners[i].fn = listener;
+                g_listeners[i].ctx = ctx;
+                return;
+            }
+        }
+    }
+
+    void removePinListener(PinListener listener, void* ctx) {
+        for (int i = 0; i < MAX_LISTENERS; i++) {
+            if (g_listeners[i].fn == listener && g_listeners[i].ctx == ctx) {
+                g_listeners[i].fn = nullptr;
+                g_listeners[i].ctx = nullptr;
+            }
+        }
+    }
+
+    unsigned long pinWriteCount(uint8_t pin) {
+        return pin < MAX_PINS ? g_pinWrites[pin] : 0;
+    }
+}
+
+unsigned long millis() { return g_nowUs / 1000; }
+unsigned long micros() {
+    unsigned long now = g_nowUs;
+    g_nowUs += g_microsStepUs;
+    return now;
+}
+void delay(unsigned long ms) { g_nowUs += ms * 1000; }
+void delayMicroseconds(unsigned int us) { g_nowUs += us; }
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    g_nowUs += g_gpioLatencyUs;
+    if (pin >= MAX_PINS) {
+        return;
+    }
+    g_pinState[pin] = val;
+    g_pinWrites[pin]++;
+    for (int i = 0; i < MAX_LISTENERS; i++) {
+        if (g_listeners[i].fn != nullptr) {
+            g_listeners[i].fn(pin, val, g_listeners[i].ctx);
+        }
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < MAX_PINS ? g_pinState[pin] : LOW;
+}
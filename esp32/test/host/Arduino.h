@@ -0,0 +1,59 @@
+// test/host/Arduino.h
+// ホスト(Linux)上でICSライブラリをビルドするための最小限のArduino互換層
+// 時間は仮想時計で進むので、通信タイミングを再現性のある形で確認できる
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define ICS_HOST_MOCK 1
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT  0x01
+#define OUTPUT 0x03
+
+#define SERIAL_8N1 0x800001c
+#define SERIAL_8E1 0x800001e
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+namespace HostSim {
+    // 仮想時計(us)
+    unsigned long nowUs();
+    void advanceUs(unsigned long us);
+    void resetClock();
+    // micros() 1回毎に進める時間(実機のように呼ぶ間にも時計が進むことを模擬する resetClock()で0に戻る)
+    void setMicrosStepUs(unsigned long us);
+
+    // digitalWrite 1回にかかる時間(ソフトウェアでの切替の遅れを模擬する)
+    void setGpioLatencyUs(unsigned long us);
+
+    // ピンの変化を受け取るリスナー
+    typedef void (*PinListener)(uint8_t pin, uint8_t val, void *ctx);
+    void addPinListener(PinListener listener, void *ctx);
+    void removePinListener(PinListener listener, void *ctx);
+    unsigned long pinWriteCount(uint8_t pin);
+}
+
+#include "HardwareSerial.h"
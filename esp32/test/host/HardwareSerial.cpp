@@ -0,0 +1,315 @@
+// test/host/HardwareSerial.cpp
+// モックUARTの実装
+#include "Arduino.h"
+
+namespace {
+    const unsigned long NO_EVENT = (unsigned long)-1;
+    const unsigned long BITS_PER_BYTE = 11;  // 8E1: start + 8 + parity + stop
+
+    void pinListener(uint8_t pin, uint8_t val, void* ctx) {
+        static_cast<HardwareSerial*>(ctx)->handlePin(pin, val);
+    }
+}
+
+HardwareSerial::HardwareSerial(int uartNum)
+    : uartNum_(uartNum), baud_(115200), timeoutMs_(1000), begun_(false),
+      mode_(UART_MODE_UART), rtsPin_(-1), dirPin_(-1), echo_(false),
+      rxTimeoutSymbols_(2), onReceive_(nullptr), txBusyUntil_(0), lastEventUs_(0),
+      peer_(nullptr) {
+    memset(&stats_, 0, sizeof(stats_));
+    HostSim::addPinListener(pinListener, this);
+}
+
+HardwareSerial::~HardwareSerial() {
+    HostSim::removePinListener(pinListener, this);
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin,
+                           bool invert, unsigned long timeoutMs, uint8_t rxfifoFull) {
+    (void)config;
+    (void)rxPin;
+    (void)txPin;
+    (void)invert;
+    (void)rxfifoFull;
+    baud_ = baud;
+    timeoutMs_ = timeoutMs;
+    begun_ = true;
+}
+
+void HardwareSerial::end() {
+    begun_ = false;
+    rx_.clear();
+}
+
+unsigned long HardwareSerial::byteTimeNs() const {
+    return (BITS_PER_BYTE * 1000000000UL) / baud_;
+}
+
+bool HardwareSerial::setPins(int8_t rxPin, int8_t txPin, int8_t ctsPin, int8_t rtsPin) {
+    (void)rxPin;
+    (void)txPin;
+    (void)ctsPin;
+    if (rtsPin >= 0) {
+        rtsPin_ = rtsPin;
+    }
+    return true;
+}
+
+bool HardwareSerial::setMode(SerialMode mode) {
+    if (mode == UART_MODE_RS485_HALF_DUPLEX && rtsPin_ < 0) {
+        return false;  // RTSピンが無いと方向制御できない
+    }
+    mode_ = mode;
+    return true;
+}
+
+bool HardwareSerial::setRxTimeout(uint8_t symbols) {
+    if (symbols > 92) {  // ESP32のUARTで設定できる上限
+        return false;
+    }
+    rxTimeoutSymbols_ = symbols;
+    return true;
+}
+
+void HardwareSerial::onReceive(OnReceiveCb cb, bool onlyOnTimeout) {
+    (void)onlyOnTimeout;
+    onReceive_ = cb;
+}
+
+void HardwareSerial::setDirPin(int pin) {
+    dirPin_ = pin;
+}
+
+bool HardwareSerial::driverEnabled() const {
+    if (mode_ == UART_MODE_RS485_HALF_DUPLEX) {
+        return HostSim::nowUs() < txBusyUntil_;
+    }
+    if (dirPin_ < 0) {
+        return true;  // 方向ピンが無い(全二重)
+    }
+    return digitalRead(dirPin_) == HIGH;
+}
+
+void HardwareSerial::handlePin(uint8_t pin, uint8_t val) {
+    if (mode_ == UART_MODE_RS485_HALF_DUPLEX || (int)pin != dirPin_) {
+        return;
+    }
+    unsigned long now = HostSim::nowUs();
+    // 送信方向になっている間に送られてきた返信は取りこぼす
+    for (size_t i = 0; i < rx_.size();) {
+        const RxByte& b = rx_[i];
+        bool lost = false;
+        if (b.fromPeer) {
+            if (val == LOW && b.startUs < now) {
+                lost = true;   // 受信に切り替える前に始まっていた
+            }
+            if (val == HIGH && b.visibleUs > now) {
+                lost = true;   // まだ受信中に送信へ切り替えた
+            }
+        }
+        if (lost) {
+            rx_.erase(rx_.begin() + i);
+            stats_.collisions++;
+        } else {
+            i++;
+        }
+    }
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t len) {
+    if (!begun_ || len == 0) {
+        return 0;
+    }
+    unsigned long now = HostSim::nowUs();
+    unsigned long startUs = now > txBusyUntil_ ? now : txBusyUntil_;
+
+    if (mode_ != UART_MODE_RS485_HALF_DUPLEX && !driverEnabled()) {
+        // 受信方向のまま送った: 線には出ない
+        stats_.lostTxBytes += len;
+        return len;
+    }
+
+    unsigned long byteNs = byteTimeNs();
+    unsigned long endUs = startUs + (len * byteNs + 999) / 1000;
+    txBusyUntil_ = endUs;
+    stats_.txFrames++;
+    stats_.txBytes += len;
+    if (mode_ == UART_MODE_RS485_HALF_DUPLEX) {
+        stats_.rtsToggles += 2;
+    }
+
+    if (echo_) {
+        // 自分の送信の回り込み
+        unsigned long visibleUs = endUs + (rxTimeoutSymbols_ * byteNs + 999) / 1000;
+        mergeBurst(startUs, visibleUs);
+        for (size_t i = 0; i < len; i++) {
+            RxByte b;
+            b.data = buf[i];
+            b.startUs = startUs + (i * byteNs) / 1000;
+            b.visibleUs = visibleUs;
+            b.fromPeer = false;
+            rx_.push_back(b);
+        }
+    }
+    if (mode_ == UART_MODE_RS485_HALF_DUPLEX) {
+        // 送信中に線に出ていた返信のバイトは取りこぼす
+        unsigned long byteUs = (byteNs + 999) / 1000;
+        for (size_t i = 0; i < rx_.size();) {
+            if (rx_[i].fromPeer && rx_[i].startUs < endUs && rx_[i].startUs + byteUs > startUs) {
+                rx_.erase(rx_.begin() + i);
+                stats_.collisions++;
+            } else {
+                i++;
+            }
+        }
+    }
+    if (peer_ != nullptr) {
+        peer_->onFrame(*this, buf, len, endUs);
+    }
+    return len;
+}
+
+void HardwareSerial::injectRx(const uint8_t* data, size_t len, unsigned long startUs) {
+    unsigned long byteNs = byteTimeNs();
+    unsigned long lastUs = startUs + (len * byteNs + 999) / 1000;
+    // FIFOのデータは線が rxTimeoutSymbols 分静かになってから読めるようになる
+    unsigned long visibleUs = lastUs + (rxTimeoutSymbols_ * byteNs + 999) / 1000;
+    mergeBurst(startUs, visibleUs);
+
+    for (size_t i = 0; i < len; i++) {
+        RxByte b;
+        b.data = data[i];
+        b.startUs = startUs + (i * byteNs) / 1000;
+        b.visibleUs = visibleUs;
+        b.fromPeer = true;
+
+        // ハードウェア切替では送信が終わるまでは受信できない
+        if (mode_ == UART_MODE_RS485_HALF_DUPLEX && b.startUs < txBusyUntil_) {
+            stats_.collisions++;
+            continue;
+        }
+
+        size_t pos = rx_.size();
+        while (pos > 0 && rx_[pos - 1].startUs > b.startUs) {
+            pos--;
+        }
+        rx_.insert(rx_.begin() + pos, b);
+    }
+}
+
+void HardwareSerial::mergeBurst(unsigned long startUs, unsigned long visibleUs) {
+    // 線が静かになる前に次のバイトが来たら、FIFOタイムアウトは次のバーストの後まで延びる
+    // (エコーの直後に返信が始まると、両方がまとめて読めるようになる)
+    for (size_t i = 0; i < rx_.size(); i++) {
+        if (rx_[i].visibleUs > startUs && rx_[i].visibleUs < visibleUs) {
+            rx_[i].visibleUs = visibleUs;
+        }
+    }
+}
+
+void HardwareSerial::resetHost() {
+    rx_.clear();
+    txBusyUntil_ = 0;
+    lastEventUs_ = 0;
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void HardwareSerial::pumpEvents() {
+    if (onReceive_ == nullptr) {
+        return;
+    }
+    unsigned long now = HostSim::nowUs();
+    for (size_t i = 0; i < rx_.size(); i++) {
+        if (rx_[i].visibleUs > lastEventUs_ && rx_[i].visibleUs <= now) {
+            lastEventUs_ = now;
+            stats_.rxEvents++;
+            onReceive_();
+            return;
+        }
+    }
+}
+
+int HardwareSerial::available() {
+    pumpEvents();
+    unsigned long now = HostSim::nowUs();
+    int count = 0;
+    for (size_t i = 0; i < rx_.size() && rx_[i].visibleUs <= now; i++) {
+        count++;
+    }
+    return count;
+}
+
+int HardwareSerial::peek() {
+    if (available() == 0) {
+        return -1;
+    }
+    return rx_.front().data;
+}
+
+int HardwareSerial::read() {
+    if (available() == 0) {
+        return -1;
+    }
+    uint8_t c = rx_.front().data;
+    rx_.erase(rx_.begin());
+    stats_.rxReadCalls++;
+    return c;
+}
+
+size_t HardwareSerial::read(uint8_t* buf, size_t len) {
+    size_t n = (size_t)available();
+    if (n > len) {
+        n = len;
+    }
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = rx_[i].data;
+    }
+    rx_.erase(rx_.begin(), rx_.begin() + n);
+    if (n > 0) {
+        stats_.rxReadCalls++;
+    }
+    return n;
+}
+
+void HardwareSerial::flush() {
+    unsigned long now = HostSim::nowUs();
+    if (txBusyUntil_ > now) {
+        HostSim::advanceUs(txBusyUntil_ - now);
+    }
+}
+
+unsigned long HardwareSerial::nextVisibleUs() const {
+    if (rx_.empty()) {
+        return NO_EVENT;
+    }
+    return rx_.front().visibleUs;
+}
+
+size_t HardwareSerial::readBytes(uint8_t* buf, size_t len) {
+    size_t count = 0;
+    while (count < len) {
+        // Stream::timedRead と同じく1バイトごとにタイムアウトを測る
+        unsigned long deadline = HostSim::nowUs() + timeoutMs_ * 1000;
+        int c = read();
+        while (c < 0) {
+            unsigned long next = nextVisibleUs();
+            unsigned long now = HostSim::nowUs();
+            if (next == NO_EVENT || next > deadline) {
+                if (deadline > now) {
+                    HostSim::advanceUs(deadline - now);
+                }
+                return count;
+            }
+            if (next > now) {
+                HostSim::advanceUs(next - now);
+            }
+            c = read();
+        }
+        buf[count++] = (uint8_t)c;
+    }
+    return count;
+}
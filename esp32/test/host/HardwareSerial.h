@@ -0,0 +1,114 @@
+// test/host/HardwareSerial.h
+// ESP32のHardwareSerialと同じ形で使えるモックUART
+// 送信フレームを接続先(HostUartPeer)に渡し、返信をバイト単位の到着時刻付きで受信キューに積む
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <functional>
+
+typedef int SerialMode;
+#define UART_MODE_UART 0x00
+#define UART_MODE_RS485_HALF_DUPLEX 0x01
+
+typedef std::function<void(void)> OnReceiveCb;
+
+class HardwareSerial;
+
+// バスの向こう側(サーボやシミュレータ)
+class HostUartPeer {
+public:
+    virtual ~HostUartPeer() {}
+    // 1回のwriteで送られたデータを受け取る。endUsは最後のバイトの送信完了時刻
+    virtual void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) = 0;
+};
+
+class HardwareSerial {
+public:
+    explicit HardwareSerial(int uartNum = 0);
+    ~HardwareSerial();
+
+    void begin(unsigned long baud, uint32_t config = 0x800001c, int8_t rxPin = -1, int8_t txPin = -1,
+               bool invert = false, unsigned long timeoutMs = 20000UL, uint8_t rxfifoFull = 112);
+    void end();
+
+    int available();
+    int peek();
+    int read();
+    // 届いている分をlenバイトまで読む(待たない)。ESP32のread(buffer, size)と同じ
+    size_t read(uint8_t* buf, size_t len);
+    void flush();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buf, size_t len);
+    size_t readBytes(uint8_t* buf, size_t len);
+    void setTimeout(unsigned long timeoutMs) { timeoutMs_ = timeoutMs; }
+    unsigned long getTimeout() const { return timeoutMs_; }
+
+    // ESP32固有のAPI
+    bool setPins(int8_t rxPin, int8_t txPin, int8_t ctsPin = -1, int8_t rtsPin = -1);
+    bool setMode(SerialMode mode);
+    bool setRxTimeout(uint8_t symbols);
+    void onReceive(OnReceiveCb cb, bool onlyOnTimeout = false);
+    void updateBaudRate(unsigned long baud) { baud_ = baud; }
+
+    // ---- ここからホスト専用 ----
+    void attachPeer(HostUartPeer* peer) { peer_ = peer; }
+    // GPIOで送受信を切り替える場合の方向ピン(HIGHで送信)
+    void setDirPin(int pin);
+    // 自分の送信が受信側に回り込む(エコーが返る)配線かどうか
+    void setEcho(bool echo) { echo_ = echo; }
+    // 接続先からの返信を積む。startUsは最初のバイトの送信開始時刻
+    void injectRx(const uint8_t* data, size_t len, unsigned long startUs);
+    // 受信キューと統計をクリア
+    void resetHost();
+
+    unsigned long baudRate() const { return baud_; }
+    // 1バイト(8E1 = 11bit)の時間
+    unsigned long byteTimeNs() const;
+    unsigned long txBusyUntilUs() const { return txBusyUntil_; }
+    bool isBegun() const { return begun_; }
+    SerialMode mode() const { return mode_; }
+    uint8_t rxTimeoutSymbols() const { return rxTimeoutSymbols_; }
+
+    struct Stats {
+        unsigned long txFrames;     ///< 送信したフレーム数
+        unsigned long txBytes;      ///< 送信したバイト数
+        unsigned long lostTxBytes;  ///< 受信方向のまま送ろうとして捨てられたバイト数
+        unsigned long collisions;   ///< 送信方向のままで取りこぼした返信バイト数
+        unsigned long rtsToggles;   ///< ハードウェアでの方向切替回数
+        unsigned long rxEvents;     ///< onReceiveコールバックの呼び出し回数
+        unsigned long rxReadCalls;  ///< データを取り出したread()/read(buf, len)の呼び出し回数
+    };
+    const Stats& stats() const { return stats_; }
+
+    void handlePin(uint8_t pin, uint8_t val);
+
+private:
+    struct RxByte {
+        uint8_t data;
+        unsigned long startUs;   // 送信開始
+        unsigned long visibleUs; // readできるようになる時刻
+        bool fromPeer;
+    };
+
+    bool driverEnabled() const;
+    void pumpEvents();
+    unsigned long nextVisibleUs() const;
+    void mergeBurst(unsigned long startUs, unsigned long visibleUs);
+
+    int uartNum_;
+    unsigned long baud_;
+    unsigned long timeoutMs_;
+    bool begun_;
+    SerialMode mode_;
+    int8_t rtsPin_;
+    int dirPin_;
+    bool echo_;
+    uint8_t rxTimeoutSymbols_;
+    OnReceiveCb onReceive_;
+    unsigned long txBusyUntil_;
+    unsigned long lastEventUs_;
+    HostUartPeer* peer_;
+    std::vector<RxByte> rx_;
+    Stats stats_;
+};
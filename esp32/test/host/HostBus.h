@@ -0,0 +1,59 @@
+// test/host/HostBus.h
+// ホスト上のサーボバス1本(モックUART + IcsBusSim + IcsHardSerialClass + IcsAsyncClass)
+// ライブラリのテストで共通の組み立て。通信速度、UARTの番号、ENピン、送受信の切替方法を変えて何本でも作れる
+// テスト毎の違い(シャドウレジスタ、エコー、テレメトリなど)は作った後に設定するか、継承して足す
+#pragma once
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include "IcsBusSim.h"
+
+namespace HostSim {
+    // 仮想時計を0に戻し、digitalWriteの遅れを無くす(テストの始めに呼ぶ)
+    inline void setupClock() {
+        resetClock();
+        setGpioLatencyUs(0);
+    }
+}
+
+// 作る時に仮想時計を0に戻す(HostBusより先に継承すると、バスを作る前に戻る)
+struct HostClock {
+    HostClock() { HostSim::setupClock(); }
+};
+
+struct HostBus {
+    static const int TIMEOUT = 20;        // 受信タイムアウト(ms) 返信の待ち時間は通信速度から求める
+    static const int DEFAULT_UART = 2;
+    static const byte DEFAULT_EN_PIN = 5;
+
+    HardwareSerial uart;
+    IcsBusSim sim;
+    IcsHardSerialClass ics;
+    IcsAsyncClass async;
+
+    // baud: ICSとサーボの通信速度(サーボだけ変えるならsim.setBaud())
+    // transport: TRANSPORT_RS485_HWならUARTが送受信を切り替える(enPinはRTS)
+    explicit HostBus(long baud, int uartNum = DEFAULT_UART, byte enPin = DEFAULT_EN_PIN,
+                     IcsHardSerialClass::TransportMode transport = IcsHardSerialClass::TRANSPORT_GPIO)
+        : uart(uartNum), sim(baud), ics(&uart, enPin, baud, TIMEOUT), async(&ics) {
+        uart.resetHost();
+        uart.attachPeer(&sim);
+        uart.setDirPin(enPin);  // RS485では使われない
+        ics.setTransportMode(transport);
+        ics.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+        ics.begin();
+    }
+
+    // ID first～lastの模擬サーボを置く
+    void addServos(byte first, byte last) {
+        for (byte id = first; id <= last; id++) {
+            sim.addServo(id);
+        }
+    }
+
+    // 送ったバイトが線から返ってくる配線(UARTとICSの両方に設定する)
+    void setEcho(bool echo) {
+        uart.setEcho(echo);
+        ics.setEcho(echo);
+    }
+};
@@ -0,0 +1,258 @@
+// test/host/IcsBusSim.cpp
+// ICSバスシミュレータの実装
+#include "IcsBusSim.h"
+#include <IcsCommand.h>
+#include <stdlib.h>
+
+IcsBusSim::IcsBusSim(long baud) : baud_(baud), replyNext_(0), rng_(1) {
+    memset(servos_, 0, sizeof(servos_));
+    memset(replyStartUs_, 0, sizeof(replyStartUs_));
+    memset(replyEndUs_, 0, sizeof(replyEndUs_));
+    memset(&global_, 0, sizeof(global_));
+    memset(berBaud_, 0, sizeof(berBaud_));
+    memset(berPpm_, 0, sizeof(berPpm_));
+    resetStats();
+}
+
+unsigned long IcsBusSim::frameTimeUs(size_t len) const {
+    return (len * 11UL * 1000000UL + baud_ - 1) / baud_;
+}
+
+IcsBusSim::Servo& IcsBusSim::addServo(byte id, byte icsVersion) {
+    Servo& s = servo(id);
+    memset(&s, 0, sizeof(s));
+    s.present = true;
+    s.icsVersion = icsVersion;
+    s.position = 7500;
+    s.target = 7500;
+    s.free = true;            // 電源投入直後は脱力している
+    s.stretch = 60;           // KRSの初期値
+    s.speed = 127;
+    s.currentLimit = 63;
+    s.tempLimit = 80;
+    s.current = 0;
+    s.temperature = 90;       // 値が大きいほど低温
+    s.latencyUs = DEFAULT_LATENCY_US;
+    s.lastUpdateUs = HostSim::nowUs();
+    return s;
+}
+
+void IcsBusSim::removeServo(byte id) {
+    servo(id).present = false;
+}
+
+void IcsBusSim::resetStats() {
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+uint32_t IcsBusSim::nextRandom() {
+    // xorshift32 (シードが同じなら毎回同じ)
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 17;
+    rng_ ^= rng_ << 5;
+    return rng_;
+}
+
+bool IcsBusSim::chance(unsigned int permille) {
+    return permille > 0 && (nextRandom() % 1000) < permille;
+}
+
+bool IcsBusSim::setBitErrorPpm(long baud, unsigned long ppm) {
+    for (int i = 0; i < MAX_BER_ENTRIES; i++) {
+        if (berBaud_[i] == baud || berBaud_[i] == 0) {
+            berBaud_[i] = baud;
+            berPpm_[i] = ppm;
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned long IcsBusSim::bitErrorPpm(long baud) const {
+    for (int i = 0; i < MAX_BER_ENTRIES; i++) {
+        if (berBaud_[i] == baud) {
+            return berPpm_[i];
+        }
+    }
+    return 0;
+}
+
+// 1バイト(8E1 = 11bit)のどこかにビット誤りが起きるか
+bool IcsBusSim::byteError() {
+    unsigned long ppm = bitErrorPpm(baud_);
+    return ppm > 0 && (nextRandom() % 1000000UL) < ppm * 11;
+}
+
+void IcsBusSim::update(Servo& s, unsigned long nowUs) {
+    // 時計を戻した(resetClock)ときは進んでいないことにする
+    unsigned long dt = ((long)(nowUs - s.lastUpdateUs) > 0) ? nowUs - s.lastUpdateUs : 0;
+    s.lastUpdateUs = nowUs;
+    if (s.free || s.position == s.target) {
+        return;
+    }
+    // スピードに比例した速さで目標へ近づく
+    long step = (long)((double)dt * MAX_SLEW_POS_PER_MS * s.speed / 127.0 / 1000.0);
+    long diff = s.target - s.position;
+    if (labs(diff) <= step) {
+        s.position = s.target;
+    } else {
+        s.position += (diff > 0) ? step : -step;
+    }
+}
+
+bool IcsBusSim::overlapsReply(unsigned long startUs, unsigned long endUs) const {
+    for (int i = 0; i < REPLY_HISTORY; i++) {
+        if (replyEndUs_[i] != 0 && startUs < replyEndUs_[i] && endUs > replyStartUs_[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t IcsBusSim::process(const byte* tx, size_t len, byte* reply, unsigned long endUs, unsigned long& replyStartUs) {
+    stats_.frames++;
+    if (len < 2) {
+        stats_.ignored++;
+        return 0;
+    }
+    // 半二重なので、返信が線に出ている間に送られたフレームはサーボに届かない
+    if (overlapsReply(endUs - frameTimeUs(len), endUs)) {
+        stats_.collisions++;
+        return 0;
+    }
+    // ビット誤りのあるフレームはパリティかコマンドの形でサーボが捨てる
+    for (size_t i = 0; i < len; i++) {
+        if (byteError()) {
+            stats_.txBitErrors++;
+            return 0;
+        }
+    }
+
+    byte cmd = tx[0] & IcsCommand::CMD_MASK;
+    byte id = IcsCommand::idOf(tx[0]);
+    Servo& s = servo(id);
+    if (!s.present) {
+        stats_.ignored++;
+        return 0;
+    }
+    update(s, endUs);
+
+    size_t n = 0;
+    reply[0] = tx[0] & 0x7F;
+    if (cmd == IcsCommand::CMD_POS && len == IcsCommand::POS_TX_LEN) {
+        int pos = IcsCommand::decodePos(tx[1], tx[2]);
+        s.posCommands++;
+        if (pos == 0) {
+            s.free = true;                           // フリー
+        } else if (pos >= (int)IcsCommand::MIN_POS && pos <= (int)IcsCommand::MAX_POS) {
+            s.free = false;
+            s.target = pos;
+        }
+        // 返信は現在位置
+        reply[1] = (s.position >> 7) & 0x7F;
+        reply[2] = s.position & 0x7F;
+        n = 3;
+    } else if (cmd == IcsCommand::CMD_WRITE && len == IcsCommand::WRITE_TX_LEN) {
+        byte sc = tx[1];
+        byte val = tx[2];
+        switch (sc) {
+        case IcsCommand::SC_STRC: s.stretch = val; break;
+        case IcsCommand::SC_SPD: s.speed = val; break;
+        case IcsCommand::SC_CUR: s.currentLimit = val; break;
+        case IcsCommand::SC_TMP: s.tempLimit = val; break;
+        default:
+            stats_.ignored++;
+            return 0;
+        }
+        s.writes++;
+        reply[1] = sc;
+        reply[2] = val;
+        n = 3;
+    } else if (cmd == IcsCommand::CMD_READ && len == IcsCommand::READ_TX_LEN) {
+        byte sc = tx[1];
+        reply[1] = sc;
+        switch (sc) {
+        case IcsCommand::SC_STRC: reply[2] = s.stretch; n = 3; break;
+        case IcsCommand::SC_SPD: reply[2] = s.speed; n = 3; break;
+        case IcsCommand::SC_CUR: reply[2] = s.current; n = 3; break;
+        case IcsCommand::SC_TMP: reply[2] = s.temperature; n = 3; break;
+        case IcsCommand::SC_POS:
+            if (s.icsVersion < 36) {   // ICS3.5は返信しない
+                stats_.ignored++;
+                return 0;
+            }
+            reply[2] = (s.position >> 7) & 0x7F;
+            reply[3] = s.position & 0x7F;
+            n = 4;
+            break;
+        default:
+            stats_.ignored++;
+            return 0;
+        }
+        s.reads++;
+    } else {
+        stats_.ignored++;
+        return 0;
+    }
+
+    // 故障
+    if (chance(s.faults.dropPermille) || chance(global_.dropPermille)) {
+        stats_.dropped++;
+        return 0;
+    }
+    if (chance(s.faults.corruptPermille) || chance(global_.corruptPermille)) {
+        reply[nextRandom() % n] ^= (byte)(1 << (nextRandom() % 7));
+        stats_.corrupted++;
+    }
+    if (chance(s.faults.truncatePermille) || chance(global_.truncatePermille)) {
+        n = 1 + nextRandom() % (n - 1);
+        stats_.truncated++;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (byteError()) {
+            reply[i] ^= (byte)(1 << (nextRandom() % 8));
+            stats_.rxBitErrors++;
+        }
+    }
+    replyStartUs = endUs + s.latencyUs + s.faults.extraLatencyUs + global_.extraLatencyUs;
+    replyStartUs_[replyNext_] = replyStartUs;
+    replyEndUs_[replyNext_] = replyStartUs + frameTimeUs(n);
+    replyNext_ = (replyNext_ + 1) % REPLY_HISTORY;
+    stats_.replies++;
+    return n;
+}
+
+void IcsBusSim::onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) {
+    byte reply[4];
+    unsigned long startUs = 0;
+    if ((long)uart.baudRate() != baud_) {
+        stats_.frames++;
+        stats_.baudMismatch++;   // サーボには意味のないビット列に見える
+        return;
+    }
+    size_t n = process(data, len, reply, endUs, startUs);
+    if (n > 0) {
+        uart.injectRx(reply, n, startUs);
+    }
+}
+
+bool IcsSimClass::transact(byte* txBuf, byte txLen, byte* rxBuf, byte rxLen) {
+    if (sim_ == nullptr) {
+        return false;
+    }
+    HostSim::advanceUs(sim_->frameTimeUs(txLen));   // 送信
+    unsigned long endUs = HostSim::nowUs();
+
+    byte reply[4];
+    unsigned long startUs = endUs;
+    size_t n = sim_->process(txBuf, txLen, reply, endUs, startUs);
+    unsigned long doneUs = startUs + sim_->frameTimeUs(n);
+
+    if (n < rxLen || doneUs - endUs > timeoutUs_) {
+        HostSim::advanceUs(timeoutUs_);             // タイムアウトまで待つ
+        return false;
+    }
+    HostSim::advanceUs(doneUs - endUs);             // 応答 + 受信
+    memcpy(rxBuf, reply, rxLen);
+    return true;
+}
@@ -0,0 +1,133 @@
+// test/host/IcsBusSim.h
+// ホスト上のICSバスシミュレータ
+// サーボごとの位置とパラメータを持ち、ICS3.5/3.6のコマンドに返信する
+// - モックUARTの接続先(HostUartPeer)として使うと、IcsHardSerialClassをそのまま試せる
+// - IcsSimClass(IcsBaseClassのsynchronize)として使うと、UART無しでバイト単位の時間だけ進める
+// 返信の欠落、データ化け、遅い返信を決まった乱数で起こせるので、結果は毎回同じになる
+// 通信速度毎のビット誤り率で配線の品質も真似られる。サーボと違う速度で送られたフレームには返信しない
+#pragma once
+#include <Arduino.h>
+#include <IcsBaseClass.h>
+
+class IcsBusSim : public HostUartPeer {
+public:
+    static const int MAX_SERVO = 32;
+    static const unsigned long DEFAULT_LATENCY_US = 100;  // サーボが返信を始めるまでの時間
+    static const int MAX_SLEW_POS_PER_MS = 14;            // スピード127での移動量(約0.13s/60deg)
+
+    // 故障の起こし方。千分率は0で起こさない
+    struct Faults {
+        unsigned int dropPermille;      // 返信しない割合
+        unsigned int corruptPermille;   // 返信の1バイトを化けさせる割合
+        unsigned int truncatePermille;  // 返信を途中で切る割合
+        unsigned long extraLatencyUs;   // 返信をこれだけ遅らせる
+
+        // 割合と遅れを指定して作る(指定しないものは起こさない)
+        static Faults make(unsigned int drop, unsigned int corrupt = 0, unsigned int truncate = 0,
+                           unsigned long extraLatencyUs = 0) {
+            Faults f = {drop, corrupt, truncate, extraLatencyUs};
+            return f;
+        }
+    };
+
+    struct Servo {
+        bool present;
+        byte icsVersion;          // 35 または 36 (35はgetPosに返信しない)
+        int position;             // 現在位置
+        int target;               // 目標位置
+        bool free;                // 脱力中
+        byte stretch;
+        byte speed;
+        byte currentLimit;
+        byte tempLimit;
+        byte current;             // 電流値(読出し)
+        byte temperature;         // 温度(読出し)
+        unsigned long latencyUs;  // 返信までの時間
+        unsigned long lastUpdateUs;
+        Faults faults;
+        // 数える
+        unsigned long posCommands;
+        unsigned long writes;
+        unsigned long reads;
+    };
+
+    struct Stats {
+        unsigned long frames;      // 受け取ったフレーム
+        unsigned long replies;     // 返信したフレーム
+        unsigned long dropped;     // 故障で返信しなかった
+        unsigned long corrupted;   // 故障で化けさせた
+        unsigned long truncated;   // 故障で途中で切った
+        unsigned long ignored;     // 存在しないIDや解釈できないフレーム
+        unsigned long collisions;  // 返信が線に出ている間に届いて壊れたフレーム
+        unsigned long baudMismatch;   // サーボと違う通信速度で届いたフレーム
+        unsigned long txBitErrors;    // ビット誤りでサーボが読めなかったフレーム
+        unsigned long rxBitErrors;    // ビット誤りで化けた返信のバイト
+    };
+    static const int MAX_BER_ENTRIES = 4;
+
+    explicit IcsBusSim(long baud = 1250000);
+
+    // サーボの通信速度(ICSマネージャで書き込んだ値)
+    void setBaud(long baud) { baud_ = baud; }
+    long baud() const { return baud_; }
+    // lenバイト(8E1)の送受信時間(us 切り上げ)
+    unsigned long frameTimeUs(size_t len) const;
+
+    Servo& addServo(byte id, byte icsVersion = 36);
+    void removeServo(byte id);
+    Servo& servo(byte id) { return servos_[id & 0x1F]; }
+
+    void setFaults(byte id, const Faults& faults) { servo(id).faults = faults; }
+    void setGlobalFaults(const Faults& faults) { global_ = faults; }
+    void seed(uint32_t seed) { rng_ = seed ? seed : 1; }
+    // 通信速度baudでの線のビット誤り率(ppm)。0で誤りなし
+    bool setBitErrorPpm(long baud, unsigned long ppm);
+    unsigned long bitErrorPpm(long baud) const;
+
+    // 1フレームを処理する。endUsは送信完了時刻
+    // 返信のバイト数(0は返信なし)を返し、replyStartUsに返信の開始時刻を入れる
+    size_t process(const byte* tx, size_t len, byte* reply, unsigned long endUs, unsigned long& replyStartUs);
+
+    // HostUartPeer
+    void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override;
+
+    const Stats& stats() const { return stats_; }
+    void resetStats();
+
+private:
+    void update(Servo& s, unsigned long nowUs);
+    bool chance(unsigned int permille);
+    bool byteError();
+    uint32_t nextRandom();
+
+    bool overlapsReply(unsigned long startUs, unsigned long endUs) const;
+
+    static const int REPLY_HISTORY = 8;
+    long baud_;
+    Servo servos_[MAX_SERVO];
+    unsigned long replyStartUs_[REPLY_HISTORY];  // 最近の返信が線に出ていた時間
+    unsigned long replyEndUs_[REPLY_HISTORY];
+    int replyNext_;
+    Faults global_;
+    long berBaud_[MAX_BER_ENTRIES];
+    unsigned long berPpm_[MAX_BER_ENTRIES];
+    uint32_t rng_;
+    Stats stats_;
+};
+
+// IcsBusSimを送受信先にするIcsBaseClass(UARTを通さない)
+// 送信、サーボの応答、受信の時間だけ仮想時計を進める
+class IcsSimClass : public IcsBaseClass {
+public:
+    explicit IcsSimClass(IcsBusSim* sim, unsigned long timeoutUs = 20000) : sim_(sim), timeoutUs_(timeoutUs) {}
+    bool synchronize(byte* txBuf, byte txLen, byte* rxBuf, byte rxLen) override {
+        return transact(txBuf, txLen, rxBuf, rxLen);
+    }
+    // IcsBus<IcsSimClass>からも使える
+    bool transact(byte* txBuf, byte txLen, byte* rxBuf, byte rxLen);
+    void setTimeoutUs(unsigned long us) { timeoutUs_ = us; }
+
+private:
+    IcsBusSim* sim_;
+    unsigned long timeoutUs_;
+};
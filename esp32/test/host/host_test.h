@@ -0,0 +1,30 @@
+// test/host/host_test.h
+// ホストテスト用の簡単なチェックマクロ
+#pragma once
+#include <stdio.h>
+
+namespace HostTest {
+    extern int failures;
+    extern int checks;
+}
+
+#define HOST_CHECK(cond) do { \
+    HostTest::checks++; \
+    if (!(cond)) { \
+        HostTest::failures++; \
+        printf("  FAILED: %s (%s:%d)\n", #cond, __FILE__, __LINE__); \
+    } \
+} while (0)
+
+#define HOST_RUN(fn) do { \
+    printf("[%s]\n", #fn); \
+    fn(); \
+} while (0)
+
+#define HOST_TEST_RESULT() ( \
+    printf("%d checks, %d failures\n", HostTest::checks, HostTest::failures), \
+    HostTest::failures == 0 ? 0 : 1)
+
+#define HOST_TEST_MAIN_DEFS \
+    int HostTest::failures = 0; \
+    int HostTest::checks = 0;
@@ -0,0 +1,60 @@
+// test/host/swim_reference.h
+// 泳ぎの計算(main.cppのhandleSwimMode)をテストで比べるための共通部品
+// motion_math.hだけで1ティック分のポジションを求める基準と、乱数と位相の判定
+#pragma once
+#include <Arduino.h>
+#include <IcsBaseClass.h>
+#include <motion_math.h>
+#include <math.h>
+
+const int SERVO_NUM = 7;   // main.cppと同じ(0番は使わない)
+
+struct SwimParams {
+    float periodSec;
+    float wingDeg;
+    float maxAngleDeg;
+    float yRate;
+    bool isBackward;
+};
+
+// motion_math.hの固定小数点で計算する(main.cppと同じ組み合わせ)
+inline void swimFixed(const SwimParams& params, unsigned long currentTime, const unsigned long* offsetUs, int* positions) {
+    MotionMath::Period period = MotionMath::makePeriod(params.periodSec);
+    float wingRad = params.wingDeg * (float)PI / 180.0f;
+    float right = params.maxAngleDeg * (1.0f + params.yRate) / 2.0f;
+    float left = params.maxAngleDeg * (1.0f - params.yRate) / 2.0f;
+    MotionMath::Gain gain[SERVO_NUM] = {0};
+    gain[1] = MotionMath::gainFromDeg(right * cosf(wingRad));
+    gain[2] = MotionMath::gainFromDeg(right * sinf(wingRad));
+    gain[4] = MotionMath::gainFromDeg(-left * cosf(wingRad));
+    gain[5] = MotionMath::gainFromDeg(-left * sinf(wingRad));
+    const int rotated = IcsBaseClass::degPosCenti(3000);   // 翼の回転角度(30度)
+    for (int i = 1; i < SERVO_NUM; i++) {
+        MotionMath::Phase ph = MotionMath::phaseAt(currentTime, offsetUs[i], period);
+        if (i == 3 || i == 6) {
+            positions[i] = (MotionMath::cosNegative(ph) != params.isBackward) ? rotated : MotionMath::POS_CENTER;
+        } else {
+            positions[i] = MotionMath::posOf(gain[i], MotionMath::sinQ15(ph));
+        }
+    }
+}
+
+// 位相がcosの符号の境目(1/4周、3/4周)のごく近く(doubleで求めた時刻から)
+inline bool nearRotationEdge(const SwimParams& params, unsigned long currentTime, unsigned long offsetUs) {
+    double periodMs = params.periodSec * 1000.0;
+    double ratio = fmod(currentTime + offsetUs / 1000.0, periodMs) / periodMs;
+    return fabs(ratio - 0.25) < 1e-6 || fabs(ratio - 0.75) < 1e-6;
+}
+
+// 位相がcosの符号の境目(1/4周、3/4周)から1サンプル以内(samples個の表で)
+inline bool nearRotationEdge(MotionMath::Phase ph, uint16_t samples) {
+    uint32_t width = (uint32_t)((1ULL << 32) / samples) + 1;
+    return (MotionMath::Phase)(ph - MotionMath::QUARTER_TURN + width) <= 2 * width ||
+           (MotionMath::Phase)(ph - MotionMath::QUARTER_TURN * 3 + width) <= 2 * width;
+}
+
+// 再現できる擬似乱数(24ビット)
+inline unsigned long lcg(unsigned long& seed) {
+    seed = seed * 1103515245UL + 12345UL;
+    return (seed >> 8) & 0xFFFFFFUL;
+}
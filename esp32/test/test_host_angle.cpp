@@ -0,0 +1,142 @@
+// test/test_host_angle.cpp
+// 整数の角度変換(degPosCenti/posCentiDeg)と単精度のdegPosFが従来のfloat版と一致するか確認し、速さを比べる
+// pio run -e host_test_angle && .pio/build/host_test_angle/program
+#include <Arduino.h>
+#include <IcsBaseClass.h>
+#include <chrono>
+#include <math.h>
+#include "host/host_test.h"
+
+HOST_TEST_MAIN_DEFS
+
+// コンパイル時に計算されること(main.cppの定数と同じ)
+static_assert(IcsBaseClass::degPosCenti(0) == 7500, "center");
+static_assert(IcsBaseClass::degPosCenti(2000) == 8092, "raise right");
+static_assert(IcsBaseClass::degPosCenti(-2000) == 6908, "raise left");
+static_assert(IcsBaseClass::degPosCenti(18001) == -1, "out of range");
+static_assert(IcsBaseClass::posCentiDeg(7500) == 0, "center");
+
+const long BENCH_COUNT = 5000000;
+
+void testDegPosCentiMatchesFloat() {
+    int mismatches = 0;
+    for (int c = -18100; c <= 18100; c++) {
+        if (IcsBaseClass::degPosCenti(c) != IcsBaseClass::degPos(c / 100.0f)) {
+            if (mismatches < 5) {
+                printf("  mismatch at %d: %d vs %d\n", c, IcsBaseClass::degPosCenti(c), IcsBaseClass::degPos(c / 100.0f));
+            }
+            mismatches++;
+        }
+    }
+    HOST_CHECK(mismatches == 0);
+}
+
+void testPosCentiDegMatchesFloat() {
+    int mismatches = 0;
+    for (int pos = 0; pos <= 16000; pos++) {
+        float ref = IcsBaseClass::posDeg(pos);
+        int centi = IcsBaseClass::posCentiDeg(pos);
+        bool ok;
+        if (ref > 9000.0f || ref < -9000.0f) {   // 範囲外
+            ok = (centi == 0x7FFF && ref > 0) || (centi == -0x7FFF && ref < 0);
+        } else {
+            ok = fabs(centi - ref * 100.0) <= 0.5 + 1e-3;
+        }
+        if (!ok) {
+            if (mismatches < 5) {
+                printf("  mismatch at pos %d: %d vs %f\n", pos, centi, ref * 100.0);
+            }
+            mismatches++;
+        }
+    }
+    HOST_CHECK(mismatches == 0);
+
+    // 往復: 角度 -> POS -> 角度 の誤差は1POS(約3.4 x0.01deg)以内
+    for (int c = -18000; c <= 18000; c += 7) {
+        int back = IcsBaseClass::posCentiDeg(IcsBaseClass::degPosCenti(c));
+        HOST_CHECK(abs(back - c) <= 4);
+    }
+}
+
+void testDegPosFixedCloseToFloat() {
+    // 実数の角度(スイム中のsin波など)では単精度の丸めの分、まれに1POSずれる
+    int maxDiff = 0;
+    long differ = 0;
+    long total = 0;
+    for (double deg = -181.0; deg <= 181.0; deg += 0.000731) {
+        int a = IcsBaseClass::degPos(deg);
+        int b = IcsBaseClass::degPosF(deg);
+        if ((a == -1) != (b == -1)) {
+            maxDiff = 99999;
+        } else if (a != -1 && abs(a - b) > maxDiff) {
+            maxDiff = abs(a - b);
+        }
+        if (a != b) {
+            differ++;
+        }
+        total++;
+    }
+    printf("  degPosF differs from degPos in %ld / %ld samples, max %d\n", differ, total, maxDiff);
+    HOST_CHECK(maxDiff <= 1);
+    HOST_CHECK(differ * 1000 < total);   // 0.1%未満
+}
+
+// 実行時の値として渡す(定数にたたみ込ませない)
+static volatile double g_angle = 0.0;
+
+__attribute__((noinline)) static long benchDegPos(double step) {
+    long sum = 0;
+    double deg = g_angle;
+    for (long i = 0; i < BENCH_COUNT; i++) {
+        sum += IcsBaseClass::degPos(deg);
+        deg += step;
+        if (deg > 170.0) deg = -170.0;
+    }
+    return sum;
+}
+
+__attribute__((noinline)) static long benchDegPosFixed(float step) {
+    long sum = 0;
+    float deg = (float)g_angle;
+    for (long i = 0; i < BENCH_COUNT; i++) {
+        sum += IcsBaseClass::degPosF(deg);
+        deg += step;
+        if (deg > 170.0f) deg = -170.0f;
+    }
+    return sum;
+}
+
+__attribute__((noinline)) static long benchDegPosCenti(int step) {
+    long sum = 0;
+    int c = (int)g_angle;
+    for (long i = 0; i < BENCH_COUNT; i++) {
+        sum += IcsBaseClass::degPosCenti(c);
+        c += step;
+        if (c > 17000) c = -17000;
+    }
+    return sum;
+}
+
+void benchConversions() {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point t0 = Clock::now();
+    long a = benchDegPos(0.0137);
+    Clock::time_point t1 = Clock::now();
+    long b = benchDegPosFixed(0.0137f);
+    Clock::time_point t2 = Clock::now();
+    long c = benchDegPosCenti(1);
+    Clock::time_point t3 = Clock::now();
+    printf("  degPos(double) %.2f ns, degPosF(float) %.2f ns, degPosCenti(int) %.2f ns (sums %ld %ld %ld)\n",
+        std::chrono::duration<double, std::nano>(t1 - t0).count() / BENCH_COUNT,
+        std::chrono::duration<double, std::nano>(t2 - t1).count() / BENCH_COUNT,
+        std::chrono::duration<double, std::nano>(t3 - t2).count() / BENCH_COUNT, a, b, c);
+    printf("  (the host has a hardware double FPU; on the ESP32 double is emulated in software)\n");
+}
+
+int main() {
+    HOST_RUN(testDegPosCentiMatchesFloat);
+    HOST_RUN(testPosCentiDegMatchesFloat);
+    HOST_RUN(testDegPosFixedCloseToFloat);
+    HOST_RUN(benchConversions);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,185 @@
+// test/test_host_async.cpp
+// ホスト上でIcsAsyncClassの状態機械を確認する
+// pio run -e host_test_async && .pio/build/host_test_async/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include "host/host_test.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const int TIMEOUT = 20;
+
+// 生きているIDにだけ返信する簡単なバス
+class SimplePeer : public HostUartPeer {
+public:
+    SimplePeer() : latencyUs(30), deadId(0xFF) { memset(params, 0, sizeof params); }
+    void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override {
+        byte id = data[0] & 0x1F;
+        if (id == deadId) {
+            return;
+        }
+        byte cmd = data[0] & 0xE0;
+        uint8_t reply[4];
+        size_t n = 0;
+        if (cmd == 0x80 && len == 3) {           // ポジション
+            reply[0] = data[0] & 0x7F; reply[1] = data[1]; reply[2] = data[2]; n = 3;
+        } else if (cmd == 0xC0 && len == 3) {    // パラメータ書込み
+            reply[0] = data[0] & 0x7F; reply[1] = data[1]; reply[2] = data[2]; n = 3;
+            params[id][data[1]] = data[2];
+        } else if (cmd == 0xA0 && len == 2) {    // パラメータ読出し
+            reply[0] = data[0] & 0x7F; reply[1] = data[1];
+            if (data[1] == 0x05) {
+                reply[2] = (7500 >> 7) & 0x7F; reply[3] = 7500 & 0x7F; n = 4;
+            } else {
+                reply[2] = params[id][data[1]]; n = 3;
+            }
+        }
+        if (n > 0) {
+            uart.injectRx(reply, n, endUs + latencyUs);
+        }
+    }
+    unsigned long latencyUs;
+    byte deadId;
+    byte params[32][6];
+};
+
+struct CallbackLog {
+    int calls;
+    int failures;
+    int lastHandle;
+};
+
+static void onDone(int handle, bool ok, const byte* rxBuf, byte rxLen, void* ctx) {
+    (void)rxBuf;
+    (void)rxLen;
+    CallbackLog* log = static_cast<CallbackLog*>(ctx);
+    log->calls++;
+    if (!ok) {
+        log->failures++;
+    }
+    log->lastHandle = handle;
+}
+
+static void setupBus(HardwareSerial& uart, SimplePeer& peer) {
+    HostSim::resetClock();
+    HostSim::setGpioLatencyUs(0);
+    uart.resetHost();
+    uart.attachPeer(&peer);
+    uart.setDirPin(EN_PIN);
+}
+
+// ループ1回分の「ネットワーク処理」
+static void networkWork() {
+    delayMicroseconds(10);
+}
+
+void testPoseCompletesWhileLoopRuns() {
+    HardwareSerial uart(2);
+    SimplePeer peer;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+    IcsAsyncClass async(&krs);
+
+    CallbackLog log = {0, 0, -1};
+    int handles[6];
+    for (int id = 1; id <= 6; id++) {
+        HOST_CHECK(async.submitSetParam(id, 0x02, 100, onDone, &log) != IcsAsyncClass::HANDLE_NONE);
+        handles[id - 1] = async.submitSetPos(id, 7000 + id * 100, onDone, &log);
+        HOST_CHECK(handles[id - 1] != IcsAsyncClass::HANDLE_NONE);
+    }
+    HOST_CHECK(async.pending() == 12);
+
+    int loops = 0;
+    while (async.busy() && loops < 10000) {
+        async.poll();
+        networkWork();
+        loops++;
+    }
+    printf("  12 transactions finished in %lu us over %d loop iterations\n", micros(), loops);
+    HOST_CHECK(!async.busy());
+    HOST_CHECK(loops > 12);     // 返信待ちの間もループが回っている
+    HOST_CHECK(log.calls == 12);
+    HOST_CHECK(log.failures == 0);
+    for (int id = 1; id <= 6; id++) {
+        HOST_CHECK(async.status(handles[id - 1]) == IcsAsyncClass::STATUS_DONE);
+        HOST_CHECK(async.result(handles[id - 1]) == 7000 + id * 100);
+    }
+}
+
+void testDeadServoDoesNotBlockLoop() {
+    HardwareSerial uart(2);
+    SimplePeer peer;
+    peer.deadId = 3;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+    IcsAsyncClass async(&krs);
+
+    CallbackLog log = {0, 0, -1};
+    int dead = async.submitSetPos(3, 7500, onDone, &log);
+    int alive = async.submitSetPos(4, 7600, onDone, &log);
+
+    unsigned long longestPoll = 0;
+    while (async.busy()) {
+        unsigned long t0 = micros();
+        async.poll();
+        unsigned long dt = micros() - t0;
+        if (dt > longestPoll) {
+            longestPoll = dt;
+        }
+        networkWork();
+    }
+    printf("  longest poll() = %lu us (blocking timeout is %d ms)\n", longestPoll, TIMEOUT);
+    HOST_CHECK(longestPoll < 1000);
+    HOST_CHECK(async.status(dead) == IcsAsyncClass::STATUS_FAILED);
+    HOST_CHECK(async.status(alive) == IcsAsyncClass::STATUS_DONE);
+    HOST_CHECK(log.failures == 1);
+}
+
+void testReadsAndUartEvent() {
+    HardwareSerial uart(2);
+    SimplePeer peer;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+    IcsAsyncClass async(&krs);
+    async.attachUartEvent();
+
+    int w = async.submitSetParam(2, 0x01, 60);
+    int r = async.submitGetParam(2, 0x01);
+    int p = async.submitGetParam(2, 0x05);
+    HOST_CHECK(async.waitAll(100000));
+    HOST_CHECK(async.result(w) == 60);
+    HOST_CHECK(async.result(r) == 60);
+    HOST_CHECK(async.result(p) == 7500);
+    HOST_CHECK(uart.stats().rxEvents >= 3);
+}
+
+void testQueueLimits() {
+    HardwareSerial uart(2);
+    SimplePeer peer;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+    IcsAsyncClass async(&krs);
+
+    for (int i = 0; i < IcsAsyncClass::QUEUE_SIZE; i++) {
+        HOST_CHECK(async.submitSetPos(1, 7500) != IcsAsyncClass::HANDLE_NONE);
+    }
+    HOST_CHECK(async.submitSetPos(1, 7500) == IcsAsyncClass::HANDLE_NONE);
+    HOST_CHECK(async.submitSetPos(40, 7500) == IcsAsyncClass::HANDLE_NONE);
+    HOST_CHECK(async.waitAll(1000000));
+    HOST_CHECK(async.submitSetPos(1, 7500) != IcsAsyncClass::HANDLE_NONE);
+}
+
+int main() {
+    HOST_RUN(testPoseCompletesWhileLoopRuns);
+    HOST_RUN(testDeadServoDoesNotBlockLoop);
+    HOST_RUN(testReadsAndUartEvent);
+    HOST_RUN(testQueueLimits);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,162 @@
+// test/test_host_bus_bench.cpp
+// IcsBaseClass(仮想関数)とIcsBus<Transport>(テンプレート)のコマンド1回あたりの処理時間を比べる
+// 送受信は即座に返信を作るループバックなので、コマンドの組み立てと呼び出しの分だけを測る
+// pio run -e host_test_bus_bench && .pio/build/host_test_bus_bench/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsBus.h>
+#include <chrono>
+#include "host/host_test.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const int TIMEOUT = 20;
+const long BENCH_COUNT = 2000000;
+
+// 送信データから返信を作る(サーボ1台分の最小限の動き)
+static inline bool loopbackReply(const byte* tx, byte txLen, byte* rx, byte rxLen) {
+    (void)txLen;
+    rx[0] = tx[0] & 0x7F;
+    switch (tx[0] & IcsCommand::CMD_MASK) {
+    case IcsCommand::CMD_POS:
+    case IcsCommand::CMD_WRITE:
+        rx[1] = tx[1];
+        rx[2] = tx[2];
+        break;
+    case IcsCommand::CMD_READ:
+        rx[1] = tx[1];
+        rx[2] = (rxLen == 4) ? (7500 >> 7) : 42;
+        if (rxLen == 4) {
+            rx[3] = 7500 & 0x7F;
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// テンプレートから使う送受信
+class LoopbackTransport {
+public:
+    LoopbackTransport() : frames(0) {}
+    bool transact(byte* txBuf, byte txLen, byte* rxBuf, byte rxLen) {
+        frames++;
+        memcpy(lastTx, txBuf, txLen);
+        return loopbackReply(txBuf, txLen, rxBuf, rxLen);
+    }
+    long frames;
+    byte lastTx[4];
+};
+
+// 仮想関数から使う送受信
+class LoopbackIcs : public IcsBaseClass {
+public:
+    LoopbackIcs() : frames(0) {}
+    bool synchronize(byte* txBuf, byte txLen, byte* rxBuf, byte rxLen) override {
+        frames++;
+        memcpy(lastTx, txBuf, txLen);
+        return loopbackReply(txBuf, txLen, rxBuf, rxLen);
+    }
+    long frames;
+    byte lastTx[4];
+};
+
+void testSameFramesAndResults() {
+    LoopbackTransport transport;
+    IcsBus<LoopbackTransport> bus(transport);
+    LoopbackIcs ics;
+
+    for (int id = 0; id <= 32; id++) {
+        for (unsigned int pos = 3000; pos <= 12000; pos += 250) {
+            HOST_CHECK(bus.setPos(id, pos) == ics.setPos(id, pos));
+        }
+        HOST_CHECK(bus.setFree(id) == ics.setFree(id));
+        for (unsigned int v = 0; v <= 128; v += 16) {
+            HOST_CHECK(bus.setStrc(id, v) == ics.setStrc(id, v));
+            HOST_CHECK(bus.setSpd(id, v) == ics.setSpd(id, v));
+            HOST_CHECK(bus.setCur(id, v) == ics.setCur(id, v));
+            HOST_CHECK(bus.setTmp(id, v) == ics.setTmp(id, v));
+        }
+        HOST_CHECK(bus.getStrc(id) == ics.getStrc(id));
+        HOST_CHECK(bus.getSpd(id) == ics.getSpd(id));
+        HOST_CHECK(bus.getCur(id) == ics.getCur(id));
+        HOST_CHECK(bus.getTmp(id) == ics.getTmp(id));
+        HOST_CHECK(bus.getPos(id) == ics.getPos(id));
+        HOST_CHECK(memcmp(transport.lastTx, ics.lastTx, 2) == 0);
+    }
+    HOST_CHECK(transport.frames == ics.frames);
+}
+
+void testHardSerialBusMatchesClass() {
+    // 同じUARTでクラス経由とテンプレート経由の結果が同じ
+    class Peer : public HostUartPeer {
+    public:
+        void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override {
+            byte rx[4];
+            byte rxLen = ((data[0] & IcsCommand::CMD_MASK) == IcsCommand::CMD_READ) ? IcsCommand::readRxLen(data[1]) : 3;
+            if (loopbackReply(data, len, rx, rxLen)) {
+                uart.injectRx(rx, rxLen, endUs + 30);
+            }
+        }
+    } peer;
+    HardwareSerial uart(2);
+    HostSim::resetClock();
+    uart.resetHost();
+    uart.attachPeer(&peer);
+    uart.setDirPin(EN_PIN);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.begin();
+    IcsBus<IcsHardSerialClass> bus(krs);
+
+    HOST_CHECK(bus.setPos(1, 8000) == krs.setPos(1, 8000));
+    HOST_CHECK(bus.setSpd(2, 90) == krs.setSpd(2, 90));
+    HOST_CHECK(bus.getPos(3) == 7500);
+    HOST_CHECK(bus.getTmp(3) == krs.getTmp(3));
+    HOST_CHECK(uart.stats().txFrames == 7);
+}
+
+__attribute__((noinline)) static long benchVirtual(IcsBaseClass* ics) {
+    long sum = 0;
+    for (long i = 0; i < BENCH_COUNT; i++) {
+        sum += ics->setPos((byte)(i & 7), 3500 + (unsigned int)(i & 4095));
+    }
+    return sum;
+}
+
+__attribute__((noinline)) static long benchTemplate(IcsBus<LoopbackTransport>& bus) {
+    long sum = 0;
+    for (long i = 0; i < BENCH_COUNT; i++) {
+        sum += bus.setPos((byte)(i & 7), 3500 + (unsigned int)(i & 4095));
+    }
+    return sum;
+}
+
+void benchPerCommandOverhead() {
+    LoopbackIcs ics;
+    IcsBaseClass* volatile icsPtr = &ics;   // コンパイラに型を見抜かせない
+    LoopbackTransport transport;
+    IcsBus<LoopbackTransport> bus(transport);
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point t0 = Clock::now();
+    long sumVirtual = benchVirtual(icsPtr);
+    Clock::time_point t1 = Clock::now();
+    long sumTemplate = benchTemplate(bus);
+    Clock::time_point t2 = Clock::now();
+
+    double nsVirtual = std::chrono::duration<double, std::nano>(t1 - t0).count() / BENCH_COUNT;
+    double nsTemplate = std::chrono::duration<double, std::nano>(t2 - t1).count() / BENCH_COUNT;
+    printf("  setPos x%ld: IcsBaseClass %.2f ns/cmd, IcsBus<> %.2f ns/cmd\n", BENCH_COUNT, nsVirtual, nsTemplate);
+    HOST_CHECK(sumVirtual == sumTemplate);
+}
+
+int main() {
+    HOST_RUN(testSameFramesAndResults);
+    HOST_RUN(testHardSerialBusMatchesClass);
+    HOST_RUN(benchPerCommandOverhead);
+    return HOST_TEST_RESULT();
+}
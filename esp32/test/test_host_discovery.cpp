@@ -0,0 +1,134 @@
+// test/test_host_discovery.cpp
+// ホスト上で起動時のサーボの問い合わせ(IcsServoTable)を確認する
+// 全IDを計算したタイムアウトで問い合わせた時間と、固定のタイムアウトで1つずつ読んだ時間を比べる
+// pio run -e host_test_discovery && .pio/build/host_test_discovery/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsMultiBus.h>
+#include <IcsServoTable.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const long BAUDRATE = 1250000;
+
+void testDiscoverSingleBus() {
+    HostSim::setupClock();
+    HostBus b(BAUDRATE, 2, 5);
+    b.sim.addServo(1);
+    b.sim.addServo(2).position = 8000;
+    b.sim.addServo(3, 35);
+    b.sim.addServo(5);
+    b.sim.addServo(6);
+    b.sim.addServo(20);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+
+    IcsServoTable table;
+    HOST_CHECK(table.count() == 0);
+    HOST_CHECK(table.discover(&bus) == 6);
+    HOST_CHECK(!bus.busy());
+
+    const byte expect[6] = {1, 2, 3, 5, 6, 20};
+    for (byte k = 0; k < table.count(); k++) {
+        HOST_CHECK(table.idAt(k) == expect[k]);
+    }
+    HOST_CHECK(!table.present(0));
+    HOST_CHECK(!table.present(4));
+    HOST_CHECK(!table.present(40));
+    HOST_CHECK(table.get(1).icsVersion == IcsServoTable::VERSION_36);
+    HOST_CHECK(table.get(1).position == 7500);
+    HOST_CHECK(table.get(2).position == 8000);
+    HOST_CHECK(table.get(3).icsVersion == IcsServoTable::VERSION_35);
+    HOST_CHECK(table.get(3).position == -1);
+    HOST_CHECK(b.sim.servo(1).posCommands == 0);   // 問い合わせで動かしたり脱力させたりしない
+    HOST_CHECK(b.sim.servo(1).writes == 0);
+
+    // 32IDの問い合わせはキュー(16)より多いが、空いた分から積む
+    unsigned long discoverUs = table.lastDiscoverUs();
+
+    // 従来のように固定のタイムアウト(20ms)で1つずつ読む
+    HostSim::setupClock();
+    HostBus naive(BAUDRATE, 2, 5);
+    for (byte id = 1; id <= 6; id++) {
+        naive.sim.addServo(id);
+    }
+    naive.ics.setTimeoutMode(IcsHardSerialClass::TIMEOUT_FIXED);
+    unsigned long start = micros();
+    int found = 0;
+    for (byte id = 0; id <= IcsCommand::MAX_ID; id++) {
+        if (naive.ics.getTmp(id) >= 0) {
+            found++;
+        }
+    }
+    unsigned long naiveUs = micros() - start;
+    printf("  32 IDs: discover %lu us, fixed timeout %lu us\n", discoverUs, naiveUs);
+    HOST_CHECK(found == 6);
+    HOST_CHECK(discoverUs < 20000);
+    HOST_CHECK(discoverUs * 20 < naiveUs);
+}
+
+void testDiscoverDualBus() {
+    HostSim::setupClock();
+    HostBus right(BAUDRATE, 2, 5);
+    HostBus left(BAUDRATE, 1, 4);
+    for (byte id = 1; id <= 3; id++) {
+        right.sim.addServo(id);
+    }
+    left.sim.addServo(4);
+    left.sim.addServo(6, 35);
+    right.sim.addServo(5);   // 左のIDだが右のバスにつながっている
+    IcsMultiBus bus;
+    bus.addBus(&right.async, 0, 3);
+    bus.addBus(&left.async, 4, 6);
+
+    IcsServoTable table;
+    HOST_CHECK(table.discover(&bus) == 5);
+    HOST_CHECK(table.present(4));
+    HOST_CHECK(!table.present(5));     // 割り当てたバスで返信が無い
+    HOST_CHECK(table.get(6).icsVersion == IcsServoTable::VERSION_35);
+    HOST_CHECK(right.sim.stats().frames + left.sim.stats().frames == 7 + 5);   // 割り当てのないIDは送らない
+    printf("  dual bus 0-6: discover %lu us\n", table.lastDiscoverUs());
+
+    // 範囲を絞る
+    HOST_CHECK(table.discover(&bus, 4, 6) == 2);
+    HOST_CHECK(table.idAt(0) == 4);
+    HOST_CHECK(table.idAt(1) == 6);
+}
+
+void testAddAndTimeout() {
+    IcsServoTable table;
+    HOST_CHECK(table.add(5));
+    HOST_CHECK(table.add(2, IcsServoTable::VERSION_36, 7500));
+    HOST_CHECK(table.add(5, IcsServoTable::VERSION_35));   // 上書き
+    HOST_CHECK(!table.add(32));
+    HOST_CHECK(table.count() == 2);
+    HOST_CHECK(table.idAt(0) == 2);
+    HOST_CHECK(table.idAt(1) == 5);
+    HOST_CHECK(table.get(5).icsVersion == IcsServoTable::VERSION_35);
+    HOST_CHECK(table.get(2).position == 7500);
+    table.clear();
+    HOST_CHECK(table.count() == 0);
+    HOST_CHECK(!table.present(2));
+
+    // 時間切れなら見つかった分だけ返す
+    HostSim::setupClock();
+    HostBus b(BAUDRATE, 2, 5);
+    b.sim.addServo(1);
+    b.sim.addServo(30);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    HOST_CHECK(table.discover(&bus, 0, IcsCommand::MAX_ID, 2000) == 1);
+    HOST_CHECK(table.present(1));
+    HOST_CHECK(!table.present(30));
+    HOST_CHECK(bus.waitAll(100000));
+}
+
+int main() {
+    HOST_RUN(testDiscoverSingleBus);
+    HOST_RUN(testDiscoverDualBus);
+    HOST_RUN(testAddAndTimeout);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,187 @@
+// test/test_host_echo.cpp
+// ホスト上でエコーの読み捨てと早い返信の競合を確認する
+// UARTのFIFOタイムアウトを模擬しているので、エコーの直後に始まる返信はエコーとまとめて読めるようになる
+// pio run -e host_test_echo && .pio/build/host_test_echo/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include "host/host_test.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const int TIMEOUT = 20;
+
+// 送信完了からlatencyUs後にポジションの返信を始めるサーボ
+class EarlyPeer : public HostUartPeer {
+public:
+    EarlyPeer() : latencyUs(0) {}
+    void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override {
+        if (len != 3 || (data[0] & 0xE0) != 0x80) {
+            return;
+        }
+        uint8_t reply[3] = {(uint8_t)(data[0] & 0x7F), data[1], data[2]};
+        uart.injectRx(reply, sizeof reply, endUs + latencyUs);
+    }
+    unsigned long latencyUs;
+};
+
+static void setupBus(HardwareSerial& uart, EarlyPeer& peer, bool echo) {
+    HostSim::resetClock();
+    HostSim::setGpioLatencyUs(0);
+    uart.resetHost();
+    uart.attachPeer(&peer);
+    uart.setDirPin(EN_PIN);
+    uart.setEcho(echo);
+}
+
+// 変更前のsynchronize: 送信後に受信バッファにあるものを全部捨ててから読む
+// drainDelayUsは送信完了から空読みまでの遅れ(割り込みやタスク切替)
+static bool legacySetPos(HardwareSerial& uart, byte id, unsigned int pos, unsigned long drainDelayUs) {
+    byte tx[3] = {(byte)(0x80 + id), (byte)((pos >> 7) & 0x7F), (byte)(pos & 0x7F)};
+    byte rx[3];
+    uart.flush();
+    digitalWrite(EN_PIN, HIGH);
+    uart.write(tx, 3);
+    uart.flush();
+    delayMicroseconds(drainDelayUs);
+    while (uart.available() > 0) {
+        uart.read();
+    }
+    digitalWrite(EN_PIN, LOW);
+    return uart.readBytes(rx, 3) == 3 && IcsBaseClass::isReplyOf(tx, rx) && rx[1] == tx[1] && rx[2] == tx[2];
+}
+
+void testLegacyDrainRaces() {
+    int ok = 0;
+    int total = 0;
+    for (unsigned long latency = 0; latency <= 40; latency += 4) {
+        for (unsigned long delayUs = 0; delayUs <= 40; delayUs += 4) {
+            HardwareSerial uart(2);
+            EarlyPeer peer;
+            peer.latencyUs = latency;
+            setupBus(uart, peer, true);
+            uart.begin(BAUDRATE, SERIAL_8E1);
+            uart.setTimeout(TIMEOUT);
+            pinMode(EN_PIN, OUTPUT);
+            digitalWrite(EN_PIN, LOW);
+            if (legacySetPos(uart, 1, 7500, delayUs)) {
+                ok++;
+            }
+            total++;
+        }
+    }
+    printf("  legacy drain: %d / %d succeeded\n", ok, total);
+    HOST_CHECK(ok > 0);        // うまくいくタイミングもあるが
+    HOST_CHECK(ok < total);    // タイミング次第で返信を捨てる
+}
+
+void testExactEchoConsumption() {
+    for (int mode = 0; mode < 2; mode++) {
+        int ok = 0;
+        int total = 0;
+        for (unsigned long latency = 0; latency <= 40; latency += 2) {
+            HardwareSerial uart(2);
+            EarlyPeer peer;
+            peer.latencyUs = latency;
+            setupBus(uart, peer, true);
+            IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+            if (mode == 1) {
+                krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+            }
+            krs.setEcho(true);
+            krs.begin();
+            if (krs.setPos(1, 7500) == 7500 && krs.setPos(2, 8000) == 8000) {
+                ok++;
+            }
+            total++;
+        }
+        printf("  exact echo (%s): %d / %d succeeded\n", mode == 0 ? "fixed" : "computed", ok, total);
+        HOST_CHECK(ok == total);
+    }
+}
+
+void testNoEchoWiring() {
+    for (unsigned long latency = 0; latency <= 40; latency += 2) {
+        HardwareSerial uart(2);
+        EarlyPeer peer;
+        peer.latencyUs = latency;
+        setupBus(uart, peer, false);
+        IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+        krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+        krs.begin();
+        HOST_CHECK(krs.setPos(3, 9000) == 9000);
+    }
+}
+
+void testStaleBytesBeforeSend() {
+    // 前の通信の残り(遅れて届いた返信)は送信前に消す
+    HardwareSerial uart(2);
+    EarlyPeer peer;
+    setupBus(uart, peer, true);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.setEcho(true);
+    krs.begin();
+
+    uint8_t junk[2] = {0x55, 0x2A};
+    uart.injectRx(junk, sizeof junk, micros());
+    HostSim::advanceUs(100);
+    HOST_CHECK(krs.setPos(1, 7500) == 7500);
+}
+
+void testEchoMismatchFails() {
+    // エコーが送信データと違う(衝突した)ときは返信を信じない
+    class CorruptEchoPeer : public HostUartPeer {
+    public:
+        void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override {
+            (void)len;
+            uint8_t garbage[3] = {0x00, data[1], data[2]};
+            uart.injectRx(garbage, 3, endUs);        // エコーの代わりに壊れたデータ
+            uint8_t reply[3] = {(uint8_t)(data[0] & 0x7F), data[1], data[2]};
+            uart.injectRx(reply, 3, endUs + 30);
+        }
+    } peer;
+    HardwareSerial uart(2);
+    HostSim::resetClock();
+    uart.resetHost();
+    uart.attachPeer(&peer);
+    uart.setDirPin(EN_PIN);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.setEcho(true);
+    krs.begin();
+    HOST_CHECK(krs.setPos(1, 7500) == IcsBaseClass::ICS_FALSE);
+}
+
+void testAsyncEcho() {
+    HardwareSerial uart(2);
+    EarlyPeer peer;
+    peer.latencyUs = 0;
+    setupBus(uart, peer, true);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.setEcho(true);
+    krs.begin();
+    IcsAsyncClass async(&krs);
+
+    int handles[6];
+    for (int id = 1; id <= 6; id++) {
+        handles[id - 1] = async.submitSetPos(id, 7000 + id * 100);
+    }
+    HOST_CHECK(async.waitAll(100000));
+    for (int id = 1; id <= 6; id++) {
+        HOST_CHECK(async.result(handles[id - 1]) == 7000 + id * 100);
+    }
+}
+
+int main() {
+    HOST_RUN(testLegacyDrainRaces);
+    HOST_RUN(testExactEchoConsumption);
+    HOST_RUN(testNoEchoWiring);
+    HOST_RUN(testStaleBytesBeforeSend);
+    HOST_RUN(testEchoMismatchFails);
+    HOST_RUN(testAsyncEcho);
+    return HOST_TEST_RESULT();
+}
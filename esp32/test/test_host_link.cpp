@@ -0,0 +1,170 @@
+// test/test_host_link.cpp
+// ホスト上で通信速度の選択と通信品質の測定(IcsLinkProbe)を確認する
+// シミュレータのサーボの速度と線のビット誤り率を変え、安定して一番速い速度を選ぶかを見る
+// pio run -e host_test_link && .pio/build/host_test_link/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsLinkProbe.h>
+#include <IcsTelemetry.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;   // main.cppと同じ初期値
+const byte PROBE_IDS[6] = {1, 2, 3, 4, 5, 6};
+
+// ICSはBAUDRATEで始め、サーボだけservoBaudにしたバス。作る度に仮想時計を0から始める
+struct LinkBus : HostClock, HostBus {
+    IcsTelemetry tel;
+
+    explicit LinkBus(long servoBaud) : HostBus(BAUDRATE, DEFAULT_UART, EN_PIN, IcsHardSerialClass::TRANSPORT_RS485_HW) {
+        sim.setBaud(servoBaud);
+        ics.attachTelemetry(&tel);
+    }
+};
+
+static void printResults(const char* name, const IcsLinkProbe& probe) {
+    printf("  %s: selected %ld bps in %lu us\n", name, probe.selectedBaud(), probe.lastProbeUs());
+    for (byte i = 0; i < IcsLinkProbe::BAUD_NUM; i++) {
+        const IcsLinkProbe::Result& r = probe.result(i);
+        printf("    %7ld bps: id %3d, errors %u/%u (%u permille), latency avg %lu max %lu us%s\n",
+               r.baudrate, r.responderId, r.errors, r.frames, r.errorPermille(),
+               r.avgLatencyUs, r.maxLatencyUs, r.stable ? " stable" : "");
+    }
+}
+
+void testBaudTable() {
+    HOST_CHECK(IcsLinkProbe::baudAt(0) == 115200);
+    HOST_CHECK(IcsLinkProbe::baudAt(2) == 1250000);
+    HOST_CHECK(IcsLinkProbe::baudAt(3) == 0);
+    HOST_CHECK(IcsLinkProbe::baudIndex(625000) == 1);
+    HOST_CHECK(IcsLinkProbe::baudIndex(9600) == IcsLinkProbe::NO_BAUD);
+
+    IcsLinkProbe probe;
+    HOST_CHECK(probe.selected() == IcsLinkProbe::NO_BAUD);
+    HOST_CHECK(probe.selectedBaud() == 0);
+    HOST_CHECK(probe.result(1).errorPermille() == 1000);
+
+    // シミュレータ: 速度の違うフレームには返信しない
+    LinkBus b(625000);
+    b.sim.addServo(1);
+    HOST_CHECK(b.ics.getStrc(1) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(b.sim.stats().baudMismatch == 1);
+    HOST_CHECK(b.ics.setBaudRate(625000));
+    HOST_CHECK(b.uart.baudRate() == 625000UL);
+    HOST_CHECK(b.ics.getStrc(1) == 60);
+    HOST_CHECK(!b.ics.setBaudRate(0));
+
+    // ビット誤り率の表
+    for (long baud = 1; baud <= 4; baud++) {
+        HOST_CHECK(b.sim.setBitErrorPpm(baud, 10));
+    }
+    HOST_CHECK(!b.sim.setBitErrorPpm(5, 10));
+    HOST_CHECK(b.sim.setBitErrorPpm(2, 20));   // 同じ速度は上書き
+    HOST_CHECK(b.sim.bitErrorPpm(2) == 20UL);
+    HOST_CHECK(b.sim.bitErrorPpm(625000) == 0UL);
+}
+
+void testCleanLinkSelectsFastest() {
+    LinkBus b(1250000);
+    for (byte id = 1; id <= 6; id++) {
+        b.sim.addServo(id);
+    }
+    IcsLinkProbe probe;
+    HOST_CHECK(probe.run(&b.ics, PROBE_IDS, 6) == 2);
+    printResults("clean 1.25M", probe);
+    HOST_CHECK(probe.selectedBaud() == 1250000);
+    HOST_CHECK(b.ics.getBaudRate() == 1250000);
+
+    const IcsLinkProbe::Result& fast = probe.result(2);
+    HOST_CHECK(fast.responderId == 1);
+    HOST_CHECK(fast.frames == IcsLinkProbe::DEFAULT_FRAMES);
+    HOST_CHECK(fast.errors == 0);
+    HOST_CHECK(fast.stable);
+    // 読出し(2バイト送信+3バイト返信)と応答時間100us
+    HOST_CHECK(fast.avgLatencyUs >= IcsBusSim::DEFAULT_LATENCY_US + b.sim.frameTimeUs(5));
+    HOST_CHECK(fast.avgLatencyUs < IcsBusSim::DEFAULT_LATENCY_US + 2 * b.sim.frameTimeUs(5));
+    HOST_CHECK(probe.result(0).responderId == IcsLinkProbe::NO_ID);
+    HOST_CHECK(!probe.result(0).stable);
+    HOST_CHECK(probe.result(1).errorPermille() == 1000);
+
+    // 返信しない速度のタイムアウトはテレメトリに残さない
+    HOST_CHECK(b.tel.get(1).count[IcsTelemetry::RESULT_TIMEOUT] == 0);
+    HOST_CHECK(b.ics.getTelemetry() == &b.tel);
+    HOST_CHECK(probe.lastProbeUs() < 100000);
+
+    // 何度でも測り直せる
+    HOST_CHECK(probe.run(&b.ics, PROBE_IDS, 6, 8) == 2);
+    HOST_CHECK(probe.result(2).frames == 8);
+}
+
+void testFollowsReflashedServos() {
+    // 配線が悪いのでサーボを625000bpsに書き換えたが、コードは1.25Mのまま
+    LinkBus b(625000);
+    for (byte id = 2; id <= 6; id++) {
+        b.sim.addServo(id);   // ID1は付いていない
+    }
+    HOST_CHECK(b.ics.getStrc(2) == IcsBaseClass::ICS_FALSE);
+
+    IcsLinkProbe probe;
+    HOST_CHECK(probe.run(&b.ics, PROBE_IDS, 6) == 1);
+    printResults("servos at 625k", probe);
+    HOST_CHECK(b.ics.getBaudRate() == 625000);
+    HOST_CHECK(probe.result(1).responderId == 2);
+    HOST_CHECK(probe.result(1).stable);
+    HOST_CHECK(b.ics.getStrc(3) == 60);
+    HOST_CHECK(b.ics.setPos(4, 8000) == 7500);
+}
+
+void testMarginalWiring() {
+    // 1.25Mでは誤りが多く、625kでは少ない配線。サーボは1.25Mのまま
+    LinkBus b(1250000);
+    for (byte id = 1; id <= 6; id++) {
+        b.sim.addServo(id);
+    }
+    b.sim.setBitErrorPpm(1250000, 2000);
+    b.sim.setBitErrorPpm(625000, 20);
+    IcsLinkProbe probe;
+    HOST_CHECK(probe.run(&b.ics, PROBE_IDS, 6, 100) == 2);   // 返信するのは1.25Mだけ
+    printResults("marginal wiring, servos at 1.25M", probe);
+    const IcsLinkProbe::Result& fast = probe.result(2);
+    HOST_CHECK(!fast.stable);
+    HOST_CHECK(fast.errorPermille() > IcsLinkProbe::STABLE_ERROR_PERMILLE);
+    HOST_CHECK(fast.errors < fast.frames);
+    HOST_CHECK(b.sim.stats().txBitErrors > 0);
+    HOST_CHECK(b.sim.stats().rxBitErrors > 0);
+
+    // サーボを625kに書き換えると、安定した625kを選ぶ
+    b.sim.setBaud(625000);
+    b.sim.resetStats();
+    HOST_CHECK(probe.run(&b.ics, PROBE_IDS, 6, 100) == 1);
+    printResults("marginal wiring, servos at 625k", probe);
+    HOST_CHECK(probe.result(1).stable);
+    HOST_CHECK(probe.result(1).errorPermille() < fast.errorPermille() || probe.result(1).errors == 0);
+    HOST_CHECK(b.ics.getBaudRate() == 625000);
+}
+
+void testNoServoKeepsBaud() {
+    LinkBus b(1250000);
+    IcsLinkProbe probe;
+    HOST_CHECK(probe.run(&b.ics, PROBE_IDS, 6) == IcsLinkProbe::NO_BAUD);
+    printResults("no servo", probe);
+    HOST_CHECK(probe.selectedBaud() == 0);
+    HOST_CHECK(b.ics.getBaudRate() == BAUDRATE);
+    for (byte i = 0; i < IcsLinkProbe::BAUD_NUM; i++) {
+        HOST_CHECK(probe.result(i).responderId == IcsLinkProbe::NO_ID);
+    }
+    // 返信しないIDを探す時間は計算したタイムアウトで決まる(115200でも数ms)
+    HOST_CHECK(probe.lastProbeUs() < 20000);
+}
+
+int main() {
+    HOST_RUN(testBaudTable);
+    HOST_RUN(testCleanLinkSelectsFastest);
+    HOST_RUN(testFollowsReflashedServos);
+    HOST_RUN(testMarginalWiring);
+    HOST_RUN(testNoServoKeepsBaud);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,200 @@
+// test/test_host_motionmath.cpp
+// 単精度と固定小数点のモーション計算(motion_math.h)を、今までのdoubleの計算と比べる
+// main.cppのhandleSwimMode/handleStayModeと同じ組み合わせで、ポジションの差が1以内であることと、ティック毎の計算時間を確認する
+// pio run -e host_test_motionmath && .pio/build/host_test_motionmath/program
+#include <Arduino.h>
+#include <IcsBaseClass.h>
+#include <motion_math.h>
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include "host/host_test.h"
+#include "host/swim_reference.h"
+
+HOST_TEST_MAIN_DEFS
+
+const double WING_ROTATION = 30.0;
+const long BENCH_TICKS = 200000;
+
+// main.cppのdoubleの計算(handleSwimMode)
+static void swimDouble(const SwimParams& params, unsigned long currentTime, const unsigned long* offsetUs, int* positions) {
+    double PERIOD_MS = params.periodSec * 1000.0;
+    double MAX_ANGLE = params.maxAngleDeg;
+    double WING_DEG = params.wingDeg;
+    double RIGHT_RATE = (1.0 + params.yRate) / 2.0;
+    double LEFT_RATE = (1.0 - params.yRate) / 2.0;
+    double baseAngle[SERVO_NUM];
+    double rotationAngle[SERVO_NUM];
+    double wingRad = WING_DEG * PI / 180.0;
+    for (int i = 1; i < SERVO_NUM; i++) {
+        double servoTimeMs = currentTime + (long)offsetUs[i] / 1000.0;
+        double timeRatio = fmod(servoTimeMs, PERIOD_MS) / PERIOD_MS;
+        baseAngle[i] = MAX_ANGLE * sin(TWO_PI * timeRatio);
+        rotationAngle[i] = 0.0;
+        if (!params.isBackward) {
+            if (cos(TWO_PI * timeRatio) < 0) {
+                rotationAngle[i] = WING_ROTATION;
+            }
+        } else {
+            if (cos(TWO_PI * timeRatio) > 0) {
+                rotationAngle[i] = WING_ROTATION;
+            }
+        }
+    }
+    positions[1] = IcsBaseClass::degPosF(baseAngle[1] * RIGHT_RATE * cos(wingRad));
+    positions[2] = IcsBaseClass::degPosF(baseAngle[2] * RIGHT_RATE * sin(wingRad));
+    positions[3] = IcsBaseClass::degPosF(rotationAngle[3]);
+    positions[4] = IcsBaseClass::degPosF(-(baseAngle[4] * LEFT_RATE * cos(wingRad)));
+    positions[5] = IcsBaseClass::degPosF(-(baseAngle[5] * LEFT_RATE * sin(wingRad)));
+    positions[6] = IcsBaseClass::degPosF(rotationAngle[6]);
+}
+
+void testSinCos() {
+    double worst = 0.0;
+    int worstOdd = 0;
+    for (uint64_t p = 0; p < (1ULL << 32); p += 40009) {
+        MotionMath::Phase ph = (MotionMath::Phase)p;
+        double ref = sin(2.0 * M_PI * p / 4294967296.0);
+        double refCos = cos(2.0 * M_PI * p / 4294967296.0);
+        worst = fmax(worst, fabs(MotionMath::sinQ15(ph) / 32768.0 - ref));
+        worst = fmax(worst, fabs(MotionMath::cosQ15(ph) / 32768.0 - refCos));
+        // 奇関数(下位ビットの切り捨ての分だけずれる)
+        worstOdd = std::max(worstOdd, abs(MotionMath::sinQ15(ph) + MotionMath::sinQ15((MotionMath::Phase)(0 - ph))));
+    }
+    printf("  sinQ15/cosQ15 max error %.2e\n", worst);
+    HOST_CHECK(worst < 1.5e-4);
+    HOST_CHECK(worstOdd <= 2);
+    HOST_CHECK(MotionMath::sinQ15(0) == 0);
+    HOST_CHECK(MotionMath::sinQ15(MotionMath::HALF_TURN) == 0);
+    HOST_CHECK(abs(MotionMath::sinQ15(MotionMath::QUARTER_TURN) - 32768) <= 4);
+    HOST_CHECK(MotionMath::cosNegative(MotionMath::HALF_TURN));
+    HOST_CHECK(!MotionMath::cosNegative(MotionMath::QUARTER_TURN));
+    HOST_CHECK(MotionMath::cosNegative(MotionMath::QUARTER_TURN * 3));
+    HOST_CHECK(!MotionMath::cosNegative(MotionMath::QUARTER_TURN * 3 + 1));
+    HOST_CHECK(!MotionMath::cosNegative(0));
+}
+
+void testPhaseMatchesDouble() {
+    const float periods[] = {0.1f, 0.3f, 0.5f, 1.0f, 1.3f, 2.0f, 2.7f, 3.0f, 7.77f, 12.5f, 300.0f};
+    unsigned long seed = 1;
+    double worst = 0.0;
+    for (float periodSec : periods) {
+        MotionMath::Period period = MotionMath::makePeriod(periodSec);
+        double periodMs = periodSec * 1000.0;
+        for (int k = 0; k < 20000; k++) {
+            // millis()の全範囲(約49日)
+            unsigned long timeMs = (lcg(seed) << 8) ^ lcg(seed);
+            unsigned long offsetUs = lcg(seed) % 20000;
+            double ratio = fmod(timeMs + offsetUs / 1000.0, periodMs) / periodMs;
+            double got = MotionMath::phaseAt(timeMs, offsetUs, period) / 4294967296.0;
+            double d = fabs(got - ratio);
+            worst = fmax(worst, fmin(d, 1.0 - d));
+        }
+    }
+    printf("  phase max error vs double fmod %.2e turn\n", worst);
+    HOST_CHECK(worst < 1e-7);
+
+    // 周期が無い(初期値)なら位相は0
+    MotionMath::Period none = MotionMath::makePeriod(0.0f);
+    HOST_CHECK(MotionMath::phaseAt(12345, 678, none) == 0);
+    // 割り切れる時刻でも、1単位あたりの位相の切り捨ての分(1e-8周)だけ手前になる
+    MotionMath::Period two = MotionMath::makePeriod(2.0f);
+    HOST_CHECK(MotionMath::QUARTER_TURN - MotionMath::phaseAt(500, 0, two) <= 64);
+    HOST_CHECK(MotionMath::HALF_TURN - MotionMath::phaseAt(1000, 0, two) <= 64);
+    HOST_CHECK(MotionMath::phaseAt(1999, 1000, two) == 0);
+}
+
+void testSwimPositions() {
+    unsigned long seed = 7;
+    long samples = 0;
+    long differ = 0;
+    int worst = 0;
+    SwimParams p;
+    for (float period : {0.5f, 1.0f, 1.7f, 2.0f, 3.3f}) {
+        for (float wing = -45.0f; wing <= 45.0f; wing += 7.5f) {
+            for (float maxAngle = -45.0f; maxAngle <= 45.0f; maxAngle += 9.0f) {
+                for (float yRate = -1.0f; yRate <= 1.0f; yRate += 0.5f) {
+                    p = {period, wing, maxAngle, yRate, (lcg(seed) & 1) != 0};
+                    for (int k = 0; k < 40; k++) {
+                        unsigned long now = lcg(seed) * 200;
+                        unsigned long offsetUs[SERVO_NUM] = {0};
+                        for (int i = 1; i < SERVO_NUM; i++) {
+                            offsetUs[i] = offsetUs[i - 1] + 100 + lcg(seed) % 2000;
+                        }
+                        int a[SERVO_NUM];
+                        int b[SERVO_NUM];
+                        swimDouble(p, now, offsetUs, a);
+                        swimFixed(p, now, offsetUs, b);
+                        for (int i = 1; i < SERVO_NUM; i++) {
+                            if ((i == 3 || i == 6) && nearRotationEdge(p, now, offsetUs[i])) {
+                                continue;
+                            }
+                            worst = std::max(worst, abs(a[i] - b[i]));
+                            differ += (a[i] != b[i]);
+                            samples++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("  swim: %ld / %ld positions differ from double, max %d\n", differ, samples, worst);
+    HOST_CHECK(worst <= 1);
+    HOST_CHECK(differ * 100 < samples);
+}
+
+void testStayPositions() {
+    // handleStayModeはWING_DEG = 0なので、上下だけsinで動く
+    long differ = 0;
+    int worst = 0;
+    for (float maxAngle : {-45.0f, -20.0f, 5.5f, 20.0f, 45.0f}) {
+        for (float period : {1.0f, 3.0f}) {
+            MotionMath::Period pq = MotionMath::makePeriod(period);
+            MotionMath::Gain g = MotionMath::gainFromDeg(maxAngle);
+            for (unsigned long t = 0; t < 20000; t += 3) {
+                double ratio = fmod(t, period * 1000.0) / (period * 1000.0);
+                double angle = maxAngle * sin(TWO_PI * ratio);
+                int s = MotionMath::sinQ15(MotionMath::phaseAt(t, 0, pq));
+                int d1 = abs(IcsBaseClass::degPosF(angle) - MotionMath::posOf(g, s));
+                int d4 = abs(IcsBaseClass::degPosF(-angle) - MotionMath::posOf(-g, s));
+                worst = std::max(worst, std::max(d1, d4));
+                differ += (d1 != 0);
+            }
+        }
+    }
+    printf("  stay: %ld positions differ from double, max %d\n", differ, worst);
+    HOST_CHECK(worst <= 1);
+}
+
+void testBenchmark() {
+    typedef std::chrono::steady_clock Clock;
+    SwimParams p = {1.7f, 20.0f, 30.0f, 0.2f, false};
+    unsigned long offsetUs[SERVO_NUM] = {0, 100, 800, 1500, 2200, 2900, 3600};
+    int positions[SERVO_NUM];
+    long sum = 0;
+
+    Clock::time_point t0 = Clock::now();
+    for (long tick = 0; tick < BENCH_TICKS; tick++) {
+        swimDouble(p, tick * 20, offsetUs, positions);
+        sum += positions[1] + positions[5];
+    }
+    Clock::time_point t1 = Clock::now();
+    for (long tick = 0; tick < BENCH_TICKS; tick++) {
+        swimFixed(p, tick * 20, offsetUs, positions);
+        sum -= positions[1] + positions[5];
+    }
+    Clock::time_point t2 = Clock::now();
+    double nsDouble = std::chrono::duration<double, std::nano>(t1 - t0).count() / BENCH_TICKS;
+    double nsFixed = std::chrono::duration<double, std::nano>(t2 - t1).count() / BENCH_TICKS;
+    printf("  per tick (6 servos, host): double %.1f ns, float/fixed %.1f ns\n", nsDouble, nsFixed);
+    HOST_CHECK(labs(sum) < BENCH_TICKS * 2);   // 同じポジション(差は1以内)
+}
+
+int main() {
+    HOST_RUN(testSinCos);
+    HOST_RUN(testPhaseMatchesDouble);
+    HOST_RUN(testSwimPositions);
+    HOST_RUN(testStayPositions);
+    HOST_RUN(testBenchmark);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,146 @@
+// test/test_host_motiontask.cpp
+// ホスト上で一定周期のモーションタスク(MotionTask)をPOSIXスレッドで動かして確認する
+// 仮想時計ではなく実際の時刻で動くので、周期と遅れの判定は緩くしてある
+// pio run -e host_test_motiontask && .pio/build/host_test_motiontask/program
+#include <Arduino.h>
+#include <MotionTask.h>
+#include <unistd.h>
+#include "host/host_test.h"
+
+HOST_TEST_MAIN_DEFS
+
+const unsigned long PERIOD_US = 5000;   // 200Hz
+const unsigned long POLL_US = 1000;
+const unsigned long RUN_US = 500000;
+
+struct Counter {
+    volatile unsigned long ticks = 0;
+    volatile unsigned long polls = 0;
+    volatile unsigned long lastTickUs = 0;
+    unsigned long sleepEvery = 0;   // この回数に1回、ティックで寝る(0は寝ない)
+    unsigned long sleepUs = 0;
+    bool pollDuringTick = false;    // ティックの途中でpollが呼ばれた
+    volatile bool inTick = false;
+};
+
+static void onTick(void* ctx) {
+    Counter* c = static_cast<Counter*>(ctx);
+    c->inTick = true;
+    c->ticks++;
+    c->lastTickUs = MotionTask::nowUs();
+    if (c->sleepEvery != 0 && c->ticks % c->sleepEvery == 0) {
+        usleep(c->sleepUs);
+    }
+    c->inTick = false;
+}
+
+static void onPoll(void* ctx) {
+    Counter* c = static_cast<Counter*>(ctx);
+    if (c->inTick) {
+        c->pollDuringTick = true;
+    }
+    c->polls++;
+}
+
+void testFixedRate() {
+    MotionTask task;
+    Counter c;
+    HOST_CHECK(!task.running());
+    HOST_CHECK(task.start(PERIOD_US, POLL_US, onTick, onPoll, &c));
+    HOST_CHECK(task.running());
+    HOST_CHECK(task.getPeriodUs() == PERIOD_US);
+    HOST_CHECK(!task.start(PERIOD_US, POLL_US, onTick, onPoll, &c));  // 2回は動かせない
+    usleep(RUN_US);
+    task.stop();
+    HOST_CHECK(!task.running());
+
+    const MotionTask::Stats& s = task.getStats();
+    unsigned long expected = RUN_US / PERIOD_US;
+    printf("  %luHz for %lums: ticks=%lu polls=%lu missed=%lu overruns=%lu jitter avg=%luus max=%luus run max=%luus\n",
+        1000000UL / PERIOD_US, RUN_US / 1000, s.ticks, s.polls, s.missedTicks, s.overruns,
+        task.avgJitterUs(), s.maxJitterUs, s.maxRunUs);
+    HOST_CHECK(s.ticks == c.ticks);
+    HOST_CHECK(s.polls == c.polls);
+    // タイマーの回数で数えるので、遅れても周期の数からはずれない
+    HOST_CHECK(s.ticks + s.missedTicks >= expected - 5 && s.ticks + s.missedTicks <= expected + 1);
+    HOST_CHECK(s.polls >= s.ticks * 3);
+    HOST_CHECK(!c.pollDuringTick);
+    HOST_CHECK(s.lastJitterUs <= s.maxJitterUs);
+    HOST_CHECK(task.avgJitterUs() < PERIOD_US);
+
+    // 止めた後は呼ばれない
+    unsigned long ticks = c.ticks;
+    usleep(3 * PERIOD_US);
+    HOST_CHECK(c.ticks == ticks);
+
+    // もう一度動かせる
+    HOST_CHECK(task.start(PERIOD_US, POLL_US, onTick, nullptr, &c));
+    usleep(10 * PERIOD_US);
+    task.stop();
+    HOST_CHECK(task.getStats().ticks > 0);
+    HOST_CHECK(task.getStats().polls == 0);
+}
+
+void testOverrun() {
+    MotionTask task;
+    Counter c;
+    c.sleepEvery = 10;
+    c.sleepUs = PERIOD_US * 5 / 2;   // 2.5周期寝るので、次のティックは少なくとも1つ見送る
+    HOST_CHECK(task.start(PERIOD_US, POLL_US, onTick, onPoll, &c));
+    usleep(RUN_US);
+    task.stop();
+
+    const MotionTask::Stats& s = task.getStats();
+    unsigned long expected = RUN_US / PERIOD_US;
+    printf("  sleeping tick every 10: ticks=%lu missed=%lu overruns=%lu jitter max=%luus run max=%luus\n",
+        s.ticks, s.missedTicks, s.overruns, s.maxJitterUs, s.maxRunUs);
+    unsigned long sleeps = c.ticks / c.sleepEvery;
+    HOST_CHECK(s.overruns >= sleeps);
+    HOST_CHECK(s.missedTicks + 1 >= sleeps);   // 最後に寝た後で止めると、見送りを数える前に抜ける
+    HOST_CHECK(s.maxRunUs >= c.sleepUs);
+    // 寝ても位相はずれず、見送ったティックと合わせれば周期の数になる
+    HOST_CHECK(s.ticks + s.missedTicks >= expected - 5 && s.ticks + s.missedTicks <= expected + 1);
+
+    task.resetStats();
+    HOST_CHECK(task.getStats().ticks == 0 && task.getStats().overruns == 0);
+}
+
+void testLock() {
+    MotionTask task;
+    Counter c;
+    HOST_CHECK(task.start(PERIOD_US, POLL_US, onTick, onPoll, &c));
+    usleep(4 * PERIOD_US);
+    {
+        // loop()側が周期より長く持つと、ティックはその間呼ばれず遅れとして数える
+        MotionTask::Guard guard(task);
+        unsigned long ticks = c.ticks;
+        usleep(3 * PERIOD_US);
+        HOST_CHECK(c.ticks == ticks);
+    }
+    usleep(4 * PERIOD_US);
+    task.stop();
+    const MotionTask::Stats& s = task.getStats();
+    printf("  held lock for 3 periods: ticks=%lu missed=%lu overruns=%lu jitter max=%luus\n",
+        s.ticks, s.missedTicks, s.overruns, s.maxJitterUs);
+    HOST_CHECK(s.overruns >= 1);
+    HOST_CHECK(s.maxJitterUs >= PERIOD_US);
+}
+
+void testInvalidArgs() {
+    MotionTask task;
+    Counter c;
+    HOST_CHECK(!task.start(PERIOD_US, 0, onTick, onPoll, &c));
+    HOST_CHECK(!task.start(PERIOD_US, 3000, onTick, onPoll, &c));   // 割り切れない
+    HOST_CHECK(!task.start(1000, POLL_US * 2, onTick, onPoll, &c));  // 周期より長いタイマー
+    HOST_CHECK(!task.start(PERIOD_US, POLL_US, nullptr, onPoll, &c));
+    HOST_CHECK(!task.running());
+    task.stop();   // 動いていなくても呼べる
+}
+
+int main() {
+    HOST_RUN(testFixedRate);
+    HOST_RUN(testOverrun);
+    HOST_RUN(testLock);
+    HOST_RUN(testInvalidArgs);
+    return HOST_TEST_RESULT();
+}
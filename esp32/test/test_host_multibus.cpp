@@ -0,0 +1,156 @@
+// test/test_host_multibus.cpp
+// ホスト上で2本のUARTに分けたサーボバス(IcsMultiBus)を確認する
+// 右ヒレ(ID1～3)と左ヒレ(ID4～6)を別のUARTにすると、全身の更新時間と左右のずれがどれだけ減るかを測る
+// pio run -e host_test_multibus && .pio/build/host_test_multibus/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsMultiBus.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN_RIGHT = 5;
+const byte EN_PIN_LEFT = 4;
+const long BAUDRATE = 1250000;
+
+// 完了時刻をIDごとに記録する
+static unsigned long doneUs[IcsCommand::MAX_ID + 1];
+static void onDone(int handle, bool ok, const byte* rxBuf, byte rxLen, void* ctx) {
+    (void)handle;
+    (void)rxBuf;
+    (void)rxLen;
+    if (ok) {
+        doneUs[*static_cast<const byte*>(ctx)] = micros();
+    }
+}
+
+static const byte IDS[6] = {1, 2, 3, 4, 5, 6};
+
+// 6軸のポジションとスピードを送って揃うまでの時間
+static unsigned long sendPose(IcsMultiBus& bus, unsigned int pos, byte spd) {
+    memset(doneUs, 0, sizeof(doneUs));
+    unsigned long start = micros();
+    for (int i = 0; i < 6; i++) {
+        bus.submitSetParam(IDS[i], IcsBaseClass::SC_SPD, spd, onDone, const_cast<byte*>(&IDS[i]));
+        bus.submitSetPos(IDS[i], pos, onDone, const_cast<byte*>(&IDS[i]));
+    }
+    HOST_CHECK(bus.waitAll(100000));
+    return micros() - start;
+}
+
+void testRouting() {
+    HostSim::setupClock();
+    HostBus right(BAUDRATE, 2, EN_PIN_RIGHT);
+    HostBus left(BAUDRATE, 1, EN_PIN_LEFT);
+    HostBus third(BAUDRATE, 0, 6);
+    HostBus fourth(BAUDRATE, 0, 7);
+    IcsMultiBus bus;
+
+    HOST_CHECK(bus.busIndexOf(1) == IcsMultiBus::NO_BUS);
+    HOST_CHECK(bus.submitSetPos(1, 7500) == IcsAsyncClass::HANDLE_NONE);
+    HOST_CHECK(bus.addBus(&right.async, 0, 3));
+    HOST_CHECK(!bus.addBus(&left.async, 3, 6));     // ID3は割り当て済み
+    HOST_CHECK(bus.busCount() == 1);
+    HOST_CHECK(bus.addBus(&left.async, 4, 6));
+    HOST_CHECK(bus.addBus(&left.async, 10, 12));    // 続けて同じバスならIDを追加する
+    HOST_CHECK(!bus.addBus(&left.async, 9, 40));    // 範囲外
+    HOST_CHECK(!bus.addBus(&left.async, 5, 4));
+    HOST_CHECK(bus.busCount() == 2);
+    HOST_CHECK(bus.addBus(&third.async, 20, 20));
+    HOST_CHECK(!bus.addBus(&fourth.async, 21, 21)); // MAX_BUSを超える
+
+    HOST_CHECK(bus.busFor(0) == &right.async);
+    HOST_CHECK(bus.busFor(3) == &right.async);
+    HOST_CHECK(bus.busFor(4) == &left.async);
+    HOST_CHECK(bus.busFor(11) == &left.async);
+    HOST_CHECK(bus.icsFor(6) == &left.ics);
+    HOST_CHECK(bus.busFor(7) == nullptr);
+    HOST_CHECK(bus.icsFor(7) == nullptr);
+    HOST_CHECK(bus.busIndexOf(200) == IcsMultiBus::NO_BUS);
+    HOST_CHECK(bus.getBus(1) == &left.async);
+    HOST_CHECK(bus.getBus(3) == nullptr);
+
+    // 送ったフレームは割り当てたバスのサーボにだけ届く
+    right.sim.addServo(2);
+    left.sim.addServo(5);
+    int h2 = bus.submitSetPos(2, 8000);
+    int h5 = bus.submitSetPos(5, 7000);
+    HOST_CHECK(bus.pending() == 2);
+    HOST_CHECK(bus.busy());
+    HOST_CHECK(bus.waitAll(100000));
+    HOST_CHECK(!bus.busy());
+    HOST_CHECK(right.async.status(h2) == IcsAsyncClass::STATUS_DONE);
+    HOST_CHECK(left.async.status(h5) == IcsAsyncClass::STATUS_DONE);
+    HOST_CHECK(right.sim.servo(2).target == 8000);
+    HOST_CHECK(left.sim.servo(5).target == 7000);
+    HOST_CHECK(right.uart.stats().txFrames == 1);
+    HOST_CHECK(left.uart.stats().txFrames == 1);
+}
+
+void testDualBusHalvesPoseTime() {
+    unsigned long poseUs[2];
+    unsigned long skewUs[2];
+    for (int mode = 0; mode < 2; mode++) {
+        HostSim::setupClock();
+        HostBus right(BAUDRATE, 2, EN_PIN_RIGHT);
+        HostBus left(BAUDRATE, 1, EN_PIN_LEFT);
+        IcsMultiBus bus;
+        for (byte id = 1; id <= 6; id++) {
+            right.sim.addServo(id);   // 1本の時は全部こちら
+            left.sim.addServo(id);
+        }
+        if (mode == 0) {
+            bus.addBus(&right.async, 0, IcsCommand::MAX_ID);
+        } else {
+            bus.addBus(&right.async, 0, 3);
+            bus.addBus(&left.async, 4, IcsCommand::MAX_ID);
+        }
+
+        poseUs[mode] = sendPose(bus, 8000, 60);
+        // 右の1軸目と左の1軸目が届いた時刻の差
+        skewUs[mode] = doneUs[4] > doneUs[1] ? doneUs[4] - doneUs[1] : doneUs[1] - doneUs[4];
+        for (byte id = 1; id <= 6; id++) {
+            IcsBusSim& sim = (mode == 1 && id >= 4) ? left.sim : right.sim;
+            HOST_CHECK(sim.servo(id).target == 8000);
+            HOST_CHECK(sim.servo(id).speed == 60);
+            HOST_CHECK(doneUs[id] != 0);
+        }
+    }
+    printf("  pose: single %lu us, dual %lu us (%.0f%%)\n", poseUs[0], poseUs[1], 100.0 * poseUs[1] / poseUs[0]);
+    printf("  left/right skew: single %lu us, dual %lu us\n", skewUs[0], skewUs[1]);
+    HOST_CHECK(poseUs[1] * 10 < poseUs[0] * 6);   // 60%未満
+    HOST_CHECK(skewUs[1] * 4 < skewUs[0]);
+}
+
+void testDualBusIsolatesDeadServo() {
+    // 左のサーボが返信しなくても、右のバスの更新時間は変わらない
+    HostSim::setupClock();
+    HostBus right(BAUDRATE, 2, EN_PIN_RIGHT);
+    HostBus left(BAUDRATE, 1, EN_PIN_LEFT);
+    IcsMultiBus bus;
+    for (byte id = 1; id <= 3; id++) {
+        right.sim.addServo(id);
+    }
+    for (byte id = 4; id <= 6; id++) {
+        left.sim.addServo(id);
+    }
+    left.sim.removeServo(5);
+    bus.addBus(&right.async, 0, 3);
+    bus.addBus(&left.async, 4, 6);
+
+    sendPose(bus, 7000, 60);
+    unsigned long rightDone = doneUs[1] > doneUs[3] ? doneUs[1] : doneUs[3];
+    unsigned long leftDone = doneUs[4] > doneUs[6] ? doneUs[4] : doneUs[6];
+    HOST_CHECK(doneUs[5] == 0);
+    HOST_CHECK(doneUs[6] != 0);
+    HOST_CHECK(rightDone < leftDone);
+}
+
+int main() {
+    HOST_RUN(testRouting);
+    HOST_RUN(testDualBusHalvesPoseTime);
+    HOST_RUN(testDualBusIsolatesDeadServo);
+    return HOST_TEST_RESULT();
+}
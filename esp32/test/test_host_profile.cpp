@@ -0,0 +1,270 @@
+// test/test_host_profile.cpp
+// ホスト上でサーボのパラメータの組(IcsParamProfile)の書込みを確認する
+// 読出し→差分→書込み→確認をまとめて進め、違う値だけ送ることと、モーションの周期より短く終わることを測る
+// pio run -e host_test_profile && .pio/build/host_test_profile/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsMultiBus.h>
+#include <IcsServoTable.h>
+#include <IcsParamProfile.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const long BAUDRATE = 1250000;
+const unsigned long CONTROL_PERIOD_US = 20000;   // main.cppのモーションの周期
+
+// シャドウレジスタを使うバス(main.cppと同じ)
+struct ShadowBus : HostBus {
+    ShadowBus(int uartNum, byte enPin) : HostBus(BAUDRATE, uartNum, enPin) {
+        ics.enableShadow(true);
+    }
+};
+
+void testSetValidation() {
+    IcsParamProfile p;
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_STRC) == IcsParamProfile::KEEP);
+    HOST_CHECK(p.set(1, 60, IcsParamProfile::KEEP, 40, 70));
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_STRC) == 60);
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_SPD) == IcsParamProfile::KEEP);
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_CUR) == 40);
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_TMP) == 70);
+
+    HOST_CHECK(!p.set(1, 60, 100, 64, 70));   // 電流リミットは63まで
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_SPD) == IcsParamProfile::KEEP);   // 何も変えない
+    HOST_CHECK(!p.set(32, 60, 100, 40, 70));
+    HOST_CHECK(!p.setParam(1, IcsCommand::SC_POS, 10));
+    HOST_CHECK(!p.setParam(1, IcsCommand::SC_STRC, 128));
+    HOST_CHECK(p.setParam(1, IcsCommand::SC_SPD, 127));
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_SPD) == 127);
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_POS) == IcsParamProfile::KEEP);
+
+    p.clear();
+    HOST_CHECK(p.getParam(1, IcsCommand::SC_CUR) == IcsParamProfile::KEEP);
+}
+
+void testWritesOnlyDifferences() {
+    HostSim::setupClock();
+    ShadowBus b(2, 5);
+    for (byte id = 1; id <= 6; id++) {
+        b.sim.addServo(id);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsServoTable table;
+    HOST_CHECK(table.discover(&bus) == 6);
+
+    // ストレッチはサーボの値(60)と同じ、スピードと2つのリミットは違う
+    IcsParamProfile p;
+    for (byte id = 1; id <= 6; id++) {
+        HOST_CHECK(p.set(id, 60, 100, 40, 70));
+    }
+    for (byte id = 1; id <= 6; id++) {
+        b.sim.servo(id).reads = 0;
+    }
+    HOST_CHECK(p.apply(&bus, &table));
+    const IcsParamProfile::ApplyStats& s = p.getApplyStats();
+    printf("  first apply: reads %lu, matched %lu, writes %lu, %lu us\n", s.reads, s.matched, s.writes, s.elapsedUs);
+    HOST_CHECK(s.reads == 12);
+    HOST_CHECK(s.matched == 6);
+    HOST_CHECK(s.writes == 18);
+    HOST_CHECK(s.skipped == 0);
+    HOST_CHECK(s.readFailures == 0);
+    HOST_CHECK(s.verifyFailures == 0);
+    for (byte id = 1; id <= 6; id++) {
+        const IcsBusSim::Servo& sv = b.sim.servo(id);
+        HOST_CHECK(sv.stretch == 60);
+        HOST_CHECK(sv.speed == 100);
+        HOST_CHECK(sv.currentLimit == 40);
+        HOST_CHECK(sv.tempLimit == 70);
+        HOST_CHECK(sv.writes == 3);   // ストレッチは送らない
+        HOST_CHECK(sv.reads == 3);    // 差分の2つとスピードの読み直し
+        HOST_CHECK(sv.posCommands == 0);
+    }
+    HOST_CHECK(s.elapsedUs < CONTROL_PERIOD_US / 2);
+    unsigned long firstUs = s.elapsedUs;
+
+    // 同じ組をもう一度: 読むだけで何も書かない
+    HOST_CHECK(p.apply(&bus, &table));
+    printf("  re-apply: reads %lu, matched %lu, skipped %lu, writes %lu, %lu us\n",
+           s.reads, s.matched, s.skipped, s.writes, s.elapsedUs);
+    HOST_CHECK(s.matched == 12);
+    HOST_CHECK(s.skipped == 12);   // 読めないリミットはシャドウレジスタで送らない
+    HOST_CHECK(s.writes == 0);
+    HOST_CHECK(b.sim.servo(1).writes == 3);
+    HOST_CHECK(s.elapsedUs < firstUs);
+
+    // 1つずつ書き込んで読み直すと
+    HostSim::setupClock();
+    unsigned long start = micros();
+    for (byte id = 1; id <= 6; id++) {
+        b.ics.setStrc(id, 60);
+        b.ics.setSpd(id, 100);
+        b.ics.setCur(id, 40);
+        b.ics.setTmp(id, 70);
+        b.ics.getStrc(id);
+        b.ics.getSpd(id);
+    }
+    unsigned long naiveUs = micros() - start;
+    printf("  blocking write+read of 6 servos: %lu us\n", naiveUs);
+    HOST_CHECK(firstUs < naiveUs);
+}
+
+void testPowerCycledServoRewritten() {
+    HostSim::setupClock();
+    ShadowBus b(2, 5);
+    for (byte id = 1; id <= 3; id++) {
+        b.sim.addServo(id);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsServoTable table;
+    table.discover(&bus);
+    IcsParamProfile p;
+    for (byte id = 1; id <= 3; id++) {
+        p.set(id, 80, 100, 40, 70);
+    }
+    HOST_CHECK(p.apply(&bus, &table));
+
+    // サーボ2の電源が入り直してROMの値に戻った(シャドウレジスタは知らない)
+    b.sim.addServo(2);
+    HOST_CHECK(p.apply(&bus, &table));
+    const IcsParamProfile::ApplyStats& s = p.getApplyStats();
+    HOST_CHECK(s.matched == 4);
+    HOST_CHECK(s.writes == 4);    // 読んだ値が違うのでリミットも書き直す
+    HOST_CHECK(s.skipped == 4);
+    HOST_CHECK(b.sim.servo(2).stretch == 80);
+    HOST_CHECK(b.sim.servo(2).currentLimit == 40);
+    HOST_CHECK(b.sim.servo(2).tempLimit == 70);
+    HOST_CHECK(b.sim.servo(2).writes == 4);
+}
+
+void testFailuresReported() {
+    HostSim::setupClock();
+    ShadowBus b(2, 5);
+    for (byte id = 1; id <= 3; id++) {
+        b.sim.addServo(id);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsParamProfile p;
+    for (byte id = 1; id <= 4; id++) {
+        p.set(id, 80, IcsParamProfile::KEEP, 40, IcsParamProfile::KEEP);
+    }
+
+    // 表が無ければ割り当てた全IDに送り、居ないID4は失敗として数える
+    HOST_CHECK(!p.apply(&bus));
+    const IcsParamProfile::ApplyStats& s = p.getApplyStats();
+    HOST_CHECK(s.readFailures == 1);
+    HOST_CHECK(s.verifyFailures == 2);
+    HOST_CHECK(b.sim.servo(1).stretch == 80);
+
+    // 表があれば居るサーボだけ
+    IcsServoTable table;
+    table.discover(&bus);
+    HOST_CHECK(p.apply(&bus, &table));
+    HOST_CHECK(s.reads == 3);
+
+    // 返信しないサーボは確かめられない
+    b.sim.setFaults(3, IcsBusSim::Faults::make(1000));
+    p.set(3, 90, IcsParamProfile::KEEP, 30, IcsParamProfile::KEEP);
+    HOST_CHECK(!p.apply(&bus, &table));
+    HOST_CHECK(s.readFailures == 1);
+    HOST_CHECK(s.verifyFailures == 2);
+    HOST_CHECK(s.elapsedUs < CONTROL_PERIOD_US);
+
+    // 時間切れ
+    HOST_CHECK(!p.apply(&bus, &table, 100));
+    HOST_CHECK(bus.waitAll(100000));
+}
+
+void testTimeoutStopsAndDrains() {
+    HostSim::setupClock();
+    ShadowBus b(2, 5);
+    for (byte id = 1; id <= 3; id++) {
+        b.sim.addServo(id);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 1, 3);
+    IcsParamProfile p;
+    for (byte id = 1; id <= 3; id++) {
+        p.set(id, 80, IcsParamProfile::KEEP, 40, IcsParamProfile::KEEP);
+    }
+
+    // 読出しが時間切れになったら、書込みに進まずに返る(100usは1トランザクションより短い)
+    HOST_CHECK(!p.apply(&bus, nullptr, 100));
+    HOST_CHECK(p.getApplyStats().elapsedUs < 200);
+    HOST_CHECK(p.getApplyStats().writes == 0);
+    HOST_CHECK(b.async.busy());   // 読出しの返信がまだ来ていない
+    for (byte id = 1; id <= 3; id++) {
+        HOST_CHECK(b.sim.servo(id).writes == 0);
+    }
+
+    // 次のapply()は残った返信を待ってから始め、前の読出しの結果を書込みと取り違えない
+    HOST_CHECK(p.apply(&bus));
+    const IcsParamProfile::ApplyStats& s = p.getApplyStats();
+    HOST_CHECK(s.reads == 3);
+    HOST_CHECK(s.matched == 0);
+    HOST_CHECK(s.writes == 6);
+    HOST_CHECK(s.verifyFailures == 0);
+    for (byte id = 1; id <= 3; id++) {
+        HOST_CHECK(b.sim.servo(id).stretch == 80);
+        HOST_CHECK(b.sim.servo(id).currentLimit == 40);
+    }
+
+    // 待つ間に時間切れになれば、何も積まずに返る
+    p.set(1, 90, IcsParamProfile::KEEP, 30, IcsParamProfile::KEEP);
+    unsigned long reads = b.sim.servo(1).reads;
+    HOST_CHECK(!p.apply(&bus, nullptr, 100));
+    HOST_CHECK(!p.apply(&bus, nullptr, 10));
+    HOST_CHECK(p.getApplyStats().reads == 0);
+    HOST_CHECK(bus.waitAll(100000));
+    HOST_CHECK(b.sim.servo(1).reads == reads + 1);
+}
+
+void testDualBusSwitch() {
+    HostSim::setupClock();
+    ShadowBus right(2, 5);
+    ShadowBus left(1, 4);
+    for (byte id = 1; id <= 3; id++) {
+        right.sim.addServo(id);
+        left.sim.addServo(id + 3);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&right.async, 0, 3);
+    bus.addBus(&left.async, 4, 6);
+    IcsServoTable table;
+    table.discover(&bus);
+
+    // 2つの組を交互に切り替える(main.cppのモード毎の組と同じ使い方)
+    IcsParamProfile soft;
+    IcsParamProfile stiff;
+    for (byte id = 1; id <= 6; id++) {
+        soft.set(id, 30, IcsParamProfile::KEEP, 30, 70);
+        stiff.set(id, 120, IcsParamProfile::KEEP, 63, 70);
+    }
+    unsigned long worst = 0;
+    for (int i = 0; i < 6; i++) {
+        IcsParamProfile& p = (i % 2) ? stiff : soft;
+        HOST_CHECK(p.apply(&bus, &table));
+        if (p.getApplyStats().elapsedUs > worst) {
+            worst = p.getApplyStats().elapsedUs;
+        }
+    }
+    printf("  dual bus profile switch: worst %lu us\n", worst);
+    HOST_CHECK(right.sim.servo(2).stretch == 120);
+    HOST_CHECK(left.sim.servo(5).currentLimit == 63);
+    HOST_CHECK(worst < CONTROL_PERIOD_US / 4);
+}
+
+int main() {
+    HOST_RUN(testSetValidation);
+    HOST_RUN(testWritesOnlyDifferences);
+    HOST_RUN(testPowerCycledServoRewritten);
+    HOST_RUN(testFailuresReported);
+    HOST_RUN(testTimeoutStopsAndDrains);
+    HOST_RUN(testDualBusSwitch);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,230 @@
+// test/test_host_resync.cpp
+// ホスト上で返信の確認と再同期(IcsHardSerialClass::resync)を確認する
+// 線のノイズでずれたバイトを返信として読ませ、失敗が次のサーボに続かないかを測る
+// pio run -e host_test_resync && .pio/build/host_test_resync/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsBus.h>
+#include <IcsTelemetry.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const unsigned long TICK_US = 10000;
+const int TICKS = 100;
+const int NOISE_EVERY = 10;   // このティック毎にノイズを入れる
+
+// 6軸のRS485のバス(送信と重ならないノイズは受信する)。作る度に仮想時計を0から始める
+struct ResyncBus : HostClock, HostBus {
+    IcsTelemetry tel;
+
+    ResyncBus() : HostBus(BAUDRATE, DEFAULT_UART, EN_PIN, IcsHardSerialClass::TRANSPORT_RS485_HW) {
+        ics.attachTelemetry(&tel);
+        addServos(1, 6);
+    }
+};
+
+// 線のノイズ。今からfirstUs後に1バイト、その後spacingUs毎にcount-1バイト
+// 最初のバイトは次の送信の返信より前、残りはその後のトランザクションに届く
+static void injectNoise(HardwareSerial& uart, unsigned long firstUs, int count, unsigned long spacingUs) {
+    const byte noise = 0x55;
+    unsigned long now = micros();
+    for (int i = 0; i < count; i++) {
+        uart.injectRx(&noise, 1, now + firstUs + i * spacingUs);
+    }
+}
+
+void testValidateEveryCommand() {
+    byte tx[4];
+    byte rx[4];
+
+    IcsCommand::encodePos(tx, 3, 7500);
+    rx[0] = 0x03; rx[1] = 0x3A; rx[2] = 0x4C;
+    HOST_CHECK(IcsCommand::validReply(tx, 3, rx, 3));
+    rx[0] = 0x04;   // 別のIDの返信
+    HOST_CHECK(!IcsCommand::validReply(tx, 3, rx, 3));
+    rx[0] = 0x03; rx[2] = 0x83;   // データの最上位ビットが1(次のコマンドがずれて入った)
+    HOST_CHECK(!IcsCommand::validReply(tx, 3, rx, 3));
+
+    IcsCommand::encodeWrite(tx, 3, IcsCommand::SC_SPD, 50);
+    rx[0] = 0x43; rx[1] = IcsCommand::SC_SPD; rx[2] = 50;
+    HOST_CHECK(IcsCommand::validReply(tx, 3, rx, 3));
+    rx[1] = IcsCommand::SC_STRC;   // サブコマンドが違う
+    HOST_CHECK(!IcsCommand::validReply(tx, 3, rx, 3));
+
+    IcsCommand::encodeRead(tx, 3, IcsCommand::SC_POS);
+    rx[0] = 0x23; rx[1] = IcsCommand::SC_POS; rx[2] = 0x3A; rx[3] = 0x4C;
+    HOST_CHECK(IcsCommand::validReply(tx, 2, rx, 4));
+    rx[0] = 0x43;   // 書込みの返信
+    HOST_CHECK(!IcsCommand::validReply(tx, 2, rx, 4));
+
+    // ID読出しはどのIDでもよく、ID書込みは書いたIDが返ること
+    tx[0] = 0xFF; tx[1] = 0; tx[2] = 0; tx[3] = 0;
+    rx[0] = 0xE5;
+    HOST_CHECK(IcsCommand::validReply(tx, 4, rx, 1));
+    rx[0] = 0x05;
+    HOST_CHECK(!IcsCommand::validReply(tx, 4, rx, 1));
+    tx[0] = 0xE0 + 7; tx[1] = 1; tx[2] = 1; tx[3] = 1;
+    rx[0] = 0xE7;
+    HOST_CHECK(IcsCommand::validReply(tx, 4, rx, 1));
+    rx[0] = 0xE5;
+    HOST_CHECK(!IcsCommand::validReply(tx, 4, rx, 1));
+
+    // UARTを通さない送受信でもIcsBusが確かめる
+    HostSim::resetClock();
+    IcsBusSim sim;
+    sim.addServo(1);
+    IcsSimClass simIcs(&sim);
+    IcsBus<IcsSimClass> bus(simIcs);
+    HOST_CHECK(bus.setPos(1, 8000) == 7500);
+    HOST_CHECK(bus.getTmp(1) >= 0);
+    HOST_CHECK(bus.setPos(2, 8000) == IcsBaseClass::ICS_FALSE);
+}
+
+void testSlippedByteRejected() {
+    ResyncBus b;
+    HOST_CHECK(b.ics.setPos(1, 8000) == 7500);
+
+    // 返信の前に1バイト入ると、以前は[ノイズ, 先頭, POS_H]をポジションとして読んでいた
+    injectNoise(b.uart, 60, 1, 0);
+    HOST_CHECK(b.ics.setPos(1, 8000) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(b.tel.get(1).count[IcsTelemetry::RESULT_BAD_REPLY] == 1);
+    HOST_CHECK(b.ics.getResyncStats().triggered == 0);   // 有効にしていない
+
+    injectNoise(b.uart, 60, 1, 0);
+    HOST_CHECK(b.ics.getSpd(1) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(b.tel.get(1).count[IcsTelemetry::RESULT_BAD_REPLY] == 2);
+
+    // ずれていなければそのまま使える
+    HOST_CHECK(b.ics.setPos(1, 8000) >= 7500);
+    HOST_CHECK(b.ics.getSpd(1) == 127);
+}
+
+void testResyncProbesLastId() {
+    ResyncBus b;
+    b.ics.setAutoResync(true);
+    HOST_CHECK(b.ics.getAutoResync());
+
+    injectNoise(b.uart, 60, 2, 160);   // 2バイト目はずれを直さないと次のトランザクションに入る
+    unsigned long start = micros();
+    HOST_CHECK(b.ics.setPos(1, 8000) == IcsBaseClass::ICS_FALSE);
+    unsigned long elapsed = micros() - start;
+    HOST_CHECK(b.ics.setPos(2, 8000) == 7500);
+
+    const IcsHardSerialClass::ResyncStats& s = b.ics.getResyncStats();
+    printf("  resync: gap %lu us, setPos with resync %lu us, drained %lu bytes\n",
+           b.ics.resyncGapUs(), elapsed, s.drainedBytes);
+    HOST_CHECK(s.triggered == 1);
+    HOST_CHECK(s.recovered == 1);
+    HOST_CHECK(s.failed == 0);
+    HOST_CHECK(s.drainedBytes >= 2);
+    HOST_CHECK(s.lastId == 1);
+    HOST_CHECK(b.sim.servo(1).reads == 1);   // 再確認の読出し
+    HOST_CHECK(elapsed < 1000);
+
+    // 返信が1バイトも来ない時は再同期しない
+    HOST_CHECK(b.ics.setPos(9, 8000) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(s.triggered == 1);
+
+    // 再確認に返信が無ければ失敗として数える
+    HOST_CHECK(!b.ics.resync(9));
+    HOST_CHECK(s.failed == 1);
+    HOST_CHECK(b.ics.resync(2));
+    HOST_CHECK(s.recovered == 2);
+
+    // ずっと何か届いていれば、決まった時間であきらめる
+    injectNoise(b.uart, 0, 100, 50);
+    start = micros();
+    HOST_CHECK(!b.ics.resync(1));
+    elapsed = micros() - start;
+    HOST_CHECK(elapsed >= b.ics.resyncGapUs() * IcsHardSerialClass::RESYNC_MAX_GAPS);
+    HOST_CHECK(elapsed < b.ics.resyncGapUs() * (IcsHardSerialClass::RESYNC_MAX_GAPS + 1));
+    HOST_CHECK(s.failed == 2);
+
+    b.ics.resetResyncStats();
+    HOST_CHECK(b.ics.getResyncStats().triggered == 0);
+}
+
+void testMultiResyncsBeforeNextFrame() {
+    ResyncBus b;
+    b.ics.setAutoResync(true);
+    unsigned int pos[6] = {8000, 8000, 8000, 8000, 8000, 8000};
+    byte ids[6] = {1, 2, 3, 4, 5, 6};
+    int rePos[6];
+
+    injectNoise(b.uart, 60, 2, 160);
+    HOST_CHECK(b.ics.setPosMulti(ids, pos, 6, rePos) == 5);
+    HOST_CHECK(rePos[0] == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(rePos[1] == 7500);
+    HOST_CHECK(b.ics.getResyncStats().recovered == 1);
+}
+
+// ティック毎に6軸を送り、NOISE_EVERYティック毎にサーボ1の返信にノイズを入れる
+static void runTicks(bool resync, bool async, unsigned long& failed, unsigned long& maxBusUs, ResyncBus& b) {
+    b.ics.setAutoResync(resync);
+    failed = 0;
+    maxBusUs = 0;
+    unsigned long tickStart = micros();
+    for (int tick = 0; tick < TICKS; tick++) {
+        if (tick % NOISE_EVERY == 0) {
+            injectNoise(b.uart, 60, 2, 160);
+        }
+        unsigned long start = micros();
+        for (byte id = 1; id <= 6; id++) {
+            if (async) {
+                b.async.submitSetPos(id, 7000 + tick);
+            } else if (b.ics.setPos(id, 7000 + tick) < 0) {
+                failed++;
+            }
+        }
+        if (async) {
+            HOST_CHECK(b.async.waitAll(TICK_US));
+        }
+        if (micros() - start > maxBusUs) {
+            maxBusUs = micros() - start;
+        }
+        tickStart += TICK_US;
+        HostSim::advanceUs(tickStart - micros());
+    }
+    if (async) {
+        for (byte id = 1; id <= 6; id++) {
+            failed += b.tel.failures(id);
+        }
+    }
+}
+
+void testFailureDoesNotCascade() {
+    for (int async = 0; async < 2; async++) {
+        unsigned long failed[2];
+        unsigned long maxBus[2];
+        unsigned long recovered = 0;
+        for (int resync = 0; resync < 2; resync++) {
+            ResyncBus b;
+            runTicks(resync == 1, async == 1, failed[resync], maxBus[resync], b);
+            if (resync == 1) {
+                recovered = b.ics.getResyncStats().recovered;
+                HOST_CHECK(b.ics.getResyncStats().triggered == (unsigned long)(TICKS / NOISE_EVERY));
+                HOST_CHECK(b.tel.failures(2) == 0);   // ずれは次のサーボに続かない
+            }
+        }
+        printf("  %s: failed %lu -> %lu, max bus time per tick %lu -> %lu us, recovered %lu\n",
+               async ? "async" : "sync ", failed[0], failed[1], maxBus[0], maxBus[1], recovered);
+        HOST_CHECK(failed[0] == 2UL * (TICKS / NOISE_EVERY));   // ノイズを読んだサーボと次のサーボ
+        HOST_CHECK(failed[1] == 1UL * (TICKS / NOISE_EVERY));
+        HOST_CHECK(recovered == (unsigned long)(TICKS / NOISE_EVERY));
+        HOST_CHECK(maxBus[1] < TICK_US / 4);   // 1ティックの中で直る
+    }
+}
+
+int main() {
+    HOST_RUN(testValidateEveryCommand);
+    HOST_RUN(testSlippedByteRejected);
+    HOST_RUN(testResyncProbesLastId);
+    HOST_RUN(testMultiResyncsBeforeNextFrame);
+    HOST_RUN(testFailureDoesNotCascade);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,199 @@
+// test/test_host_ring.cpp
+// ホスト上でフレームのリング(IcsFrameRing)とIcsHardSerialClass::transactRing()を確認する
+// 枠の中に組み立てて返信をその場で読む送受信を、今までのsetPos/setPosMultiと比べる
+// pio run -e host_test_ring && .pio/build/host_test_ring/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsFrameRing.h>
+#include <IcsTelemetry.h>
+#include <chrono>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const int BENCH_TICKS = 2000;
+const byte IDS[6] = {1, 2, 3, 4, 5, 6};
+
+// 6軸のバス。作る度に仮想時計を0から始める
+struct RingBus : HostClock, HostBus {
+    RingBus() : HostBus(BAUDRATE, DEFAULT_UART, EN_PIN) {
+        addServos(1, 6);
+    }
+};
+
+void testRingFrames() {
+    IcsFrameRing ring;
+    HOST_CHECK(ring.pending() == 0);
+    HOST_CHECK(ring.front() == nullptr);
+    HOST_CHECK(ring.pushPos(32, 7500) == nullptr);
+    HOST_CHECK(ring.pushPos(1, 20000) == nullptr);
+    HOST_CHECK(ring.pushWrite(1, IcsCommand::SC_CUR, 64) == nullptr);
+    HOST_CHECK(ring.pushRead(1, 6) == nullptr);
+
+    IcsFrameRing::Frame* f = ring.pushPos(3, 8000);
+    HOST_CHECK(f != nullptr);
+    HOST_CHECK(f->tx()[0] == 0x83);
+    HOST_CHECK(f->rx() == f->buf + 3);
+    HOST_CHECK(f->id() == 3);
+    HOST_CHECK(((uintptr_t)f->buf & 3) == 0);
+    HOST_CHECK(IcsFrameRing::value(f) == -1);   // まだ送っていない
+    IcsFrameRing::Frame* r = ring.pushRead(3, IcsCommand::SC_POS);
+    HOST_CHECK(r->txLen == 2 && r->rxLen == 4);
+    HOST_CHECK(ring.front() == f);
+    ring.pop();
+    HOST_CHECK(ring.front() == r);
+    ring.clear();
+
+    // いっぱいになったら積めない。送った枠は使い回す
+    for (int i = 0; i < IcsFrameRing::FRAME_NUM; i++) {
+        HOST_CHECK(ring.pushFree(1) != nullptr);
+    }
+    HOST_CHECK(ring.pushFree(1) == nullptr);
+    ring.pop();
+    HOST_CHECK(ring.pushFree(1) != nullptr);
+}
+
+void testTransactRing() {
+    RingBus b;
+    IcsFrameRing ring;
+    IcsFrameRing::Frame* pos[6];
+    for (byte k = 0; k < 6; k++) {
+        pos[k] = ring.pushPos(IDS[k], 7000 + 100 * k);
+    }
+    IcsFrameRing::Frame* spd = ring.pushWrite(2, IcsCommand::SC_SPD, 90);
+    IcsFrameRing::Frame* tmp = ring.pushRead(4, IcsCommand::SC_TMP);
+    IcsFrameRing::Frame* cur = ring.pushRead(5, IcsCommand::SC_POS);
+    IcsFrameRing::Frame* gone = ring.pushPos(9, 7500);   // 居ないID
+    HOST_CHECK(ring.pending() == 10);
+
+    HOST_CHECK(b.ics.transactRing(ring) == 9);
+    HOST_CHECK(ring.pending() == 0);
+    for (byte k = 0; k < 6; k++) {
+        HOST_CHECK(pos[k]->ok);
+        HOST_CHECK(IcsFrameRing::value(pos[k]) == 7500);   // 返信は動く前の位置
+        HOST_CHECK(b.sim.servo(IDS[k]).target == 7000 + 100 * k);
+    }
+    HOST_CHECK(IcsFrameRing::value(spd) == 90);
+    HOST_CHECK(b.sim.servo(2).speed == 90);
+    HOST_CHECK(IcsFrameRing::value(tmp) == b.sim.servo(4).temperature);
+    HOST_CHECK(IcsFrameRing::value(cur) == b.sim.servo(5).position);
+    HOST_CHECK(!gone->ok);
+    HOST_CHECK(gone->rxCount == 0);
+    HOST_CHECK(IcsFrameRing::value(gone) == -1);
+    // 3バイトずつ返信が来るので、フレーム1つで1回だけread()する
+    HOST_CHECK(b.uart.stats().rxReadCalls == 9);
+}
+
+void testRingFailures() {
+    RingBus b;
+    IcsTelemetry tel;
+    b.ics.attachTelemetry(&tel);
+    b.ics.setAutoResync(true);
+
+    // 化けた返信は照合で失敗にして再同期し、後ろのフレームは正しく読む
+    b.sim.setFaults(2, IcsBusSim::Faults::make(0, 1000));
+    IcsFrameRing ring;
+    IcsFrameRing::Frame* a = ring.pushPos(1, 8000);
+    IcsFrameRing::Frame* bad = ring.pushPos(2, 8000);
+    IcsFrameRing::Frame* c = ring.pushRead(3, IcsCommand::SC_STRC);
+    HOST_CHECK(b.ics.transactRing(ring) == 2);
+    HOST_CHECK(a->ok);
+    HOST_CHECK(!bad->ok);
+    HOST_CHECK(IcsFrameRing::value(c) == 60);
+    HOST_CHECK(tel.get(2).count[IcsTelemetry::RESULT_OK] == 0);
+    HOST_CHECK(tel.get(3).count[IcsTelemetry::RESULT_OK] == 1);
+
+    // エコーのある配線
+    RingBus e;
+    e.setEcho(true);
+    IcsFrameRing::Frame* p = ring.pushPos(4, 9000);
+    IcsFrameRing::Frame* q = ring.pushRead(4, IcsCommand::SC_POS);
+    HOST_CHECK(e.ics.transactRing(ring) == 2);
+    HOST_CHECK(IcsFrameRing::value(p) == 7500);
+    HOST_CHECK(IcsFrameRing::value(q) >= 7500);
+    HOST_CHECK(e.sim.servo(4).target == 9000);
+
+    // TIMEOUT_FIXEDでも読める
+    e.ics.setTimeoutMode(IcsHardSerialClass::TIMEOUT_FIXED);
+    p = ring.pushRead(6, IcsCommand::SC_SPD);
+    HOST_CHECK(e.ics.transactRing(ring) == 1);
+    HOST_CHECK(IcsFrameRing::value(p) == 127);
+}
+
+// 6軸のポジション設定をBENCH_TICKS回送る
+enum Path {PATH_SETPOS, PATH_MULTI, PATH_RING};
+static void bench(Path path, double& nsPerFrame, double& readsPerFrame, unsigned long& busUsPerTick) {
+    RingBus b;
+    IcsFrameRing ring;
+    unsigned int positions[6];
+    int rePos[6];
+    unsigned long sum = 0;
+
+    typedef std::chrono::steady_clock Clock;
+    unsigned long startUs = micros();
+    Clock::time_point t0 = Clock::now();
+    for (int tick = 0; tick < BENCH_TICKS; tick++) {
+        for (byte k = 0; k < 6; k++) {
+            positions[k] = 7000 + (tick + k) % 1000;
+        }
+        switch (path) {
+        case PATH_SETPOS:
+            for (byte k = 0; k < 6; k++) {
+                sum += b.ics.setPos(IDS[k], positions[k]);
+            }
+            break;
+        case PATH_MULTI:
+            b.ics.setPosMulti(IDS, positions, 6, rePos);
+            for (byte k = 0; k < 6; k++) {
+                sum += rePos[k];
+            }
+            break;
+        case PATH_RING: {
+            IcsFrameRing::Frame* f[6];
+            for (byte k = 0; k < 6; k++) {
+                f[k] = ring.pushPos(IDS[k], positions[k]);
+            }
+            b.ics.transactRing(ring);
+            for (byte k = 0; k < 6; k++) {
+                sum += IcsFrameRing::value(f[k]);
+            }
+            break;
+        }
+        }
+    }
+    Clock::time_point t1 = Clock::now();
+    unsigned long frames = 6UL * BENCH_TICKS;
+    nsPerFrame = std::chrono::duration<double, std::nano>(t1 - t0).count() / frames;
+    readsPerFrame = (double)b.uart.stats().rxReadCalls / frames;
+    busUsPerTick = (micros() - startUs) / BENCH_TICKS;
+    HOST_CHECK(b.uart.stats().txFrames == frames);
+    HOST_CHECK(b.sim.servo(6).posCommands == (unsigned long)BENCH_TICKS);
+    HOST_CHECK(sum > 0);
+}
+
+void testBenchmark() {
+    double ns[3], reads[3];
+    unsigned long busUs[3];
+    bench(PATH_SETPOS, ns[0], reads[0], busUs[0]);
+    bench(PATH_MULTI, ns[1], reads[1], busUs[1]);
+    bench(PATH_RING, ns[2], reads[2], busUs[2]);
+    printf("  setPos:        %8.1f ns/frame (host), %.1f read calls/frame, %lu us/tick on the bus\n", ns[0], reads[0], busUs[0]);
+    printf("  setPosMulti:   %8.1f ns/frame (host), %.1f read calls/frame, %lu us/tick on the bus\n", ns[1], reads[1], busUs[1]);
+    printf("  transactRing:  %8.1f ns/frame (host), %.1f read calls/frame, %lu us/tick on the bus\n", ns[2], reads[2], busUs[2]);
+    // 返信を1バイトずつ読まない
+    HOST_CHECK(reads[0] == 3.0);
+    HOST_CHECK(reads[2] == 1.0);
+    // バスの時間は同じかそれ以下
+    HOST_CHECK(busUs[2] <= busUs[1]);
+}
+
+int main() {
+    HOST_RUN(testRingFrames);
+    HOST_RUN(testTransactRing);
+    HOST_RUN(testRingFailures);
+    HOST_RUN(testBenchmark);
+    return HOST_TEST_RESULT();
+}
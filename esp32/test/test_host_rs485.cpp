@@ -0,0 +1,130 @@
+// test/test_host_rs485.cpp
+// ホスト上でGPIO切替とRS485ハードウェア切替の違いを確認する
+// pio run -e host_test_rs485 && .pio/build/host_test_rs485/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include "host/host_test.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const int TIMEOUT = 20;
+
+// ポジションコマンドにだけ返信するサーボ
+class ReplyPeer : public HostUartPeer {
+public:
+    explicit ReplyPeer(unsigned long latencyUs) : latencyUs(latencyUs) {}
+    void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override {
+        if (len != 3 || (data[0] & 0xE0) != 0x80) {
+            return;
+        }
+        uint8_t reply[3] = {(uint8_t)(data[0] & 0x7F), data[1], data[2]};
+        uart.injectRx(reply, sizeof reply, endUs + latencyUs);
+    }
+    unsigned long latencyUs;
+};
+
+static void setupBus(HardwareSerial& uart, ReplyPeer& peer) {
+    HostSim::resetClock();
+    HostSim::setGpioLatencyUs(0);
+    uart.resetHost();
+    uart.attachPeer(&peer);
+    uart.setDirPin(EN_PIN);
+}
+
+void testGpioTransportWorks() {
+    HardwareSerial uart(2);
+    ReplyPeer peer(20);
+    setupBus(uart, peer);
+
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    HOST_CHECK(krs.begin());
+    HOST_CHECK(krs.getTransportMode() == IcsHardSerialClass::TRANSPORT_GPIO);
+
+    unsigned long writesBefore = HostSim::pinWriteCount(EN_PIN);
+    HOST_CHECK(krs.setPos(1, 7500) == 7500);
+    HOST_CHECK(HostSim::pinWriteCount(EN_PIN) - writesBefore == 2);
+    HOST_CHECK(uart.stats().collisions == 0);
+}
+
+void testSlowSoftwareTurnaroundLosesReply() {
+    HardwareSerial uart(2);
+    ReplyPeer peer(5);  // サーボの返信がソフトウェアの切替より早い
+    setupBus(uart, peer);
+
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+    HostSim::setGpioLatencyUs(15);
+
+    HOST_CHECK(krs.setPos(1, 7500) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(uart.stats().collisions > 0);
+}
+
+void testRs485HardwareTurnaround() {
+    HardwareSerial uart(2);
+    ReplyPeer peer(5);
+    setupBus(uart, peer);
+
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    HOST_CHECK(krs.setTransportMode(IcsHardSerialClass::TRANSPORT_RS485_HW));
+    HOST_CHECK(krs.begin());
+    HOST_CHECK(krs.getTransportMode() == IcsHardSerialClass::TRANSPORT_RS485_HW);
+    HOST_CHECK(uart.mode() == UART_MODE_RS485_HALF_DUPLEX);
+    HOST_CHECK(uart.rxTimeoutSymbols() == IcsHardSerialClass::RS485_RX_TIMEOUT_SYMBOLS);
+    HostSim::setGpioLatencyUs(15);
+
+    unsigned long writesBefore = HostSim::pinWriteCount(EN_PIN);
+    HOST_CHECK(krs.setPos(1, 7500) == 7500);
+    HOST_CHECK(krs.setPos(2, 8000) == 8000);
+    HOST_CHECK(HostSim::pinWriteCount(EN_PIN) == writesBefore);  // ソフトウェアでは切り替えない
+    HOST_CHECK(uart.stats().rtsToggles == 4);
+    HOST_CHECK(uart.stats().collisions == 0);
+}
+
+void testRs485ReplyLatency() {
+    // RX FIFOタイムアウトを短くした分だけ返信を早く受け取れる
+    unsigned long elapsed[2];
+    for (int mode = 0; mode < 2; mode++) {
+        HardwareSerial uart(2);
+        ReplyPeer peer(20);
+        setupBus(uart, peer);
+        IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+        if (mode == 1) {
+            krs.setTransportMode(IcsHardSerialClass::TRANSPORT_RS485_HW);
+        }
+        krs.begin();
+        unsigned long start = micros();
+        HOST_CHECK(krs.setPos(3, 9000) == 9000);
+        elapsed[mode] = micros() - start;
+    }
+    printf("  GPIO: %lu us, RS485: %lu us\n", elapsed[0], elapsed[1]);
+    HOST_CHECK(elapsed[1] < elapsed[0]);
+}
+
+void testRs485Multi() {
+    HardwareSerial uart(2);
+    ReplyPeer peer(5);
+    setupBus(uart, peer);
+
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTransportMode(IcsHardSerialClass::TRANSPORT_RS485_HW);
+    krs.begin();
+
+    byte ids[6] = {1, 2, 3, 4, 5, 6};
+    unsigned int pos[6] = {7000, 7100, 7200, 7300, 7400, 7500};
+    int rePos[6];
+    HOST_CHECK(krs.setPosMulti(ids, pos, 6, rePos) == 6);
+    for (int i = 0; i < 6; i++) {
+        HOST_CHECK(rePos[i] == (int)pos[i]);
+    }
+}
+
+int main() {
+    HOST_RUN(testGpioTransportWorks);
+    HOST_RUN(testSlowSoftwareTurnaroundLosesReply);
+    HOST_RUN(testRs485HardwareTurnaround);
+    HOST_RUN(testRs485ReplyLatency);
+    HOST_RUN(testRs485Multi);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,211 @@
+// test/test_host_scheduler.cpp
+// ホスト上で優先度付きスケジューラ(IcsScheduler)を確認する
+// 読出しをティックの空き時間にだけ送り、モーションの送信がティックから遅れないことを測る
+// pio run -e host_test_scheduler && .pio/build/host_test_scheduler/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsMultiBus.h>
+#include <IcsScheduler.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+
+// 読出しの完了を数える
+struct ReadLog {
+    int done;
+    int order[64];
+};
+static void onRead(int handle, bool ok, const byte* rxBuf, byte rxLen, void* ctx) {
+    (void)handle;
+    (void)rxLen;
+    ReadLog* log = static_cast<ReadLog*>(ctx);
+    if (ok && log->done < 64) {
+        log->order[log->done++] = rxBuf[1];   // サブコマンド
+    }
+}
+
+// モーションの最後の返信が届いた時刻
+static unsigned long motionDoneUs;
+static void onMotion(int handle, bool ok, const byte* rxBuf, byte rxLen, void* ctx) {
+    (void)handle;
+    (void)ok;
+    (void)rxBuf;
+    (void)rxLen;
+    (void)ctx;
+    motionDoneUs = micros();
+}
+
+void testFreeRunAndPriority() {
+    HostSim::setupClock();
+    HostBus b(1250000);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    ReadLog log;
+    memset(&log, 0, sizeof(log));
+
+    HOST_CHECK(sched.slackUs() > 1000000L);   // ティック無し
+    HOST_CHECK(!sched.requestRead(IcsScheduler::PRIO_MOTION, 1, IcsCommand::SC_TMP));
+    HOST_CHECK(!sched.requestRead(IcsScheduler::PRIO_SAFETY, 1, 9));
+
+    // 後から置いた安全の読出しが先に送られる
+    HOST_CHECK(sched.requestRead(IcsScheduler::PRIO_TELEMETRY, 1, IcsCommand::SC_CUR, onRead, &log));
+    HOST_CHECK(sched.requestRead(IcsScheduler::PRIO_TELEMETRY, 2, IcsCommand::SC_POS, onRead, &log));
+    HOST_CHECK(sched.requestRead(IcsScheduler::PRIO_SAFETY, 3, IcsCommand::SC_TMP, onRead, &log));
+    HOST_CHECK(sched.queuedReads(IcsScheduler::PRIO_TELEMETRY) == 2);
+    for (int i = 0; i < 1000 && log.done < 3; i++) {
+        sched.poll();
+        delayMicroseconds(10);
+    }
+    HOST_CHECK(log.done == 3);
+    HOST_CHECK(log.order[0] == IcsCommand::SC_TMP);
+    HOST_CHECK(log.order[1] == IcsCommand::SC_CUR);
+    HOST_CHECK(log.order[2] == IcsCommand::SC_POS);
+    HOST_CHECK(sched.getStats().issued[IcsScheduler::PRIO_SAFETY] == 1);
+    HOST_CHECK(sched.getStats().issued[IcsScheduler::PRIO_TELEMETRY] == 2);
+
+    // キューがいっぱい
+    for (int i = 0; i < IcsScheduler::READ_QUEUE_SIZE; i++) {
+        HOST_CHECK(sched.requestRead(IcsScheduler::PRIO_TELEMETRY, 1, IcsCommand::SC_CUR));
+    }
+    HOST_CHECK(!sched.requestRead(IcsScheduler::PRIO_TELEMETRY, 1, IcsCommand::SC_CUR));
+    HOST_CHECK(sched.getStats().dropped == 1);
+}
+
+void testSlackAdmission() {
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+
+    unsigned long cost = sched.readCostUs(1, IcsCommand::SC_TMP);
+    printf("  read cost @115200: %lu us\n", cost);
+    HOST_CHECK(cost > 500 && cost < 2000);
+    HOST_CHECK(sched.readCostUs(1, IcsCommand::SC_POS) > cost);
+    HOST_CHECK(sched.readCostUs(20, IcsCommand::SC_TMP) > 0);
+
+    // ティックの残りが足りない時は送らない
+    sched.beginTick(10000);
+    HostSim::advanceUs(10000 - IcsScheduler::DEFAULT_GUARD_US - cost + 10);
+    HOST_CHECK(sched.slackUs() < (long)cost);
+    sched.requestRead(IcsScheduler::PRIO_SAFETY, 1, IcsCommand::SC_TMP);
+    sched.poll();
+    sched.poll();
+    HOST_CHECK(!b.async.busy());
+    HOST_CHECK(sched.queuedReads(IcsScheduler::PRIO_SAFETY) == 1);
+    HOST_CHECK(sched.getStats().deferred == 1);   // 1ティックに1回だけ数える
+
+    // 次のティックの初めなら送る
+    HostSim::advanceUs(1000);
+    sched.beginTick(10000);
+    sched.poll();
+    HOST_CHECK(b.async.busy());
+    HOST_CHECK(sched.queuedReads(IcsScheduler::PRIO_SAFETY) == 0);
+    HOST_CHECK(b.async.waitAll(100000));
+
+    // 2周期ティックが来なければモーションは止まったとみなす
+    HostSim::advanceUs(20000);
+    HOST_CHECK(sched.slackUs() > 1000000L);
+    sched.beginTick(10000);
+    sched.endTicks();
+    HOST_CHECK(sched.slackUs() > 1000000L);
+}
+
+// 6軸のモーションをティック毎に送り、読出しを詰め込んだ時のモーションの遅れを測る
+enum ReadMode {READ_NONE, READ_NAIVE, READ_SCHEDULED};
+// READ_NAIVEは読出しをバスが空いた時に何も考えずに送る
+static void runTicks(ReadMode mode, unsigned long& maxMotionUs, unsigned long& lateTicks, unsigned long& reads) {
+    const unsigned long TICK_US = 10000;
+    const int TICKS = 200;
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    ReadLog log;
+    memset(&log, 0, sizeof(log));
+
+    maxMotionUs = 0;
+    lateTicks = 0;
+    reads = 0;
+    byte readId = 1;
+    unsigned long tickStart = micros();
+    for (int tick = 0; tick < TICKS; tick++) {
+        if (bus.busy()) {
+            lateTicks++;
+        }
+        if (mode == READ_SCHEDULED) {
+            sched.beginTick(TICK_US);
+        }
+        unsigned long start = micros();
+        for (byte id = 1; id <= 6; id++) {
+            if (mode == READ_SCHEDULED) {
+                sched.submitMotionPos(id, 7000 + tick, onMotion);
+            } else {
+                bus.submitSetPos(id, 7000 + tick, onMotion);
+            }
+        }
+        motionDoneUs = 0;
+        while ((long)(micros() - (tickStart + TICK_US)) < 0) {
+            if (mode == READ_SCHEDULED) {
+                if (sched.queuedReads(IcsScheduler::PRIO_TELEMETRY) == 0) {
+                    sched.requestRead(IcsScheduler::PRIO_TELEMETRY, readId, IcsCommand::SC_POS, onRead, &log);
+                    readId = readId % 6 + 1;
+                }
+                sched.poll();
+            } else {
+                bus.poll();
+                if (mode == READ_NAIVE && !bus.busy()) {
+                    bus.submitGetParam(readId, IcsCommand::SC_POS, onRead, &log);
+                    readId = readId % 6 + 1;
+                    bus.poll();
+                }
+            }
+            delayMicroseconds(20);
+        }
+        if (motionDoneUs != 0 && motionDoneUs - start > maxMotionUs) {
+            maxMotionUs = motionDoneUs - start;
+        }
+        tickStart += TICK_US;
+        reads += log.done;
+        log.done = 0;
+    }
+    HOST_CHECK(bus.waitAll(100000));
+    if (mode == READ_SCHEDULED) {
+        HOST_CHECK(sched.getStats().lateTicks == 0);
+        HOST_CHECK(sched.getStats().issued[IcsScheduler::PRIO_MOTION] == 6UL * TICKS);
+    }
+}
+
+void testMotionNeverPushedPastTick() {
+    unsigned long maxMotion[3], late[3], reads[3];
+    runTicks(READ_NONE, maxMotion[0], late[0], reads[0]);
+    runTicks(READ_NAIVE, maxMotion[1], late[1], reads[1]);
+    runTicks(READ_SCHEDULED, maxMotion[2], late[2], reads[2]);
+    printf("  motion only: late ticks %lu/200, max motion %lu us\n", late[0], maxMotion[0]);
+    printf("  naive:       late ticks %lu/200, max motion %lu us, reads %lu\n", late[1], maxMotion[1], reads[1]);
+    printf("  scheduler:   late ticks %lu/200, max motion %lu us, reads %lu\n", late[2], maxMotion[2], reads[2]);
+
+    HOST_CHECK(late[0] == 0);
+    HOST_CHECK(late[1] > 0);
+    HOST_CHECK(late[2] == 0);
+    // 読出しに押されず、モーションだけの時と同じ時間で届く
+    HOST_CHECK(maxMotion[2] < maxMotion[1]);
+    HOST_CHECK(maxMotion[2] <= maxMotion[0] + 100);
+    // 空き時間で読出しも進む
+    HOST_CHECK(reads[2] > 200);
+}
+
+int main() {
+    HOST_RUN(testFreeRunAndPriority);
+    HOST_RUN(testSlackAdmission);
+    HOST_RUN(testMotionNeverPushedPastTick);
+    return HOST_TEST_RESULT();
+}
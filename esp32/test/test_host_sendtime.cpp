@@ -0,0 +1,262 @@
+// test/test_host_sendtime.cpp
+// ホスト上でサーボ毎の送信時刻の見込み(IcsScheduler::predictSendUs)を確認する
+// 見込みとサーボが実際にポジションを受け取った時刻を比べ、軌道を1回の時刻で計算した時の位相の誤差と比べる
+// pio run -e host_test_sendtime && .pio/build/host_test_sendtime/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsMultiBus.h>
+#include <IcsScheduler.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const unsigned long TICK_US = 20000;
+const byte IDS[6] = {1, 2, 3, 4, 5, 6};
+
+// 返信までの時間の見込みをシミュレータのサーボに合わせたバス
+struct LatencyBus : HostBus {
+    LatencyBus(int uartNum, byte enPin, long baud) : HostBus(baud, uartNum, enPin) {
+        ics.setResponseLatencyUs(IcsBusSim::DEFAULT_LATENCY_US);
+    }
+};
+
+// 見込みと、サーボが最後のフレームを受け取った時刻の差の最大(us)
+static unsigned long maxError(const IcsBusSim& sim, const unsigned long* predicted, byte first, byte last) {
+    unsigned long worst = 0;
+    for (byte id = first; id <= last; id++) {
+        unsigned long actual = const_cast<IcsBusSim&>(sim).servo(id).lastUpdateUs;
+        unsigned long e = (actual > predicted[id - 1]) ? actual - predicted[id - 1] : predicted[id - 1] - actual;
+        if (e > worst) {
+            worst = e;
+        }
+    }
+    return worst;
+}
+
+void testBurstPrediction() {
+    HostSim::setupClock();
+    LatencyBus b(2, 5, 115200);
+    for (byte id = 1; id <= 6; id++) {
+        b.sim.addServo(id);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+
+    sched.beginTick(TICK_US);
+    unsigned long now = micros();
+    unsigned long predicted[6];
+    sched.predictSendUs(IDS, 6, predicted);
+    HOST_CHECK(predicted[0] == now + b.ics.frameTimeUs(IcsCommand::POS_TX_LEN));
+    for (byte k = 1; k < 6; k++) {
+        HOST_CHECK(predicted[k] > predicted[k - 1]);
+    }
+    for (byte id = 1; id <= 6; id++) {
+        sched.submitMotionPos(id, 8000);
+    }
+    HOST_CHECK(bus.waitAll(100000));
+    unsigned long err = maxError(b.sim, predicted, 1, 6);
+    unsigned long spread = b.sim.servo(6).lastUpdateUs - b.sim.servo(1).lastUpdateUs;
+    printf("  burst @115200: servo 6 receives %lu us after servo 1, prediction error %lu us\n", spread, err);
+    HOST_CHECK(spread > 3000);
+    HOST_CHECK(err < 100);
+
+    // 割り当てていないIDは今の時刻
+    IcsMultiBus part;
+    part.addBus(&b.async, 1, 3);
+    IcsScheduler small(&part);
+    const byte ids[2] = {4, 1};
+    small.predictSendUs(ids, 2, predicted);
+    HOST_CHECK(predicted[0] == micros());
+    HOST_CHECK(predicted[1] == micros() + b.ics.frameTimeUs(IcsCommand::POS_TX_LEN));
+}
+
+void testDualBusPrediction() {
+    HostSim::setupClock();
+    LatencyBus right(2, 5, 1250000);
+    LatencyBus left(1, 4, 1250000);
+    for (byte id = 1; id <= 3; id++) {
+        right.sim.addServo(id);
+        left.sim.addServo(id + 3);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&right.async, 0, 3);
+    bus.addBus(&left.async, 4, 6);
+    IcsScheduler sched(&bus);
+
+    sched.beginTick(TICK_US);
+    unsigned long predicted[6];
+    sched.predictSendUs(IDS, 6, predicted);
+    // 左右は同時に送る
+    HOST_CHECK(predicted[0] == predicted[3]);
+    HOST_CHECK(predicted[2] == predicted[5]);
+    for (byte id = 1; id <= 6; id++) {
+        sched.submitMotionPos(id, 8000);
+    }
+    bus.poll();
+    HOST_CHECK(bus.waitAll(100000));
+    unsigned long err = maxError(right.sim, predicted, 1, 3);
+    unsigned long errLeft = maxError(left.sim, predicted, 4, 6);
+    printf("  dual bus @1.25M: prediction error right %lu us, left %lu us\n", err, errLeft);
+    HOST_CHECK(err < 50);
+    HOST_CHECK(errLeft < 50);
+}
+
+void testSlotPrediction() {
+    HostSim::setupClock();
+    LatencyBus b(2, 5, 115200);
+    for (byte id = 1; id <= 6; id++) {
+        b.sim.addServo(id);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US, true));
+
+    sched.beginTick(TICK_US);
+    unsigned long tickStart = micros();
+    unsigned long predicted[6];
+    sched.predictSendUs(IDS, 6, predicted);
+    for (byte id = 1; id <= 6; id++) {
+        HOST_CHECK(predicted[id - 1] == tickStart + sched.slotOffsetUs(id) + b.ics.frameTimeUs(IcsCommand::POS_TX_LEN));
+        sched.stageMotion(id, 8000);
+    }
+    while (micros() - tickStart < TICK_US) {
+        sched.poll();
+        delayMicroseconds(10);
+    }
+    unsigned long err = maxError(b.sim, predicted, 1, 6);
+    printf("  tdma slots @115200: prediction error %lu us\n", err);
+    HOST_CHECK(err <= IcsScheduler::DEFAULT_JITTER_US);
+}
+
+// タイマー毎(500us)にしかpoll()を呼ばない時は、次のpoll()まで待つ時間も見込む
+void testPolledPrediction() {
+    const unsigned long POLL_US = 500;
+    HostSim::setupClock();
+    LatencyBus b(2, 5, 115200);
+    for (byte id = 1; id <= 6; id++) {
+        b.sim.addServo(id);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    sched.setJitterUs(POLL_US);
+    sched.setPollUs(POLL_US);
+
+    // ID順にまとめて送る 返信を受け取ったpoll()で次を送る
+    sched.beginTick(TICK_US);
+    unsigned long tickStart = micros();
+    unsigned long predicted[6];
+    sched.predictSendUs(IDS, 6, predicted);
+    for (byte k = 1; k < 6; k++) {
+        HOST_CHECK((predicted[k] - b.ics.frameTimeUs(IcsCommand::POS_TX_LEN) - tickStart) % POLL_US == 0);
+    }
+    for (byte id = 1; id <= 6; id++) {
+        sched.submitMotionPos(id, 8000);
+    }
+    bus.poll();  // モーションタスクはティックの直後にもpoll()を呼ぶ
+    for (unsigned long t = POLL_US; t < TICK_US; t += POLL_US) {
+        HostSim::advanceUs(tickStart + t - micros());
+        bus.poll();
+    }
+    unsigned long err = maxError(b.sim, predicted, 1, 6);
+    printf("  burst polled every %lu us: prediction error %lu us\n", POLL_US, err);
+    HOST_CHECK(err < 100);
+
+    // スロット
+    HostSim::advanceUs(tickStart + TICK_US - micros());
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US));
+    sched.beginTick(TICK_US);
+    tickStart = micros();
+    sched.predictSendUs(IDS, 6, predicted);
+    for (byte id = 1; id <= 6; id++) {
+        sched.stageMotion(id, 7000);
+    }
+    sched.poll();
+    for (unsigned long t = POLL_US; t < TICK_US; t += POLL_US) {
+        HostSim::advanceUs(tickStart + t - micros());
+        sched.poll();
+    }
+    err = maxError(b.sim, predicted, 1, 6);
+    printf("  tdma slots polled every %lu us: prediction error %lu us\n", POLL_US, err);
+    HOST_CHECK(err < 100);
+}
+
+// ティックの処理が長く、先頭のスロットの見込みが過ぎてから時間を求めると0になる(符号なしの引き算で回り込まない)
+void testPredictionInPast() {
+    HostSim::setupClock();
+    LatencyBus b(2, 5, 115200);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US, true));
+
+    sched.beginTick(TICK_US);
+    unsigned long predicted[6];
+    sched.predictSendUs(IDS, 6, predicted);
+    HostSim::advanceUs(sched.slotOffsetUs(2) + b.ics.frameTimeUs(IcsCommand::POS_TX_LEN) + 100);  // ID1,2の見込みを過ぎる
+    unsigned long now = micros();
+    HOST_CHECK((long)(predicted[0] - now) < 0);
+    HOST_CHECK(predicted[0] - now > TICK_US);  // そのまま引くと回り込む
+    HOST_CHECK(IcsScheduler::sendOffsetUs(predicted[0], now) == 0);
+    HOST_CHECK(IcsScheduler::sendOffsetUs(predicted[1], now) == 0);
+    HOST_CHECK(IcsScheduler::sendOffsetUs(predicted[5], now) == predicted[5] - now);
+    HOST_CHECK(predicted[5] - now < TICK_US);
+    HOST_CHECK(IcsScheduler::sendOffsetUs(now, now) == 0);
+}
+
+// 4Hz ±20度の羽ばたきで、サーボが受け取った時刻の軌道との差(度)
+static double flapDeg(double timeUs) {
+    const double PERIOD_US = 250000.0;
+    return 20.0 * sin(2.0 * M_PI * fmod(timeUs, PERIOD_US) / PERIOD_US);
+}
+
+void testPhaseError() {
+    HostSim::setupClock();
+    LatencyBus b(2, 5, 115200);
+    for (byte id = 1; id <= 6; id++) {
+        b.sim.addServo(id);
+    }
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+
+    double worstSingle = 0.0;
+    double worstPredicted = 0.0;
+    for (int tick = 0; tick < 50; tick++) {
+        sched.beginTick(TICK_US);
+        unsigned long now = micros();
+        unsigned long predicted[6];
+        sched.predictSendUs(IDS, 6, predicted);
+        double single[6];
+        double aware[6];
+        for (byte k = 0; k < 6; k++) {
+            single[k] = flapDeg(now);
+            aware[k] = flapDeg(predicted[k]);
+            sched.submitMotionPos(IDS[k], IcsBaseClass::degPosF(aware[k]));
+        }
+        HOST_CHECK(bus.waitAll(100000));
+        for (byte k = 0; k < 6; k++) {
+            double truth = flapDeg(b.sim.servo(IDS[k]).lastUpdateUs);
+            worstSingle = fmax(worstSingle, fabs(single[k] - truth));
+            worstPredicted = fmax(worstPredicted, fabs(aware[k] - truth));
+        }
+        HostSim::advanceUs(TICK_US - (micros() - now));
+    }
+    printf("  4Hz flap phase error: single sample %.3f deg, send-time aware %.3f deg\n", worstSingle, worstPredicted);
+    HOST_CHECK(worstSingle > 1.0);
+    HOST_CHECK(worstPredicted < 0.1);
+}
+
+int main() {
+    HOST_RUN(testBurstPrediction);
+    HOST_RUN(testDualBusPrediction);
+    HOST_RUN(testSlotPrediction);
+    HOST_RUN(testPredictionInPast);
+    HOST_RUN(testPolledPrediction);
+    HOST_RUN(testPhaseError);
+    return HOST_TEST_RESULT();
+}
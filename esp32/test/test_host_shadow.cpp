@@ -0,0 +1,143 @@
+// test/test_host_shadow.cpp
+// ホスト上でシャドウレジスタ(書込み済みパラメータのキャッシュ)を確認する
+// pio run -e host_test_shadow && .pio/build/host_test_shadow/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include "host/host_test.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const int TIMEOUT = 20;
+
+// ポジションとパラメータ書込みに返信するバス
+class WritePeer : public HostUartPeer {
+public:
+    WritePeer() : frames(0), silent(false) {}
+    void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override {
+        frames++;
+        if (silent || len != 3) {
+            return;
+        }
+        uint8_t reply[3] = {(uint8_t)(data[0] & 0x7F), data[1], data[2]};
+        uart.injectRx(reply, sizeof reply, endUs + 30);
+    }
+    int frames;
+    bool silent;
+};
+
+static void setupBus(HardwareSerial& uart, WritePeer& peer) {
+    HostSim::resetClock();
+    uart.resetHost();
+    uart.attachPeer(&peer);
+    uart.setDirPin(EN_PIN);
+}
+
+void testDisabledByDefault() {
+    HardwareSerial uart(2);
+    WritePeer peer;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+
+    HOST_CHECK(!krs.isShadowEnabled());
+    krs.setSpd(1, 100);
+    krs.setSpd(1, 100);
+    HOST_CHECK(peer.frames == 2);
+    HOST_CHECK(krs.getShadowStats().skipped == 0);
+}
+
+void testRepeatedWritesAreSkipped() {
+    HardwareSerial uart(2);
+    WritePeer peer;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+    krs.enableShadow(true);
+
+    // handleSwimModeと同じ速度を10ティック分
+    const int speeds[7] = {127, 127, 127, 30, 127, 127, 30};
+    for (int tick = 0; tick < 10; tick++) {
+        for (int id = 1; id <= 6; id++) {
+            HOST_CHECK(krs.setSpd(id, speeds[id]) == speeds[id]);
+            krs.setPos(id, 7500);
+        }
+    }
+    HOST_CHECK(peer.frames == 6 + 60);
+    HOST_CHECK(krs.getShadowStats().written == 6);
+    HOST_CHECK(krs.getShadowStats().skipped == 54);
+
+    // 値が変わったら書く
+    HOST_CHECK(krs.setSpd(3, 31) == 31);
+    HOST_CHECK(peer.frames == 67);
+
+    // パラメータ毎に別々に覚えている
+    krs.setStrc(1, 60);
+    krs.setCur(1, 20);
+    krs.setTmp(1, 80);
+    int before = peer.frames;
+    krs.setStrc(1, 60);
+    krs.setCur(1, 20);
+    krs.setTmp(1, 80);
+    HOST_CHECK(peer.frames == before);
+}
+
+void testInvalidation() {
+    HardwareSerial uart(2);
+    WritePeer peer;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+    krs.enableShadow(true);
+
+    krs.setSpd(2, 50);
+    krs.setFree(2);     // 脱力したら捨てる
+    int before = peer.frames;
+    krs.setSpd(2, 50);
+    HOST_CHECK(peer.frames == before + 1);
+    HOST_CHECK(krs.getShadowStats().invalidated == 1);
+
+    // 通信エラーでも捨てる
+    peer.silent = true;
+    HOST_CHECK(krs.setPos(2, 7500) == IcsBaseClass::ICS_FALSE);
+    peer.silent = false;
+    before = peer.frames;
+    krs.setSpd(2, 50);
+    HOST_CHECK(peer.frames == before + 1);
+    HOST_CHECK(krs.getShadowStats().invalidated == 2);
+
+    // 書込み失敗はキャッシュに入らない
+    peer.silent = true;
+    HOST_CHECK(krs.setSpd(4, 90) == IcsBaseClass::ICS_FALSE);
+    peer.silent = false;
+    before = peer.frames;
+    krs.setSpd(4, 90);
+    HOST_CHECK(peer.frames == before + 1);
+}
+
+void testAsyncSharesShadow() {
+    HardwareSerial uart(2);
+    WritePeer peer;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.begin();
+    krs.enableShadow(true);
+    IcsAsyncClass async(&krs);
+
+    HOST_CHECK(async.submitSetParam(5, IcsBaseClass::SC_SPD, 70) >= 0);
+    HOST_CHECK(async.waitAll(100000));
+    HOST_CHECK(async.submitSetParam(5, IcsBaseClass::SC_SPD, 70) == IcsAsyncClass::HANDLE_SKIPPED);
+    HOST_CHECK(krs.setSpd(5, 70) == 70);
+    HOST_CHECK(peer.frames == 1);
+    HOST_CHECK(krs.getShadowStats().skipped == 2);
+}
+
+int main() {
+    HOST_RUN(testDisabledByDefault);
+    HOST_RUN(testRepeatedWritesAreSkipped);
+    HOST_RUN(testInvalidation);
+    HOST_RUN(testAsyncSharesShadow);
+    return HOST_TEST_RESULT();
+}
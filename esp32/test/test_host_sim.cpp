@@ -0,0 +1,220 @@
+// test/test_host_sim.cpp
+// ホスト上のICSバスシミュレータ(IcsBusSim)で、ライブラリを実機無しに動かす
+// synchronize()の差し替え(IcsSimClass)とモックUART経由(IcsHardSerialClass)の両方を確認する
+// pio run -e host_test_sim && .pio/build/host_test_sim/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsBus.h>
+#include "host/host_test.h"
+#include "host/IcsBusSim.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const int TIMEOUT = 20;
+
+void testSemantics() {
+    HostSim::resetClock();
+    IcsBusSim sim;
+    sim.addServo(1);
+    sim.addServo(2, 35);
+    IcsSimClass krs(&sim);
+
+    // 電源投入直後は脱力して中央
+    HOST_CHECK(sim.servo(1).free);
+    HOST_CHECK(krs.setPos(1, 9000) == 7500);   // 返信は動く前の現在位置
+    HOST_CHECK(!sim.servo(1).free);
+    HOST_CHECK(sim.servo(1).target == 9000);
+
+    // 時間が経つと目標に着く
+    HostSim::advanceUs(200000);
+    HOST_CHECK(krs.getPos(1) == 9000);
+    HOST_CHECK(krs.setFree(1) == 9000);
+    HOST_CHECK(sim.servo(1).free);
+    krs.setPos(1, 3500);
+    HostSim::advanceUs(500000);      // 5500 / 14 = 約393ms
+    HOST_CHECK(krs.getPos(1) == 3500);
+
+    // パラメータの書込みと読出し
+    HOST_CHECK(krs.setSpd(1, 30) == 30);
+    HOST_CHECK(krs.getSpd(1) == 30);
+    HOST_CHECK(krs.setStrc(1, 100) == 100);
+    HOST_CHECK(krs.getStrc(1) == 100);
+    HOST_CHECK(krs.setCur(1, 20) == 20);
+    HOST_CHECK(sim.servo(1).currentLimit == 20);
+    HOST_CHECK(krs.setTmp(1, 70) == 70);
+    HOST_CHECK(sim.servo(1).tempLimit == 70);
+    sim.servo(1).current = 12;
+    sim.servo(1).temperature = 55;
+    HOST_CHECK(krs.getCur(1) == 12);
+    HOST_CHECK(krs.getTmp(1) == 55);
+
+    // 遅いスピードでは途中の位置が読める
+    krs.setPos(1, 7500);
+    HostSim::advanceUs(20000);
+    int mid = krs.getPos(1);
+    HOST_CHECK(mid > 3500 && mid < 7500);
+
+    // ICS3.5はgetPosに返信しないが、他のコマンドは通る
+    HOST_CHECK(krs.getPos(2) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(krs.setPos(2, 8000) == 7500);
+    // 存在しないID
+    HOST_CHECK(krs.setPos(7, 7500) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(sim.stats().ignored == 2);
+    HOST_CHECK(sim.servo(1).posCommands == 4);
+}
+
+void testFrameTiming() {
+    const long bauds[] = {115200, 625000, 1250000};
+    const unsigned long expectTx[] = {287, 53, 27};   // 3バイト = 33bit
+    for (int i = 0; i < 3; i++) {
+        HostSim::resetClock();
+        IcsBusSim sim(bauds[i]);
+        sim.addServo(1);
+        IcsSimClass krs(&sim);
+        HOST_CHECK(sim.frameTimeUs(3) == expectTx[i]);
+
+        unsigned long start = micros();
+        HOST_CHECK(krs.setPos(1, 7500) == 7500);
+        unsigned long cost = micros() - start;
+        // 送信 + 応答の遅れ + 受信
+        HOST_CHECK(cost == 2 * sim.frameTimeUs(3) + IcsBusSim::DEFAULT_LATENCY_US);
+
+        start = micros();
+        HOST_CHECK(krs.getPos(1) == 7500);
+        HOST_CHECK(micros() - start == sim.frameTimeUs(2) + sim.frameTimeUs(4) + IcsBusSim::DEFAULT_LATENCY_US);
+        printf("  %7ld bps: setPos %lu us\n", bauds[i], cost);
+    }
+}
+
+void testBusTemplate() {
+    HostSim::resetClock();
+    IcsBusSim sim;
+    sim.addServo(3);
+    IcsSimClass krs(&sim);
+    IcsBus<IcsSimClass> bus(krs);
+    HOST_CHECK(bus.setPos(3, 8000) == 7500);
+    HostSim::advanceUs(100000);
+    HOST_CHECK(bus.getPos(3) == 8000);
+    HOST_CHECK(bus.setSpd(3, 64) == 64);
+    HOST_CHECK(sim.servo(3).speed == 64);
+}
+
+void testFaults() {
+    HostSim::resetClock();
+    IcsBusSim sim;
+    sim.seed(1234);
+    for (byte id = 1; id <= 6; id++) {
+        sim.addServo(id);
+    }
+    IcsSimClass krs(&sim, 1000);
+
+    // 毎回落ちるサーボはタイムアウトまで待たされる
+    sim.setFaults(4, IcsBusSim::Faults::make(1000));
+    unsigned long start = micros();
+    HOST_CHECK(krs.setPos(4, 7500) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(micros() - start == sim.frameTimeUs(3) + 1000);
+    sim.setFaults(4, IcsBusSim::Faults::make(0));
+
+    // タイムアウトより遅いサーボは失敗、速くなれば通る
+    sim.setFaults(5, IcsBusSim::Faults::make(0, 0, 0, 2000));
+    HOST_CHECK(krs.setPos(5, 7500) == IcsBaseClass::ICS_FALSE);
+    krs.setTimeoutUs(5000);
+    HOST_CHECK(krs.setPos(5, 7500) == 7500);
+    krs.setTimeoutUs(1000);
+    sim.setFaults(5, IcsBusSim::Faults::make(0));
+
+    // バス全体で欠落と化けを起こし、sendVec2ServoPosBlockingと同じリトライで送る
+    sim.resetStats();
+    sim.setGlobalFaults(IcsBusSim::Faults::make(50, 50));
+    const int rounds = 200;
+    int firstTry = 0;
+    int delivered = 0;
+    int mismatched = 0;
+    for (int r = 0; r < rounds; r++) {
+        unsigned int pos = 5000 + r * 20;
+        for (byte id = 1; id <= 6; id++) {
+            int ret = IcsBaseClass::ICS_FALSE;
+            for (int retry = 0; retry < 5 && ret == IcsBaseClass::ICS_FALSE; retry++) {
+                ret = krs.setPos(id, pos);
+                if (retry == 0 && ret != IcsBaseClass::ICS_FALSE) {
+                    firstTry++;
+                }
+            }
+            if (ret != IcsBaseClass::ICS_FALSE) {
+                delivered++;
+            }
+            if (sim.servo(id).target != (int)pos) {
+                mismatched++;
+            }
+        }
+    }
+    const IcsBusSim::Stats& st = sim.stats();
+    printf("  frames %lu, dropped %lu, corrupted %lu, first try %d/%d, delivered %d\n",
+        st.frames, st.dropped, st.corrupted, firstTry, rounds * 6, delivered);
+    HOST_CHECK(st.dropped > 0);
+    HOST_CHECK(st.corrupted > 0);
+    HOST_CHECK(firstTry < rounds * 6);
+    HOST_CHECK(delivered == rounds * 6);   // 5回のリトライでほぼ確実に届く
+    HOST_CHECK(mismatched == 0);           // 送信側は化けないので目標は常に正しい
+
+    // 同じシードなら同じ結果になる
+    IcsBusSim a, b;
+    a.seed(7);
+    b.seed(7);
+    a.addServo(1);
+    b.addServo(1);
+    a.setGlobalFaults(IcsBusSim::Faults::make(300, 300));
+    b.setGlobalFaults(IcsBusSim::Faults::make(300, 300));
+    IcsSimClass ka(&a, 1000), kb(&b, 1000);
+    bool same = true;
+    for (int i = 0; i < 100; i++) {
+        same = same && ka.setPos(1, 7000 + i) == kb.setPos(1, 7000 + i);
+    }
+    HOST_CHECK(same);
+    HOST_CHECK(a.stats().dropped == b.stats().dropped && a.stats().corrupted == b.stats().corrupted);
+}
+
+void testHardSerialPeer() {
+    const long bauds[] = {115200, 625000, 1250000};
+    for (int i = 0; i < 3; i++) {
+        HostSim::resetClock();
+        HostSim::setGpioLatencyUs(0);
+        HardwareSerial uart(2);
+        uart.resetHost();
+        IcsBusSim sim(bauds[i]);
+        sim.addServo(1);
+        sim.addServo(2);
+        uart.attachPeer(&sim);
+        uart.setDirPin(EN_PIN);
+
+        IcsHardSerialClass krs(&uart, EN_PIN, bauds[i], TIMEOUT);
+        krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+        krs.begin();
+
+        HOST_CHECK(krs.setPos(1, 8500) == 7500);
+        HOST_CHECK(krs.setSpd(2, 40) == 40);
+        HOST_CHECK(sim.servo(2).speed == 40);
+        HostSim::advanceUs(200000);
+        HOST_CHECK(krs.getPos(1) == 8500);
+        HOST_CHECK(krs.setPos(9, 7500) == IcsBaseClass::ICS_FALSE);
+
+        // 非同期でもそのまま使える
+        IcsAsyncClass async(&krs);
+        int h1 = async.submitSetPos(1, 7000);
+        int h2 = async.submitGetParam(2, IcsBaseClass::SC_SPD);
+        HOST_CHECK(async.waitAll(100000));
+        HOST_CHECK(async.result(h1) == 8500);
+        HOST_CHECK(async.result(h2) == 40);
+    }
+}
+
+int main() {
+    HOST_RUN(testSemantics);
+    HOST_RUN(testFrameTiming);
+    HOST_RUN(testBusTemplate);
+    HOST_RUN(testFaults);
+    HOST_RUN(testHardSerialPeer);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,345 @@
+// test/test_host_spline.cpp
+// 固定の大きさのSplineInterpolator(motion_patterns.h)を、以前のstd::vector<double>の実装と比べる
+// 値が同じこと、メモリを確保しないこと、区間を覚えて探す速さを確認する
+// pio run -e host_test_spline && .pio/build/host_test_spline/program
+#include <Arduino.h>
+#include <motion_patterns.h>
+#include <chrono>
+#include <math.h>
+#include <new>
+#include <stdlib.h>
+#include "host/host_test.h"
+
+// operator newを置き換えて数えるので、mallocとdeleteの組み合わせの警告は出さない
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+HOST_TEST_MAIN_DEFS
+
+const long BENCH_STEPS = 200000;
+
+// operator newの回数
+static unsigned long allocCount = 0;
+void* operator new(size_t size) {
+    allocCount++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// 以前の実装(std::vector<double>の係数、計算の度に作業用のvector、区間は先頭から探す) 速さを比べるだけ
+// 1次と2次の係数を入れ替えて計算し、最後の区間の3次・1次の係数も0のままなので、値は正しくない
+class VectorSplineInterpolator {
+public:
+    struct Coefficients {
+        std::vector<double> a, b, c, d;
+    };
+
+    void calculateCoefficients(const std::vector<WingMotionPoint>& points) {
+        size_t n = points.size() - 1;
+        coeffs.a.resize(n);
+        coeffs.b.resize(n);
+        coeffs.c.resize(n);
+        coeffs.d.resize(n);
+        std::vector<double> h(n);
+        for (size_t i = 0; i < n; i++) {
+            h[i] = points[i + 1].timeRatio - points[i].timeRatio;
+        }
+        std::vector<double> alpha(n);
+        std::vector<double> l(n + 1);
+        std::vector<double> mu(n);
+        std::vector<double> z(n + 1);
+        l[0] = 1.0;
+        for (size_t i = 1; i < n; i++) {
+            alpha[i] = 3.0 * (points[i + 1].angleRatio - points[i].angleRatio) / h[i]
+                    - 3.0 * (points[i].angleRatio - points[i - 1].angleRatio) / h[i - 1];
+            l[i] = 2.0 * (points[i + 1].timeRatio - points[i - 1].timeRatio) - h[i - 1] * mu[i - 1];
+            mu[i] = h[i] / l[i];
+            z[i] = (alpha[i] - h[i - 1] * z[i - 1]) / l[i];
+        }
+        l[n] = 1.0;
+        z[n] = 0.0;
+        coeffs.c[n - 1] = z[n - 1];
+        for (int i = n - 2; i >= 0; i--) {
+            coeffs.c[i] = z[i] - mu[i] * coeffs.c[i + 1];
+            coeffs.b[i] = (points[i + 1].angleRatio - points[i].angleRatio) / h[i]
+                       - h[i] * (coeffs.c[i + 1] + 2.0 * coeffs.c[i]) / 3.0;
+            coeffs.a[i] = (coeffs.c[i + 1] - coeffs.c[i]) / (3.0 * h[i]);
+        }
+        for (size_t i = 0; i < n; i++) {
+            coeffs.d[i] = points[i].angleRatio;
+        }
+    }
+
+    double interpolate(double t, const std::vector<WingMotionPoint>& points) {
+        size_t i = 0;
+        while (i < points.size() - 1 && t > points[i + 1].timeRatio) {
+            i++;
+        }
+        double dt = t - points[i].timeRatio;
+        return coeffs.a[i] * dt * dt * dt + coeffs.b[i] * dt * dt + coeffs.c[i] * dt + coeffs.d[i];
+    }
+
+private:
+    Coefficients coeffs;
+};
+
+// doubleで解いた自然スプラインの値(値を比べる基準)
+static double naturalSpline(const std::vector<WingMotionPoint>& p, double t) {
+    size_t n = p.size() - 1;
+    std::vector<double> h(n), l(n + 1), mu(n + 1), z(n + 1), c(n + 1);
+    for (size_t i = 0; i < n; i++) {
+        h[i] = p[i + 1].timeRatio - p[i].timeRatio;
+    }
+    l[0] = 1.0;
+    for (size_t i = 1; i < n; i++) {
+        double alpha = 3.0 * (p[i + 1].angleRatio - p[i].angleRatio) / h[i] - 3.0 * (p[i].angleRatio - p[i - 1].angleRatio) / h[i - 1];
+        l[i] = 2.0 * (p[i + 1].timeRatio - p[i - 1].timeRatio) - h[i - 1] * mu[i - 1];
+        mu[i] = h[i] / l[i];
+        z[i] = (alpha - h[i - 1] * z[i - 1]) / l[i];
+    }
+    for (int i = (int)n - 1; i >= 0; i--) {
+        c[i] = z[i] - mu[i] * c[i + 1];
+    }
+    size_t i = 0;
+    while (i < n - 1 && t > p[i + 1].timeRatio) {
+        i++;
+    }
+    double dt = t - p[i].timeRatio;
+    double b = (p[i + 1].angleRatio - p[i].angleRatio) / h[i] - h[i] * (c[i + 1] + 2.0 * c[i]) / 3.0;
+    double a = (c[i + 1] - c[i]) / (3.0 * h[i]);
+    return ((a * dt + c[i]) * dt + b) * dt + p[i].angleRatio;
+}
+
+static const std::vector<WingMotionPoint> SWIM(MotionPatterns::SWIM_PATTERN, MotionPatterns::SWIM_PATTERN + MotionPatterns::SWIM_POINT_NUM);
+static const std::vector<WingMotionPoint> STAY(MotionPatterns::STAY_PATTERN, MotionPatterns::STAY_PATTERN + MotionPatterns::STAY_POINT_NUM);
+
+// 8点の不等間隔のパターン
+static const std::vector<WingMotionPoint> UNEVEN = {
+    {0.0, 0.0}, {0.1, 0.4}, {0.22, 0.9}, {0.4, 0.6}, {0.55, -0.2}, {0.7, -0.9}, {0.86, -0.5}, {1.0, 0.0},
+};
+
+void testMatchesDouble() {
+    for (const std::vector<WingMotionPoint>* pattern : {&SWIM, &STAY, &UNEVEN}) {
+        SplineInterpolator spline;
+        HOST_CHECK(spline.calculateCoefficients(*pattern));
+        double worst = 0.0;
+        for (int k = -100; k <= 1100; k++) {
+            double t = k / 1000.0;  // 範囲の外は端の区間の式を延ばす
+            worst = fmax(worst, fabs(spline.interpolate(t, *pattern) - naturalSpline(*pattern, t)));
+        }
+        printf("  %u points: max diff vs double %.2e\n", (unsigned int)pattern->size(), worst);
+        HOST_CHECK(worst < 1e-5);
+    }
+}
+
+void testNaturalSpline() {
+    SplineInterpolator spline;
+    HOST_CHECK(spline.calculateCoefficients(UNEVEN));
+    // 点を通り、点の前後で値と傾きがつながる
+    bool passes = true;
+    bool smooth = true;
+    const float e = 1e-4f;
+    for (size_t i = 0; i < UNEVEN.size(); i++) {
+        float t = (float)UNEVEN[i].timeRatio;
+        passes = passes && fabsf(spline.interpolate(t) - (float)UNEVEN[i].angleRatio) < 1e-5f;
+        if (i > 0 && i + 1 < UNEVEN.size()) {
+            float before = spline.interpolate(t - e);
+            float after = spline.interpolate(t + e);
+            float slopeBefore = (spline.interpolate(t) - spline.interpolate(t - e)) / e;
+            float slopeAfter = (spline.interpolate(t + e) - spline.interpolate(t)) / e;
+            smooth = smooth && fabsf(after - before) < 2e-3f && fabsf(slopeAfter - slopeBefore) < 0.05f;
+        }
+    }
+    HOST_CHECK(passes);
+    HOST_CHECK(smooth);
+    // 最後の区間も終点(1.0, 0.0)を通る(以前の実装は通らなかった)
+    HOST_CHECK(fabsf(spline.interpolate(1.0f)) < 1e-5f);
+
+    // 2点なら直線
+    const WingMotionPoint line[] = {{0.0, -1.0}, {1.0, 1.0}};
+    HOST_CHECK(spline.calculateCoefficients(line, 2));
+    HOST_CHECK(fabsf(spline.interpolate(0.25f) + 0.5f) < 1e-6f);
+}
+
+// 組み込みパターンの係数はコンパイル時に決まる
+static_assert(MotionPatterns::SWIM_SEGMENTS[0].k[3] == 0.0f, "constant term is the first point");
+static_assert(MotionPatterns::SWIM_SEGMENTS[1].k[1] < 0.0f, "curving down after the peak");
+static_assert(MotionPatterns::STAY.pointCount == 5, "");
+
+void testBuiltinPatterns() {
+    for (const SplinePattern* pattern : {&MotionPatterns::SWIM, &MotionPatterns::STAY}) {
+        SplineInterpolator spline;
+        HOST_CHECK(spline.calculateCoefficients(pattern->points, pattern->pointCount));
+        std::vector<WingMotionPoint> points(pattern->points, pattern->points + pattern->pointCount);
+        // 実行時にfloatで解いた係数、doubleの自然スプラインと同じ値。区間を覚えても覚えなくても同じ
+        float worst = 0.0f;
+        double worstDouble = 0.0;
+        uint8_t segment = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int k = -100; k <= 1100; k++) {
+                int step = (pass == 0) ? k : (k * 389) % 1201 - 100;
+                float t = step / 1000.0f;
+                float v = pattern->interpolate(t, segment);
+                worst = fmaxf(worst, fabsf(v - spline.interpolate(t)));
+                worst = fmaxf(worst, fabsf(v - pattern->interpolate(t)));
+                worstDouble = fmax(worstDouble, fabs(v - naturalSpline(points, t)));
+            }
+        }
+        printf("  built-in %u points: max diff vs runtime float %.2e, vs double %.2e\n",
+            pattern->pointCount, worst, worstDouble);
+        HOST_CHECK(worst < 1e-6f);
+        HOST_CHECK(worstDouble < 1e-5);
+        // 点を通る
+        bool passes = true;
+        for (uint8_t i = 0; i < pattern->pointCount; i++) {
+            passes = passes && fabsf(pattern->interpolate((float)pattern->points[i].timeRatio) - (float)pattern->points[i].angleRatio) < 1e-6f;
+        }
+        HOST_CHECK(passes);
+    }
+    // 範囲外の区間を渡されても端の区間から探す
+    uint8_t segment = 200;
+    HOST_CHECK(fabsf(MotionPatterns::SWIM.interpolate(0.25f, segment) - 1.0f) < 1e-6f);
+    HOST_CHECK(segment <= 1);
+}
+
+void testInvalid() {
+    SplineInterpolator spline;
+    HOST_CHECK(spline.interpolate(0.5f) == 0.0f);  // 係数が無い
+    const WingMotionPoint one[] = {{0.0, 1.0}};
+    HOST_CHECK(!spline.calculateCoefficients(one, 1));
+    const WingMotionPoint backward[] = {{0.0, 0.0}, {0.5, 1.0}, {0.5, 0.0}};
+    HOST_CHECK(!spline.calculateCoefficients(backward, 3));
+    std::vector<WingMotionPoint> many(SplineInterpolator::MAX_POINTS + 1);
+    for (size_t i = 0; i < many.size(); i++) {
+        many[i].timeRatio = (double)i;
+    }
+    HOST_CHECK(!spline.calculateCoefficients(many));
+    float times[2] = {0.0f, 1.0f};
+    float values[2 * (SplineInterpolator::MAX_CHANNELS + 1)] = {0};
+    HOST_CHECK(!spline.calculatePose(times, values, 2, SplineInterpolator::MAX_CHANNELS + 1));
+    HOST_CHECK(!spline.calculatePose(times, values, 2, 0));
+    HOST_CHECK(spline.getPointCount() == 0);  // 失敗しても前の係数のまま
+}
+
+void testPoseAndCache() {
+    // 6チャンネルのポーズ列(チャンネル毎に振幅と符号を変える)
+    const uint8_t COUNT = 8;
+    const uint8_t CH = SplineInterpolator::MAX_CHANNELS;
+    float times[COUNT];
+    float values[COUNT * CH];
+    SplineInterpolator single[CH];
+    for (uint8_t ch = 0; ch < CH; ch++) {
+        WingMotionPoint pts[COUNT];
+        for (uint8_t i = 0; i < COUNT; i++) {
+            times[i] = (float)UNEVEN[i].timeRatio;
+            values[i * CH + ch] = (float)UNEVEN[i].angleRatio * (ch + 1) * ((ch & 1) ? -10.0f : 10.0f);
+            pts[i].timeRatio = times[i];
+            pts[i].angleRatio = values[i * CH + ch];
+        }
+        HOST_CHECK(single[ch].calculateCoefficients(pts, COUNT));
+    }
+    SplineInterpolator pose;
+    unsigned long allocs = allocCount;
+    HOST_CHECK(pose.calculatePose(times, values, COUNT, CH));
+    HOST_CHECK(pose.getChannelCount() == CH);
+
+    // 時刻が進む順、飛ぶ順(二分探索)、戻る順で同じ値
+    float worst = 0.0f;
+    float out[CH];
+    for (int pass = 0; pass < 3; pass++) {
+        for (int k = 0; k <= 2000; k++) {
+            int step = (pass == 0) ? k : (pass == 1) ? (k * 977) % 2001 : 2000 - k;
+            float t = step / 2000.0f * 1.2f - 0.1f;  // 範囲の外も少し
+            pose.interpolatePose(t, out);
+            for (uint8_t ch = 0; ch < CH; ch++) {
+                worst = fmaxf(worst, fabsf(out[ch] - single[ch].interpolate(t)));
+            }
+        }
+    }
+    HOST_CHECK(allocCount == allocs);  // 係数の計算も補間もメモリを確保しない
+    printf("  %u channels in one call: max diff vs single channel %.2e, %u bytes per interpolator\n",
+        CH, worst, (unsigned int)sizeof(SplineInterpolator));
+    HOST_CHECK(worst < 1e-5f);
+}
+
+void testBenchmark() {
+    const std::vector<WingMotionPoint>& pattern = UNEVEN;
+    VectorSplineInterpolator ref;
+    SplineInterpolator spline;
+
+    const int COMPILES = 20000;
+    unsigned long allocs = allocCount;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < COMPILES; k++) {
+        ref.calculateCoefficients(pattern);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    unsigned long refAllocs = (allocCount - allocs) / COMPILES;
+    allocs = allocCount;
+    for (int k = 0; k < COMPILES; k++) {
+        spline.calculateCoefficients(pattern);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    HOST_CHECK(allocCount == allocs);
+
+    // ティック毎に時刻が少しずつ進み、1周で0に戻る
+    double sink = 0.0;
+    auto t3 = std::chrono::steady_clock::now();
+    for (long k = 0; k < BENCH_STEPS; k++) {
+        sink += ref.interpolate((k % 997) / 997.0, pattern);
+    }
+    auto t4 = std::chrono::steady_clock::now();
+    for (long k = 0; k < BENCH_STEPS; k++) {
+        sink += spline.interpolate((k % 997) / 997.0f);
+    }
+    auto t5 = std::chrono::steady_clock::now();
+
+    // 6サーボのポーズ: 以前の実装を6つ vs 1回の呼び出し
+    const uint8_t CH = SplineInterpolator::MAX_CHANNELS;
+    float times[8];
+    float values[8 * CH];
+    for (uint8_t i = 0; i < 8; i++) {
+        times[i] = (float)pattern[i].timeRatio;
+        for (uint8_t ch = 0; ch < CH; ch++) {
+            values[i * CH + ch] = (float)pattern[i].angleRatio * (ch + 1);
+        }
+    }
+    SplineInterpolator pose;
+    pose.calculatePose(times, values, 8, CH);
+    float out[CH];
+    auto t6 = std::chrono::steady_clock::now();
+    for (long k = 0; k < BENCH_STEPS; k++) {
+        double t = (k % 997) / 997.0;
+        for (uint8_t ch = 0; ch < CH; ch++) {
+            sink += ref.interpolate(t, pattern) * (ch + 1);
+        }
+    }
+    auto t7 = std::chrono::steady_clock::now();
+    for (long k = 0; k < BENCH_STEPS; k++) {
+        pose.interpolatePose((k % 997) / 997.0f, out);
+        sink += out[0] + out[CH - 1];
+    }
+    auto t8 = std::chrono::steady_clock::now();
+
+    auto ns = [](std::chrono::steady_clock::duration d, long n) { return std::chrono::duration<double, std::nano>(d).count() / n; };
+    printf("  calculateCoefficients (8 points): vector<double> %.0f ns, %lu allocations; fixed %.0f ns, 0 allocations\n",
+        ns(t1 - t0, COMPILES), refAllocs, ns(t2 - t1, COMPILES));
+    printf("  interpolate: vector<double> %.1f ns, fixed %.1f ns\n", ns(t4 - t3, BENCH_STEPS), ns(t5 - t4, BENCH_STEPS));
+    printf("  6-servo pose: vector<double> x6 %.1f ns, interpolatePose %.1f ns (sink %d)\n",
+        ns(t7 - t6, BENCH_STEPS), ns(t8 - t7, BENCH_STEPS), (int)sink & 1);
+    HOST_CHECK(refAllocs > 0);
+}
+
+int main() {
+    HOST_RUN(testMatchesDouble);
+    HOST_RUN(testNaturalSpline);
+    HOST_RUN(testBuiltinPatterns);
+    HOST_RUN(testInvalid);
+    HOST_RUN(testPoseAndCache);
+    HOST_RUN(testBenchmark);
+    return HOST_TEST_RESULT();
+}
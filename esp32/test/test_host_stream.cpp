@@ -0,0 +1,239 @@
+// test/test_host_stream.cpp
+// ホスト上でポジション設定のストリーミング(IcsAsyncClass::setStreaming)を確認する
+// 返信を待たずに返信窓を空けて送り、返信は後から照合する。サンプルACKで返信しないサーボを見つける
+// pio run -e host_test_stream && .pio/build/host_test_stream/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+// シミュレータのサーボは100usで返信する。応答待ちの間に次を送るには
+// (最大 - 最小) + 返信 + 送信 が最小より短くなるように見込む
+const unsigned long LATENCY_MAX_US = 110;
+const unsigned long LATENCY_MIN_US = 90;
+const int POSES = 50;
+
+// 6軸のRS485のバス。作る度に仮想時計を0から始める
+struct StreamBus : HostClock, HostBus {
+    explicit StreamBus(bool echo = false) : HostBus(BAUDRATE, DEFAULT_UART, EN_PIN, IcsHardSerialClass::TRANSPORT_RS485_HW) {
+        setEcho(echo);
+        ics.setResponseLatencyUs(LATENCY_MAX_US);
+        addServos(1, 6);
+    }
+};
+
+// 6軸に少しずつ違うポジションをPOSES回送る
+static unsigned long sendPoses(HostBus& b, int poses) {
+    unsigned long start = micros();
+    for (int p = 0; p < poses; p++) {
+        for (byte id = 1; id <= 6; id++) {
+            while (b.async.submitSetPos(id, 7000 + p * 10 + id) == IcsAsyncClass::HANDLE_NONE) {
+                b.async.poll();
+                delayMicroseconds(1);
+            }
+            b.async.poll();
+        }
+    }
+    HOST_CHECK(b.async.waitAll(100000));
+    return micros() - start;
+}
+
+static int streamDone;
+static int streamRxLen;
+static void onStreamDone(int handle, bool ok, const byte* rxBuf, byte rxLen, void* ctx) {
+    (void)handle;
+    (void)rxBuf;
+    (void)ctx;
+    if (ok) {
+        streamDone++;
+        streamRxLen += rxLen;
+    }
+}
+
+void testStatusAndCallbacks() {
+    StreamBus b;
+    b.async.setStreaming(4, LATENCY_MIN_US);
+    HOST_CHECK(b.async.streaming());
+
+    streamDone = 0;
+    streamRxLen = 0;
+    int h[4];
+    for (int i = 0; i < 4; i++) {
+        h[i] = b.async.submitSetPos(1, 8000, onStreamDone);
+    }
+    HOST_CHECK(b.async.waitAll(100000));
+    HOST_CHECK(!b.async.busy());
+    // 1回目はサンプルACK、残りは送っただけ
+    HOST_CHECK(b.async.status(h[0]) == IcsAsyncClass::STATUS_DONE);
+    HOST_CHECK(b.async.result(h[0]) == 7500);
+    HOST_CHECK(b.async.status(h[1]) == IcsAsyncClass::STATUS_SENT);
+    HOST_CHECK(b.async.result(h[1]) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(streamDone == 4);
+    HOST_CHECK(streamRxLen == 3);
+
+    const IcsAsyncClass::StreamStats& s = b.async.getStreamStats(1);
+    HOST_CHECK(s.frames == 4);
+    HOST_CHECK(s.acks == 1);
+    HOST_CHECK(s.repliesOk == 3);
+    HOST_CHECK(s.repliesMissing == 0);
+    HOST_CHECK(s.lastPos > 7500);   // 後から読んだ返信の現在位置
+    HOST_CHECK(b.sim.servo(1).posCommands == 4);
+    HOST_CHECK(b.async.servoResponding(1));
+
+    // ストリーミングの返信を読み終えてから同期版を使える
+    HOST_CHECK(b.ics.setPos(2, 8000) == 7500);
+    HOST_CHECK(b.sim.stats().collisions == 0);
+    HOST_CHECK(b.uart.stats().collisions == 0);
+
+    // パラメータ書込みは常に返信を待つ
+    int hw = b.async.submitSetParam(1, IcsBaseClass::SC_SPD, 50);
+    HOST_CHECK(b.async.waitAll(100000));
+    HOST_CHECK(b.async.status(hw) == IcsAsyncClass::STATUS_DONE);
+
+    b.async.setStreaming(0);
+    HOST_CHECK(!b.async.streaming());
+    int hn = b.async.submitSetPos(1, 8000);
+    HOST_CHECK(b.async.waitAll(100000));
+    HOST_CHECK(b.async.status(hn) == IcsAsyncClass::STATUS_DONE);
+}
+
+void testStreamingRaisesFrameRate() {
+    unsigned long elapsed[3];
+    float rate[3];
+    for (int mode = 0; mode < 3; mode++) {
+        StreamBus b;
+        if (mode == 1) {
+            b.async.setStreaming(IcsAsyncClass::DEFAULT_ACK_EVERY);                  // 返信窓だけ空ける
+        } else if (mode == 2) {
+            b.async.setStreaming(IcsAsyncClass::DEFAULT_ACK_EVERY, LATENCY_MIN_US);  // 応答待ちの間に次を送る
+        }
+        elapsed[mode] = sendPoses(b, POSES);
+        rate[mode] = b.async.streamRateHz(6);
+
+        HOST_CHECK(b.sim.stats().collisions == 0);
+        HOST_CHECK(b.uart.stats().collisions == 0);
+        for (byte id = 1; id <= 6; id++) {
+            HOST_CHECK(b.sim.servo(id).posCommands == (unsigned long)POSES);
+            HOST_CHECK(b.sim.servo(id).target == 7000 + (POSES - 1) * 10 + id);
+            if (mode > 0) {
+                const IcsAsyncClass::StreamStats& s = b.async.getStreamStats(id);
+                HOST_CHECK(s.frames == (unsigned long)POSES);
+                HOST_CHECK(s.acks == (POSES + IcsAsyncClass::DEFAULT_ACK_EVERY - 1) / IcsAsyncClass::DEFAULT_ACK_EVERY);
+                HOST_CHECK(s.ackFailures == 0);
+                HOST_CHECK(s.repliesOk + s.acks == (unsigned long)POSES);
+                HOST_CHECK(s.repliesMissing == 0);
+                HOST_CHECK(s.repliesBad == 0);
+            }
+        }
+    }
+    printf("  %d poses x 6 servos: ack every frame %lu us, stream %lu us, pipelined %lu us\n",
+           POSES, elapsed[0], elapsed[1], elapsed[2]);
+    printf("  servo 6 frame rate: stream %.0f Hz, pipelined %.0f Hz\n", rate[1], rate[2]);
+    HOST_CHECK(rate[0] == 0.0f);   // ストリーミングしていなければ数えない
+    // 返信窓だけ空ける時は最大の応答時間を待つので、実際の返信で進む通常の送受信と大きく変わらない
+    HOST_CHECK(elapsed[1] * 10 < elapsed[0] * 12);
+    HOST_CHECK(elapsed[2] * 10 < elapsed[0] * 8);   // 80%未満
+    HOST_CHECK(rate[2] > rate[1]);
+}
+
+// 実機ではmicros()を呼ぶ間にも時計が進む。送ってよい時刻ちょうどでなくても、過ぎていれば送る
+void testRunningClock() {
+    StreamBus b;
+    HostSim::setMicrosStepUs(1);
+    b.async.setStreaming(IcsAsyncClass::DEFAULT_ACK_EVERY, LATENCY_MIN_US);
+    unsigned long elapsed = sendPoses(b, POSES);
+    printf("  %d poses with micros() advancing 1us per call: %lu us\n", POSES, elapsed);
+    HOST_CHECK(b.sim.servo(1).posCommands == (unsigned long)POSES);
+    HOST_CHECK(b.async.getStreamStats(1).frames == (unsigned long)POSES);
+    HOST_CHECK(b.sim.stats().collisions == 0);
+    HostSim::setMicrosStepUs(0);
+}
+
+void testDeadServoDetected() {
+    StreamBus b;
+    b.async.setStreaming(4, LATENCY_MIN_US);
+    sendPoses(b, 8);
+    HOST_CHECK(b.async.servoResponding(3));
+
+    b.sim.removeServo(3);
+    sendPoses(b, 8);
+    HOST_CHECK(!b.async.servoResponding(3));
+    for (byte id = 1; id <= 6; id++) {
+        if (id != 3) {
+            HOST_CHECK(b.async.servoResponding(id));
+            HOST_CHECK(b.async.getStreamStats(id).repliesMissing == 0);
+        }
+    }
+    const IcsAsyncClass::StreamStats& s = b.async.getStreamStats(3);
+    HOST_CHECK(s.ackFailures == 2);
+    HOST_CHECK(s.repliesMissing == 6);
+
+    // 戻ればサンプルACKが通った時点で応答ありに戻る
+    b.sim.addServo(3);
+    sendPoses(b, 4);
+    HOST_CHECK(b.async.servoResponding(3));
+
+    b.async.resetStreamStats();
+    HOST_CHECK(b.async.getStreamStats(3).frames == 0);
+    HOST_CHECK(b.async.getStreamStats(3).lastPos == -1);
+}
+
+void testFaultsCountedLazily() {
+    StreamBus b;
+    b.sim.setFaults(2, IcsBusSim::Faults::make(0, 300));
+    b.async.setStreaming(IcsAsyncClass::DEFAULT_ACK_EVERY, LATENCY_MIN_US);
+    sendPoses(b, POSES);
+
+    const IcsAsyncClass::StreamStats& s = b.async.getStreamStats(2);
+    printf("  corrupted servo 2: ok %lu, bad %lu, ack failures %lu\n", s.repliesOk, s.repliesBad, s.ackFailures);
+    HOST_CHECK(s.repliesBad > 0);
+    HOST_CHECK(s.repliesOk + s.repliesBad + s.acks == (unsigned long)POSES);
+    HOST_CHECK(b.async.getStreamStats(1).repliesBad == 0);
+    HOST_CHECK(b.sim.servo(2).posCommands == (unsigned long)POSES);   // 送信は止まらない
+}
+
+void testLatencyMinTooLargeIsVisible() {
+    // 実際の応答(100us)より遅く見込むと、返信と次の送信が衝突する
+    StreamBus b;
+    b.ics.setResponseLatencyUs(150);
+    b.async.setStreaming(IcsAsyncClass::DEFAULT_ACK_EVERY, 150);
+    sendPoses(b, 10);
+    unsigned long lost = 0;
+    for (byte id = 1; id <= 6; id++) {
+        const IcsAsyncClass::StreamStats& s = b.async.getStreamStats(id);
+        lost += s.repliesMissing + s.repliesBad + s.ackFailures;
+    }
+    printf("  latency min too large: sim collisions %lu, lost replies %lu\n", b.sim.stats().collisions, lost);
+    HOST_CHECK(b.sim.stats().collisions + b.uart.stats().collisions > 0);
+    HOST_CHECK(lost > 0);
+}
+
+void testEchoWiring() {
+    // エコーが返る配線では応答待ちの間に送らないが、返信は照合できる
+    StreamBus b(true);
+    b.async.setStreaming(IcsAsyncClass::DEFAULT_ACK_EVERY, LATENCY_MIN_US);
+    sendPoses(b, 16);
+    for (byte id = 1; id <= 6; id++) {
+        const IcsAsyncClass::StreamStats& s = b.async.getStreamStats(id);
+        HOST_CHECK(s.repliesOk == 14);
+        HOST_CHECK(s.repliesMissing == 0);
+        HOST_CHECK(s.ackFailures == 0);
+    }
+    HOST_CHECK(b.sim.stats().collisions == 0);
+}
+
+int main() {
+    HOST_RUN(testStatusAndCallbacks);
+    HOST_RUN(testStreamingRaisesFrameRate);
+    HOST_RUN(testRunningClock);
+    HOST_RUN(testDeadServoDetected);
+    HOST_RUN(testFaultsCountedLazily);
+    HOST_RUN(testLatencyMinTooLargeIsVisible);
+    HOST_RUN(testEchoWiring);
+    return HOST_TEST_RESULT();
+}
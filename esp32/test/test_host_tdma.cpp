@@ -0,0 +1,413 @@
+// test/test_host_tdma.cpp
+// ホスト上で時間割り(IcsSchedulerのスロット)を確認する
+// ID順にまとめて送る時と比べて、サーボ6の更新間隔が他のサーボの返信に左右されないことを測る
+// pio run -e host_test_tdma && .pio/build/host_test_tdma/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsMultiBus.h>
+#include <IcsScheduler.h>
+#include "host/host_test.h"
+#include "host/HostBus.h"
+
+HOST_TEST_MAIN_DEFS
+
+const unsigned long TICK_US = 20000;   // main.cppのモーションの周期
+const byte IDS[6] = {1, 2, 3, 4, 5, 6};
+
+// サーボ毎のポジション設定の完了時刻
+static unsigned long doneUs[7];
+static void onMotion(int handle, bool ok, const byte* rxBuf, byte rxLen, void* ctx) {
+    (void)handle;
+    (void)ok;
+    (void)rxBuf;
+    (void)rxLen;
+    doneUs[(byte)(uintptr_t)ctx] = micros();
+}
+
+void testLayout() {
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+
+    unsigned long len = sched.motionCostUs(1) + IcsScheduler::DEFAULT_JITTER_US;
+    printf("  slot length @115200: %lu us\n", len);
+    HOST_CHECK(sched.motionCostUs(7) > 0);
+    HOST_CHECK(len > 2 * sched.readCostUs(1, IcsCommand::SC_TMP));
+    HOST_CHECK(len < TICK_US / 6);
+
+    // 詰めて並べる(IDの順はidsの順に関係ない)
+    const byte reversed[6] = {6, 5, 4, 3, 2, 1};
+    HOST_CHECK(sched.layoutSlots(reversed, 6, TICK_US));
+    for (byte id = 1; id <= 6; id++) {
+        HOST_CHECK(sched.hasSlot(id));
+        HOST_CHECK(sched.slotOffsetUs(id) == (id - 1) * len);
+        HOST_CHECK(sched.slotLengthUs(id) == len);
+    }
+    HOST_CHECK(!sched.hasSlot(7));
+
+    // 等間隔に並べる
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US, true));
+    HOST_CHECK(sched.slotOffsetUs(1) == 0);
+    HOST_CHECK(sched.slotOffsetUs(6) == 5 * (TICK_US / 6));
+
+    // 周期に収まらなければ今のスロットを残す
+    HOST_CHECK(!sched.layoutSlots(IDS, 6, 5 * len));
+    HOST_CHECK(sched.slotOffsetUs(6) == 5 * (TICK_US / 6));
+    HOST_CHECK(sched.layoutSlots(IDS, 6, 6 * len, true));
+    HOST_CHECK(!sched.layoutSlots(IDS, 6, 6 * len - 1, true));
+
+    // 割り当てていないID
+    IcsMultiBus part;
+    part.addBus(&b.async, 1, 3);
+    IcsScheduler small(&part);
+    HOST_CHECK(!small.layoutSlots(IDS, 6, TICK_US));
+    HOST_CHECK(!small.setSlot(4, 0, len));
+    HOST_CHECK(small.setSlot(3, 100, len));
+    HOST_CHECK(small.slotOffsetUs(3) == 100);
+    small.clearSlots();
+    HOST_CHECK(!small.hasSlot(3));
+
+    // スロットの無いIDはすぐに送る
+    HOST_CHECK(small.stageMotion(2, 8000, 0, onMotion, (void*)(uintptr_t)2));
+    HOST_CHECK(b.async.busy());
+    HOST_CHECK(bus.waitAll(100000));
+    HOST_CHECK(b.sim.servo(2).target == 8000);
+    HOST_CHECK(!small.stageMotion(2, 20000));
+}
+
+void testSlotsSentOnTime() {
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US, true));
+
+    // 置いただけでは送らない
+    sched.beginTick(TICK_US);
+    unsigned long tickStart = micros();
+    for (byte id = 1; id <= 6; id++) {
+        HOST_CHECK(sched.stageMotion(id, 7000 + id, 100, onMotion, (void*)(uintptr_t)id));
+    }
+    HOST_CHECK(!b.async.busy());
+    memset(doneUs, 0, sizeof(doneUs));
+    while (micros() - tickStart < TICK_US) {
+        sched.poll();
+        delayMicroseconds(10);
+    }
+    for (byte id = 1; id <= 6; id++) {
+        const IcsScheduler::SlotStats& s = sched.getSlotStats(id);
+        HOST_CHECK(s.sent == 1);
+        HOST_CHECK(s.late == 0);
+        HOST_CHECK(s.overruns == 0);
+        HOST_CHECK(s.maxJitterUs <= 20);
+        HOST_CHECK(b.sim.servo(id).target == 7000 + id);
+        HOST_CHECK(b.sim.servo(id).speed == 100);
+        // スロットの中で終わる
+        HOST_CHECK(doneUs[id] >= tickStart + sched.slotOffsetUs(id));
+        HOST_CHECK(doneUs[id] <= tickStart + sched.slotOffsetUs(id) + sched.slotLengthUs(id));
+    }
+    HOST_CHECK(sched.getStats().issued[IcsScheduler::PRIO_MOTION] == 12);
+
+    // 同じスピードはシャドウレジスタで送らない
+    b.ics.enableShadow(true);
+    b.ics.shadowStore(1, IcsCommand::SC_SPD, 100);
+    sched.beginTick(TICK_US);
+    tickStart = micros();
+    unsigned long writes = b.sim.servo(1).writes;
+    sched.stageMotion(1, 7100, 100);
+    while (micros() - tickStart < TICK_US) {
+        sched.poll();
+        delayMicroseconds(10);
+    }
+    HOST_CHECK(b.sim.servo(1).target == 7100);
+    HOST_CHECK(b.sim.servo(1).writes == writes);
+}
+
+// サーボ1～5のスピードが時々変わり、サーボ2が時々返信しない時の、
+// サーボ6の完了時刻(ティックの始まりから)のばらつき
+static unsigned long servo6Spread(bool tdma, unsigned long& reads) {
+    const int TICKS = 200;
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    b.ics.enableShadow(true);
+    b.sim.setFaults(2, IcsBusSim::Faults::make(300));
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    if (tdma) {
+        HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US));
+    }
+
+    unsigned long minUs = 0xFFFFFFFFUL;
+    unsigned long maxUs = 0;
+    unsigned long tickStart = micros();
+    reads = 0;
+    byte readId = 1;
+    for (int tick = 0; tick < TICKS; tick++) {
+        sched.beginTick(TICK_US);
+        for (byte id = 1; id <= 6; id++) {
+            // シャドウレジスタと違うスピードだけ送る
+            byte speed = (id < 6 && tick % 8 < 2) ? 60 + tick % 2 : 100;
+            if (tdma) {
+                sched.stageMotion(id, 7000 + tick, speed, onMotion, (void*)(uintptr_t)id);
+            } else {
+                sched.submitMotionParam(id, IcsCommand::SC_SPD, speed);
+                sched.submitMotionPos(id, 7000 + tick, onMotion, (void*)(uintptr_t)id);
+            }
+        }
+        doneUs[6] = 0;
+        while ((long)(micros() - (tickStart + TICK_US)) < 0) {
+            if (sched.queuedReads(IcsScheduler::PRIO_TELEMETRY) == 0) {
+                sched.requestRead(IcsScheduler::PRIO_TELEMETRY, readId, IcsCommand::SC_TMP);
+                readId = readId % 6 + 1;
+            }
+            sched.poll();
+            delayMicroseconds(10);
+        }
+        HOST_CHECK(doneUs[6] != 0);
+        if (tick == 0) {
+            tickStart += TICK_US;   // 最初のティックはシャドウレジスタが空なのでスピードも送る
+            continue;
+        }
+        unsigned long t = doneUs[6] - tickStart;
+        if (t < minUs) {
+            minUs = t;
+        }
+        if (t > maxUs) {
+            maxUs = t;
+        }
+        tickStart += TICK_US;
+    }
+    HOST_CHECK(bus.waitAll(100000));
+    reads = sched.getStats().issued[IcsScheduler::PRIO_TELEMETRY];
+    HOST_CHECK(sched.getStats().lateTicks == 0);
+    if (tdma) {
+        for (byte id = 1; id <= 6; id++) {
+            const IcsScheduler::SlotStats& s = sched.getSlotStats(id);
+            HOST_CHECK(s.sent == (unsigned long)TICKS);
+            HOST_CHECK(s.late == 0);
+            HOST_CHECK(s.missed == 0);
+            HOST_CHECK(s.overruns == 0);
+        }
+    }
+    return maxUs - minUs;
+}
+
+void testBoundedJitter() {
+    unsigned long burstReads, tdmaReads;
+    unsigned long burst = servo6Spread(false, burstReads);
+    unsigned long tdma = servo6Spread(true, tdmaReads);
+    printf("  servo 6 update spread: burst %lu us, tdma %lu us (reads %lu / %lu)\n", burst, tdma, burstReads, tdmaReads);
+    // ID順では前のサーボの書込みとタイムアウトで後ろがずれる
+    HOST_CHECK(burst > 1000);
+    HOST_CHECK(tdma <= 50);
+    // 読出しはスロットの間の空き時間に進む
+    HOST_CHECK(tdmaReads > 200);
+}
+
+void testOverrunAndMissed() {
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US));
+
+    // サーボ3のスロットを返信が収まらない長さに詰めた
+    HOST_CHECK(sched.setSlot(3, sched.slotOffsetUs(3), sched.slotLengthUs(3) / 4));
+    sched.beginTick(TICK_US);
+    unsigned long tickStart = micros();
+    for (byte id = 1; id <= 6; id++) {
+        sched.stageMotion(id, 7200, 0, onMotion, (void*)(uintptr_t)id);
+    }
+    while (micros() - tickStart < TICK_US) {
+        sched.poll();
+        delayMicroseconds(10);
+    }
+    HOST_CHECK(sched.getSlotStats(3).overruns == 1);
+    HOST_CHECK(sched.getSlotStats(2).overruns == 0);
+    // 超過してもスロットの長さの残りで終わるので、後ろのスロットは遅れない
+    HOST_CHECK(sched.getSlotStats(4).late == 0);
+    HOST_CHECK(sched.getSlotStats(4).overruns == 0);
+
+    // 送る前に次のティックが来たスロットは見送り
+    sched.beginTick(TICK_US);
+    sched.stageMotion(6, 7300);
+    sched.beginTick(TICK_US);
+    HOST_CHECK(sched.getSlotStats(6).missed == 1);
+    for (int i = 0; i < 1000; i++) {
+        sched.poll();
+        delayMicroseconds(10);
+    }
+    HOST_CHECK(b.sim.servo(6).target == 7200);
+
+    // 時刻を過ぎてから置いたスロットは遅れとして送る
+    sched.beginTick(TICK_US);
+    HostSim::advanceUs(sched.slotOffsetUs(6) + 500);
+    sched.stageMotion(6, 7400);
+    sched.poll();
+    HOST_CHECK(sched.getSlotStats(6).late == 1);
+    HOST_CHECK(sched.getSlotStats(6).maxJitterUs >= 500);
+    HOST_CHECK(bus.waitAll(100000));
+    HOST_CHECK(b.sim.servo(6).target == 7400);
+
+    sched.resetStats();
+    HOST_CHECK(sched.getSlotStats(6).late == 0);
+    HOST_CHECK(sched.getSlotStats(3).overruns == 0);
+}
+
+void testReadsYieldToSlots() {
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US, true));
+    unsigned long cost = sched.readCostUs(1, IcsCommand::SC_POS);
+
+    // サーボ2のスロットの直前は読出しを送らない
+    sched.beginTick(TICK_US);
+    sched.stageMotion(2, 7600);
+    HostSim::advanceUs(sched.slotOffsetUs(2) - cost / 2);
+    sched.requestRead(IcsScheduler::PRIO_SAFETY, 1, IcsCommand::SC_POS);
+    sched.poll();
+    HOST_CHECK(!b.async.busy());
+    HOST_CHECK(sched.queuedReads(IcsScheduler::PRIO_SAFETY) == 1);
+
+    // スロットを送った後なら送る
+    HostSim::advanceUs(cost / 2);
+    sched.poll();
+    HOST_CHECK(sched.getSlotStats(2).sent == 1);
+    HOST_CHECK(b.async.waitAll(100000));
+    sched.poll();
+    HOST_CHECK(sched.queuedReads(IcsScheduler::PRIO_SAFETY) == 0);
+    HOST_CHECK(b.async.waitAll(100000));
+    HOST_CHECK(sched.getSlotStats(2).late == 0);
+    HOST_CHECK(sched.getSlotStats(2).maxJitterUs <= 1);
+}
+
+// タイマー毎(500us)にしかpoll()を呼ばない時(main.cppのモーションタスク)
+// スロットをpoll()の時刻に揃えないと、スロットの時刻から次のpoll()まで遅れる
+static void runPolledTick(IcsScheduler& sched, unsigned long pollUs) {
+    sched.beginTick(TICK_US);
+    unsigned long tickStart = micros();
+    for (byte id = 1; id <= 6; id++) {
+        sched.stageMotion(id, 7000 + id, 100, onMotion, (void*)(uintptr_t)id);
+    }
+    sched.poll();
+    for (unsigned long t = pollUs; t < TICK_US; t += pollUs) {
+        HostSim::advanceUs(tickStart + t - micros());
+        sched.poll();
+    }
+    HostSim::advanceUs(tickStart + TICK_US - micros());
+}
+
+void testPollAligned() {
+    const unsigned long POLL_US = 500;
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+
+    // 揃えない(50usの許容のまま、loop()で呼ぶ時の並べ方)
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US));
+    runPolledTick(sched, POLL_US);
+    unsigned long unalignedLate = 0;
+    for (byte id = 1; id <= 6; id++) {
+        unalignedLate += sched.getSlotStats(id).late;
+    }
+
+    sched.resetStats();
+    sched.setJitterUs(POLL_US);
+    sched.setPollUs(POLL_US);
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US));
+    for (byte id = 1; id <= 6; id++) {
+        HOST_CHECK(sched.slotOffsetUs(id) % POLL_US == 0);
+        HOST_CHECK(sched.slotLengthUs(id) % POLL_US == 0);
+        HOST_CHECK(sched.slotLengthUs(id) >= sched.motionCostUs(id) + POLL_US);
+    }
+    for (int tick = 0; tick < 5; tick++) {
+        runPolledTick(sched, POLL_US);
+    }
+    printf("  500us poll: late slots unaligned %lu, aligned %lu\n", unalignedLate,
+           sched.getSlotStats(1).late + sched.getSlotStats(6).late);
+    HOST_CHECK(unalignedLate > 0);
+    for (byte id = 1; id <= 6; id++) {
+        const IcsScheduler::SlotStats& s = sched.getSlotStats(id);
+        HOST_CHECK(s.sent == 5);
+        HOST_CHECK(s.late == 0);
+        HOST_CHECK(s.overruns == 0);
+        HOST_CHECK(s.maxJitterUs == 0);
+    }
+
+    // 等間隔もpoll()の周期の倍数
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US, true));
+    for (byte id = 1; id <= 6; id++) {
+        HOST_CHECK(sched.slotOffsetUs(id) % POLL_US == 0);
+    }
+    HOST_CHECK(sched.slotOffsetUs(6) == 5 * (TICK_US / 6 - (TICK_US / 6) % POLL_US));
+}
+
+// main.cppのsetServoOff()と同じ順(endTicks -> waitAll -> setFree)で脱力した後、
+// モーションタスクがpoll()を呼び続けても、置いたまま送っていないスロットのポジションでサーボが戻らない
+void testServoOffDropsStaged() {
+    HostSim::setupClock();
+    HostBus b(115200);
+    b.addServos(1, 6);
+    IcsMultiBus bus;
+    bus.addBus(&b.async, 0, IcsCommand::MAX_ID);
+    IcsScheduler sched(&bus);
+    HOST_CHECK(sched.layoutSlots(IDS, 6, TICK_US));
+
+    sched.beginTick(TICK_US);
+    for (byte id = 1; id <= 6; id++) {
+        HOST_CHECK(sched.stageMotion(id, 9000));
+    }
+    sched.poll();
+    HOST_CHECK(sched.getSlotStats(1).sent == 1);
+
+    sched.endTicks();
+    HOST_CHECK(bus.waitAll(100000));
+    for (byte id = 1; id <= 6; id++) {
+        b.ics.setFree(id);
+    }
+    for (int i = 0; i < 3000; i++) {
+        sched.poll();
+        delayMicroseconds(10);
+    }
+    for (byte id = 1; id <= 6; id++) {
+        HOST_CHECK(b.sim.servo(id).free);
+        HOST_CHECK(sched.getSlotStats(id).sent == (id == 1 ? 1UL : 0UL));
+    }
+    HOST_CHECK(!b.async.busy());
+
+    // 置いても、次のbeginTick()までは送らない
+    HOST_CHECK(sched.stageMotion(2, 9000));
+    for (int i = 0; i < 3000; i++) {
+        sched.poll();
+        delayMicroseconds(10);
+    }
+    HOST_CHECK(b.sim.servo(2).free);
+}
+
+int main() {
+    HOST_RUN(testLayout);
+    HOST_RUN(testSlotsSentOnTime);
+    HOST_RUN(testBoundedJitter);
+    HOST_RUN(testOverrunAndMissed);
+    HOST_RUN(testReadsYieldToSlots);
+    HOST_RUN(testPollAligned);
+    HOST_RUN(testServoOffDropsStaged);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+// test/test_host_telemetry.cpp
+// ホスト上でID毎のトランザクションの記録(IcsTelemetry)を確認する
+// 失敗はバスシミュレータの故障とエコーの衝突で起こし、種類毎に数えられるか見る
+// pio run -e host_test_telemetry && .pio/build/host_test_telemetry/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include <IcsTelemetry.h>
+#include "host/host_test.h"
+#include "host/IcsBusSim.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const int TIMEOUT = 20;
+
+static uint32_t readU32(const byte* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+void testBuckets() {
+    HOST_CHECK(IcsTelemetry::bucketOf(0) == 0);
+    HOST_CHECK(IcsTelemetry::bucketOf(63) == 0);
+    HOST_CHECK(IcsTelemetry::bucketOf(64) == 1);
+    HOST_CHECK(IcsTelemetry::bucketOf(127) == 1);
+    HOST_CHECK(IcsTelemetry::bucketOf(128) == 2);
+    HOST_CHECK(IcsTelemetry::bucketOf(20000) == 9);
+    HOST_CHECK(IcsTelemetry::bucketOf(65535) == 10);
+    HOST_CHECK(IcsTelemetry::bucketOf(65536) == 11);
+    HOST_CHECK(IcsTelemetry::bucketOf(0xFFFFFFFFUL) == IcsTelemetry::HIST_BUCKETS - 1);
+
+    HOST_CHECK(IcsTelemetry::classify(3, 3) == IcsTelemetry::RESULT_OK);
+    HOST_CHECK(IcsTelemetry::classify(0, 3) == IcsTelemetry::RESULT_TIMEOUT);
+    HOST_CHECK(IcsTelemetry::classify(2, 3) == IcsTelemetry::RESULT_SHORT_READ);
+    HOST_CHECK(IcsTelemetry::classify(-1, 3) == IcsTelemetry::RESULT_ECHO_MISMATCH);
+}
+
+void testClassification() {
+    HostSim::resetClock();
+    HostSim::setGpioLatencyUs(0);
+    HardwareSerial uart(2);
+    uart.resetHost();
+    IcsBusSim sim(BAUDRATE);
+    for (byte id = 1; id <= 4; id++) {
+        sim.addServo(id);
+    }
+    sim.setFaults(2, IcsBusSim::Faults::make(1000));   // 返信しない
+    sim.setFaults(3, IcsBusSim::Faults::make(0, 0, 1000));   // 途中で切れる
+    sim.setFaults(4, IcsBusSim::Faults::make(0, 0, 0, 3000));   // 遅い(返信は来る)
+    uart.attachPeer(&sim);
+    uart.setDirPin(EN_PIN);
+
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.begin();
+    IcsTelemetry tel;
+
+    // 登録前は記録しない
+    krs.setPos(1, 7500);
+    HOST_CHECK(tel.get(1).count[IcsTelemetry::RESULT_OK] == 0);
+    krs.attachTelemetry(&tel);
+
+    for (int i = 0; i < 10; i++) {
+        HOST_CHECK(krs.setPos(1, 7500) == 7500);
+        HOST_CHECK(krs.setPos(2, 7500) == IcsBaseClass::ICS_FALSE);
+        HOST_CHECK(krs.setPos(3, 7500) == IcsBaseClass::ICS_FALSE);
+        HOST_CHECK(krs.setPos(4, 7500) == IcsBaseClass::ICS_FALSE);   // 計算したタイムアウトより遅い
+    }
+    HOST_CHECK(krs.setPos(1, 20000) == IcsBaseClass::ICS_FALSE);      // 範囲外
+    HOST_CHECK(krs.setSpd(1, 200) == IcsBaseClass::ICS_FALSE);
+
+    HOST_CHECK(tel.get(1).count[IcsTelemetry::RESULT_OK] == 10);
+    HOST_CHECK(tel.get(1).count[IcsTelemetry::RESULT_OUT_OF_RANGE] == 2);
+    HOST_CHECK(tel.get(2).count[IcsTelemetry::RESULT_TIMEOUT] == 10);
+    HOST_CHECK(tel.get(3).count[IcsTelemetry::RESULT_SHORT_READ] == 10);
+    HOST_CHECK(tel.get(4).count[IcsTelemetry::RESULT_TIMEOUT] == 10);
+    HOST_CHECK(tel.failures(1) == 2);
+    HOST_CHECK(tel.failures(2) == 10);
+
+    // 成功は 送信 + 応答 + 受信 (約160us) のビン、タイムアウトはそれより長い
+    const IcsTelemetry::IdStats& ok = tel.get(1);
+    HOST_CHECK(ok.hist[IcsTelemetry::bucketOf(160)] == 10);
+    HOST_CHECK(ok.maxUs < 256);
+    HOST_CHECK(ok.totalUs >= 10 * 100);
+    HOST_CHECK(tel.get(2).maxUs > ok.maxUs);
+    printf("  ok max %lu us, timeout max %lu us\n", (unsigned long)ok.maxUs, (unsigned long)tel.get(2).maxUs);
+
+    // 固定タイムアウトでは同じ失敗が20msのビンに入り、バスを食っているのが分かる
+    tel.reset();
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_FIXED);
+    krs.setPos(2, 7500);
+    HOST_CHECK(tel.get(2).hist[IcsTelemetry::bucketOf(20000)] == 1);
+    HOST_CHECK(tel.get(2).totalUs >= 20000);
+}
+
+void testEchoMismatch() {
+    class CorruptEchoPeer : public HostUartPeer {
+    public:
+        void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override {
+            (void)len;
+            uint8_t garbage[3] = {0x00, data[1], data[2]};
+            uart.injectRx(garbage, 3, endUs);
+        }
+    } peer;
+    HostSim::resetClock();
+    HardwareSerial uart(2);
+    uart.resetHost();
+    uart.attachPeer(&peer);
+    uart.setDirPin(EN_PIN);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.setEcho(true);
+    krs.begin();
+    IcsTelemetry tel;
+    krs.attachTelemetry(&tel);
+
+    HOST_CHECK(krs.setPos(5, 7500) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(tel.get(5).count[IcsTelemetry::RESULT_ECHO_MISMATCH] == 1);
+
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_FIXED);
+    HOST_CHECK(krs.setPos(5, 7500) == IcsBaseClass::ICS_FALSE);
+    HOST_CHECK(tel.get(5).count[IcsTelemetry::RESULT_ECHO_MISMATCH] == 2);
+}
+
+void testMultiAndAsync() {
+    HostSim::resetClock();
+    HostSim::setGpioLatencyUs(0);
+    HardwareSerial uart(2);
+    uart.resetHost();
+    IcsBusSim sim(BAUDRATE);
+    for (byte id = 1; id <= 3; id++) {
+        sim.addServo(id);
+    }
+    sim.setFaults(3, IcsBusSim::Faults::make(1000));
+    uart.attachPeer(&sim);
+    uart.setDirPin(EN_PIN);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.begin();
+    IcsTelemetry tel;
+    krs.attachTelemetry(&tel);
+
+    const byte ids[4] = {1, 2, 3, 40};
+    const unsigned int pos[4] = {7500, 7500, 7500, 7500};
+    int rePos[4];
+    HOST_CHECK(krs.setPosMulti(ids, pos, 4, rePos) == 2);
+    HOST_CHECK(tel.get(1).count[IcsTelemetry::RESULT_OK] == 1);
+    HOST_CHECK(tel.get(3).count[IcsTelemetry::RESULT_TIMEOUT] == 1);
+
+    IcsAsyncClass async(&krs);
+    async.submitSetPos(1, 7600);
+    async.submitSetPos(3, 7600);
+    async.submitGetParam(2, IcsBaseClass::SC_SPD);
+    HOST_CHECK(async.waitAll(100000));
+    HOST_CHECK(tel.get(1).count[IcsTelemetry::RESULT_OK] == 2);
+    HOST_CHECK(tel.get(2).count[IcsTelemetry::RESULT_OK] == 2);
+    HOST_CHECK(tel.get(3).count[IcsTelemetry::RESULT_TIMEOUT] == 2);
+
+    // 範囲外のID(40)はIDの表に入らない
+    byte buf[IcsTelemetry::SNAPSHOT_MAX];
+    size_t len = tel.snapshot(buf, sizeof buf);
+    HOST_CHECK(buf[7] == 1);
+    HOST_CHECK(len == IcsTelemetry::HEADER_SIZE + 3 * IcsTelemetry::RECORD_SIZE);
+}
+
+void testSnapshot() {
+    IcsTelemetry tel;
+    byte buf[IcsTelemetry::SNAPSHOT_MAX];
+
+    size_t len = tel.snapshot(buf, sizeof buf);
+    HOST_CHECK(len == IcsTelemetry::HEADER_SIZE);
+    HOST_CHECK(buf[0] == 'I' && buf[1] == 'T');
+    HOST_CHECK(buf[2] == IcsTelemetry::SNAPSHOT_VERSION);
+    HOST_CHECK(buf[3] == 0);
+    HOST_CHECK(buf[4] == IcsTelemetry::RESULT_COUNT);
+    HOST_CHECK(buf[5] == IcsTelemetry::HIST_BUCKETS);
+    HOST_CHECK(buf[6] == IcsTelemetry::HIST_FIRST_SHIFT);
+
+    tel.record(6, IcsTelemetry::RESULT_OK, 150);
+    tel.record(6, IcsTelemetry::RESULT_OK, 170);
+    tel.record(6, IcsTelemetry::RESULT_TIMEOUT, 400);
+    tel.record(2, IcsTelemetry::RESULT_SHORT_READ, 300);
+    len = tel.snapshot(buf, sizeof buf);
+    HOST_CHECK(len == IcsTelemetry::HEADER_SIZE + 2 * IcsTelemetry::RECORD_SIZE);
+    HOST_CHECK(buf[3] == 2);
+
+    // IDの小さい順
+    const byte* r2 = buf + IcsTelemetry::HEADER_SIZE;
+    const byte* r6 = r2 + IcsTelemetry::RECORD_SIZE;
+    HOST_CHECK(r2[0] == 2);
+    HOST_CHECK(readU32(r2 + 1 + 4 * IcsTelemetry::RESULT_SHORT_READ) == 1);
+    HOST_CHECK(r6[0] == 6);
+    HOST_CHECK(readU32(r6 + 1 + 4 * IcsTelemetry::RESULT_OK) == 2);
+    HOST_CHECK(readU32(r6 + 1 + 4 * IcsTelemetry::RESULT_TIMEOUT) == 1);
+    const byte* t6 = r6 + 1 + 4 * IcsTelemetry::RESULT_COUNT;
+    HOST_CHECK(readU32(t6) == 720);       // 合計
+    HOST_CHECK(readU32(t6 + 4) == 400);   // 最大
+    uint16_t hist[IcsTelemetry::HIST_BUCKETS];
+    memcpy(hist, t6 + 8, sizeof hist);
+    HOST_CHECK(hist[2] == 2 && hist[3] == 1);
+
+    // 入りきらないIDは省く
+    len = tel.snapshot(buf, IcsTelemetry::HEADER_SIZE + IcsTelemetry::RECORD_SIZE + 10);
+    HOST_CHECK(len == IcsTelemetry::HEADER_SIZE + IcsTelemetry::RECORD_SIZE);
+    HOST_CHECK(buf[3] == 1);
+    HOST_CHECK(tel.snapshot(buf, 4) == 0);
+
+    // 全IDでもSNAPSHOT_MAXに入る
+    for (byte id = 0; id <= IcsCommand::MAX_ID; id++) {
+        tel.record(id, IcsTelemetry::RESULT_OK, 100);
+    }
+    HOST_CHECK(tel.snapshot(buf, sizeof buf) == IcsTelemetry::SNAPSHOT_MAX);
+    tel.reset();
+    HOST_CHECK(tel.snapshot(buf, sizeof buf) == IcsTelemetry::HEADER_SIZE);
+}
+
+int main() {
+    HOST_RUN(testBuckets);
+    HOST_RUN(testClassification);
+    HOST_RUN(testEchoMismatch);
+    HOST_RUN(testMultiAndAsync);
+    HOST_RUN(testSnapshot);
+    return HOST_TEST_RESULT();
+}
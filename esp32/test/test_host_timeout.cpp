@@ -0,0 +1,154 @@
+// test/test_host_timeout.cpp
+// ホスト上で計算した受信タイムアウトと固定タイムアウトの違いを確認する
+// pio run -e host_test_timeout && .pio/build/host_test_timeout/program
+#include <Arduino.h>
+#include <IcsHardSerialClass.h>
+#include <IcsAsyncClass.h>
+#include "host/host_test.h"
+
+HOST_TEST_MAIN_DEFS
+
+const byte EN_PIN = 5;
+const long BAUDRATE = 1250000;
+const int TIMEOUT = 20;
+
+// deadId以外のポジションコマンドにlatencyUs後に返信する
+class LatencyPeer : public HostUartPeer {
+public:
+    explicit LatencyPeer(unsigned long latencyUs) : latencyUs(latencyUs), deadId(0xFF) {}
+    void onFrame(HardwareSerial& uart, const uint8_t* data, size_t len, unsigned long endUs) override {
+        if (len != 3 || (data[0] & 0xE0) != 0x80 || (data[0] & 0x1F) == deadId) {
+            return;
+        }
+        uint8_t reply[3] = {(uint8_t)(data[0] & 0x7F), data[1], data[2]};
+        uart.injectRx(reply, sizeof reply, endUs + latencyUs);
+    }
+    unsigned long latencyUs;
+    byte deadId;
+};
+
+static void setupBus(HardwareSerial& uart, LatencyPeer& peer) {
+    HostSim::resetClock();
+    HostSim::setGpioLatencyUs(0);
+    uart.resetHost();
+    uart.attachPeer(&peer);
+    uart.setDirPin(EN_PIN);
+}
+
+void testComputedTimeoutValues() {
+    IcsHardSerialClass fast(nullptr, EN_PIN, 1250000, TIMEOUT);
+    IcsHardSerialClass slow(nullptr, EN_PIN, 115200, TIMEOUT);
+
+    HOST_CHECK(fast.replyTimeoutUs(3) == (unsigned long)TIMEOUT * 1000);  // 既定は従来どおり
+    fast.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    slow.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+
+    HOST_CHECK(fast.frameTimeUs(3) == 27);     // 33bit / 1.25Mbps = 26.4us
+    HOST_CHECK(slow.frameTimeUs(3) == 287);    // 33bit / 115200bps = 286.5us
+    printf("  rxLen=3: %lu us @1.25M, %lu us @115200\n", fast.replyTimeoutUs(3), slow.replyTimeoutUs(3));
+    HOST_CHECK(fast.replyTimeoutUs(3) < 300);
+    HOST_CHECK(fast.replyTimeoutUs(4) > fast.replyTimeoutUs(3));
+    HOST_CHECK(slow.replyTimeoutUs(3) > fast.replyTimeoutUs(3));
+
+    // timeOut(ms)を超えない
+    fast.setResponseLatencyUs(50000);
+    HOST_CHECK(fast.replyTimeoutUs(3) == (unsigned long)TIMEOUT * 1000);
+}
+
+void testDeadServoCost() {
+    unsigned long cost[2];
+    for (int mode = 0; mode < 2; mode++) {
+        HardwareSerial uart(2);
+        LatencyPeer peer(50);
+        peer.deadId = 3;
+        setupBus(uart, peer);
+        IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+        if (mode == 1) {
+            krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+        }
+        krs.begin();
+
+        // sendVec2ServoPosBlockingと同じく5回までリトライ
+        unsigned long start = micros();
+        for (int retry = 0; retry < 5; retry++) {
+            HOST_CHECK(krs.setPos(3, 7500) == IcsBaseClass::ICS_FALSE);
+        }
+        cost[mode] = micros() - start;
+        HOST_CHECK(krs.setPos(4, 7500) == 7500);  // 生きているサーボは通る
+    }
+    printf("  dead ID x5 retries: fixed %lu us, computed %lu us\n", cost[0], cost[1]);
+    HOST_CHECK(cost[0] >= 5UL * TIMEOUT * 1000);
+    HOST_CHECK(cost[1] < 2000);
+}
+
+void testSlowServoNeedsLatency() {
+    HardwareSerial uart(2);
+    LatencyPeer peer(400);   // 見込みより遅いサーボ
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.begin();
+
+    HOST_CHECK(krs.setPos(1, 7500) == IcsBaseClass::ICS_FALSE);
+    krs.setResponseLatencyUs(600);
+    HostSim::advanceUs(1000);  // 前の遅れた返信を流す
+    while (uart.available() > 0) {
+        uart.read();
+    }
+    HOST_CHECK(krs.setPos(1, 7500) == 7500);
+}
+
+void testLatencyLearning() {
+    HardwareSerial uart(2);
+    LatencyPeer peer(150);
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.setLatencyLearning(true);
+    krs.begin();
+
+    unsigned long before = krs.replyTimeoutUs(3);
+    HOST_CHECK(krs.setPos(1, 7500) == 7500);
+    unsigned long measured = krs.getMeasuredLatencyUs();
+    unsigned long after = krs.replyTimeoutUs(3);
+    printf("  measured %lu us, timeout %lu -> %lu us\n", measured, before, after);
+    HOST_CHECK(measured >= 150 && measured < 200);
+    HOST_CHECK(after > before);           // 実測の1.5倍が見込みを超えた
+    HOST_CHECK(after < 1000);
+
+    // 実測がばらついて少し遅くなっても通る
+    peer.latencyUs = 220;
+    HOST_CHECK(krs.setPos(1, 7600) == 7600);
+
+    krs.setLatencyLearning(false);
+    HOST_CHECK(krs.getMeasuredLatencyUs() == 0);
+    HOST_CHECK(krs.replyTimeoutUs(3) == before);
+}
+
+void testAsyncUsesComputedTimeout() {
+    HardwareSerial uart(2);
+    LatencyPeer peer(50);
+    peer.deadId = 2;
+    setupBus(uart, peer);
+    IcsHardSerialClass krs(&uart, EN_PIN, BAUDRATE, TIMEOUT);
+    krs.setTimeoutMode(IcsHardSerialClass::TIMEOUT_COMPUTED);
+    krs.begin();
+    IcsAsyncClass async(&krs);
+
+    int dead = async.submitSetPos(2, 7500);
+    int alive = async.submitSetPos(1, 7500);
+    unsigned long start = micros();
+    HOST_CHECK(async.waitAll(100000));
+    HOST_CHECK(micros() - start < 1000);
+    HOST_CHECK(async.status(dead) == IcsAsyncClass::STATUS_FAILED);
+    HOST_CHECK(async.status(alive) == IcsAsyncClass::STATUS_DONE);
+}
+
+int main() {
+    HOST_RUN(testComputedTimeoutValues);
+    HOST_RUN(testDeadServoCost);
+    HOST_RUN(testSlowServoNeedsLatency);
+    HOST_RUN(testLatencyLearning);
+    HOST_RUN(testAsyncUsesComputedTimeout);
+    return HOST_TEST_RESULT();
+}
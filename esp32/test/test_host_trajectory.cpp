@@ -0,0 +1,198 @@
+// test/test_host_trajectory.cpp
+// 軌道表(trajectory_table.h)を引いたポジションを、motion_math.hで毎回計算したポジションと比べる
+// 2枚の表の入れ替え、表を作る時間と大きさ、ティック毎の時間も確認する
+// pio run -e host_test_trajectory && .pio/build/host_test_trajectory/program
+#include <Arduino.h>
+#include <IcsBaseClass.h>
+#include <motion_math.h>
+#include <trajectory_table.h>
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include "host/host_test.h"
+#include "host/swim_reference.h"
+
+HOST_TEST_MAIN_DEFS
+
+const unsigned long TICK_US = 50000;  // main.cppのMOTION_UPDATE_INTERVAL
+const long BENCH_TICKS = 200000;
+
+// 表を引く(main.cppのhandleSwimMode)
+static void swimTable(const TrajectoryTable& table, unsigned long currentTime, const unsigned long* offsetUs, int* positions) {
+    for (int i = 1; i < SERVO_NUM; i++) {
+        positions[i] = table.positionAt(i, table.phaseAt(currentTime, offsetUs[i]));
+    }
+}
+
+void testSwimMatchesDirect() {
+    const SwimParams cases[] = {
+        {2.0f, 20.0f, 20.0f, 0.0f, false},
+        {1.0f, 45.0f, 45.0f, 0.4f, false},
+        {3.0f, 10.0f, 30.0f, -0.6f, true},
+        {0.5f, 30.0f, 45.0f, 1.0f, false},
+        {0.3f, 0.0f, 45.0f, 0.0f, true},
+        {12.5f, 80.0f, 25.0f, -1.0f, false},
+    };
+    unsigned long seed = 3;
+    for (const SwimParams& p : cases) {
+        TrajectoryTable table;
+        table.compile(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(p), TICK_US);
+        int worst = 0;
+        long rotationMiss = 0;
+        bool rotationOutside = false;
+        for (int k = 0; k < 20000; k++) {
+            unsigned long timeMs = (lcg(seed) << 8) ^ lcg(seed);
+            unsigned long offsetUs[SERVO_NUM] = {0};
+            for (int i = 1; i < SERVO_NUM; i++) {
+                offsetUs[i] = lcg(seed) % 20000;
+            }
+            int direct[SERVO_NUM] = {0};
+            int looked[SERVO_NUM] = {0};
+            swimFixed(p, timeMs, offsetUs, direct);
+            swimTable(table, timeMs, offsetUs, looked);
+            for (int i = 1; i < SERVO_NUM; i++) {
+                if (i == 3 || i == 6) {
+                    if (looked[i] != direct[i]) {
+                        rotationMiss++;
+                        // 回転はサンプルの区切りで切り替わるので、ずれるのは境目の1サンプルの中だけ
+                        if (!nearRotationEdge(table.phaseAt(timeMs, offsetUs[i]), table.sampleCount())) {
+                            rotationOutside = true;
+                        }
+                    }
+                } else {
+                    worst = std::max(worst, abs(looked[i] - direct[i]));
+                }
+            }
+        }
+        printf("  swim %.1fs max %.0fdeg: %u samples, %u bytes, max diff %d, rotation differs %ld/40000 (edge only)\n",
+            p.periodSec, p.maxAngleDeg, table.sampleCount(), (unsigned int)table.usedBytes(), worst, rotationMiss);
+        HOST_CHECK(worst <= 2);
+        HOST_CHECK(!rotationOutside);
+    }
+}
+
+void testStay() {
+    SwimParams p = {1.0f, 0.0f, 20.0f, 0.0f, false};  // handleEmergencySurfaceの浮上
+    TrajectoryTable table;
+    table.compile(TrajectoryTable::KIND_STAY, TrajectoryShape::of(p), TICK_US);
+    MotionMath::Period period = MotionMath::makePeriod(p.periodSec);
+    MotionMath::Gain gain = MotionMath::gainFromDeg(p.maxAngleDeg);
+    int worst = 0;
+    bool centered = true;
+    bool samePhase = true;
+    for (unsigned long t = 0; t < 5000; t++) {
+        MotionMath::Phase ph = table.phaseAt(t, 0);
+        samePhase = samePhase && ph == MotionMath::phaseAt(t, 0, period);
+        int32_t s = MotionMath::sinQ15(ph);
+        worst = std::max(worst, abs(table.positionAt(1, ph) - MotionMath::posOf(gain, s)));
+        worst = std::max(worst, abs(table.positionAt(4, ph) - MotionMath::posOf(-gain, s)));
+        for (uint8_t id : {2, 3, 5, 6}) {
+            centered = centered && table.positionAt(id, ph) == MotionMath::POS_CENTER;
+        }
+    }
+    printf("  stay: max diff %d\n", worst);
+    HOST_CHECK(worst <= 2);
+    HOST_CHECK(centered);
+    HOST_CHECK(samePhase);
+    // 範囲外のIDは中心
+    HOST_CHECK(table.positionAt(0, 0) == MotionMath::POS_CENTER);
+    HOST_CHECK(table.positionAt(7, 0) == MotionMath::POS_CENTER);
+}
+
+void testSampleCount() {
+    TrajectoryTable table;
+    HOST_CHECK(table.sampleCount() == 0);
+    HOST_CHECK(table.positionAt(1, 12345) == MotionMath::POS_CENTER);  // 作る前は中心
+
+    // 1周期の制御周期の数 x OVERSAMPLE(MIN_SAMPLES～MAX_SAMPLES)
+    SwimParams p = {2.0f, 20.0f, 20.0f, 0.0f, false};
+    table.compile(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(p), TICK_US);
+    HOST_CHECK(table.sampleCount() == 40 * TrajectoryTable::OVERSAMPLE);
+    HOST_CHECK(table.usedBytes() == 40u * TrajectoryTable::OVERSAMPLE * 6 * sizeof(int16_t));
+    p.periodSec = 0.3f;
+    table.compile(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(p), TICK_US);
+    HOST_CHECK(table.sampleCount() == TrajectoryTable::MIN_SAMPLES);
+    p.periodSec = 300.0f;
+    table.compile(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(p), TICK_US);
+    HOST_CHECK(table.sampleCount() == TrajectoryTable::MAX_SAMPLES);
+
+    // 周期が無い(初期値)なら位相は0のまま
+    p.periodSec = 0.0f;
+    table.compile(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(p), TICK_US);
+    HOST_CHECK(table.phaseAt(12345, 678) == 0);
+    HOST_CHECK(table.positionAt(1, table.phaseAt(12345, 678)) == MotionMath::POS_CENTER);
+}
+
+void testDoubleBuffer() {
+    TrajectoryBank bank;
+    SwimParams a = {2.0f, 20.0f, 20.0f, 0.0f, false};
+    SwimParams b = {2.0f, 20.0f, 20.0f, 0.5f, false};
+    HOST_CHECK(bank.current() == nullptr);
+
+    const TrajectoryTable* first = bank.prepare(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(a), TICK_US);
+    HOST_CHECK(bank.current() == first);
+    HOST_CHECK(bank.swapCount() == 1);
+    // 同じパラメータなら作り直さない
+    HOST_CHECK(bank.prepare(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(a), TICK_US) == first);
+    HOST_CHECK(bank.swapCount() == 1);
+
+    // 違うパラメータはもう1枚に作り、前の表はそのまま残る
+    int before = first->positionAt(1, MotionMath::QUARTER_TURN);
+    const TrajectoryTable* second = bank.prepare(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(b), TICK_US);
+    HOST_CHECK(second != first);
+    HOST_CHECK(bank.current() == second);
+    HOST_CHECK(bank.swapCount() == 2);
+    HOST_CHECK(first->positionAt(1, MotionMath::QUARTER_TURN) == before);
+    HOST_CHECK(second->positionAt(1, MotionMath::QUARTER_TURN) != before);
+
+    // 種類と制御周期も区別し、2枚を交互に使う
+    HOST_CHECK(bank.prepare(TrajectoryTable::KIND_STAY, TrajectoryShape::of(b), TICK_US) == first);
+    HOST_CHECK(bank.prepare(TrajectoryTable::KIND_STAY, TrajectoryShape::of(b), TICK_US / 2) == second);
+    HOST_CHECK(bank.swapCount() == 4);
+}
+
+void testCompileAndTickTime() {
+    SwimParams p = {2.0f, 20.0f, 20.0f, 0.2f, false};
+    TrajectoryTable table;
+    const int COMPILES = 2000;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < COMPILES; k++) {
+        p.yRate = (k & 1) ? 0.2f : -0.2f;
+        table.compile(TrajectoryTable::KIND_SWIM, TrajectoryShape::of(p), TICK_US);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    unsigned long offsetUs[SERVO_NUM] = {0, 0, 1000, 2000, 3000, 4000, 5000};
+    int positions[SERVO_NUM] = {0};
+    long sink = 0;
+    auto t2 = std::chrono::steady_clock::now();
+    for (long k = 0; k < BENCH_TICKS; k++) {
+        swimFixed(p, 1000 + k * 20, offsetUs, positions);
+        sink += positions[1] + positions[5];
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    for (long k = 0; k < BENCH_TICKS; k++) {
+        swimTable(table, 1000 + k * 20, offsetUs, positions);
+        sink += positions[1] + positions[5];
+    }
+    auto t4 = std::chrono::steady_clock::now();
+
+    double compileUs = std::chrono::duration<double, std::micro>(t1 - t0).count() / COMPILES;
+    double directNs = std::chrono::duration<double, std::nano>(t3 - t2).count() / BENCH_TICKS;
+    double tableNs = std::chrono::duration<double, std::nano>(t4 - t3).count() / BENCH_TICKS;
+    printf("  compile %u samples: %.1f us, %u bytes used (%u bytes per table, %u per bank)\n",
+        table.sampleCount(), compileUs, (unsigned int)table.usedBytes(),
+        (unsigned int)sizeof(TrajectoryTable), (unsigned int)sizeof(TrajectoryBank));
+    printf("  per tick (6 servos): direct %.0f ns, table %.0f ns (sink %ld)\n", directNs, tableNs, sink & 1);
+    HOST_CHECK(compileUs > 0.0);
+    HOST_CHECK(sizeof(TrajectoryTable) >= (size_t)TrajectoryTable::MAX_SAMPLES * 6 * sizeof(int16_t));
+}
+
+int main() {
+    HOST_RUN(testSwimMatchesDirect);
+    HOST_RUN(testStay);
+    HOST_RUN(testSampleCount);
+    HOST_RUN(testDoubleBuffer);
+    HOST_RUN(testCompileAndTickTime);
+    return HOST_TEST_RESULT();
+}